@@ -1,9 +1,19 @@
 
-cbuffer MatrixBuffer : register(b0)
+// Constant buffers by update frequency, see ShaderBuffers.h
+cbuffer FrameBuffer : register(b0)
 {
-	matrix ModelToWorldMatrix;
 	matrix WorldToViewMatrix;
 	matrix ProjectionMatrix;
+	float4 LightColor;
+	float4 CameraDir;
+};
+
+cbuffer ObjectBuffer : register(b2)
+{
+	matrix ModelToWorldMatrix;
+	matrix ModelToProjectionMatrix;		// computed on the CPU, see transforms.h
+	matrix NormalMatrix;
+	float4 LightDir;
 };
 
 struct VSIn
@@ -13,6 +23,16 @@ struct VSIn
 	float3 Tangent : TANGENT;
 	float3 Binormal : BINORMAL;
 	float2 TexCoord : TEX;
+#ifdef INSTANCED
+	// instance_data_t, see instancing.h
+	float4 World0 : WORLD0;
+	float4 World1 : WORLD1;
+	float4 World2 : WORLD2;
+	float3 Normal0 : NORMALMATRIX0;
+	float3 Normal1 : NORMALMATRIX1;
+	float3 Normal2 : NORMALMATRIX2;
+	float4 InstanceColor : INSTANCECOLOR;
+#endif
 };
 
 struct PSIn
@@ -23,6 +43,9 @@ struct PSIn
 	float3 Binormal : BINORMAL;
 	float2 TexCoord : TEX;
 	float4 WorldPos : WORLDPOSITION;
+#ifdef INSTANCED
+	float4 InstanceColor : INSTANCECOLOR;
+#endif
 };
 
 
@@ -34,23 +57,30 @@ struct PSIn
 PSIn VS_main(VSIn input)
 {
 	PSIn output = (PSIn)0;
-	
-	// Model->View transformation
-	matrix MV = mul(WorldToViewMatrix, ModelToWorldMatrix);
+
+	// Model->World, Model->View->Projection (clip space) and normal transformations, per
+	// object from the CPU, or of the instance when instanced (from its rows)
+#ifdef INSTANCED
+	matrix ModelToWorld = float4x4(input.World0, input.World1, input.World2, float4(0, 0, 0, 1));
+	matrix MVP = mul(ProjectionMatrix, mul(WorldToViewMatrix, ModelToWorld));
+	matrix NormalToWorld = float4x4(float4(input.Normal0, 0), float4(input.Normal1, 0), float4(input.Normal2, 0), float4(0, 0, 0, 1));
+	output.InstanceColor = input.InstanceColor;
+#else
+	matrix ModelToWorld = ModelToWorldMatrix;
+	matrix MVP = ModelToProjectionMatrix;
+	matrix NormalToWorld = NormalMatrix;
+#endif
 
 	//For the world pos
 	float4 WP = mul(WorldToViewMatrix, input.Pos);
 	output.WorldPos = WP;
 
-	// Model->View->Projection (clip space) transformation
-	// SV_Position expects the output position to be in clip space
-	matrix MVP = mul(ProjectionMatrix, MV);
-	
 	// Perform transformations and send to output
+	// SV_Position expects the output position to be in clip space
 	output.Pos = mul(MVP, float4(input.Pos, 1));
-	output.Normal = normalize( mul(ModelToWorldMatrix, float4(input.Normal,0)).xyz ); //Changed from MV to ModelToWorldMatrix
-	output.Tangent = normalize( mul(ModelToWorldMatrix, float4(input.Tangent,0)).xyz ); //Changed from MV to ModelToWorldMatrix
-	output.Binormal = normalize( mul(ModelToWorldMatrix, float4(input.Binormal,0)).xyz ); //Changed from MV to ModelToWorldMatrix
+	output.Normal = normalize( mul(NormalToWorld, float4(input.Normal,0)).xyz ); //Inverse transpose of ModelToWorldMatrix
+	output.Tangent = normalize( mul(ModelToWorld, float4(input.Tangent,0)).xyz ); //Changed from MV to ModelToWorldMatrix
+	output.Binormal = normalize( mul(ModelToWorld, float4(input.Binormal,0)).xyz ); //Changed from MV to ModelToWorldMatrix
 	output.TexCoord = input.TexCoord;
 	
 	
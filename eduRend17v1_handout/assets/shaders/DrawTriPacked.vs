@@ -0,0 +1,106 @@
+
+// Constant buffers by update frequency, see ShaderBuffers.h
+cbuffer FrameBuffer : register(b0)
+{
+	matrix WorldToViewMatrix;
+	matrix ProjectionMatrix;
+	float4 LightColor;
+	float4 CameraDir;
+};
+
+cbuffer ObjectBuffer : register(b2)
+{
+	matrix ModelToWorldMatrix;
+	matrix ModelToProjectionMatrix;		// computed on the CPU, see transforms.h
+	matrix NormalMatrix;
+	float4 LightDir;
+};
+
+// Dequantization of positions, see packed_box_t
+cbuffer PackedBuffer : register(b1)
+{
+	float4 PosOffset;
+	float4 PosScale;
+};
+
+// packed_vertex_t, see packedvertex.h
+struct VSIn
+{
+	float4 Pos : POSITION;		// xyz in [0,1] (or fp32), w: handedness 0 or 1
+	float2 Normal : NORMAL;		// octahedral
+	float2 Tangent : TANGENT;	// octahedral
+	float2 TexCoord : TEX;
+#ifdef INSTANCED
+	// instance_data_t, see instancing.h
+	float4 World0 : WORLD0;
+	float4 World1 : WORLD1;
+	float4 World2 : WORLD2;
+	float3 Normal0 : NORMALMATRIX0;
+	float3 Normal1 : NORMALMATRIX1;
+	float3 Normal2 : NORMALMATRIX2;
+	float4 InstanceColor : INSTANCECOLOR;
+#endif
+};
+
+struct PSIn
+{
+	float4 Pos  : SV_Position;
+	float3 Normal : NORMAL;
+	float3 Tangent : TANGENT;
+	float3 Binormal : BINORMAL;
+	float2 TexCoord : TEX;
+	float4 WorldPos : WORLDPOSITION;
+#ifdef INSTANCED
+	float4 InstanceColor : INSTANCECOLOR;
+#endif
+};
+
+float3 DecodeOctahedral(float2 e)
+{
+	float3 n = float3(e.xy, 1 - abs(e.x) - abs(e.y));
+	if (n.z < 0)
+		n.xy = (1 - abs(n.yx)) * (n.xy >= 0 ? 1 : -1);
+	return normalize(n);
+}
+
+//-----------------------------------------------------------------------------------------
+// Vertex Shader
+//-----------------------------------------------------------------------------------------
+
+PSIn VS_main(VSIn input)
+{
+	PSIn output = (PSIn)0;
+
+	// Unpack
+	float3 pos = PosOffset.xyz + input.Pos.xyz * PosScale.xyz;
+	float3 normal = DecodeOctahedral(input.Normal);
+	float3 tangent = DecodeOctahedral(input.Tangent);
+	float3 binormal = cross(normal, tangent) * (input.Pos.w * 2 - 1);
+
+	// Model->World, Model->View->Projection (clip space) and normal transformations, per
+	// object from the CPU, or of the instance when instanced (from its rows)
+#ifdef INSTANCED
+	matrix ModelToWorld = float4x4(input.World0, input.World1, input.World2, float4(0, 0, 0, 1));
+	matrix MVP = mul(ProjectionMatrix, mul(WorldToViewMatrix, ModelToWorld));
+	matrix NormalToWorld = float4x4(float4(input.Normal0, 0), float4(input.Normal1, 0), float4(input.Normal2, 0), float4(0, 0, 0, 1));
+	output.InstanceColor = input.InstanceColor;
+#else
+	matrix ModelToWorld = ModelToWorldMatrix;
+	matrix MVP = ModelToProjectionMatrix;
+	matrix NormalToWorld = NormalMatrix;
+#endif
+
+	//For the world pos
+	float4 WP = mul(WorldToViewMatrix, pos);
+	output.WorldPos = WP;
+
+	// Perform transformations and send to output
+	// SV_Position expects the output position to be in clip space
+	output.Pos = mul(MVP, float4(pos, 1));
+	output.Normal = normalize( mul(NormalToWorld, float4(normal,0)).xyz );
+	output.Tangent = normalize( mul(ModelToWorld, float4(tangent,0)).xyz );
+	output.Binormal = normalize( mul(ModelToWorld, float4(binormal,0)).xyz );
+	output.TexCoord = input.TexCoord;
+
+	return output;
+}
@@ -2,8 +2,8 @@
 
 
 
-Cube::Cube(ID3D11Device* dxdevice, ID3D11DeviceContext* dxdevice_context)
-	: Geometry_t(dxdevice, dxdevice_context)
+Cube::Cube(ID3D11Device* dxdevice, ID3D11DeviceContext* dxdevice_context, d3d_state_cache_t* state_cache)
+	: Geometry_t(dxdevice, dxdevice_context, state_cache)
 {
 	// Populate the vertex array with 4 vertices
 	vertex_t v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15, v16, v17, v18, v19, v20, v21, v22, v23;
@@ -187,7 +187,7 @@ Cube::Cube(ID3D11Device* dxdevice, ID3D11DeviceContext* dxdevice_context)
 	ibufferDesc.CPUAccessFlags = 0;
 	ibufferDesc.Usage = D3D11_USAGE_DEFAULT;
 	ibufferDesc.MiscFlags = 0;
-	ibufferDesc.ByteWidth = indices.size()*sizeof(unsigned);
+	ibufferDesc.ByteWidth = indices.size()*sizeof(uint16_t);
 	// Data resource
 	D3D11_SUBRESOURCE_DATA idata;
 	idata.pSysMem = &indices[0];
@@ -215,20 +215,29 @@ void Cube::compute_tangentSpace(vertex_t& v0, vertex_t& v1, vertex_t& v2, vertex
 void Cube::render() const
 {
 	//set topology
-	dxdevice_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// bind our vertex buffer
 	UINT32 stride = sizeof(vertex_t); //  sizeof(float) * 8;
-	UINT32 offset = 0;
-	dxdevice_context->IASetVertexBuffers(0, 1, &vertex_buffer, &stride, &offset);
+	state_cache->set_vertex_buffer(vertex_buffer, stride, 0);
 
 	// bind our index buffer
-	dxdevice_context->IASetIndexBuffer(index_buffer, DXGI_FORMAT_R32_UINT, 0);
+	state_cache->set_index_buffer(index_buffer, DXGI_FORMAT_R16_UINT, 0);
 
 	// make the drawcall
 	dxdevice_context->DrawIndexed(nbr_indices, 0, 0);
 }
 
+void Cube::render_instanced(unsigned instance_count, unsigned first_instance) const
+{
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state_cache->set_vertex_buffer(vertex_buffer, sizeof(vertex_t), 0);
+	state_cache->set_index_buffer(index_buffer, DXGI_FORMAT_R16_UINT, 0);
+
+	// one drawcall for all instances
+	dxdevice_context->DrawIndexedInstanced(nbr_indices, instance_count, 0, 0, first_instance);
+}
+
 Cube::~Cube()
 {
 }
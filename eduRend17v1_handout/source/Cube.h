@@ -16,13 +16,14 @@ using namespace linalg;
 class Cube : public Geometry_t
 {
 	std::vector<vertex_t> vertices;	
-	std::vector<unsigned> indices;
+	std::vector<uint16_t> indices;
 	unsigned nbr_indices = 0;
 
 public:
-	Cube(ID3D11Device* dx3ddevice, ID3D11DeviceContext* dx3ddevice_context);
+	Cube(ID3D11Device* dx3ddevice, ID3D11DeviceContext* dx3ddevice_context, d3d_state_cache_t* state_cache = nullptr);
 	void compute_tangentSpace(vertex_t& v0, vertex_t& v1, vertex_t& v2, vertex_t& v3);
 	virtual void render() const;
+	virtual void render_instanced(unsigned instance_count, unsigned first_instance) const;
 	~Cube();
 };
 #endif
@@ -1,29 +1,34 @@
 
 #include "Geometry.h"
+#include "tangents.h"
 
 
-void Geometry_t::MapMatrixBuffers(
-	ID3D11Buffer* matrix_buffer,
-	mat4f ModelToWorldMatrix,
+void Geometry_t::MapFrameBuffer(
+	ID3D11DeviceContext* dxdevice_context,
+	ID3D11Buffer* frame_buffer,
 	mat4f WorldToViewMatrix,
-	mat4f ProjectionMatrix)
+	mat4f ProjectionMatrix,
+	float4 LightColor,
+	float4 CameraDir)
 {
 	// Map the resource buffer, obtain a pointer and then write our matrices to it
 	D3D11_MAPPED_SUBRESOURCE resource;
-	dxdevice_context->Map(matrix_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
-	MatrixBuffer_t* matrix_buffer_ = (MatrixBuffer_t*)resource.pData;
-	matrix_buffer_->ModelToWorldMatrix = ModelToWorldMatrix;
-	matrix_buffer_->WorldToViewMatrix = WorldToViewMatrix;
-	matrix_buffer_->ProjectionMatrix = ProjectionMatrix;
-	dxdevice_context->Unmap(matrix_buffer, 0);
+	dxdevice_context->Map(frame_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
+	FrameBuffer_t* frame_buffer_ = (FrameBuffer_t*)resource.pData;
+	frame_buffer_->WorldToViewMatrix = WorldToViewMatrix;
+	frame_buffer_->ProjectionMatrix = ProjectionMatrix;
+	frame_buffer_->LightColor = LightColor;
+	frame_buffer_->CameraDir = CameraDir;
+	dxdevice_context->Unmap(frame_buffer, 0);
 	
 }
 
 
 Quad_t::Quad_t(
 	ID3D11Device* dxdevice,
-	ID3D11DeviceContext* dxdevice_context)
-	: Geometry_t(dxdevice, dxdevice_context)
+	ID3D11DeviceContext* dxdevice_context,
+	d3d_state_cache_t* state_cache)
+	: Geometry_t(dxdevice, dxdevice_context, state_cache)
 {
 	// Populate the vertex array with 4 vertices
 	vertex_t v0, v1, v2, v3;
@@ -74,7 +79,7 @@ Quad_t::Quad_t(
 	ibufferDesc.CPUAccessFlags = 0;
 	ibufferDesc.Usage = D3D11_USAGE_DEFAULT;
 	ibufferDesc.MiscFlags = 0;
-	ibufferDesc.ByteWidth = indices.size()*sizeof(unsigned);
+	ibufferDesc.ByteWidth = indices.size()*sizeof(uint16_t);
 	// Data resource
 	D3D11_SUBRESOURCE_DATA idata;
 	idata.pSysMem = &indices[0];
@@ -87,16 +92,17 @@ Quad_t::Quad_t(
 	indices.clear();
 }
 
-void Geometry_t::MapLightBuffer(
-	ID3D11Buffer* constantBuffer, float4 LightColor, float4 LightDir, float4 CameraDir)
+void Geometry_t::MapObjectBuffer(
+	ID3D11Buffer* constantBuffer, mat4f ModelToWorldMatrix, mat4f ModelToProjectionMatrix, mat4f NormalMatrix, float4 LightDir)
 {
 	// Map the resource buffer, obtain a pointer and then write our matrices to it
 	D3D11_MAPPED_SUBRESOURCE resource;
 	dxdevice_context->Map(constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
-	LightBuffer_t* constant_Buffer = (LightBuffer_t*)resource.pData;
-	constant_Buffer->LightColor = LightColor;
+	ObjectBuffer_t* constant_Buffer = (ObjectBuffer_t*)resource.pData;
+	constant_Buffer->ModelToWorldMatrix = ModelToWorldMatrix;
+	constant_Buffer->ModelToProjectionMatrix = ModelToProjectionMatrix;
+	constant_Buffer->NormalMatrix = NormalMatrix;
 	constant_Buffer->LightDir = LightDir;
-	constant_Buffer->CameraDir = CameraDir;
 	dxdevice_context->Unmap(constantBuffer, 0);
 }
 void Geometry_t::MapPhongBuffer(
@@ -117,61 +123,136 @@ void Geometry_t::MapPhongBuffer(
 void Quad_t::render() const
 {
 	//set topology
-	dxdevice_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// bind our vertex buffer
 	UINT32 stride = sizeof(vertex_t); //  sizeof(float) * 8;
-	UINT32 offset = 0;
-	dxdevice_context->IASetVertexBuffers(0, 1, &vertex_buffer, &stride, &offset);
+	state_cache->set_vertex_buffer(vertex_buffer, stride, 0);
 
 	// bind our index buffer
-	dxdevice_context->IASetIndexBuffer(index_buffer, DXGI_FORMAT_R32_UINT, 0);
+	state_cache->set_index_buffer(index_buffer, DXGI_FORMAT_R16_UINT, 0);
 
 	// make the drawcall
 	dxdevice_context->DrawIndexed(nbr_indices, 0, 0);
 }
 
+void Quad_t::render_instanced(unsigned instance_count, unsigned first_instance) const
+{
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state_cache->set_vertex_buffer(vertex_buffer, sizeof(vertex_t), 0);
+	state_cache->set_index_buffer(index_buffer, DXGI_FORMAT_R16_UINT, 0);
+
+	// one drawcall for all instances
+	dxdevice_context->DrawIndexedInstanced(nbr_indices, instance_count, 0, 0, first_instance);
+}
+
 
 OBJModel_t::OBJModel_t(
 	const std::string& objfile,
 	ID3D11Device* dxdevice,
-	ID3D11DeviceContext* dxdevice_context)
-	: Geometry_t(dxdevice, dxdevice_context)
+	ID3D11DeviceContext* dxdevice_context,
+	d3d_state_cache_t* state_cache)
+	: Geometry_t(dxdevice, dxdevice_context, state_cache)
 {
-	// Load the OBJ
+	// Load the OBJ, from the binary cache when there is an up-to-date one
 	mesh_t* mesh = new mesh_t();
-	mesh->load_obj(objfile);
+	bool cached = false;
+#ifdef MESH_USE_CACHE
+	cached = mesh->load_cache(objfile);
+#endif
+	if (!cached)
+		mesh->load_obj(objfile);
+
+	// Load and organize indices in ranges per drawcall (material),
+	// 16-bit where the drawcalls fit (see indexbuffer.h)
+	index_buffer_t ib;
+	build_index_buffer(mesh->drawcalls, ib);
+	size_t unbatched = ib.ranges.size();
+#ifdef MESH_BATCH_RANGES
+	// one range per material where possible, the groups kept on the side
+	batch_index_ranges(mesh->drawcalls, ib, 0, index_groups);
+#endif
+	index_ranges = ib.ranges;
+
+	// Levels of detail after the full mesh, in the same index array
+	lod_errors.push_back(0);
+	for (unsigned level = 1; level <= mesh->lod_count(); level++)
+	{
+		std::vector<drawcall_t> lod_drawcalls = mesh->lod_drawcalls(level);
+		size_t first = append_index_ranges(lod_drawcalls, ib);
+		unbatched += ib.ranges.size() - first;
+#ifdef MESH_BATCH_RANGES
+		std::vector<index_group_t> lod_groups;
+		batch_index_ranges(lod_drawcalls, ib, first, lod_groups);
+#endif
+		lod_ranges.push_back(std::vector<index_range_t>(ib.ranges.begin() + first, ib.ranges.end()));
+		lod_errors.push_back(mesh->lod_error(level));
+	}
 
-	// Load and organize indices in ranges per drawcall (material)
+	// Bounds of the mesh and of each range (see bounds.h)
+	bounds = compute_bounds(mesh->vertices);
+	compute_bounds(mesh->vertices, ib, index_ranges, index_bounds);
+	lod_bounds.resize(lod_ranges.size());
+	for (size_t i = 0; i < lod_ranges.size(); i++)
+		compute_bounds(mesh->vertices, ib, lod_ranges[i], lod_bounds[i]);
 
-	std::vector<unsigned> indices;
-	size_t i_ofs = 0;
+	visible.assign(index_ranges.size(), 1);
+	cull_stats.visible = (unsigned)index_ranges.size();
+#ifdef OCCLUSION_CULL_DRAWCALLS
+	select_occluders(mesh->vertices, ib, index_ranges, OCCLUSION_OCCLUDERS, occluders);
+#endif
 
-	for (auto& dc : mesh->drawcalls)
-	{
-		// Append the drawcall indices
-		for (auto& tri : dc.tris)
-		{
-			indices.insert(indices.end(), tri.vi, tri.vi + 3);
-			compute_tangentSpace(mesh->vertices[tri.vi[0]], mesh->vertices[tri.vi[1]], mesh->vertices[tri.vi[2]]);
-		}
+	index_format = ib.wide ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+	printf("Index buffer: %d ranges (%d before batching) for %d drawcalls and %d LODs, %d-bit indices (%.1f KB)\n",
+		(int)ib.ranges.size(), (int)unbatched, (int)mesh->drawcalls.size(), (int)lod_ranges.size(), (int)ib.index_size() * 8, ib.bytes() / 1024.0);
 
-		// Create a range
-		size_t i_size = dc.tris.size() * 3;
-		int mtl_index = dc.mtl_index > -1 ? dc.mtl_index : -1;
-		index_ranges.push_back({ i_ofs, i_size, 0, mtl_index });
-		i_ofs = indices.size();
+	if (!cached)
+	{
+		// Tangent space from the triangles
+		std::vector<unsigned> indices;
+		for (auto& dc : mesh->drawcalls)
+			for (auto& tri : dc.tris)
+				indices.insert(indices.end(), tri.vi, tri.vi + 3);
+		compute_tangent_frames(mesh->vertices, indices.data(), indices.size() / 3);
+#ifdef MESH_USE_CACHE
+		mesh->save_cache(objfile);
+#endif
 	}
+
+#ifdef MESH_PACKED_VERTICES
+	// Pack the vertices; handedness is taken from the binormals, which also holds for cached meshes
+	std::vector<packed_vertex_t> packed;
+	packed_box_t box;
+	encode_vertices(mesh->vertices, nullptr, packed, box);
+
+	// Dequantization constants, never changed
+	PackedBuffer_t packed_constants = { float4(box.offset, 0), float4(box.scale, 0) };
+	D3D11_BUFFER_DESC pbufferDesc = { 0.0f };
+	pbufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	pbufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	pbufferDesc.ByteWidth = sizeof(PackedBuffer_t);
+	D3D11_SUBRESOURCE_DATA pdata;
+	pdata.pSysMem = &packed_constants;
+	dxdevice->CreateBuffer(&pbufferDesc, &pdata, &packed_buffer);
+#endif
+
 	// Vertex array descriptor
 	D3D11_BUFFER_DESC vbufferDesc = { 0.0f };
 	vbufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 	vbufferDesc.CPUAccessFlags = 0;
 	vbufferDesc.Usage = D3D11_USAGE_DEFAULT;
 	vbufferDesc.MiscFlags = 0;
+#ifdef MESH_PACKED_VERTICES
+	vbufferDesc.ByteWidth = packed.size()*sizeof(packed_vertex_t);
+	// Data resource
+	D3D11_SUBRESOURCE_DATA vdata;
+	vdata.pSysMem = &packed[0];
+#else
 	vbufferDesc.ByteWidth = mesh->vertices.size()*sizeof(vertex_t);
 	// Data resource
 	D3D11_SUBRESOURCE_DATA vdata;
 	vdata.pSysMem = &(mesh->vertices)[0];
+#endif
 	// Create vertex buffer on device using descriptor & data
 	HRESULT vhr = dxdevice->CreateBuffer(&vbufferDesc, &vdata, &vertex_buffer);
 
@@ -181,16 +262,32 @@ OBJModel_t::OBJModel_t(
 	ibufferDesc.CPUAccessFlags = 0;
 	ibufferDesc.Usage = D3D11_USAGE_DEFAULT;
 	ibufferDesc.MiscFlags = 0;
-	ibufferDesc.ByteWidth = indices.size()*sizeof(unsigned);
+	ibufferDesc.ByteWidth = ib.bytes();
 	// Data resource
 	D3D11_SUBRESOURCE_DATA idata;
-	idata.pSysMem = &indices[0];
+	idata.pSysMem = ib.data();
 	// Create index buffer on device using descriptor & data
 	HRESULT ihr = dxdevice->CreateBuffer(&ibufferDesc, &idata, &index_buffer);
 
 	// Copy materials from mesh
 	append_materials(mesh->materials);
 
+	// What the render queue binds for this model (see renderdevice.h)
+	static unsigned model_count = 0, material_count = 0;
+	model_id = model_count++;
+	material_id = material_count;
+	material_count += (unsigned)materials.size();
+	binding.vertex_buffer = vertex_buffer;
+#ifdef MESH_PACKED_VERTICES
+	binding.stride = sizeof(packed_vertex_t);
+	binding.vs_constants = packed_buffer;
+#else
+	binding.stride = sizeof(vertex_t);
+#endif
+	binding.index_buffer = index_buffer;
+	binding.index_format = index_format;
+	binding.sampler = m_sampleState;
+
 	// Go through materials and load textures (if any) to device
 
 	for (auto& mtl : materials)
@@ -234,61 +331,176 @@ OBJModel_t::OBJModel_t(
 
 	SAFE_DELETE(mesh);
 }
-void Geometry_t::compute_tangentSpace(vertex_t& v0, vertex_t& v1, vertex_t& v2)
-{
-	D = v1.Pos - v0.Pos;
-	E = v2.Pos - v0.Pos;
-
-	F = v1.TexCoord - v0.TexCoord;
-	G = v2.TexCoord - v0.TexCoord;
-
-	R = (1 / ((F.x * G.y) - (F.y * G.x)));
-
-	T.x = (G.y * D.x) + (-F.y * E.x) * R;
-	T.y = (G.y * D.y) + (-F.y * E.y) * R;
-	T.z = (G.y * D.z) + (-F.y * E.z) * R;
-
-	B.x = (-G.x * D.x) + (F.x * E.x) * R;
-	B.y = (-G.x * D.y) + (F.x * E.y) * R;
-	B.z = (-G.x * D.z) + (F.x * E.z) * R;
-
-	v0.Tangent = T;
-	v1.Tangent = T;
-	v2.Tangent = T;
-
-	v0.Binormal = B;
-	v1.Binormal = B;
-	v2.Binormal = B;
-}
 
 void OBJModel_t::render() const
 {
 	// Set topology
-	dxdevice_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
 	// Bind vertex buffer
+#ifdef MESH_PACKED_VERTICES
+	UINT32 stride = sizeof(packed_vertex_t);
+	state_cache->set_vs_constant_buffer(1, packed_buffer);
+#else
 	UINT32 stride = sizeof(vertex_t);
-	UINT32 offset = 0;
-	dxdevice_context->IASetVertexBuffers(0, 1, &vertex_buffer, &stride, &offset);
+#endif
+	state_cache->set_vertex_buffer(vertex_buffer, stride, 0);
 
 	// Bind index buffer
-	dxdevice_context->IASetIndexBuffer(index_buffer, DXGI_FORMAT_R32_UINT, 0);
+	state_cache->set_index_buffer(index_buffer, index_format, 0);
 
-	// Iterate drawcalls
-	for (auto& irange : index_ranges)
+	// Iterate drawcalls in the view frustum, at the current level of detail
+	draw_visible(current_ranges(), visible, [&](const index_range_t& irange)
 	{
 		// Fetch material
 		const material_t& mtl = materials[irange.mtl_index];
 
-		// Bind textures
-		dxdevice_context->PSSetShaderResources(0, 1, &mtl.map_Kd_TexSRV);
-		dxdevice_context->PSSetShaderResources(1, 1, &mtl.map_bump_TexSRV);
-		dxdevice_context->PSSetShaderResources(2, 1, &mtl.map_cube_TexSRV);
+		// Bind textures, skipped by the state cache for consecutive ranges of a material
+		state_cache->set_ps_shader_resource(0, mtl.map_Kd_TexSRV);
+		state_cache->set_ps_shader_resource(1, mtl.map_bump_TexSRV);
+		state_cache->set_ps_shader_resource(2, mtl.map_cube_TexSRV);
 		// ...other textures here (see material_t)
 
-		dxdevice_context->PSSetSamplers(0, 1, &m_sampleState);
+		state_cache->set_ps_sampler(0, m_sampleState);
 
 		// Make the drawcall
-		dxdevice_context->DrawIndexed(irange.size, irange.start, 0);
+		dxdevice_context->DrawIndexed(irange.size, irange.start, irange.ofs);
+	});
+}
+
+void OBJModel_t::render_instanced(unsigned instance_count, unsigned first_instance) const
+{
+	state_cache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+#ifdef MESH_PACKED_VERTICES
+	UINT32 stride = sizeof(packed_vertex_t);
+	state_cache->set_vs_constant_buffer(1, packed_buffer);
+#else
+	UINT32 stride = sizeof(vertex_t);
+#endif
+	state_cache->set_vertex_buffer(vertex_buffer, stride, 0);
+	state_cache->set_index_buffer(index_buffer, index_format, 0);
+
+	// a drawcall per range for all instances
+	for (auto& irange : index_ranges)
+	{
+		const material_t& mtl = materials[irange.mtl_index];
+		state_cache->set_ps_shader_resource(0, mtl.map_Kd_TexSRV);
+		state_cache->set_ps_shader_resource(1, mtl.map_bump_TexSRV);
+		state_cache->set_ps_shader_resource(2, mtl.map_cube_TexSRV);
+		state_cache->set_ps_sampler(0, m_sampleState);
+
+		dxdevice_context->DrawIndexedInstanced((UINT)irange.size, instance_count, (UINT)irange.start, irange.ofs, first_instance);
+	}
+}
+
+InstancedGeometry_t::InstancedGeometry_t(
+	const Geometry_t* geometry,
+	ID3D11Device* dxdevice,
+	ID3D11DeviceContext* dxdevice_context,
+	d3d_state_cache_t* state_cache)
+	:	geometry(geometry),
+		dxdevice_context(dxdevice_context),
+		state_cache(state_cache)
+{
+	// Written with WRITE_DISCARD before each draw
+	D3D11_BUFFER_DESC bufferDesc = { 0 };
+	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = INSTANCE_BUFFER_CAPACITY * sizeof(instance_data_t);
+	dxdevice->CreateBuffer(&bufferDesc, nullptr, &instance_buffer);
+}
+
+void InstancedGeometry_t::render() const
+{
+	for (size_t first = 0; first < instances.size(); first += INSTANCE_BUFFER_CAPACITY)
+	{
+		unsigned count = (unsigned)std::min(instances.size() - first, (size_t)INSTANCE_BUFFER_CAPACITY);
+
+		// Pack the instances straight into the buffer
+		D3D11_MAPPED_SUBRESOURCE resource;
+		dxdevice_context->Map(instance_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
+		pack_instances(&instances[first], count, (instance_data_t*)resource.pData);
+		dxdevice_context->Unmap(instance_buffer, 0);
+
+		state_cache->set_vertex_buffer(instance_buffer, sizeof(instance_data_t), 0, 1);
+		geometry->render_instanced(count, 0);
+	}
+}
+
+void OBJModel_t::submit(render_queue_t& queue, const shader_program_t* program, unsigned shader_id,
+	const object_constants_t* constants, unsigned pass, float depth) const
+{
+	draw_visible(current_ranges(), visible, [&](const index_range_t& irange)
+	{
+		render_packet_t packet;
+		packet.key = make_sort_key(pass, shader_id, material_id + irange.mtl_index, depth, model_id);
+		packet.state[render_state_shader] = program;
+		packet.state[render_state_geometry] = &binding;
+		packet.state[render_state_material] = &materials[irange.mtl_index];
+		packet.state[render_state_constants] = constants;
+		packet.index_count = irange.size;
+		packet.start_index = (unsigned)irange.start;
+		packet.base_vertex = irange.ofs;
+		queue.push(packet);
+	});
+}
+
+void OBJModel_t::update_lod(const camera_t& camera, const mat4f& ModelToWorldMatrix, float viewport_height)
+{
+	// Bounding sphere in world space, scaled by the largest scaling of the transform
+	vec4f center = ModelToWorldMatrix * vec4f(bounds.sphere.center, 1);
+	float scale = 0;
+	for (int i = 0; i < 3; i++)
+		scale = std::max(scale, vec3f(ModelToWorldMatrix.col[i].x, ModelToWorldMatrix.col[i].y, ModelToWorldMatrix.col[i].z).norm2());
+
+	vec3f d = vec3f(center.x, center.y, center.z) - camera.position;
+	float distance = std::max(d.norm2() - bounds.sphere.radius * scale, camera.zNear);
+
+	int level = select_lod(lod_errors, scale, distance, camera.vfov, viewport_height);
+	if (level != lod)
+	{
+		// everything at the new level is visible until culled
+		lod = level;
+		visible.assign(current_ranges().size(), 1);
+		cull_stats = cull_stats_t();
+		cull_stats.visible = (unsigned)visible.size();
 	}
+}
+
+cull_stats_t OBJModel_t::cull(const mat4f& ModelToClipMatrix)
+{
+#ifdef FRUSTUM_CULL_DRAWCALLS
+	cull_stats = cull_boxes(extract_frustum(ModelToClipMatrix), current_bounds(), visible);
+#endif
+	return cull_stats;
+}
+
+cull_stats_t OBJModel_t::occlusion_cull(occlusion_buffer_t& buffer, const mat4f& ModelToClipMatrix)
+{
+#ifdef OCCLUSION_CULL_DRAWCALLS
+	unsigned occluded = buffer.cull_boxes(ModelToClipMatrix, current_bounds(), visible);
+	cull_stats.visible -= occluded;
+	cull_stats.occluded += occluded;
+#endif
+	return cull_stats;
+}
+
+cull_stats_t OBJModel_t::cull(const mat4f& ModelToClipMatrix, const std::vector<uint8_t>& index_visible)
+{
+#ifdef FRUSTUM_CULL_DRAWCALLS
+	bool any = std::find(index_visible.begin(), index_visible.end(), 1) != index_visible.end();
+	if (lod && any)
+		return cull(ModelToClipMatrix);
+
+	if (lod)
+		visible.assign(visible.size(), 0);
+	else
+		visible = index_visible;
+	cull_stats = cull_stats_t();
+	for (uint8_t v : visible)
+		cull_stats.visible += v;
+	cull_stats.culled = (unsigned)visible.size() - cull_stats.visible;
+#endif
+	return cull_stats;
 }
\ No newline at end of file
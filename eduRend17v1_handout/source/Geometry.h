@@ -15,6 +15,15 @@
 #include "ShaderBuffers.h"
 #include "drawcall.h"
 #include "mesh.h"
+#include "packedvertex.h"
+#include "indexbuffer.h"
+#include "bounds.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "renderdevice.h"
+#include "statecache.h"
+#include "instancing.h"
+#include "Camera.h"
 
 using namespace linalg;
 
@@ -25,6 +34,10 @@ protected:
 	ID3D11Device* const			dxdevice;
 	ID3D11DeviceContext* const	dxdevice_context;
 
+	// Binding goes through a state cache, shared with the rest of the frame when given
+	d3d_state_cache_t* own_state_cache = nullptr;
+	d3d_state_cache_t* const	state_cache;
+
 	// Pointers to the class' vertex & index arrays
 	ID3D11Buffer* vertex_buffer = nullptr;
 	ID3D11Buffer* index_buffer = nullptr;
@@ -37,17 +50,13 @@ protected:
 
 public:
 
-	//For normal mapping
-	vec3f D, E;
-	vec2f F, G;
-	float R;
-	vec3f T, B;
-
 	Geometry_t(
 		ID3D11Device* dxdevice, 
-		ID3D11DeviceContext* dxdevice_context) 
+		ID3D11DeviceContext* dxdevice_context,
+		d3d_state_cache_t* state_cache = nullptr)
 		:	dxdevice(dxdevice),
-			dxdevice_context(dxdevice_context)
+			dxdevice_context(dxdevice_context),
+			state_cache(state_cache ? state_cache : (own_state_cache = new d3d_state_cache_t(dxdevice_context, query_context1(dxdevice_context))))
 	{
 		//Create sampler
 		HRESULT hr;
@@ -70,22 +79,39 @@ public:
 	}
 
 	//
-	// Map and update the matrix buffer
+	// Map and update the constant buffer of the frame, which is the same for every object
+	// (see ShaderBuffers.h)
 	//
-	virtual void MapMatrixBuffers(
-		ID3D11Buffer* matrix_buffer,
-		mat4f ModelToWorldMatrix,
+	static void MapFrameBuffer(
+		ID3D11DeviceContext* dxdevice_context,
+		ID3D11Buffer* frame_buffer,
 		mat4f WorldToViewMatrix,
-		mat4f ProjectionMatrix);
-	virtual void MapLightBuffer(ID3D11Buffer* light_buffer, float4 LightColor, float4 LightDir, float4 CameraDir);
+		mat4f ProjectionMatrix,
+		float4 LightColor,
+		float4 CameraDir);
+
+	//
+	// Map and update the constant buffers of an object and of a material (see ShaderBuffers.h)
+	//
+	virtual void MapObjectBuffer(
+		ID3D11Buffer* object_buffer,
+		mat4f ModelToWorldMatrix,
+		mat4f ModelToProjectionMatrix,
+		mat4f NormalMatrix,
+		float4 LightDir);
 	virtual void MapPhongBuffer(ID3D11Buffer* light_buffer, float4 SpecularPower, float4 SpecularColor, float4 AmbientColor, float4 DiffuseColor, float isSkybox);
-	void compute_tangentSpace(vertex_t& v0, vertex_t& v1, vertex_t& v2);
 
 	//
 	// Abstract render method: must be implemented by derived classes
 	//
 	virtual void render() const = 0;
 
+	//
+	// Draw instance_count instances from first_instance of the instance buffer bound to input
+	// slot 1, with the instanced shaders bound (see InstancedGeometry_t)
+	//
+	virtual void render_instanced(unsigned instance_count, unsigned first_instance) const = 0;
+
 	//
 	// Destructor
 	//
@@ -93,6 +119,7 @@ public:
 	{ 
 		SAFE_RELEASE(vertex_buffer);
 		SAFE_RELEASE(index_buffer);
+		SAFE_DELETE(own_state_cache);
 	}
 };
 
@@ -100,34 +127,65 @@ class Quad_t : public Geometry_t
 {
 	// our local vertex and index arrays
 	std::vector<vertex_t> vertices;
-	std::vector<unsigned> indices;
+	std::vector<uint16_t> indices;
 	unsigned nbr_indices = 0;
 
 public:
 
 	Quad_t(
 		ID3D11Device* dx3ddevice,
-		ID3D11DeviceContext* dx3ddevice_context);
+		ID3D11DeviceContext* dx3ddevice_context,
+		d3d_state_cache_t* state_cache = nullptr);
 
 	virtual void render() const;
+	virtual void render_instanced(unsigned instance_count, unsigned first_instance) const;
 
 	~Quad_t() { }
 };
 
 class OBJModel_t : public Geometry_t
 {
-	// index ranges, representing drawcalls, within an index array
-	struct index_range_t
-	{
-		size_t start;
-		size_t size;
-		unsigned ofs;
-		int mtl_index;
-	};
-
+	// index ranges, representing drawcalls, within an index array (see indexbuffer.h),
+	// and the bounds of the vertices each of them uses
 	std::vector<index_range_t> index_ranges;
+	std::vector<bounds_t> index_bounds;
+	DXGI_FORMAT index_format = DXGI_FORMAT_R32_UINT;
+
+	// the OBJ groups within index_ranges, for picking and debugging (see batch_index_ranges)
+	std::vector<index_group_t> index_groups;
+
+	// index ranges of the levels of detail, in the same index array (see mesh_t::generate_lods),
+	// their errors, with 0 for index_ranges first, and the level to render (0 = index_ranges)
+	std::vector<std::vector<index_range_t>> lod_ranges;
+	std::vector<std::vector<bounds_t>> lod_bounds;
+	std::vector<float> lod_errors;
+	int lod = 0;
+
+	// bounds of all vertices
+	bounds_t bounds;
+
+	// which ranges of the current level are in the view frustum, and how many (see cull)
+	std::vector<uint8_t> visible;
+	cull_stats_t cull_stats;
+
+	// largest triangles, for rasterizing into an occlusion_buffer_t
+	std::vector<vec3f> occluders;
+
+	// buffers to bind for render queue packets, and ids for their sort keys: the model, and
+	// its first material among the materials of all models
+	geometry_binding_t binding;
+	unsigned model_id = 0;
+	unsigned material_id = 0;
 	std::vector<material_t> materials;
 
+#ifdef MESH_PACKED_VERTICES
+	// position dequantization for DrawTriPacked.vs (VS slot 1)
+	ID3D11Buffer* packed_buffer = nullptr;
+#endif
+
+	const std::vector<index_range_t>& current_ranges() const { return lod ? lod_ranges[lod - 1] : index_ranges; }
+	const std::vector<bounds_t>& current_bounds() const { return lod ? lod_bounds[lod - 1] : index_bounds; }
+
 	void append_materials(const std::vector<material_t>& mtl_vec)
 	{
 		materials.insert(materials.end(), mtl_vec.begin(), mtl_vec.end());
@@ -138,11 +196,91 @@ public:
 	OBJModel_t(
 		const std::string& objfile,
 		ID3D11Device* dxdevice,
-		ID3D11DeviceContext* dxdevice_context);
+		ID3D11DeviceContext* dxdevice_context,
+		d3d_state_cache_t* state_cache = nullptr);
 
 	virtual void render() const;
 
-	~OBJModel_t() { }
+	//
+	// All ranges at full detail, since the culling and level of detail are for one transform
+	//
+	virtual void render_instanced(unsigned instance_count, unsigned first_instance) const;
+
+	//
+	// What render would draw, as packets for queue, with shader program and constants as
+	// their states; depth in [0, 1] is the distance of the model for sorting
+	//
+	void submit(render_queue_t& queue, const shader_program_t* program, unsigned shader_id,
+		const object_constants_t* constants, unsigned pass, float depth) const;
+
+	//
+	// Pick the level of detail to render from how large its error appears from camera
+	// on a viewport viewport_height pixels high (see select_lod)
+	//
+	void update_lod(const camera_t& camera, const mat4f& ModelToWorldMatrix, float viewport_height);
+	int lod_level() const { return lod; }
+
+	//
+	// Mark the ranges of the current level of detail that are outside the view frustum,
+	// so that render skips them. Call after update_lod, with Projection * WorldToView *
+	// ModelToWorld. Returns the number of visible and culled ranges.
+	//
+	cull_stats_t cull(const mat4f& ModelToClipMatrix);
+
+	//
+	// As above, with the visible ranges at full detail given, e.g. from a scene hierarchy
+	// query. Other levels are tested against the frustum if anything is visible.
+	//
+	cull_stats_t cull(const mat4f& ModelToClipMatrix, const std::vector<uint8_t>& index_visible);
+
+	//
+	// Hide the visible ranges that are behind the occluders in buffer, after cull
+	//
+	cull_stats_t occlusion_cull(occlusion_buffer_t& buffer, const mat4f& ModelToClipMatrix);
+	const std::vector<vec3f>& occluder_triangles() const { return occluders; }
+
+	// bounds of the model and of the ranges at full detail, in model space
+	const bounds_t& model_bounds() const { return bounds; }
+	const std::vector<bounds_t>& range_bounds() const { return index_bounds; }
+	const cull_stats_t& last_cull_stats() const { return cull_stats; }
+
+	~OBJModel_t()
+	{
+#ifdef MESH_PACKED_VERTICES
+		SAFE_RELEASE(packed_buffer);
+#endif
+	}
+};
+
+//
+// Instances of a geometry, which they share the vertex and index data of, packed into one
+// dynamic instance buffer and drawn with one instanced drawcall per INSTANCE_BUFFER_CAPACITY
+// instances (see instancing.h). Bind the instanced shaders and the view and projection
+// matrices before render.
+//
+class InstancedGeometry_t
+{
+	const Geometry_t* const geometry;
+	ID3D11DeviceContext* const dxdevice_context;
+	d3d_state_cache_t* const state_cache;
+	ID3D11Buffer* instance_buffer = nullptr;
+
+public:
+
+	std::vector<instance_t> instances;
+
+	InstancedGeometry_t(
+		const Geometry_t* geometry,
+		ID3D11Device* dxdevice,
+		ID3D11DeviceContext* dxdevice_context,
+		d3d_state_cache_t* state_cache);
+
+	void render() const;
+
+	~InstancedGeometry_t()
+	{
+		SAFE_RELEASE(instance_buffer);
+	}
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 
 #define VSYNC
 #define USECONSOLE
+//#define MESH_BENCHMARK	// Load a set of larger OBJs at startup and report parse throughput
 
 #include "stdafx.h"
 #include "ShaderBuffers.h"
@@ -8,6 +9,11 @@
 #include "Camera.h"
 #include "Geometry.h"
 #include "Cube.h"
+#include "bvh.h"
+#include "transforms.h"
+#ifdef MESH_BENCHMARK
+#include <chrono>
+#endif
 
 //--------------------------------------------------------------------------------------
 // Global Variables
@@ -27,10 +33,15 @@ ID3D11InputLayout*		g_InputLayout			= nullptr;
 ID3D11VertexShader*		g_VertexShader			= nullptr;
 ID3D11PixelShader*		g_PixelShader			= nullptr;
 
-ID3D11Buffer*			g_MatrixBuffer = nullptr;
+// the shaders above compiled with INSTANCED, for InstancedGeometry_t
+ID3D11InputLayout*		g_InstancedInputLayout	= nullptr;
+ID3D11VertexShader*		g_InstancedVertexShader	= nullptr;
+ID3D11PixelShader*		g_InstancedPixelShader	= nullptr;
+
+ID3D11Buffer*			g_FrameBuffer = nullptr;
 InputHandler*			g_InputHandler = nullptr;
 
-ID3D11Buffer*			g_LightBuffer = nullptr;
+ID3D11Buffer*			g_ObjectBuffer = nullptr;
 ID3D11Buffer*			g_PhongBuffer = nullptr;
 
 
@@ -61,7 +72,7 @@ float camera_vel = 5.0f;	// Camera movement velocity in units/s
 
 //Quad_t* quad;
 Cube * cube;
-Cube * cube2;
+InstancedGeometry_t* cubes;		// cube, twice
 
 OBJModel_t* hand;
 OBJModel_t* sphere;
@@ -82,6 +93,135 @@ mat4f Mview;
 // Projection matrix
 mat4f Mproj;
 
+// Scene hierarchy over the world-space boxes of the drawcall ranges of the models (see bvh.h).
+// Item first_item + i of the hierarchy is range i of a model.
+struct scene_model_t
+{
+	OBJModel_t* model;
+	const mat4f* M;
+	bool moving;
+	unsigned first_item;
+	std::vector<uint8_t> visible;	// per range at full detail, from the last query
+};
+std::vector<scene_model_t> scene_models;
+bvh_t scene_bvh;
+
+// Depth of the occluders of the frame, for occlusion culling (see occlusion.h)
+occlusion_buffer_t occlusion;
+
+// Drawcalls of the OBJ models, sorted and submitted once all are collected (see renderqueue.h)
+render_queue_t render_queue;
+
+// What is bound on g_DeviceContext, shared by all objects so redundant binds are skipped (see statecache.h)
+d3d_state_cache_t* g_StateCache = nullptr;
+
+// Constants of the objects in the render queue, written once per frame (see constantring.h)
+d3d11_ring_buffer_t* g_ConstantRingBuffer = nullptr;
+constant_ring_t* g_ConstantRing = nullptr;
+
+//
+// Draw instances with the instanced shaders, then bind the others again
+//
+void renderInstanced(const InstancedGeometry_t* instanced)
+{
+	g_StateCache->set_input_layout(g_InstancedInputLayout);
+	g_StateCache->set_vertex_shader(g_InstancedVertexShader);
+	g_StateCache->set_pixel_shader(g_InstancedPixelShader);
+	instanced->render();
+	g_StateCache->set_input_layout(g_InputLayout);
+	g_StateCache->set_vertex_shader(g_VertexShader);
+	g_StateCache->set_pixel_shader(g_PixelShader);
+}
+
+#ifdef MESH_BENCHMARK
+//
+// 10k instances of the cube and of the sphere on a grid in front of the camera, drawn one
+// object per draw (an object buffer map and a draw each, as renderObjects draws objects) and
+// instanced: CPU time of the maps and drawcalls, best of 5, each flushed to the driver.
+// Needs the device, unlike the checks of tests.cpp.
+//
+void benchmarkInstancing()
+{
+	const int nbr_instances = 10000, side = 100;
+	Geometry_t* geometries[] = { cube, sphere };
+	const char* names[] = { "cube", "sphere" };
+	mat4f V = camera->get_WorldToViewMatrix(), P = camera->get_ProjectionMatrix();
+
+	for (int g = 0; g < 2; g++)
+	{
+		InstancedGeometry_t instanced(geometries[g], g_Device, g_DeviceContext, g_StateCache);
+		instanced.instances.resize(nbr_instances);
+		for (int i = 0; i < nbr_instances; i++)
+		{
+			instanced.instances[i].ModelToWorldMatrix = mat4f::translation((i % side - side / 2) * 0.5f, (i / side - side / 2) * 0.5f, -20) * mat4f::scaling(0.2f);
+			instanced.instances[i].DiffuseColor = vec4f((i % side) / (float)side, (i / side) / (float)side, 1, 1);
+		}
+		std::vector<mat4f> models(nbr_instances), mvps(nbr_instances), normals(nbr_instances);
+		for (int i = 0; i < nbr_instances; i++)
+			models[i] = instanced.instances[i].ModelToWorldMatrix;
+
+		double per_object_ms = 1e9, instanced_ms = 1e9;
+		for (int run = 0; run < 5; run++)
+		{
+			g_StateCache->invalidate();
+			g_StateCache->set_input_layout(g_InputLayout);
+			g_StateCache->set_vertex_shader(g_VertexShader);
+			g_StateCache->set_pixel_shader(g_PixelShader);
+			g_StateCache->set_vs_constant_buffer(0, g_FrameBuffer);
+			g_StateCache->set_vs_constant_buffer(2, g_ObjectBuffer);
+			Geometry_t::MapFrameBuffer(g_DeviceContext, g_FrameBuffer, V, P, { 1, 1, 1, 1 }, { 0, 0, 0, 0 });
+			g_DeviceContext->Flush();
+
+			auto t0 = std::chrono::high_resolution_clock::now();
+			transform_objects(P * V, models.data(), nbr_instances, mvps.data(), normals.data());
+			for (int i = 0; i < nbr_instances; i++)
+			{
+				geometries[g]->MapObjectBuffer(g_ObjectBuffer, models[i], mvps[i], normals[i], { 1, 1, 1, 1 });
+				geometries[g]->render();
+			}
+			g_DeviceContext->Flush();
+			auto t1 = std::chrono::high_resolution_clock::now();
+			geometries[g]->MapObjectBuffer(g_ObjectBuffer, mat4f_identity, P * V, mat4f_identity, { 1, 1, 1, 1 });
+			renderInstanced(&instanced);
+			g_DeviceContext->Flush();
+			auto t2 = std::chrono::high_resolution_clock::now();
+
+			per_object_ms = std::min(per_object_ms, std::chrono::duration<double, std::milli>(t1 - t0).count());
+			instanced_ms = std::min(instanced_ms, std::chrono::duration<double, std::milli>(t2 - t1).count());
+		}
+
+		printf("Instancing %s: %d instances one object per draw in %.2f ms, instanced in %.2f ms (%d instanced draws per range)\n",
+			names[g], nbr_instances, per_object_ms, instanced_ms, (nbr_instances + INSTANCE_BUFFER_CAPACITY - 1) / INSTANCE_BUFFER_CAPACITY);
+	}
+}
+
+//
+// Load some larger OBJs without creating any device resources, and parse city.obj with 1-8
+// threads. load_obj prints size, time and MB/s for the parse of each file. What the loaded
+// meshes, culling and the rest must give is checked by the tests project (see tests.cpp).
+//
+void benchmarkMeshLoading()
+{
+	const char* files[] = {
+		"../../assets/city/city.obj",
+		"../../assets/hand/hand.obj",
+		"../../assets/crytek-sponza/banner.obj" };
+
+	for (auto file : files)
+	{
+		mesh_t mesh;
+		mesh.load_obj(file);
+	}
+
+	// parse scaling over threads
+	for (unsigned threads = 1; threads <= 8; threads *= 2)
+	{
+		mesh_t mesh;
+		mesh.load_obj(files[0], true, true, threads);
+	}
+}
+#endif
+
 //
 // Initialize objects
 //
@@ -97,16 +237,25 @@ void initObjects()
 	// The camera will look toward (0,0,0)  
 	camera->moveTo({ 0, 0, 5 });
 
+	g_StateCache = new d3d_state_cache_t(g_DeviceContext, query_context1(g_DeviceContext));
+	g_ConstantRingBuffer = new d3d11_ring_buffer_t(g_Device, g_DeviceContext, CONSTANT_RING_BYTES);
+	g_ConstantRing = new constant_ring_t(g_ConstantRingBuffer, CONSTANT_RING_BYTES);
+
 	// Create objects
-	//quad = new Quad_t(g_Device, g_DeviceContext);
-	cube = new Cube(g_Device, g_DeviceContext);
-	cube2 = new Cube(g_Device, g_DeviceContext);
-//	obj = new OBJModel_t("../../assets/tyre/Tyre.obj", g_Device, g_DeviceContext);
+	//quad = new Quad_t(g_Device, g_DeviceContext, g_StateCache);
+	cube = new Cube(g_Device, g_DeviceContext, g_StateCache);
+	cubes = new InstancedGeometry_t(cube, g_Device, g_DeviceContext, g_StateCache);
+//	obj = new OBJModel_t("../../assets/tyre/Tyre.obj", g_Device, g_DeviceContext, g_StateCache);
 	
-	hand = new OBJModel_t("../../assets/hand/hand.obj", g_Device, g_DeviceContext);
-	sphere = new OBJModel_t("../../assets/sphere/sphere.obj", g_Device, g_DeviceContext);
-	sponza = new OBJModel_t("../../assets/crytek-sponza/sponza.obj", g_Device, g_DeviceContext);
-	skyBox = new OBJModel_t("../../assets/sphere/invertedSphere.obj", g_Device, g_DeviceContext);
+	hand = new OBJModel_t("../../assets/hand/hand.obj", g_Device, g_DeviceContext, g_StateCache);
+	sphere = new OBJModel_t("../../assets/sphere/sphere.obj", g_Device, g_DeviceContext, g_StateCache);
+	sponza = new OBJModel_t("../../assets/crytek-sponza/sponza.obj", g_Device, g_DeviceContext, g_StateCache);
+	skyBox = new OBJModel_t("../../assets/sphere/invertedSphere.obj", g_Device, g_DeviceContext, g_StateCache);
+
+#ifdef MESH_BENCHMARK
+	benchmarkMeshLoading();
+	benchmarkInstancing();
+#endif
 
 	//TEXTURE
 	// Load the texture in.
@@ -174,6 +323,73 @@ void updateObjects(float dt)
 
 
 
+//
+// Boxes of the ranges of a model in world space
+//
+void sceneBoxes(const scene_model_t& m, std::vector<aabb_t>& boxes)
+{
+	for (auto& b : m.model->range_bounds())
+		boxes.push_back(transform_box(*m.M, b.box));
+}
+
+//
+// Refit the scene hierarchy to the moving models, or build it the first time, then find
+// the ranges in the view frustum
+//
+void updateScene()
+{
+	if (scene_models.empty())
+	{
+		// the models renderObjects submits; the hand is not drawn, so it is neither refit nor queried
+		scene_models = {
+			{ sphere, &Msphere, true },
+			{ skyBox, &MSkyBox, true },
+			{ sponza, &Msponza, false } };
+		std::vector<aabb_t> boxes;
+		for (auto& m : scene_models)
+		{
+			m.first_item = (unsigned)boxes.size();
+			sceneBoxes(m, boxes);
+		}
+		scene_bvh.build(boxes);
+	}
+	else
+	{
+		std::vector<aabb_t> boxes;
+		for (auto& m : scene_models)
+		{
+			if (!m.moving)
+				continue;
+			boxes.clear();
+			sceneBoxes(m, boxes);
+			for (unsigned i = 0; i < boxes.size(); i++)
+				scene_bvh.update(m.first_item + i, boxes[i]);
+		}
+	}
+
+	for (auto& m : scene_models)
+		m.visible.assign(m.model->range_bounds().size(), 0);
+	frustum_t frustum = extract_frustum(Mproj * Mview);
+	scene_bvh.query(frustum, [&](unsigned item)
+	{
+		// models are in item order
+		size_t k = scene_models.size() - 1;
+		while (scene_models[k].first_item > item)
+			k--;
+		scene_models[k].visible[item - scene_models[k].first_item] = 1;
+	});
+}
+
+//
+// Distance from the camera to the center of a model, in [0, 1] of the far plane, for
+// front to back sorting
+//
+float sortDepth(const mat4f& M, const OBJModel_t* model)
+{
+	vec4f c = M * vec4f(model->model_bounds().sphere.center, 1);
+	return (vec3f(c.x, c.y, c.z) - camera->position).norm2() / camera->zFar;
+}
+
 //
 // per frame, render object
 //
@@ -189,39 +405,121 @@ void renderObjects()
 	Mview = camera->get_WorldToViewMatrix();
 	Mproj = camera->get_ProjectionMatrix();
 
+	// Constants of the frame, and of the materials the objects share
+	FrameBuffer_t frame = { Mview, Mproj, lightColor, cameraDir };
+	material_constants_t phong = { { specPower, specColor, ambientColor, diffColor, 0 }, 0 };
+	material_constants_t skybox_phong = { { specPower, specColor, ambientColor, diffColor, 1 }, 0 };
+
+	// Model-view-projection and normal matrices of the objects, in one batch (see transforms.h)
+	enum { object_cube, object_hand, object_sphere, object_skybox, object_sponza, object_count };
+	const mat4f models[object_count] = { Mquad, Mhand, Msphere, MSkyBox, Msponza };
+	mat4f mvps[object_count], normals[object_count];
+	transform_objects(Mproj * Mview, models, object_count, mvps, normals);
+
 	// Load matrices + the Quad's transformation to the device and render it
-	//quad->MapMatrixBuffers(g_MatrixBuffer, Mquad, Mview, Mproj);
+	//quad->MapObjectBuffer(g_ObjectBuffer, Mquad, mvps[object_cube], normals[object_cube], { 1, 1, 1, 1 });
 	//quad->render();
-	cube->MapMatrixBuffers(g_MatrixBuffer, Mquad, Mview, Mproj);
-	cube->MapLightBuffer(g_LightBuffer, lightColor, { 1, 1, 1, 1 }, cameraDir);
-	cube->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 0);
-	//cube->render();
-	cube2->MapMatrixBuffers(g_MatrixBuffer, Mquad2, Mview, Mproj);
-	cube2->MapLightBuffer(g_LightBuffer, lightColor, { 0.7f, 0.5f, 0.3f, 1 }, cameraDir);
-	cube2->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 0);
-	//cube2->render();
-
-	sphere->MapMatrixBuffers(g_MatrixBuffer, Msphere, Mview, Mproj);
-	sphere->MapLightBuffer(g_LightBuffer, lightColor, { 0.2f, 0.2f, 0.2f, 1 }, cameraDir);
-	sphere->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 0);
-	sphere->render();
-
-	skyBox->MapMatrixBuffers(g_MatrixBuffer, MSkyBox, Mview, Mproj);
-	skyBox->MapLightBuffer(g_LightBuffer, lightColor, { 0.2f, 0.2f, 0.2f, 1 }, cameraDir);
-	skyBox->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 1);
-	skyBox->render();
-
-	// Load matrices + Sponza's transformation to the device and render it
-	sponza->MapMatrixBuffers(g_MatrixBuffer, Msponza, Mview, Mproj);
-	sponza->MapLightBuffer(g_LightBuffer, lightColor, { 0.7f, 0.5f, 0.3f, 1 }, cameraDir);
-	sponza->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 0);
-	sponza->render();
+	// The cubes as two instances of one, their transforms in the instance buffer
+	//cubes->instances = { { Mquad, { 1, 1, 1, 1 } }, { Mquad2, { 1, 1, 1, 1 } } };
+	//renderInstanced(cubes);
+
+	// Ranges in the view frustum, from the scene hierarchy
+	updateScene();
+
+	// The OBJ models go through the render queue, with the shaders set up in Render
+	shader_program_t program;
+	program.vertex_shader = g_VertexShader;
+	program.pixel_shader = g_PixelShader;
+	program.input_layout = g_InputLayout;
+	render_queue.clear();
+
+	// Sponza's walls hide most of the scene
+	occlusion.clear();
+#ifdef OCCLUSION_CULL_DRAWCALLS
+	const std::vector<vec3f>& occluders = sponza->occluder_triangles();
+	occlusion.rasterize(mvps[object_sponza], occluders.data(), occluders.size() / 3);
+	occlusion.build_hiz();
+#endif
+
+	cull_stats_t cull;
+	sphere->update_lod(*camera, Msphere, (float)height);
+	sphere->cull(mvps[object_sphere], scene_models[0].visible);
+	cull += sphere->occlusion_cull(occlusion, mvps[object_sphere]);
+	object_constants_t sphere_constants = { sphere, { Msphere, mvps[object_sphere], normals[object_sphere], { 0.2f, 0.2f, 0.2f, 1 } }, &phong, 0 };
+	sphere->submit(render_queue, &program, 0, &sphere_constants, 0, sortDepth(Msphere, sphere));
+
+	skyBox->cull(mvps[object_skybox], scene_models[1].visible);
+	cull += skyBox->occlusion_cull(occlusion, mvps[object_skybox]);
+	object_constants_t skybox_constants = { skyBox, { MSkyBox, mvps[object_skybox], normals[object_skybox], { 0.2f, 0.2f, 0.2f, 1 } }, &skybox_phong, 0 };
+	skyBox->submit(render_queue, &program, 0, &skybox_constants, 0, sortDepth(MSkyBox, skyBox));
+
+	// Sponza's transformation and constants
+	sponza->update_lod(*camera, Msponza, (float)height);
+	sponza->cull(mvps[object_sponza], scene_models[2].visible);
+	cull += sponza->occlusion_cull(occlusion, mvps[object_sponza]);
+	object_constants_t sponza_constants = { sponza, { Msponza, mvps[object_sponza], normals[object_sponza], { 0.7f, 0.5f, 0.3f, 1 } }, &phong, 0 };
+	sponza->submit(render_queue, &program, 0, &sponza_constants, 0, sortDepth(Msponza, sponza));
 
 	//The hand
-	hand->MapMatrixBuffers(g_MatrixBuffer, Mhand, Mview, Mproj);
-	hand->MapLightBuffer(g_LightBuffer, lightColor, { 0.7f, 0.5f, 0.3f, 1 }, cameraDir);
-	hand->MapPhongBuffer(g_PhongBuffer, specPower, specColor, ambientColor, diffColor, 0);
+	hand->update_lod(*camera, Mhand, (float)height);
 	//hand->render();
+
+	// Constants of the frame, the materials and the queued objects in one map of the ring,
+	// bound as ranges of it
+	ID3D11Buffer* constant_ring = nullptr;
+#ifdef CONSTANT_RING_BUFFER
+	if (g_ConstantRingBuffer->supports_offsetting() && g_StateCache->binds_ranges())
+	{
+		material_constants_t* materials[] = { &phong, &skybox_phong };
+		object_constants_t* objects[] = { &sphere_constants, &skybox_constants, &sponza_constants };
+		g_ConstantRing->begin_frame(frame_constant_bytes(ARRAYSIZE(materials), ARRAYSIZE(objects)));
+		unsigned frame_offset = 0;
+		bool written = g_ConstantRing->write(frame, frame_offset);
+		for (auto m : materials)
+			written &= g_ConstantRing->write(m->phong, m->offset);
+		for (auto c : objects)
+			written &= g_ConstantRing->write(c->object, c->offset);
+		g_ConstantRing->end_frame();
+		if (written)
+		{
+			constant_ring = g_ConstantRingBuffer->get_buffer();
+			UINT frame_count = (UINT)padded_size(sizeof(FrameBuffer_t)) / 16;
+			g_StateCache->set_vs_constant_buffer(0, constant_ring, frame_offset / 16, frame_count);
+			g_StateCache->set_ps_constant_buffer(0, constant_ring, frame_offset / 16, frame_count);
+		}
+
+		// bytes and maps of the frame, reported when they change
+		static constant_ring_stats_t last_ring;
+		const constant_ring_stats_t& ring = g_ConstantRing->stats;
+		if (ring.bytes != last_ring.bytes || ring.maps != last_ring.maps)
+			printf("Constants: %u bytes (%u padded) in %u allocations, %u maps (%u discards)\n", (unsigned)ring.bytes,
+				(unsigned)ring.padded_bytes, ring.allocations, ring.maps, ring.discards);
+		last_ring = ring;
+	}
+#endif
+	if (!constant_ring)
+		Geometry_t::MapFrameBuffer(g_DeviceContext, g_FrameBuffer, Mview, Mproj, lightColor, cameraDir);
+
+	// Draw the queue sorted by material and depth, binding only what changes
+	d3d11_render_device_t device(g_StateCache, g_ObjectBuffer, g_PhongBuffer, constant_ring);
+	render_queue.submit(device);
+
+	// bytes and maps of the frame without the ring, reported when they change
+	static unsigned last_constant_maps = 0;
+	if (!constant_ring && device.constant_maps != last_constant_maps)
+		printf("Constants: %u bytes in %u maps\n", (unsigned)(sizeof(FrameBuffer_t) + device.constant_bytes), 1 + device.constant_maps);
+	last_constant_maps = constant_ring ? 0 : device.constant_maps;
+
+	// Drawcalls of this frame skipped by frustum and occlusion culling, reported when they change
+	static cull_stats_t last_cull;
+	if (cull != last_cull)
+	{
+		const occlusion_stats_t& o = occlusion.stats;
+		printf("Culling: %u drawcalls visible, %u outside the frustum, %u occluded "
+			"(%u occluder triangles, clear %.3f ms, raster %.3f ms, hiz %.3f ms, test %.3f ms)\n",
+			cull.visible, cull.culled, cull.occluded, o.triangles, o.clear_ms, o.raster_ms, o.hiz_ms, o.test_ms);
+	}
+	last_cull = cull;
 }
 
 //
@@ -230,12 +528,15 @@ void renderObjects()
 void releaseObjects()
 {
 	//SAFE_DELETE(quad);
+	SAFE_DELETE(cubes);
 	SAFE_DELETE(cube);
-	SAFE_DELETE(cube2);
 	SAFE_DELETE(hand);
 	SAFE_DELETE(sphere);
 	SAFE_DELETE(sponza);
 	SAFE_DELETE(camera);
+	SAFE_DELETE(g_ConstantRing);
+	SAFE_DELETE(g_ConstantRingBuffer);
+	SAFE_DELETE(g_StateCache);
 
 }
 
@@ -430,9 +731,16 @@ HRESULT CreateShadersAndInputLayout()
 {
 	HRESULT hr = S_OK;
 
+	D3D10_SHADER_MACRO instancedDefines[] = { { "INSTANCED", "1" }, { nullptr, nullptr } };
+
 	printf("\nCompiling vertex shader...\n");
 	ID3DBlob* pVertexShader = nullptr;
-	if(SUCCEEDED(hr = CompileShader("../../assets/shaders/DrawTri.vs", "VS_main", "vs_5_0", nullptr, &pVertexShader)))
+#ifdef MESH_PACKED_VERTICES
+	const char* vertexShaderFile = "../../assets/shaders/DrawTriPacked.vs";
+#else
+	const char* vertexShaderFile = "../../assets/shaders/DrawTri.vs";
+#endif
+	if(SUCCEEDED(hr = CompileShader((char*)vertexShaderFile, "VS_main", "vs_5_0", nullptr, &pVertexShader)))
 	{
 		if(SUCCEEDED(hr = g_Device->CreateVertexShader(
 			pVertexShader->GetBufferPointer(),
@@ -440,6 +748,10 @@ HRESULT CreateShadersAndInputLayout()
 			nullptr,
 			&g_VertexShader)))
 		{
+#ifdef MESH_PACKED_VERTICES
+			// packed_vertex_t, see packedvertex.h
+			D3D11_INPUT_ELEMENT_DESC inputDesc[] = PACKED_VERTEX_INPUT_DESC;
+#else
 			D3D11_INPUT_ELEMENT_DESC inputDesc[] = {
 				{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 				{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
@@ -447,6 +759,7 @@ HRESULT CreateShadersAndInputLayout()
 				{ "BINORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 36, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 				{ "TEX", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 48, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 			};
+#endif
 
 			hr = g_Device->CreateInputLayout(
 						inputDesc,
@@ -454,6 +767,29 @@ HRESULT CreateShadersAndInputLayout()
 						pVertexShader->GetBufferPointer(),
 						pVertexShader->GetBufferSize(),
 						&g_InputLayout);
+
+			// The same compiled with INSTANCED, with instance_data_t in input slot 1
+			ID3DBlob* pInstancedShader = nullptr;
+			if (SUCCEEDED(hr) &&
+				SUCCEEDED(hr = CompileShader((char*)vertexShaderFile, "VS_main", "vs_5_0", instancedDefines, &pInstancedShader)) &&
+				SUCCEEDED(hr = g_Device->CreateVertexShader(
+					pInstancedShader->GetBufferPointer(),
+					pInstancedShader->GetBufferSize(),
+					nullptr,
+					&g_InstancedVertexShader)))
+			{
+				D3D11_INPUT_ELEMENT_DESC instanceDesc[] = INSTANCE_INPUT_DESC;
+				std::vector<D3D11_INPUT_ELEMENT_DESC> instancedDesc(inputDesc, inputDesc + ARRAYSIZE(inputDesc));
+				instancedDesc.insert(instancedDesc.end(), instanceDesc, instanceDesc + ARRAYSIZE(instanceDesc));
+
+				hr = g_Device->CreateInputLayout(
+							instancedDesc.data(),
+							(UINT)instancedDesc.size(),
+							pInstancedShader->GetBufferPointer(),
+							pInstancedShader->GetBufferSize(),
+							&g_InstancedInputLayout);
+			}
+			SAFE_RELEASE(pInstancedShader);
 		}
 
 		SAFE_RELEASE(pVertexShader);
@@ -480,6 +816,18 @@ HRESULT CreateShadersAndInputLayout()
 		MessageBoxA(nullptr, "Failed to create pixel shader (check Output window for more info)", 0, 0);
 	}
 
+	if (SUCCEEDED(hr) &&
+		SUCCEEDED(hr = CompileShader("../../assets/shaders/DrawTri.ps", "PS_main", "ps_5_0", instancedDefines, &pPixelShader)))
+	{
+		hr = g_Device->CreatePixelShader(
+			pPixelShader->GetBufferPointer(),
+			pPixelShader->GetBufferSize(),
+			nullptr,
+			&g_InstancedPixelShader);
+
+		SAFE_RELEASE(pPixelShader);
+	}
+
 	return hr;
 }
 
@@ -553,27 +901,27 @@ void InitShaderBuffers()
 {
 	HRESULT hr;
 
-	// Matrix buffer
-	D3D11_BUFFER_DESC MatrixBuffer_desc = { 0 };
-	MatrixBuffer_desc.Usage = D3D11_USAGE_DYNAMIC;
-	MatrixBuffer_desc.ByteWidth = sizeof(MatrixBuffer_t);
-	MatrixBuffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	MatrixBuffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	MatrixBuffer_desc.MiscFlags = 0;
-	MatrixBuffer_desc.StructureByteStride = 0;
+	// Frame buffer
+	D3D11_BUFFER_DESC FrameBuffer_desc = { 0 };
+	FrameBuffer_desc.Usage = D3D11_USAGE_DYNAMIC;
+	FrameBuffer_desc.ByteWidth = sizeof(FrameBuffer_t);
+	FrameBuffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	FrameBuffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	FrameBuffer_desc.MiscFlags = 0;
+	FrameBuffer_desc.StructureByteStride = 0;
 
-	ASSERT(hr = g_Device->CreateBuffer(&MatrixBuffer_desc, nullptr, &g_MatrixBuffer));
+	ASSERT(hr = g_Device->CreateBuffer(&FrameBuffer_desc, nullptr, &g_FrameBuffer));
 
-	// Light Buffer
-	D3D11_BUFFER_DESC LightBuffer_desc = { 0 };
-	LightBuffer_desc.Usage = D3D11_USAGE_DYNAMIC;
-	LightBuffer_desc.ByteWidth = sizeof(LightBuffer_t);
-	LightBuffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	LightBuffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	LightBuffer_desc.MiscFlags = 0;
-	LightBuffer_desc.StructureByteStride = 0;
+	// Object Buffer
+	D3D11_BUFFER_DESC ObjectBuffer_desc = { 0 };
+	ObjectBuffer_desc.Usage = D3D11_USAGE_DYNAMIC;
+	ObjectBuffer_desc.ByteWidth = sizeof(ObjectBuffer_t);
+	ObjectBuffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	ObjectBuffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	ObjectBuffer_desc.MiscFlags = 0;
+	ObjectBuffer_desc.StructureByteStride = 0;
 
-	ASSERT(hr = g_Device->CreateBuffer(&LightBuffer_desc, nullptr, &g_LightBuffer));
+	ASSERT(hr = g_Device->CreateBuffer(&ObjectBuffer_desc, nullptr, &g_ObjectBuffer));
 
 	// Phong Buffer
 	D3D11_BUFFER_DESC PhongBuffer_desc = { 0 };
@@ -682,25 +1030,31 @@ HRESULT Render(float deltaTime)
 	//clear depth buffer
 	g_DeviceContext->ClearDepthStencilView( g_DepthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0 );
 	
+	// state is bound through the cache from here on; nothing is known to be bound at frame start
+	g_StateCache->invalidate();
+	g_StateCache->reset_stats();
+
 	//set topology
-	g_DeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST); /// D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST
+	g_StateCache->set_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST); /// D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST
 	
 	//set vertex description
-	g_DeviceContext->IASetInputLayout(g_InputLayout);
+	g_StateCache->set_input_layout(g_InputLayout);
 	
 	//set shaders
-	g_DeviceContext->VSSetShader(g_VertexShader, nullptr, 0);
+	g_StateCache->set_vertex_shader(g_VertexShader);
 	g_DeviceContext->HSSetShader(nullptr, nullptr, 0);
 	g_DeviceContext->DSSetShader(nullptr, nullptr, 0);
 	g_DeviceContext->GSSetShader(nullptr, nullptr, 0);
-	g_DeviceContext->PSSetShader(g_PixelShader, nullptr, 0);
+	g_StateCache->set_pixel_shader(g_PixelShader);
 	
-	// set matrix buffers
-	g_DeviceContext->VSSetConstantBuffers(0, 1, &g_MatrixBuffer);
+	// set frame and object buffers, for both stages
+	g_StateCache->set_vs_constant_buffer(0, g_FrameBuffer);
+	g_StateCache->set_ps_constant_buffer(0, g_FrameBuffer);
+	g_StateCache->set_vs_constant_buffer(2, g_ObjectBuffer);
+	g_StateCache->set_ps_constant_buffer(2, g_ObjectBuffer);
 
-	// set light buffers
-	g_DeviceContext->PSSetConstantBuffers(0, 1, &g_LightBuffer);
-	g_DeviceContext->PSSetConstantBuffers(1, 1, &g_PhongBuffer);
+	// set material buffer
+	g_StateCache->set_ps_constant_buffer(1, g_PhongBuffer);
 
 	// Set texture buffers
 	//g_DeviceContext->PSSetSamplers(0, 1, &m_sampler);
@@ -708,6 +1062,14 @@ HRESULT Render(float deltaTime)
 	// time to render our objects
 	renderObjects();
 
+	// Binds of this frame issued and skipped by the state cache, reported when they change
+	static unsigned last_issued = 0, last_skipped = 0;
+	const state_cache_stats_t& binds = g_StateCache->stats();
+	if (binds.total_issued() != last_issued || binds.total_skipped() != last_skipped)
+		printf("State cache: %u calls issued, %u skipped\n", binds.total_issued(), binds.total_skipped());
+	last_issued = binds.total_issued();
+	last_skipped = binds.total_skipped();
+
 	//swap front and back buffer
 	return g_SwapChain->Present( 0, 0 );
 }
@@ -822,6 +1184,9 @@ void Release()
 	SAFE_RELEASE(g_InputLayout);
 	SAFE_RELEASE(g_VertexShader);
 	SAFE_RELEASE(g_PixelShader);
+	SAFE_RELEASE(g_InstancedInputLayout);
+	SAFE_RELEASE(g_InstancedVertexShader);
+	SAFE_RELEASE(g_InstancedPixelShader);
 
 	SAFE_RELEASE(g_VertexShader);
 	SAFE_RELEASE(g_DeviceContext);
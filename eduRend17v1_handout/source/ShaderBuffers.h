@@ -8,18 +8,26 @@
 
 using namespace linalg;
 
-struct MatrixBuffer_t
+// Constant buffers by how often they change, in the registers of DrawTri.vs and DrawTri.ps:
+//
+// FrameBuffer_t	b0 of both stages, once per frame
+// PhongBuffer_t	b1 of the pixel shader, per material
+// ObjectBuffer_t	b2 of both stages, per object
+//
+struct FrameBuffer_t
 {
-	mat4f ModelToWorldMatrix;
 	mat4f WorldToViewMatrix;
 	mat4f ProjectionMatrix;
-};
-struct LightBuffer_t
-{
 	float4 LightColor;
-	float4 LightDir;
 	float4 CameraDir;
 };
+struct ObjectBuffer_t
+{
+	mat4f ModelToWorldMatrix;
+	mat4f ModelToProjectionMatrix;	// see transforms.h
+	mat4f NormalMatrix;
+	float4 LightDir;		// the scene lights each object from its own direction
+};
 struct PhongBuffer_t
 {
 	float4 SpecularPower;
@@ -29,6 +37,11 @@ struct PhongBuffer_t
 	float isSkybox;
 	float3 padding;
 };
+struct PackedBuffer_t
+{
+	float4 PosOffset;
+	float4 PosScale;
+};
 
 
 #endif
\ No newline at end of file
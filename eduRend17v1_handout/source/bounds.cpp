@@ -0,0 +1,119 @@
+//
+//  bounds.cpp
+//
+
+#include <cmath>
+#include <algorithm>
+#include "bounds.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define BOUNDS_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace linalg;
+
+//
+// Two passes over the vertices given by index(i), i < count: box, then the largest squared
+// distance from its center. Pos is followed by Normal in vertex_t, so the four-float loads
+// of a position stay within its vertex.
+//
+template<class index_fn_t>
+static bounds_t bounds_of(const std::vector<vertex_t>& vertices, size_t count, index_fn_t index)
+{
+	bounds_t b;
+	if (!count)
+		return b;
+
+#ifdef BOUNDS_SSE
+	__m128 lo = _mm_loadu_ps(&vertices[index(0)].Pos.x), hi = lo;
+	for (size_t i = 1; i < count; i++)
+	{
+		__m128 p = _mm_loadu_ps(&vertices[index(i)].Pos.x);
+		lo = _mm_min_ps(lo, p);
+		hi = _mm_max_ps(hi, p);
+	}
+	float l[4], h[4];
+	_mm_storeu_ps(l, lo);
+	_mm_storeu_ps(h, hi);
+	b.box.min = vec3f(l[0], l[1], l[2]);
+	b.box.max = vec3f(h[0], h[1], h[2]);
+	b.sphere.center = (b.box.min + b.box.max) * 0.5f;
+
+	const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 c = _mm_set_ps(0, b.sphere.center.z, b.sphere.center.y, b.sphere.center.x);
+	__m128 r2 = _mm_setzero_ps();
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(&vertices[index(i)].Pos.x), c);
+		__m128 sq = _mm_and_ps(_mm_mul_ps(d, d), xyz);
+		__m128 sum = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, 1)), _mm_shuffle_ps(sq, sq, 2));
+		r2 = _mm_max_ss(r2, sum);
+	}
+	b.sphere.radius = sqrtf(_mm_cvtss_f32(r2));
+#else
+	b.box.min = b.box.max = vertices[index(0)].Pos;
+	for (size_t i = 1; i < count; i++)
+	{
+		const vec3f& p = vertices[index(i)].Pos;
+		for (int k = 0; k < 3; k++)
+		{
+			b.box.min.vec[k] = std::min(b.box.min.vec[k], p.vec[k]);
+			b.box.max.vec[k] = std::max(b.box.max.vec[k], p.vec[k]);
+		}
+	}
+	b.sphere.center = (b.box.min + b.box.max) * 0.5f;
+
+	float r2 = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		vec3f d = vertices[index(i)].Pos - b.sphere.center;
+		r2 = std::max(r2, d.x * d.x + d.y * d.y + d.z * d.z);
+	}
+	b.sphere.radius = sqrtf(r2);
+#endif
+
+	return b;
+}
+
+bounds_t compute_bounds(const std::vector<vertex_t>& vertices)
+{
+	return bounds_of(vertices, vertices.size(), [](size_t i) { return i; });
+}
+
+bounds_t compute_bounds(const std::vector<vertex_t>& vertices, const index_buffer_t& ib, const index_range_t& range)
+{
+	if (ib.wide)
+	{
+		const unsigned* indices = ib.indices32.data() + range.start;
+		unsigned ofs = range.ofs;
+		return bounds_of(vertices, range.size, [=](size_t i) { return ofs + indices[i]; });
+	}
+	const uint16_t* indices = ib.indices16.data() + range.start;
+	unsigned ofs = range.ofs;
+	return bounds_of(vertices, range.size, [=](size_t i) { return ofs + indices[i]; });
+}
+
+aabb_t transform_box(const mat4f& M, const aabb_t& box)
+{
+	// each column of the 3x3 part adds its smallest and largest product with the extent
+	aabb_t t;
+	for (int i = 0; i < 3; i++)
+		t.min.vec[i] = t.max.vec[i] = M.col[3].vec[i];
+	for (int j = 0; j < 3; j++)
+		for (int i = 0; i < 3; i++)
+		{
+			float a = M.col[j].vec[i] * box.min.vec[j], b = M.col[j].vec[i] * box.max.vec[j];
+			t.min.vec[i] += std::min(a, b);
+			t.max.vec[i] += std::max(a, b);
+		}
+	return t;
+}
+
+void compute_bounds(const std::vector<vertex_t>& vertices, const index_buffer_t& ib,
+	const std::vector<index_range_t>& ranges, std::vector<bounds_t>& bounds)
+{
+	bounds.resize(ranges.size());
+	for (size_t i = 0; i < ranges.size(); i++)
+		bounds[i] = compute_bounds(vertices, ib, ranges[i]);
+}
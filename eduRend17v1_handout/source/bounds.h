@@ -0,0 +1,77 @@
+//
+//  bounds.h
+//
+//  Axis-aligned boxes and spheres around meshes and index ranges
+//
+
+#pragma once
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <vector>
+#include <algorithm>
+#include "vec\mat.h"
+#include "drawcall.h"
+#include "indexbuffer.h"
+
+struct aabb_t
+{
+	vec3f min = { 0, 0, 0 };
+	vec3f max = { 0, 0, 0 };
+};
+
+//
+// Smallest box around both boxes, and half the surface area of a box (for SAH costs)
+//
+inline aabb_t merge(const aabb_t& a, const aabb_t& b)
+{
+	aabb_t m;
+	for (int k = 0; k < 3; k++)
+	{
+		m.min.vec[k] = std::min(a.min.vec[k], b.min.vec[k]);
+		m.max.vec[k] = std::max(a.max.vec[k], b.max.vec[k]);
+	}
+	return m;
+}
+
+inline float half_area(const aabb_t& a)
+{
+	vec3f d = a.max - a.min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+struct sphere_t
+{
+	vec3f center = { 0, 0, 0 };
+	float radius = 0;
+};
+
+//
+// Box around a set of vertices, and the sphere around the center of the box through the
+// vertex furthest from it. Both are zero for an empty set.
+//
+struct bounds_t
+{
+	aabb_t box;
+	sphere_t sphere;
+};
+
+//
+// Bounds of all vertices, and of the vertices used by one range of an index buffer (with its
+// ofs added). Min/max and distances are taken four floats at a time with SSE where available.
+//
+bounds_t compute_bounds(const std::vector<vertex_t>& vertices);
+bounds_t compute_bounds(const std::vector<vertex_t>& vertices, const index_buffer_t& ib, const index_range_t& range);
+
+//
+// Box around box transformed by M, e.g. a model-space box to world space
+//
+aabb_t transform_box(const mat4f& M, const aabb_t& box);
+
+//
+// One bounds_t per range
+//
+void compute_bounds(const std::vector<vertex_t>& vertices, const index_buffer_t& ib,
+	const std::vector<index_range_t>& ranges, std::vector<bounds_t>& bounds);
+
+#endif
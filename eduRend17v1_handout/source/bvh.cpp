@@ -0,0 +1,212 @@
+//
+//  bvh.cpp
+//
+
+#include <cfloat>
+#include <algorithm>
+#include "bvh.h"
+
+// below this depth nodes are split at the median, which keeps query stacks small
+#define BVH_MAX_SAH_DEPTH 32
+
+static aabb_t empty_box()
+{
+	aabb_t b;
+	b.min = vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+	b.max = vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return b;
+}
+
+static vec3f center(const aabb_t& b)
+{
+	return (b.min + b.max) * 0.5f;
+}
+
+void bvh_t::build(const std::vector<aabb_t>& item_boxes)
+{
+	boxes = item_boxes;
+	size_t n = boxes.size();
+	items.resize(n);
+	for (unsigned i = 0; i < n; i++)
+		items[i] = i;
+	nodes.clear();
+	parents.clear();
+	leaves.assign(n, 0);
+	if (!n)
+		return;
+
+	nodes.reserve(n * 2);
+	parents.reserve(n * 2);
+	nodes.push_back(bvh_node_t());
+	nodes[0].count = (unsigned)n;
+	parents.push_back(~0u);
+
+	struct task_t { unsigned node; int depth; };
+	std::vector<task_t> tasks;
+	tasks.push_back({ 0, 0 });
+	while (!tasks.empty())
+	{
+		task_t task = tasks.back();
+		tasks.pop_back();
+		unsigned first = nodes[task.node].first, count = nodes[task.node].count;
+
+		aabb_t box = empty_box(), centers = empty_box();
+		for (unsigned i = first; i < first + count; i++)
+		{
+			box = merge(box, boxes[items[i]]);
+			aabb_t c;
+			c.min = c.max = center(boxes[items[i]]);
+			centers = merge(centers, c);
+		}
+		nodes[task.node].box = box;
+
+		auto make_leaf = [&]()
+		{
+			for (unsigned i = first; i < first + count; i++)
+				leaves[items[i]] = task.node;
+		};
+		if (count == 1)
+		{
+			make_leaf();
+			continue;
+		}
+
+		vec3f extent = centers.max - centers.min;
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		float lo = centers.min.vec[axis], width = extent.vec[axis];
+		unsigned mid = first + count / 2;
+		bool median = true;
+
+		if (width > 0 && task.depth < BVH_MAX_SAH_DEPTH)
+		{
+			// bin the centers, then sweep for the cheapest of the BVH_BINS - 1 splits
+			aabb_t bin_boxes[BVH_BINS];
+			unsigned bin_counts[BVH_BINS] = {};
+			for (auto& b : bin_boxes)
+				b = empty_box();
+			float to_bin = BVH_BINS / width;
+			auto bin_of = [&](unsigned item)
+			{
+				int b = (int)((center(boxes[item]).vec[axis] - lo) * to_bin);
+				return std::min(b, BVH_BINS - 1);
+			};
+			for (unsigned i = first; i < first + count; i++)
+			{
+				int b = bin_of(items[i]);
+				bin_boxes[b] = merge(bin_boxes[b], boxes[items[i]]);
+				bin_counts[b]++;
+			}
+
+			float right_cost[BVH_BINS];
+			aabb_t acc = empty_box();
+			unsigned acc_count = 0;
+			for (int b = BVH_BINS - 1; b > 0; b--)
+			{
+				acc = merge(acc, bin_boxes[b]);
+				acc_count += bin_counts[b];
+				right_cost[b] = acc_count ? half_area(acc) * acc_count : 0;
+			}
+			float best_cost = FLT_MAX;
+			int best = 0;
+			acc = empty_box();
+			acc_count = 0;
+			for (int b = 1; b < BVH_BINS; b++)
+			{
+				acc = merge(acc, bin_boxes[b - 1]);
+				acc_count += bin_counts[b - 1];
+				float cost = (acc_count ? half_area(acc) * acc_count : 0) + right_cost[b];
+				if (acc_count && acc_count < count && cost < best_cost)
+				{
+					best_cost = cost;
+					best = b;
+				}
+			}
+
+			// a traversal step costs as much as one item test
+			float area = half_area(box);
+			float split_cost = 1 + (area > 0 ? best_cost / area : 0);
+			if (count <= BVH_LEAF_SIZE && (!best || split_cost >= count))
+			{
+				make_leaf();
+				continue;
+			}
+			median = !best;
+			if (best)
+				mid = (unsigned)(std::partition(items.begin() + first, items.begin() + first + count,
+					[&](unsigned item) { return bin_of(item) < best; }) - items.begin());
+		}
+		else if (count <= BVH_LEAF_SIZE)
+		{
+			make_leaf();
+			continue;
+		}
+
+		if (median)
+			std::nth_element(items.begin() + first, items.begin() + mid, items.begin() + first + count,
+				[&](unsigned a, unsigned b) { return center(boxes[a]).vec[axis] < center(boxes[b]).vec[axis]; });
+
+		unsigned child = (unsigned)nodes.size();
+		nodes.resize(child + 2);
+		parents.push_back(task.node);
+		parents.push_back(task.node);
+		nodes[child].first = first;
+		nodes[child].count = mid - first;
+		nodes[child + 1].first = mid;
+		nodes[child + 1].count = first + count - mid;
+		nodes[task.node].first = child;
+		nodes[task.node].count = 0;
+		tasks.push_back({ child + 1, task.depth + 1 });
+		tasks.push_back({ child, task.depth + 1 });
+	}
+
+	// query holds a pending sibling per level above a node and its two children
+	stack_size = (unsigned)depth() + 1;
+}
+
+void bvh_t::update(unsigned item, const aabb_t& box)
+{
+	boxes[item] = box;
+
+	unsigned node = leaves[item];
+	const bvh_node_t& leaf = nodes[node];
+	aabb_t b = boxes[items[leaf.first]];
+	for (unsigned i = 1; i < leaf.count; i++)
+		b = merge(b, boxes[items[leaf.first + i]]);
+	nodes[node].box = b;
+
+	for (node = parents[node]; node != ~0u; node = parents[node])
+	{
+		const bvh_node_t& n = nodes[node];
+		nodes[node].box = merge(nodes[n.first].box, nodes[n.first + 1].box);
+	}
+}
+
+void bvh_t::refit()
+{
+	// children come after their parents
+	for (size_t i = nodes.size(); i-- > 0; )
+	{
+		bvh_node_t& n = nodes[i];
+		if (n.count)
+		{
+			n.box = boxes[items[n.first]];
+			for (unsigned k = 1; k < n.count; k++)
+				n.box = merge(n.box, boxes[items[n.first + k]]);
+		}
+		else
+			n.box = merge(nodes[n.first].box, nodes[n.first + 1].box);
+	}
+}
+
+int bvh_t::depth() const
+{
+	int d = 0;
+	for (unsigned leaf : leaves)
+	{
+		int k = 0;
+		for (unsigned node = leaf; node != ~0u; node = parents[node])
+			k++;
+		d = std::max(d, k);
+	}
+	return d;
+}
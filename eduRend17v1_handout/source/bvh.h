@@ -0,0 +1,119 @@
+//
+//  bvh.h
+//
+//  Bounding volume hierarchy over boxes, built with binned SAH and refitted as they move
+//
+
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "bounds.h"
+#include "frustum.h"
+
+#define BVH_BINS		12	// SAH split candidates per node, along the widest axis of the centers
+#define BVH_LEAF_SIZE	4	// nodes with more items are always split
+
+//
+// A leaf holds count items from items[first], an inner node (count == 0) has its children
+// at nodes[first] and nodes[first + 1]. The root is nodes[0].
+//
+struct bvh_node_t
+{
+	aabb_t box;
+	unsigned first = 0;
+	unsigned count = 0;
+};
+
+struct bvh_t
+{
+	std::vector<bvh_node_t> nodes;
+	std::vector<unsigned> items;		// item indices, in leaf order
+	std::vector<aabb_t> boxes;			// per item
+	std::vector<unsigned> parents;		// per node, ~0u for the root
+	std::vector<unsigned> leaves;		// per item, the leaf holding it
+	unsigned stack_size = 0;			// entries the stack of query takes, from the depth at build
+
+	//
+	// Build over one box per item, item i being boxes[i]
+	//
+	void build(const std::vector<aabb_t>& item_boxes);
+
+	//
+	// New box for one item, and the boxes of the nodes above it. The tree keeps its shape,
+	// so it degrades when items move far; build again then.
+	//
+	void update(unsigned item, const aabb_t& box);
+
+	//
+	// Recompute the boxes of all nodes from the items, after changing many of them
+	//
+	void refit();
+
+	//
+	// Visit the nodes from the root: test(box) returns frustum_outside to skip the node,
+	// frustum_inside to take everything below without further tests, or
+	// frustum_intersects to go on. visit(item) is called for each item taken.
+	//
+	template<class test_fn_t, class visit_fn_t>
+	void query(test_fn_t test, visit_fn_t visit) const
+	{
+		if (nodes.empty())
+			return;
+
+		// the nodes still to visit, on the stack unless the tree is deeper than it holds
+		struct entry_t { unsigned node; bool inside; };
+		entry_t local[64];
+		std::vector<entry_t> heap;
+		entry_t* stack = local;
+		if (stack_size > 64)
+		{
+			heap.resize(stack_size);
+			stack = heap.data();
+		}
+		int top = 0;
+		stack[top++] = { 0, false };
+		while (top)
+		{
+			entry_t e = stack[--top];
+			const bvh_node_t& n = nodes[e.node];
+			bool inside = e.inside;
+			if (!inside)
+			{
+				frustum_test_t t = test(n.box);
+				if (t == frustum_outside)
+					continue;
+				inside = t == frustum_inside;
+			}
+			if (n.count)
+			{
+				for (unsigned i = 0; i < n.count; i++)
+				{
+					unsigned item = items[n.first + i];
+					if (inside || test(boxes[item]) != frustum_outside)
+						visit(item);
+				}
+				continue;
+			}
+			stack[top++] = { n.first + 1, inside };
+			stack[top++] = { n.first, inside };
+		}
+	}
+
+	//
+	// Items whose boxes are (partly) in the frustum
+	//
+	template<class visit_fn_t>
+	void query(const frustum_t& frustum, visit_fn_t visit) const
+	{
+		query([&](const aabb_t& box) { return classify_box(frustum, box); }, visit);
+	}
+
+	//
+	// Nodes on the longest path from the root to a leaf
+	//
+	int depth() const;
+};
+
+#endif
@@ -0,0 +1,50 @@
+//
+//  constantring.cpp
+//
+
+#include "constantring.h"
+
+void constant_ring_t::begin_frame(size_t bytes)
+{
+	stats = constant_ring_stats_t();
+
+	// the first map has nothing to keep
+	bool discard = !started || head + bytes > capacity;
+	data = (uint8_t*)buffer->map(discard);
+	started = true;
+	stats.maps++;
+	if (discard)
+	{
+		stats.discards++;
+		head = 0;
+	}
+	end = head + bytes < capacity ? head + bytes : capacity;
+
+	// nothing to allocate from
+	if (!data)
+		end = head;
+}
+
+void* constant_ring_t::allocate(size_t size, unsigned& offset)
+{
+	size_t padded = padded_size(size);
+	if (head + padded > end)
+	{
+		stats.failed++;
+		return nullptr;
+	}
+
+	offset = (unsigned)head;
+	head += padded;
+	stats.allocations++;
+	stats.bytes += size;
+	stats.padded_bytes += padded;
+	return data + offset;
+}
+
+void constant_ring_t::end_frame()
+{
+	if (data)
+		buffer->unmap();
+	data = nullptr;
+}
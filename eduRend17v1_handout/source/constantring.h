@@ -0,0 +1,109 @@
+//
+//  constantring.h
+//
+//  Per-frame constants written linearly into one large mapped buffer, bound by offset
+//
+
+#pragma once
+#ifndef CONSTANTRING_H
+#define CONSTANTRING_H
+
+#include <cstddef>
+#include <cstdint>
+
+// bind per object constants as ranges of one ring buffer (see renderObjects)
+#define CONSTANT_RING_BUFFER
+// alignment and size granularity of allocations: constant buffer ranges are bound in
+// multiples of 16 constants of 16 bytes
+#define CONSTANT_RING_ALIGNMENT 256
+#define CONSTANT_RING_BYTES (1 << 20)
+
+//
+// What a constant_ring_t writes to: a buffer mapped whole, e.g. a dynamic constant buffer, or
+// plain memory in tests
+//
+class ring_buffer_t
+{
+public:
+	// discard: start over in a new buffer, since the GPU may still read all of the old one;
+	// otherwise the contents stay and only memory past what is in use gets written
+	virtual void* map(bool discard) = 0;
+	virtual void unmap() = 0;
+	virtual ~ring_buffer_t() { }
+};
+
+// size rounded up to the alignment
+inline size_t padded_size(size_t size)
+{
+	return (size + CONSTANT_RING_ALIGNMENT - 1) & ~(size_t)(CONSTANT_RING_ALIGNMENT - 1);
+}
+
+struct constant_ring_stats_t
+{
+	unsigned allocations = 0;
+	size_t bytes = 0;			// asked for
+	size_t padded_bytes = 0;	// used, with alignment
+	unsigned maps = 0;
+	unsigned discards = 0;		// maps that started over
+	unsigned failed = 0;		// allocations past the space of the frame
+};
+
+//
+// Linear allocator over a ring_buffer_t of capacity bytes, mapped once per frame: each frame
+// continues after the constants of the frames before, which the GPU may still read, and the
+// buffer is discarded and started over when the rest is too small for the frame. All
+// constants of a frame are in one buffer, as they are drawn with after end_frame.
+//
+class constant_ring_t
+{
+	ring_buffer_t* const buffer;
+	const size_t capacity;
+	size_t head = 0;
+	size_t end = 0;		// of the space for the frame
+	uint8_t* data = nullptr;
+	bool started = false;
+
+public:
+
+	// of the current frame, or the last one after end_frame
+	constant_ring_stats_t stats;
+
+	constant_ring_t(ring_buffer_t* buffer, size_t capacity) : buffer(buffer), capacity(capacity) { }
+
+	//
+	// Map the buffer for the constants of a frame, which take at most bytes, with alignment
+	// (see padded_size), and at most the capacity
+	//
+	void begin_frame(size_t bytes);
+
+	//
+	// Space for size bytes at an offset that is a multiple of CONSTANT_RING_ALIGNMENT, to
+	// write before end_frame, or nullptr past what begin_frame was given
+	//
+	void* allocate(size_t size, unsigned& offset);
+
+	template<class T>
+	T* allocate(unsigned& offset)
+	{
+		return (T*)allocate(sizeof(T), offset);
+	}
+
+	//
+	// Copy values to an allocation at offset, false if there is no space
+	//
+	template<class T>
+	bool write(const T& values, unsigned& offset)
+	{
+		T* dst = allocate<T>(offset);
+		if (dst)
+			*dst = values;
+		return dst != nullptr;
+	}
+
+	//
+	// Unmap the buffer, before drawing with the constants
+	//
+	void end_frame();
+};
+
+#endif
@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <vector>
+#include <cstdint>
 #include <unordered_map>
 #include "stdafx.h"
 #include "vec/vec.h"
@@ -60,12 +61,41 @@ struct quad_t_
 	unsigned vi[4];
 };
 
+//
+// Coarser version of the triangles of a drawcall, over the same vertices (see simplify.h)
+//
+struct lod_t
+{
+	std::vector<triangle_t> tris;
+	float error = 0;
+};
+
+//
+// Cluster of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles of a
+// drawcall (see meshlet.h). Its vertices are meshlet_vertices[vertex_offset..] of the drawcall,
+// and its triangles are triples of bytes in meshlet_indices[triangle_offset * 3..], indexing
+// those vertices.
+//
+struct meshlet_t
+{
+	unsigned vertex_offset, vertex_count;
+	unsigned triangle_offset, triangle_count;
+	vec3f center;			// bounding sphere
+	float radius;
+	vec3f cone_axis;		// normal cone, see meshlet_backfacing
+	float cone_cutoff;
+};
+
 struct drawcall_t
 {
     std::string group_name;
     int mtl_index = -1;
     std::vector<triangle_t> tris;
     std::vector<quad_t_> quads;
+    std::vector<lod_t> lods;
+    std::vector<meshlet_t> meshlets;
+    std::vector<unsigned> meshlet_vertices;
+    std::vector<uint8_t> meshlet_indices;
     
 	// make sortable
     bool operator < (const drawcall_t& dc) const
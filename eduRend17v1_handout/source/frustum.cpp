@@ -0,0 +1,143 @@
+//
+//  frustum.cpp
+//
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include "frustum.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+frustum_t extract_frustum(const mat4f& M)
+{
+	// rows of the matrix, the planes are sums and differences of the last row with the others
+	vec4f r[4];
+	for (int i = 0; i < 4; i++)
+		r[i] = vec4f(M.col[0].vec[i], M.col[1].vec[i], M.col[2].vec[i], M.col[3].vec[i]);
+
+	frustum_t f;
+	for (int i = 0; i < 3; i++)
+	{
+		f.planes[i * 2] = r[3] + r[i];
+		f.planes[i * 2 + 1] = r[3] - r[i];
+	}
+	for (auto& p : f.planes)
+	{
+		float len = vec3f(p.x, p.y, p.z).norm2();
+		if (len > 0)
+			p = p * (1.0f / len);
+	}
+	return f;
+}
+
+bool box_in_frustum(const frustum_t& frustum, const aabb_t& box)
+{
+	// the corner furthest along each plane normal decides
+	for (auto& p : frustum.planes)
+	{
+		float d = p.w;
+		d += p.x * (p.x >= 0 ? box.max.x : box.min.x);
+		d += p.y * (p.y >= 0 ? box.max.y : box.min.y);
+		d += p.z * (p.z >= 0 ? box.max.z : box.min.z);
+		if (d < 0)
+			return false;
+	}
+	return true;
+}
+
+frustum_test_t classify_box(const frustum_t& frustum, const aabb_t& box)
+{
+	// the nearest corner along each normal decides whether the box is entirely inside
+	frustum_test_t result = frustum_inside;
+	for (auto& p : frustum.planes)
+	{
+		float far_d = p.w, near_d = p.w;
+		for (int k = 0; k < 3; k++)
+		{
+			bool pos = p.vec[k] >= 0;
+			far_d += p.vec[k] * (pos ? box.max.vec[k] : box.min.vec[k]);
+			near_d += p.vec[k] * (pos ? box.min.vec[k] : box.max.vec[k]);
+		}
+		if (far_d < 0)
+			return frustum_outside;
+		if (near_d < 0)
+			result = frustum_intersects;
+	}
+	return result;
+}
+
+#ifdef FRUSTUM_SSE
+//
+// Four boxes from center and extent, one component per register: outside when
+// dot(n, c) + d + dot(|n|, e) < 0 for some plane. Returns a bit per box inside.
+//
+static int boxes_in_frustum(const frustum_t& frustum, const bounds_t* b)
+{
+	// min and max are 3 floats each and followed by more floats in bounds_t, the fourth
+	// lane is loaded but not used
+	__m128 lo0 = _mm_loadu_ps(&b[0].box.min.x), lo1 = _mm_loadu_ps(&b[1].box.min.x);
+	__m128 lo2 = _mm_loadu_ps(&b[2].box.min.x), lo3 = _mm_loadu_ps(&b[3].box.min.x);
+	__m128 hi0 = _mm_loadu_ps(&b[0].box.max.x), hi1 = _mm_loadu_ps(&b[1].box.max.x);
+	__m128 hi2 = _mm_loadu_ps(&b[2].box.max.x), hi3 = _mm_loadu_ps(&b[3].box.max.x);
+	_MM_TRANSPOSE4_PS(lo0, lo1, lo2, lo3);
+	_MM_TRANSPOSE4_PS(hi0, hi1, hi2, hi3);
+
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 cx = _mm_mul_ps(_mm_add_ps(hi0, lo0), half), ex = _mm_mul_ps(_mm_sub_ps(hi0, lo0), half);
+	__m128 cy = _mm_mul_ps(_mm_add_ps(hi1, lo1), half), ey = _mm_mul_ps(_mm_sub_ps(hi1, lo1), half);
+	__m128 cz = _mm_mul_ps(_mm_add_ps(hi2, lo2), half), ez = _mm_mul_ps(_mm_sub_ps(hi2, lo2), half);
+
+	__m128 outside = _mm_setzero_ps();
+	for (auto& p : frustum.planes)
+	{
+		__m128 d = _mm_set1_ps(p.w);
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.x), cx));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.y), cy));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(p.z), cz));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(fabsf(p.x)), ex));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(fabsf(p.y)), ey));
+		d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(fabsf(p.z)), ez));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+	}
+	return ~_mm_movemask_ps(outside) & 0xf;
+}
+#endif
+
+cull_stats_t cull_boxes(const frustum_t& frustum, const std::vector<bounds_t>& bounds, std::vector<uint8_t>& visible)
+{
+	size_t count = bounds.size();
+	visible.resize(count);
+
+	size_t i = 0;
+#ifdef FRUSTUM_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		int mask = boxes_in_frustum(frustum, &bounds[i]);
+		for (int k = 0; k < 4; k++)
+			visible[i + k] = (mask >> k) & 1;
+	}
+	if (i < count)
+	{
+		// the last few, padded with copies of the last box
+		bounds_t tail[4];
+		for (size_t k = 0; k < 4; k++)
+			tail[k] = bounds[std::min(i + k, count - 1)];
+		int mask = boxes_in_frustum(frustum, tail);
+		for (size_t k = 0; i + k < count; k++)
+			visible[i + k] = (mask >> k) & 1;
+	}
+#else
+	for (; i < count; i++)
+		visible[i] = box_in_frustum(frustum, bounds[i].box);
+#endif
+
+	cull_stats_t stats;
+	for (uint8_t v : visible)
+		stats.visible += v;
+	stats.culled = (unsigned)count - stats.visible;
+	return stats;
+}
@@ -0,0 +1,85 @@
+//
+//  frustum.h
+//
+//  View-frustum planes and culling of index ranges by their bounding boxes
+//
+
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <vector>
+#include <cstdint>
+#include "vec\vec.h"
+#include "vec\mat.h"
+#include "indexbuffer.h"
+#include "bounds.h"
+
+// skip the drawcalls of OBJModel_t whose boxes are outside the view frustum
+#define FRUSTUM_CULL_DRAWCALLS
+
+using namespace linalg;
+
+//
+// Planes (n, d) of a frustum, normalized and facing inwards: p is on the inside of
+// plane i when dot(n, p) + d >= 0. Left, right, bottom, top, near, far.
+//
+struct frustum_t
+{
+	vec4f planes[6];
+};
+
+struct cull_stats_t
+{
+	unsigned visible = 0;
+	unsigned culled = 0;		// outside the frustum
+	unsigned occluded = 0;		// inside, but hidden (see occlusion.h)
+
+	cull_stats_t& operator += (const cull_stats_t& s)
+	{
+		visible += s.visible;
+		culled += s.culled;
+		occluded += s.occluded;
+		return *this;
+	}
+	bool operator == (const cull_stats_t& s) const { return visible == s.visible && culled == s.culled && occluded == s.occluded; }
+	bool operator != (const cull_stats_t& s) const { return !(*this == s); }
+};
+
+//
+// Frustum in the space that ModelToClip transforms from, for the GL style clip space of
+// mat4f::projection (-w <= x, y, z <= w). Pass Projection * WorldToView * ModelToWorld to get
+// the frustum in model space.
+//
+frustum_t extract_frustum(const mat4f& ModelToClip);
+
+//
+// Is some part of the box on the inside of all planes? Conservative: boxes near a corner
+// of the frustum may pass while being outside.
+//
+bool box_in_frustum(const frustum_t& frustum, const aabb_t& box);
+
+//
+// Is the box entirely outside one of the planes, entirely inside all of them, or neither?
+// For hierarchies: nothing below an inside node needs testing.
+//
+enum frustum_test_t { frustum_outside, frustum_intersects, frustum_inside };
+frustum_test_t classify_box(const frustum_t& frustum, const aabb_t& box);
+
+//
+// visible[i] = box_in_frustum(bounds[i].box), four boxes per iteration with SSE where available
+//
+cull_stats_t cull_boxes(const frustum_t& frustum, const std::vector<bounds_t>& bounds, std::vector<uint8_t>& visible);
+
+//
+// Call draw(range) for each visible range, in order
+//
+template<class draw_fn_t>
+void draw_visible(const std::vector<index_range_t>& ranges, const std::vector<uint8_t>& visible, draw_fn_t draw)
+{
+	for (size_t i = 0; i < ranges.size(); i++)
+		if (visible[i])
+			draw(ranges[i]);
+}
+
+#endif
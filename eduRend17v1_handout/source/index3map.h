@@ -0,0 +1,107 @@
+//
+//  index3map.h
+//
+//  Flat hash map from OBJ index triples to welded vertex indices
+//
+
+#pragma once
+#ifndef INDEX3MAP_H
+#define INDEX3MAP_H
+
+#include <vector>
+#include <cstdint>
+#include "vec/vec.h"
+
+//
+// Open addressing with linear probing over one array of (key, value) slots, keyed on the
+// full (position, normal, texcoord) triple. The table is sized up front from an estimate of
+// the number of unique triples at a load factor of at most 1/2, so there are no per-insert
+// allocations, and doubles if the estimate was too low.
+//
+class index3_map_t
+{
+	struct slot_t
+	{
+		linalg::int3 key;
+		unsigned value;
+	};
+	static const unsigned empty = ~0u;
+
+	std::vector<slot_t> slots;
+	size_t mask, count = 0;
+
+public:
+	index3_map_t(size_t expected_keys)
+	{
+		size_t capacity = 16;
+		while (capacity < expected_keys * 2)
+			capacity *= 2;
+		slots.resize(capacity, { linalg::int3(0, 0, 0), empty });
+		mask = capacity - 1;
+	}
+
+	static size_t hash(const linalg::int3& k)
+	{
+		uint64_t h = (uint32_t)k.x * 0x9E3779B97F4A7C15ull ^
+					 (uint32_t)k.y * 0xC2B2AE3D27D4EB4Full ^
+					 (uint32_t)k.z * 0x165667B19E3779F9ull;
+		h ^= h >> 32;
+		h *= 0xD6E8FEB86659FD93ull;
+		h ^= h >> 32;
+		return (size_t)h;
+	}
+
+	//
+	// Return the value of key if present, otherwise insert it with the given value
+	// (which must not be ~0u) and return that
+	//
+	unsigned find_or_insert(const linalg::int3& key, unsigned value, bool& inserted)
+	{
+		if ((count + 1) * 2 > slots.size())
+			grow();
+
+		for (size_t i = hash(key) & mask; ; i = (i + 1) & mask)
+		{
+			slot_t& s = slots[i];
+			if (s.value == empty)
+			{
+				s.key = key;
+				s.value = value;
+				count++;
+				inserted = true;
+				return value;
+			}
+			if (s.key.x == key.x && s.key.y == key.y && s.key.z == key.z)
+			{
+				inserted = false;
+				return s.value;
+			}
+		}
+	}
+
+	size_t size() const { return count; }
+
+	// heap memory held by the table
+	size_t bytes() const { return slots.capacity() * sizeof(slot_t); }
+
+private:
+	void grow()
+	{
+		std::vector<slot_t> old;
+		old.swap(slots);
+		slots.resize(old.size() * 2, { linalg::int3(0, 0, 0), empty });
+		mask = slots.size() - 1;
+
+		for (auto& s : old)
+		{
+			if (s.value == empty)
+				continue;
+			size_t i = hash(s.key) & mask;
+			while (slots[i].value != empty)
+				i = (i + 1) & mask;
+			slots[i] = s;
+		}
+	}
+};
+
+#endif
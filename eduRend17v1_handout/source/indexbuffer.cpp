@@ -0,0 +1,212 @@
+//
+//  indexbuffer.cpp
+//
+
+#include <algorithm>
+#include "indexbuffer.h"
+
+static inline void triangle_span(const triangle_t& tri, unsigned& lo, unsigned& hi)
+{
+	lo = std::min(tri.vi[0], std::min(tri.vi[1], tri.vi[2]));
+	hi = std::max(tri.vi[0], std::max(tri.vi[1], tri.vi[2]));
+}
+
+void build_index_buffer(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib, unsigned max_vertices)
+{
+	ib = index_buffer_t();
+#ifdef MESH_USE_INDEX16
+	ib.wide = false;
+#endif
+	append_index_ranges(drawcalls, ib, max_vertices);
+}
+
+size_t append_index_ranges(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib, unsigned max_vertices)
+{
+	size_t first_range = ib.ranges.size();
+
+	size_t nbr_tris = 0;
+	unsigned nbr_vertices = 0;
+	bool fits = true;
+	for (auto& dc : drawcalls)
+	{
+		nbr_tris += dc.tris.size();
+		for (auto& tri : dc.tris)
+		{
+			unsigned lo, hi;
+			triangle_span(tri, lo, hi);
+			nbr_vertices = std::max(nbr_vertices, hi + 1);
+			if (hi - lo >= max_vertices)
+				fits = false;
+		}
+	}
+
+	if (!fits && !ib.wide)
+	{
+		// the ranges so far keep their ofs
+		ib.indices32.assign(ib.indices16.begin(), ib.indices16.end());
+		ib.indices16.clear();
+		ib.wide = true;
+	}
+
+	if (ib.wide || nbr_vertices <= max_vertices)
+	{
+		// one range per drawcall, indexing the whole vertex array
+		if (ib.wide)
+			ib.indices32.reserve(ib.indices32.size() + nbr_tris * 3);
+		else
+			ib.indices16.reserve(ib.indices16.size() + nbr_tris * 3);
+
+		for (auto& dc : drawcalls)
+		{
+			size_t start = ib.count();
+			for (auto& tri : dc.tris)
+				for (int k = 0; k < 3; k++)
+				{
+					if (ib.wide)
+						ib.indices32.push_back(tri.vi[k]);
+					else
+						ib.indices16.push_back((uint16_t)tri.vi[k]);
+				}
+			ib.ranges.push_back({ start, dc.tris.size() * 3, 0, dc.mtl_index });
+		}
+		return first_range;
+	}
+
+	// rebased ranges of 16-bit indices, splitting drawcalls where needed
+	ib.indices16.reserve(ib.indices16.size() + nbr_tris * 3);
+
+	for (auto& dc : drawcalls)
+	{
+		size_t first = 0;
+		unsigned lo = 0, hi = 0;
+
+		auto flush = [&](size_t last)
+		{
+			size_t start = ib.indices16.size();
+			for (size_t t = first; t < last; t++)
+				for (int k = 0; k < 3; k++)
+					ib.indices16.push_back((uint16_t)(dc.tris[t].vi[k] - lo));
+			ib.ranges.push_back({ start, (last - first) * 3, lo, dc.mtl_index });
+		};
+
+		for (size_t t = 0; t < dc.tris.size(); t++)
+		{
+			unsigned tlo, thi;
+			triangle_span(dc.tris[t], tlo, thi);
+			if (t == first)
+			{
+				lo = tlo;
+				hi = thi;
+			}
+			else if (std::max(hi, thi) - std::min(lo, tlo) >= max_vertices)
+			{
+				flush(t);
+				first = t;
+				lo = tlo;
+				hi = thi;
+			}
+			else
+			{
+				lo = std::min(lo, tlo);
+				hi = std::max(hi, thi);
+			}
+		}
+		flush(dc.tris.size());
+	}
+	return first_range;
+}
+
+size_t batch_index_ranges(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib, size_t first_range,
+	std::vector<index_group_t>& groups, unsigned max_vertices)
+{
+	// the drawcalls lie one after the other from the first range on
+	groups.clear();
+	size_t start = first_range < ib.ranges.size() ? ib.ranges[first_range].start : ib.count();
+	for (auto& dc : drawcalls)
+	{
+		index_group_t group;
+		group.name = dc.group_name;
+		group.mtl_index = dc.mtl_index;
+		group.start = start;
+		group.size = dc.tris.size() * 3;
+		group.range = 0;
+		groups.push_back(group);
+		start += group.size;
+	}
+
+	// merged ranges, the highest vertex each uses, and the merged range of each range
+	std::vector<index_range_t> batches;
+	std::vector<unsigned> batch_hi;
+	std::vector<size_t> batch_of(ib.ranges.size() - first_range);
+	for (size_t r = first_range; r < ib.ranges.size(); r++)
+	{
+		const index_range_t& range = ib.ranges[r];
+		unsigned lo = range.ofs, hi = range.ofs;
+		for (size_t i = 0; i < range.size; i++)
+			hi = std::max(hi, ib.vertex(range, i));
+
+		if (batches.size() && batches.back().mtl_index == range.mtl_index &&
+			batches.back().start + batches.back().size == range.start)
+		{
+			// an empty range takes the vertices of the other
+			index_range_t& batch = batches.back();
+			unsigned merged_lo = !range.size ? batch.ofs : !batch.size ? lo : std::min(batch.ofs, lo);
+			unsigned merged_hi = !range.size ? batch_hi.back() : !batch.size ? hi : std::max(batch_hi.back(), hi);
+			if (ib.wide || merged_hi - merged_lo < max_vertices)
+			{
+				batch.size += range.size;
+				batch.ofs = merged_lo;
+				batch_hi.back() = merged_hi;
+				batch_of[r - first_range] = batches.size() - 1;
+				continue;
+			}
+		}
+		batches.push_back(range);
+		batch_hi.push_back(hi);
+		batch_of[r - first_range] = batches.size() - 1;
+	}
+
+	// rebase the indices of the ranges to their merged range
+	for (size_t r = first_range; r < ib.ranges.size(); r++)
+	{
+		const index_range_t& range = ib.ranges[r];
+		unsigned delta = range.ofs - batches[batch_of[r - first_range]].ofs;
+		if (!delta)
+			continue;
+		for (size_t i = range.start; i < range.start + range.size; i++)
+		{
+			if (ib.wide)
+				ib.indices32[i] += delta;
+			else
+				ib.indices16[i] = (uint16_t)(ib.indices16[i] + delta);
+		}
+	}
+
+	size_t merged = ib.ranges.size() - first_range - batches.size();
+	ib.ranges.resize(first_range);
+	ib.ranges.insert(ib.ranges.end(), batches.begin(), batches.end());
+
+	for (auto& group : groups)
+	{
+		auto it = std::upper_bound(batches.begin(), batches.end(), group.start,
+			[](size_t start, const index_range_t& batch) { return start < batch.start; });
+		group.range = it == batches.begin() ? 0 : it - batches.begin() - 1;
+	}
+	return merged;
+}
+
+const index_group_t* find_group(const std::vector<index_group_t>& groups, size_t index)
+{
+	auto it = std::upper_bound(groups.begin(), groups.end(), index,
+		[](size_t index, const index_group_t& group) { return index < group.start; });
+	while (it != groups.begin())
+	{
+		--it;
+		// empty groups share their start with the next one
+		if (index < it->start + it->size)
+			return &*it;
+		if (it->size)
+			break;
+	}
+	return nullptr;
+}
@@ -0,0 +1,112 @@
+//
+//  indexbuffer.h
+//
+//  Index arrays for drawcalls, with 16-bit indices where the vertices allow it
+//
+
+#pragma once
+#ifndef INDEXBUFFER_H
+#define INDEXBUFFER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "drawcall.h"
+
+// build 16-bit index arrays where the drawcalls fit (see build_index_buffer)
+#define MESH_USE_INDEX16
+// vertices a range of 16-bit indices can address
+#define INDEX16_MAX_VERTICES 65536
+// merge the ranges of a material into one drawcall where they allow it (see batch_index_ranges)
+#define MESH_BATCH_RANGES
+
+//
+// index ranges, representing drawcalls, within an index array;
+// ofs is added to the indices of the range when drawing (base vertex location)
+//
+struct index_range_t
+{
+	size_t start;
+	size_t size;
+	unsigned ofs;
+	int mtl_index;
+};
+
+//
+// One index array, of either 16- or 32-bit indices, and its ranges
+//
+struct index_buffer_t
+{
+	bool wide = true;				// 32-bit indices
+	std::vector<uint16_t> indices16;
+	std::vector<unsigned> indices32;
+	std::vector<index_range_t> ranges;
+
+	size_t count() const { return wide ? indices32.size() : indices16.size(); }
+	size_t index_size() const { return wide ? sizeof(unsigned) : sizeof(uint16_t); }
+	size_t bytes() const { return count() * index_size(); }
+	const void* data() const { return wide ? (const void*)indices32.data() : (const void*)indices16.data(); }
+
+	// index i of the array with the ofs of its range added, as the vertex fetch sees it
+	unsigned vertex(const index_range_t& range, size_t i) const
+	{
+		return range.ofs + (wide ? indices32[range.start + i] : indices16[range.start + i]);
+	}
+};
+
+//
+// Lay out the triangles of the drawcalls in one index array, in order, with a range per drawcall.
+//
+// If the mesh has at most max_vertices vertices, the indices are 16-bit and the ranges have
+// ofs 0. Otherwise each drawcall is rebased to the lowest vertex it uses, and drawcalls
+// spanning more than max_vertices vertices are split, at the triangle where the span would get
+// too wide, into several ranges with the same material. The indices are 32-bit, as before, if a
+// single triangle spans too many vertices or MESH_USE_INDEX16 is not defined.
+//
+// max_vertices is only lowered for testing the splitting.
+//
+void build_index_buffer(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib,
+	unsigned max_vertices = INDEX16_MAX_VERTICES);
+
+//
+// Append the triangles of further drawcalls over the same vertices, such as levels of detail,
+// to ib in the same way. A 16-bit ib is widened to 32 bits, keeping its ranges, if one of the
+// new triangles does not fit. Returns the index of the first new range.
+//
+size_t append_index_ranges(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib,
+	unsigned max_vertices = INDEX16_MAX_VERTICES);
+
+//
+// A drawcall of the OBJ (its g group and material) within the index array: its indices
+// [start, start + size), and the range drawing the first of them (a group split at the
+// vertex limit continues in the following ranges)
+//
+struct index_group_t
+{
+	std::string name;
+	int mtl_index;
+	size_t start;
+	size_t size;
+	size_t range;		// counted from first_range of batch_index_ranges
+};
+
+//
+// Merge the ranges of ib from first_range on that are adjacent in the index array and have the
+// same material, such as the drawcalls of a material in different groups, into one range each.
+// 16-bit indices are rebased to the lowest ofs of the merged ranges, which is only done while
+// they span at most max_vertices vertices; 32-bit ranges are always merged.
+//
+// drawcalls are those the ranges were made from, in order. groups gets one entry per drawcall,
+// for finding the group of a triangle after merging (see find_group). Returns the number of
+// ranges merged away.
+//
+size_t batch_index_ranges(const std::vector<drawcall_t>& drawcalls, index_buffer_t& ib, size_t first_range,
+	std::vector<index_group_t>& groups, unsigned max_vertices = INDEX16_MAX_VERTICES);
+
+//
+// The group holding index position index (e.g. start + 3 * primitive of a picked triangle),
+// or nullptr
+//
+const index_group_t* find_group(const std::vector<index_group_t>& groups, size_t index);
+
+#endif
@@ -0,0 +1,57 @@
+//
+//  instancing.cpp
+//
+
+#include <algorithm>
+#include "instancing.h"
+#include "transforms.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define INSTANCING_SSE
+#include <xmmintrin.h>
+#endif
+
+static inline uint32_t pack_unorm8(float f)
+{
+	return (uint32_t)(std::min(std::max(f, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void pack_instances(const instance_t* instances, size_t count, instance_data_t* dst)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const mat4f& M = instances[i].ModelToWorldMatrix;
+		instance_data_t& d = dst[i];
+#ifdef INSTANCING_SSE
+		// rows from the columns, the last one dropped
+		__m128 c0 = _mm_loadu_ps(&M.col[0].x), c1 = _mm_loadu_ps(&M.col[1].x);
+		__m128 c2 = _mm_loadu_ps(&M.col[2].x), c3 = _mm_loadu_ps(&M.col[3].x);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+		_mm_storeu_ps(d.world[0], c0);
+		_mm_storeu_ps(d.world[1], c1);
+		_mm_storeu_ps(d.world[2], c2);
+#else
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 4; c++)
+				d.world[r][c] = M.col[c].vec[r];
+#endif
+		mat4f N;
+		normal_matrix(M, N);
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				d.normal[r][c] = N.col[c].vec[r];
+		const vec4f& color = instances[i].DiffuseColor;
+		d.color = pack_unorm8(color.x) | (pack_unorm8(color.y) << 8) | (pack_unorm8(color.z) << 16) | (pack_unorm8(color.w) << 24);
+	}
+}
+
+instance_t unpack_instance(const instance_data_t& data)
+{
+	instance_t instance;
+	for (int c = 0; c < 4; c++)
+		instance.ModelToWorldMatrix.col[c] = vec4f(data.world[0][c], data.world[1][c], data.world[2][c], c == 3 ? 1.0f : 0.0f);
+	instance.DiffuseColor = vec4f(
+		(data.color & 0xff) / 255.0f, ((data.color >> 8) & 0xff) / 255.0f,
+		((data.color >> 16) & 0xff) / 255.0f, (data.color >> 24) / 255.0f);
+	return instance;
+}
@@ -0,0 +1,70 @@
+//
+//  instancing.h
+//
+//  Instances of one geometry packed for a per-instance vertex stream, to draw them all
+//  with one instanced drawcall
+//
+
+#pragma once
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <vector>
+#include <cstdint>
+#include "vec\vec.h"
+#include "vec\mat.h"
+
+using namespace linalg;
+
+// instances an instance buffer holds, and so draws at most; more take several map and draw
+#define INSTANCE_BUFFER_CAPACITY 4096
+
+//
+// What instances of a geometry differ in: the transform and a tint of the diffuse texture
+//
+struct instance_t
+{
+	mat4f ModelToWorldMatrix;
+	vec4f DiffuseColor;
+};
+
+//
+// 88 bytes, as the instanced vertex shaders read it:
+//
+// world:	the upper three rows of ModelToWorldMatrix, which is affine (last row 0, 0, 0, 1)
+// normal:	the rows of the normal matrix of ModelToWorldMatrix, see normal_matrix in transforms.h,
+//			so normals stay perpendicular under non-uniform scale
+// color:	8-bit UNORM RGBA, red in the lowest byte
+//
+struct instance_data_t
+{
+	float world[3][4];
+	float normal[3][3];
+	uint32_t color;
+};
+
+//
+// Vertex input elements matching instance_data_t in input slot 1, for the VSIn of DrawTri.vs
+// and DrawTriPacked.vs compiled with INSTANCED, after the elements of the vertices
+//
+#define INSTANCE_INPUT_DESC { \
+	{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "NORMALMATRIX", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "NORMALMATRIX", 1, DXGI_FORMAT_R32G32B32_FLOAT, 1, 60, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "NORMALMATRIX", 2, DXGI_FORMAT_R32G32B32_FLOAT, 1, 72, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+	{ "INSTANCECOLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 1, 84, D3D11_INPUT_PER_INSTANCE_DATA, 1 }, \
+}
+
+//
+// Pack count instances to dst, which holds as many (e.g. a mapped instance buffer)
+//
+void pack_instances(const instance_t* instances, size_t count, instance_data_t* dst);
+
+//
+// Back to an instance_t, for testing (normal is not read)
+//
+instance_t unpack_instance(const instance_data_t& data);
+
+#endif
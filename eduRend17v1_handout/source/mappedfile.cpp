@@ -0,0 +1,160 @@
+//
+//  mappedfile.cpp
+//
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+mapped_file_t::mapped_file_t(const std::string& filename)
+{
+	if (map(filename))
+		return;
+
+	// fallback: read everything into the buffer
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		throw std::runtime_error(std::string("Failed to open ") + filename);
+
+	in.seekg(0, std::ios::end);
+	std::streamoff len = in.tellg();
+	in.seekg(0, std::ios::beg);
+
+	if (len > 0)
+	{
+		buffer.resize((size_t)len);
+		in.read(&buffer[0], buffer.size());
+		buffer.resize((size_t)in.gcount());
+	}
+	else
+	{
+		// size unknown (e.g. a pipe), read until the end
+		buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	data = buffer.size() ? &buffer[0] : nullptr;
+	size = buffer.size();
+}
+
+mapped_file_t::~mapped_file_t()
+{
+	unmap();
+}
+
+#ifdef _WIN32
+
+bool mapped_file_t::map(const std::string& filename)
+{
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &file_size) ||
+		file_size.QuadPart == 0 || (unsigned long long)file_size.QuadPart > (size_t)-1)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	data = (const char*)view;
+	size = (size_t)file_size.QuadPart;
+	mapped = true;
+	return true;
+}
+
+void mapped_file_t::release(const char* up_to)
+{
+	if (!mapped)
+		return;
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	size_t end = (size_t)(up_to - data) / si.dwPageSize * si.dwPageSize;
+	if (end <= released)
+		return;
+
+	// unlocking pages that are not locked removes them from the working set
+	VirtualUnlock((void*)(data + released), end - released);
+	released = end;
+}
+
+void mapped_file_t::unmap()
+{
+	if (!mapped)
+		return;
+	UnmapViewOfFile(data);
+	CloseHandle(mapping_handle);
+	CloseHandle(file_handle);
+	mapped = false;
+}
+
+#else
+
+bool mapped_file_t::map(const std::string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	data = (const char*)view;
+	size = (size_t)st.st_size;
+	mapped = true;
+	return true;
+}
+
+void mapped_file_t::release(const char* up_to)
+{
+	if (!mapped)
+		return;
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t end = (size_t)(up_to - data) / page_size * page_size;
+	if (end <= released)
+		return;
+
+	madvise((void*)(data + released), end - released, MADV_DONTNEED);
+	released = end;
+}
+
+void mapped_file_t::unmap()
+{
+	if (!mapped)
+		return;
+	munmap((void*)data, size);
+	mapped = false;
+}
+
+#endif
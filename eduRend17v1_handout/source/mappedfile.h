@@ -0,0 +1,53 @@
+//
+//  mappedfile.h
+//
+//  Read-only view of the contents of a whole file
+//
+
+#pragma once
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+
+//
+// The file is memory mapped when possible, so it can be parsed in place without copying
+// it line by line. Inputs that cannot be mapped (empty files, pipes, some network shares)
+// are instead read into an internal buffer in one go; data/size work the same either way.
+//
+class mapped_file_t
+{
+public:
+	const char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;	// false if the fallback buffer is used
+
+	// throws std::runtime_error if the file cannot be opened
+	mapped_file_t(const std::string& filename);
+	~mapped_file_t();
+
+	mapped_file_t(const mapped_file_t&) = delete;
+	mapped_file_t& operator = (const mapped_file_t&) = delete;
+
+	//
+	// Drop the pages before up_to from the working set when the file has been read that far,
+	// so a sequential reader of a large file only keeps a window of it resident. Pages are
+	// read back from the file if touched again. Does nothing for the fallback buffer.
+	//
+	void release(const char* up_to);
+
+private:
+	std::vector<char> buffer;
+	size_t released = 0;
+
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+	bool map(const std::string& filename);
+	void unmap();
+};
+
+#endif
@@ -0,0 +1,39 @@
+//
+//  memusage.cpp
+//
+
+#include "memusage.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef _WIN32
+
+size_t peak_memory_usage()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return pmc.PeakWorkingSetSize;
+}
+
+#else
+
+size_t peak_memory_usage()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;			// bytes
+#else
+	return (size_t)usage.ru_maxrss * 1024;	// kilobytes
+#endif
+}
+
+#endif
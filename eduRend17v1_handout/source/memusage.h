@@ -0,0 +1,19 @@
+//
+//  memusage.h
+//
+//  Memory use of the process, for reporting
+//
+
+#pragma once
+#ifndef MEMUSAGE_H
+#define MEMUSAGE_H
+
+#include <cstddef>
+
+//
+// Largest resident set (working set on Windows) of the process so far, in bytes, or 0 if
+// it cannot be queried. It never decreases, so it bounds the peak of everything loaded so far.
+//
+size_t peak_memory_usage();
+
+#endif
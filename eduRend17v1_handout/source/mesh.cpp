@@ -5,10 +5,106 @@
 //
 
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "mesh.h"
+#include "mappedfile.h"
+#include "index3map.h"
+#include "memusage.h"
+#include "bounds.h"
 
 using linalg::int3;
 
+//
+// Parse the corners of a face line (following the 'f') and add it to a drawcall
+//
+// The corner format (v, v/t, v//n or v/t/n) is given by the first corner and the remaining
+// corners must follow it. Three corners make a triangle and a fourth makes a quad, which is
+// split in two triangles if triangulate is set; anything after the fourth corner is ignored.
+//
+static void parse_face(const char* p, const char* end, bool triangulate, unwelded_drawcall_t& dc)
+{
+	int v[4], t[4] = { 0,0,0,0 }, n[4] = { 0,0,0,0 };
+	bool has_t = false, has_n = false;
+
+	// first corner decides the format
+	if (!parse_int(p, end, v[0]))
+		return;
+	if (p < end && *p == '/')
+	{
+		p++;
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (!parse_int(p, end, n[0])) return;
+			has_n = true;
+		}
+		else
+		{
+			if (!parse_int(p, end, t[0])) return;
+			has_t = true;
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (!parse_int(p, end, n[0])) return;
+				has_n = true;
+			}
+		}
+	}
+
+	auto parse_corner = [&](int i) -> bool
+	{
+		if (!parse_int(p, end, v[i]))
+			return false;
+		if (has_t)
+		{
+			if (p == end || *p++ != '/' || !parse_int(p, end, t[i]))
+				return false;
+		}
+		if (has_n)
+		{
+			// v//n has one extra slash
+			if (!has_t && (p == end || *p++ != '/'))
+				return false;
+			if (p == end || *p++ != '/' || !parse_int(p, end, n[i]))
+				return false;
+		}
+		return true;
+	};
+
+	if (!parse_corner(1) || !parse_corner(2))
+		return;
+
+	if (!parse_corner(3))
+	{
+		dc.tris.push_back({ v[0] - 1, v[1] - 1, v[2] - 1, n[0] - 1, n[1] - 1, n[2] - 1, t[0] - 1, t[1] - 1, t[2] - 1 });
+	}
+	else if (triangulate)
+	{
+		dc.tris.push_back({ v[0] - 1, v[1] - 1, v[2] - 1, n[0] - 1, n[1] - 1, n[2] - 1, t[0] - 1, t[1] - 1, t[2] - 1 });
+		dc.tris.push_back({ v[0] - 1, v[2] - 1, v[3] - 1, n[0] - 1, n[2] - 1, n[3] - 1, t[0] - 1, t[2] - 1, t[3] - 1 });
+	}
+	else
+		dc.quads.push_back({ v[0] - 1, v[1] - 1, v[2] - 1, v[3] - 1, n[0] - 1, n[1] - 1, n[2] - 1, n[3] - 1, t[0] - 1, t[1] - 1, t[2] - 1, t[3] - 1 });
+}
+
+//
+// Search the rest of a map_* line for an image file with an allowed suffix, ignoring everything else
+//
+static bool parse_mapfile(const char* p, const char* end, const std::string& key, const material_t& mtl, std::string& mapfile)
+{
+    p = skip_space(p, end);
+    if (p == end)
+        return false;
+
+    if (!find_filename_from_suffixes(std::string(p, end), ALLOWED_TEXTURE_SUFFIXES, mapfile))
+        throw std::runtime_error(std::string("Error: no allowed format found for '") + key + "' in material " + mtl.name);
+    return true;
+}
 
 void mesh_t::load_mtl(	std::string path, 
 						std::string filename, 
@@ -16,229 +112,173 @@ void mesh_t::load_mtl(	std::string path,
 {
     std::string fullpath = path+filename;
     
-    std::ifstream in(fullpath.c_str());
-    if (!in)
-        throw std::runtime_error(std::string("Failed to open ") + fullpath);
+    mapped_file_t file(fullpath);
     std::cout << "Opened " << fullpath << "\n";
     
-    std::string line;
     material_t *current_mtl = NULL;
     
-    while (getline(in, line, '\n'))
+    const char *p = file.data, *end = file.data + file.size;
+    const char *line, *line_end;
+    while (next_line(p, end, line, line_end))
     {
-        char str0[1024] = {0}, str1[1024];
+        const char *kw, *tok;
+        size_t kwlen, toklen;
         float a,b,c;
         
-		ltrim(line);
-        if (sscanf(line.c_str(), "newmtl %s", str0) == 1)
+        if (!parse_token(line, line_end, kw, kwlen))
+            continue;
+        
+        if (token_equals(kw, kwlen, "newmtl"))
         {
+            if (!parse_token(line, line_end, tok, toklen))
+                continue;
+            std::string name(tok, toklen);
+            
             // check for duplicate
-            if (mtl_hash.find(str0) != mtl_hash.end() ) printf("Warning: duplicate material '%s'\n", str0);
+            if (mtl_hash.find(name) != mtl_hash.end() ) printf("Warning: duplicate material '%s'\n", name.c_str());
             
-            mtl_hash[str0] = material_t();
-            current_mtl = &mtl_hash[str0];
-            current_mtl->name = str0;
+            mtl_hash[name] = material_t();
+            current_mtl = &mtl_hash[name];
+            current_mtl->name = name;
         }
         else if (!current_mtl)
         {
             // no parsed material so can't add any content
             continue;
         }
-        else if (sscanf(line.c_str(), "map_Kd %[^\n]", str0) == 1)
+        else if (token_equals(kw, kwlen, "map_Kd"))
         {
-            // search for the image file and ignore the rest
             std::string mapfile;
-			if (find_filename_from_suffixes(str0, ALLOWED_TEXTURE_SUFFIXES, mapfile))
+            if (parse_mapfile(line, line_end, "map_Kd", *current_mtl, mapfile))
                 current_mtl->map_Kd = path + mapfile;
-            else
-                throw std::runtime_error(std::string("Error: no allowed format found for 'map_Kd' in material ") + current_mtl->name);
-        }
-        else if (sscanf(line.c_str(), "map_bump %[^\n]", str0) == 1)
-        {
-            // search for the image file and ignore the rest
-            std::string mapfile;
-			if (find_filename_from_suffixes(str0, ALLOWED_TEXTURE_SUFFIXES, mapfile))
-                current_mtl->map_bump = path+mapfile;
-            else
-                throw std::runtime_error(std::string("Error: no allowed format found for 'map_bump' in material ") + current_mtl->name);
         }
-        else if (sscanf(line.c_str(), "bump %[^\n]", str0) == 1)
+        else if (token_equals(kw, kwlen, "map_bump") || token_equals(kw, kwlen, "bump"))
         {
-            // search for the image file and ignore the rest
             std::string mapfile;
-			if (find_filename_from_suffixes(str0, ALLOWED_TEXTURE_SUFFIXES, mapfile))
-                current_mtl->map_bump = path+mapfile;
-            else
-                throw std::runtime_error(std::string("Error: no allowed format found for 'bump' in material ") + current_mtl->name);
+            if (parse_mapfile(line, line_end, std::string(kw, kwlen), *current_mtl, mapfile))
+                current_mtl->map_bump = path + mapfile;
         }
-        else if (sscanf(line.c_str(), "Ka %f %f %f", &a, &b, &c) == 3)
+        else if (token_equals(kw, kwlen, "Ka"))
         {
-            current_mtl->Ka = vec3f(a, b, c);
+            if (parse_float(line, line_end, a) && parse_float(line, line_end, b) && parse_float(line, line_end, c))
+                current_mtl->Ka = vec3f(a, b, c);
         }
-        else if (sscanf(line.c_str(), "Kd %f %f %f", &a, &b, &c) == 3)
+        else if (token_equals(kw, kwlen, "Kd"))
         {
-            current_mtl->Kd = vec3f(a, b, c);
+            if (parse_float(line, line_end, a) && parse_float(line, line_end, b) && parse_float(line, line_end, c))
+                current_mtl->Kd = vec3f(a, b, c);
         }
-        else if (sscanf(line.c_str(), "Ks %f %f %f", &a, &b, &c) == 3)
+        else if (token_equals(kw, kwlen, "Ks"))
         {
-            current_mtl->Ks = vec3f(a, b, c);
+            if (parse_float(line, line_end, a) && parse_float(line, line_end, b) && parse_float(line, line_end, c))
+                current_mtl->Ks = vec3f(a, b, c);
         }
     }
-    in.close();
 }
 
-void mesh_t::load_obj(const std::string& filename,
-	bool auto_generate_normals,
-	bool triangulate)
+//
+// Raw OBJ data parsed from a range of whole lines
+//
+// Position, normal and texel indices in faces are global (1-based) and are kept as-is, so
+// chunks only need to be appended in order. The usemtl/g/mtllib state and the skinning
+// offsets however depend on what precedes the chunk, so those lines are recorded as
+// events and resolved when the chunks are stitched together.
+//
+struct obj_event_t
 {
-	std::string parentdir = get_parentdir(filename);
-
-	std::ifstream in(filename.c_str());
-	if (!in) throw std::runtime_error(std::string("Failed to open ") + filename);
-	std::cout << "Opened " << filename << "\n";
+	enum { USEMTL, GROUP, MTLLIB, VERTEX } type;
+	int vertex;			// VERTEX: chunk-local index of the first 3D vertex after the chunk start or a usemtl
+	std::string name;	// GROUP, MTLLIB
+};
 
-	// raw data from obj
-	std::vector<vec3f> file_vertices, file_normals;
-	std::vector<vec2f> file_texcoords;
-	std::vector<unwelded_drawcall_t> file_drawcalls;
-	mtl_hash_t file_materials;
+struct obj_chunk_t
+{
+	std::vector<vec3f> vertices, normals;
+	std::vector<vec2f> texcoords;
+	unwelded_drawcall_t leading;					// faces before the first usemtl of the chunk
+	std::vector<unwelded_drawcall_t> drawcalls;		// one per usemtl; group_name and v_ofs are set when stitching
+	std::vector<obj_event_t> events;
+};
 
-	std::string current_group_name;
-	unwelded_drawcall_t default_drawcall;
-	unwelded_drawcall_t* current_drawcall = &default_drawcall;
-	int last_ofs = 0; bool face_section = false; // info for skin weight mapping
+static void parse_obj_chunk(const char* next, const char* chunk_end, bool triangulate, obj_chunk_t& chunk)
+{
+	unwelded_drawcall_t* current_drawcall = &chunk.leading;
+	bool vertex_pending = true;
 
-	std::string line;
-	while (getline(in, line))
+	const char *p, *end;
+	while (next_line(next, chunk_end, p, end))
 	{
+		const char* kw = p;
+		while (p < end && !is_space(*p)) p++;
+		size_t kwlen = p - kw;
+
 		float x, y, z;
-		int a[3], b[3], c[3], d[3];
-		char str[1024];
+		const char* tok;
+		size_t toklen;
 
-		// material file
-		//
-		if (sscanf(line.c_str(), "mtllib %s", str) == 1)
-		{
-			load_mtl(parentdir, str, file_materials);
-		}
-		// active material
-		//
-		else if (sscanf(line.c_str(), "usemtl %s", str) == 1)
-		{
-			unwelded_drawcall_t udc;
-			udc.mtl_name = str;
-			udc.group_name = current_group_name;
-			udc.v_ofs = last_ofs; face_section = true; // skinning: set current vertex offset and mark beginning of a face-section
-			file_drawcalls.push_back(udc);
-			current_drawcall = &file_drawcalls.back();
-		}
-		else if (sscanf(line.c_str(), "g %s", str) == 1)
+		if (kwlen == 1 && kw[0] == 'f')
 		{
-			current_group_name = str;
+			parse_face(p, end, triangulate, *current_drawcall);
 		}
-		// 3D vertex
+		// 3D/2D vertex
 		//
-		else if (sscanf(line.c_str(), "v %f %f %f", &x, &y, &z) == 3)
+		else if (kwlen == 1 && kw[0] == 'v')
 		{
-			// update vertex offset and mark end to a face section
-			if (face_section) {
-				last_ofs = file_vertices.size();
-				face_section = false;
-			}
+			if (!parse_float(p, end, x) || !parse_float(p, end, y))
+				continue;
 
-			file_vertices.push_back(vec3f(x, y, z));
-		}
-		// 2D vertex
-		//
-		else if (sscanf(line.c_str(), "v %f %f", &x, &y) == 2)
-		{
-			file_vertices.push_back(vec3f(x, y, 0.0f));
-		}
-		// 3D texel (not supported: ignore last component)
-		//
-		else if (sscanf(line.c_str(), "vt %f %f %f", &x, &y, &z) == 3)
-		{
-			file_texcoords.push_back(vec2f(x, 1 - y));
-		}
-		// 2D texel
-		//
-		else if (sscanf(line.c_str(), "vt %f %f", &x, &y) == 2)
-		{
-			file_texcoords.push_back(vec2f(x, 1 - y));
-		}
-		// normal
-		//
-		else if (sscanf(line.c_str(), "vn %f %f %f", &x, &y, &z) == 3)
-		{
-			file_normals.push_back(vec3f(x, y, z));
-		}
-		// face: 4x vertex
-		//
-		else if (sscanf(line.c_str(), "f %d %d %d %d", &a[0], &b[0], &c[0], &d[0]) == 4)
-		{
-			if (triangulate) {
-				current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, -1, -1, -1, -1, -1, -1 });
-				current_drawcall->tris.push_back({ a[0] - 1, c[0] - 1, d[0] - 1, -1, -1, -1, -1, -1, -1 });
-			}
-			else
-				current_drawcall->quads.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, d[0] - 1, -1, -1, -1, -1, -1, -1, -1, -1 });
-		}
-		// face: 3x vertex
-		//
-		else if (sscanf(line.c_str(), "f %d %d %d", &a[0], &b[0], &c[0]) == 3)
-		{
-			current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, -1, -1, -1, -1, -1, -1 });
-		}
-		// face: 4x vertex/texel (triangulate)
-		//
-		else if (sscanf(line.c_str(), "f %d/%d %d/%d %d/%d %d/%d", &a[0], &a[1], &b[0], &b[1], &c[0], &c[1], &d[0], &d[1]) == 8)
-		{
-			if (triangulate) {
-				current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, -1, -1, -1, a[1] - 1, b[1] - 1, c[1] - 1 });
-				current_drawcall->tris.push_back({ a[0] - 1, c[0] - 1, d[0] - 1, -1, -1, -1, a[1] - 1, c[1] - 1, d[1] - 1 });
+			if (parse_float(p, end, z))
+			{
+				// may update vertex offset and mark end to a face section
+				if (vertex_pending) {
+					chunk.events.push_back({ obj_event_t::VERTEX, (int)chunk.vertices.size() });
+					vertex_pending = false;
+				}
+
+				chunk.vertices.push_back(vec3f(x, y, z));
 			}
 			else
-				current_drawcall->quads.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, d[0] - 1, -1, -1, -1, -1, a[1] - 1, b[1] - 1, c[1] - 1, d[1] - 1 });
+				chunk.vertices.push_back(vec3f(x, y, 0.0f));
 		}
-		// face: 3x vertex/texel
+		// 2D/3D texel (3D not supported: ignore last component)
 		//
-		else if (sscanf(line.c_str(), "f %d/%d %d/%d %d/%d", &a[0], &a[1], &b[0], &b[1], &c[0], &c[1]) == 6)
+		else if (kwlen == 2 && kw[0] == 'v' && kw[1] == 't')
 		{
-			current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, -1, -1, -1, a[1] - 1, b[1] - 1, c[1] - 1 });
+			if (parse_float(p, end, x) && parse_float(p, end, y))
+				chunk.texcoords.push_back(vec2f(x, 1 - y));
 		}
-		// face: 4x vertex//normal (triangulate)
+		// normal
 		//
-		else if (sscanf(line.c_str(), "f %d//%d %d//%d %d//%d %d//%d", &a[0], &a[1], &b[0], &b[1], &c[0], &c[1], &d[0], &d[1]) == 8)
+		else if (kwlen == 2 && kw[0] == 'v' && kw[1] == 'n')
 		{
-			if (triangulate) {
-				current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, a[1] - 1, b[1] - 1, c[1] - 1, -1, -1, -1 });
-				current_drawcall->tris.push_back({ a[0] - 1, c[0] - 1, d[0] - 1, a[1] - 1, c[1] - 1, d[1] - 1, -1, -1, -1 });
-			}
-			else
-				current_drawcall->quads.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, d[0] - 1, a[2] - 1, b[2] - 1, c[2] - 1, d[2] - 1, -1, -1, -1, -1 });
+			if (parse_float(p, end, x) && parse_float(p, end, y) && parse_float(p, end, z))
+				chunk.normals.push_back(vec3f(x, y, z));
 		}
-		// face: 3x vertex//normal
-		//
-		else if (sscanf(line.c_str(), "f %d//%d %d//%d %d//%d", &a[0], &a[1], &b[0], &b[1], &c[0], &c[1]) == 6)
+		else if (kwlen == 1 && kw[0] == 'g')
 		{
-			current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, a[1] - 1, b[1] - 1, c[1] - 1, -1, -1, -1 });
+			if (parse_token(p, end, tok, toklen))
+				chunk.events.push_back({ obj_event_t::GROUP, 0, std::string(tok, toklen) });
 		}
-		// face: 4x vertex/texel/normal (triangulate)
+		// active material
 		//
-		else if (sscanf(line.c_str(), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d", &a[0], &a[1], &a[2], &b[0], &b[1], &b[2], &c[0], &c[1], &c[2], &d[0], &d[1], &d[2]) == 12)
+		else if (token_equals(kw, kwlen, "usemtl"))
 		{
-			if (triangulate) {
-				current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, a[2] - 1, b[2] - 1, c[2] - 1, a[1] - 1, b[1] - 1, c[1] - 1 });
-				current_drawcall->tris.push_back({ a[0] - 1, c[0] - 1, d[0] - 1, a[2] - 1, c[2] - 1, d[2] - 1, a[1] - 1, c[1] - 1, d[1] - 1 });
-			}
-			else
-				current_drawcall->quads.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, d[0] - 1, a[2] - 1, b[2] - 1, c[2] - 1, d[2] - 1, a[1] - 1, b[1] - 1, c[1] - 1, d[1] - 1 });
+			if (!parse_token(p, end, tok, toklen))
+				continue;
+
+			unwelded_drawcall_t udc;
+			udc.mtl_name.assign(tok, toklen);
+			chunk.drawcalls.push_back(udc);
+			chunk.events.push_back({ obj_event_t::USEMTL, 0 });
+			current_drawcall = &chunk.drawcalls.back();
+			vertex_pending = true;
 		}
-		// face: 3x vertex/texel/normal
+		// material file
 		//
-		else if (sscanf(line.c_str(), "f %d/%d/%d %d/%d/%d %d/%d/%d", &a[0], &a[1], &a[2], &b[0], &b[1], &b[2], &c[0], &c[1], &c[2]) == 9)
+		else if (token_equals(kw, kwlen, "mtllib"))
 		{
-			current_drawcall->tris.push_back({ a[0] - 1, b[0] - 1, c[0] - 1, a[2] - 1, b[2] - 1, c[2] - 1, a[1] - 1, b[1] - 1, c[1] - 1 });
+			if (parse_token(p, end, tok, toklen))
+				chunk.events.push_back({ obj_event_t::MTLLIB, 0, std::string(tok, toklen) });
 		}
 		// unknown obj syntax
 		//
@@ -247,7 +287,177 @@ void mesh_t::load_obj(const std::string& filename,
 
 		}
 	}
-	in.close();
+}
+
+template<class T>
+static void append(std::vector<T>& dst, std::vector<T>& src)
+{
+	if (dst.empty())
+		dst.swap(src);
+	else
+		dst.insert(dst.end(), src.begin(), src.end());
+}
+
+//
+// Index of the welded vertex for an OBJ (position, normal, texcoord) triple, appending it to vertices if new
+//
+static unsigned weld_corner(index3_map_t& index3_to_index, const int3& i3,
+	const std::vector<vec3f>& file_vertices, const std::vector<vec3f>& file_normals, const std::vector<vec2f>& file_texcoords,
+	std::vector<vertex_t>& vertices)
+{
+	bool inserted;
+	unsigned index = index3_to_index.find_or_insert(i3, (unsigned)vertices.size(), inserted);
+	if (inserted)
+	{
+		// index-combo did not exist, create it
+		vertex_t v;
+		v.Pos = file_vertices[i3.x];
+		if (i3.y > -1) v.Normal = file_normals[i3.y];
+		if (i3.z > -1) v.TexCoord = file_texcoords[i3.z];
+
+		vertices.push_back(v);
+	}
+	return index;
+}
+
+//
+// Index of a material in materials, adding it from file_materials on first use. -1 for no material.
+//
+static int resolve_material(const std::string& mtl_name, const mtl_hash_t& file_materials,
+	std::unordered_map<std::string, unsigned>& mtl_to_index_hash, std::vector<material_t>& materials)
+{
+	// mtl string is empty, use empty index
+	if (!mtl_name.size())
+		return -1;
+
+	//
+	// is material added to main vector?
+	auto mtl_index = mtl_to_index_hash.find(mtl_name);
+	if (mtl_index != mtl_to_index_hash.end())
+		return mtl_index->second;
+
+	auto mtl = file_materials.find(mtl_name);
+	if (mtl == file_materials.end())
+		throw std::runtime_error(std::string("Error: used material ") + mtl_name + " not found\n");
+
+	mtl_to_index_hash[mtl_name] = (unsigned)materials.size();
+	materials.push_back(mtl->second);
+	return (int)materials.size() - 1;
+}
+
+template<class T>
+static size_t heap_size(const std::vector<T>& v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+template<class DC>
+static size_t heap_size_faces(const DC& dc)
+{
+	return heap_size(dc.tris) + heap_size(dc.quads);
+}
+
+void mesh_t::load_obj(const std::string& filename,
+	bool auto_generate_normals,
+	bool triangulate,
+	unsigned nbr_threads)
+{
+	std::string parentdir = get_parentdir(filename);
+	generated_normals = auto_generate_normals;
+	triangulated = triangulate;
+
+	mapped_file_t file(filename);
+	std::cout << "Opened " << filename << (file.mapped ? " (mapped)" : "") << "\n";
+
+	peak_load_memory = 0;
+	if (file.size >= MESH_STREAM_MIN_SIZE)
+	{
+		stream_obj(file, parentdir, auto_generate_normals, triangulate);
+		return;
+	}
+
+	// raw data from obj
+	std::vector<vec3f> file_vertices, file_normals;
+	std::vector<vec2f> file_texcoords;
+	std::vector<unwelded_drawcall_t> file_drawcalls;
+	mtl_hash_t file_materials;
+
+	size_t file_size = file.size;
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	// split the file at line breaks, into chunks of at least MESH_PARSE_MIN_CHUNK bytes
+	if (!nbr_threads)
+		nbr_threads = std::max(1u, std::thread::hardware_concurrency());
+	nbr_threads = (unsigned)std::max<size_t>(1, std::min<size_t>(nbr_threads, file_size / MESH_PARSE_MIN_CHUNK));
+
+	std::vector<obj_chunk_t> chunks(nbr_threads);
+	std::vector<const char*> bounds(nbr_threads + 1);
+	const char* file_end = file.data + file_size;
+	bounds[0] = file.data;
+	bounds[nbr_threads] = file_end;
+	for (unsigned i = 1; i < nbr_threads; i++)
+	{
+		const char* b = std::max(bounds[i - 1], file.data + file_size / nbr_threads * i);
+		const char* nl = b < file_end ? (const char*)memchr(b, '\n', file_end - b) : nullptr;
+		bounds[i] = nl ? nl + 1 : file_end;
+	}
+
+	// parse chunks, the first one on this thread
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < nbr_threads; i++)
+		workers.push_back(std::thread(parse_obj_chunk, bounds[i], bounds[i + 1], triangulate, std::ref(chunks[i])));
+	parse_obj_chunk(bounds[0], bounds[1], triangulate, chunks[0]);
+	for (auto& w : workers)
+		w.join();
+
+	// stitch chunks in file order, replaying the usemtl/g/mtllib state
+	std::string current_group_name;
+	unwelded_drawcall_t default_drawcall;
+	unwelded_drawcall_t* current_drawcall = &default_drawcall;
+	int last_ofs = 0; bool face_section = false; // info for skin weight mapping
+
+	for (auto& chunk : chunks)
+	{
+		int vertex_base = (int)file_vertices.size();
+
+		append(current_drawcall->tris, chunk.leading.tris);
+		append(current_drawcall->quads, chunk.leading.quads);
+
+		auto udc = chunk.drawcalls.begin();
+		for (auto& e : chunk.events)
+		{
+			switch (e.type)
+			{
+			case obj_event_t::MTLLIB:
+				load_mtl(parentdir, e.name, file_materials);
+				mtl_files.push_back(parentdir + e.name);
+				break;
+			case obj_event_t::GROUP:
+				current_group_name = e.name;
+				break;
+			case obj_event_t::USEMTL:
+				udc->group_name = current_group_name;
+				udc->v_ofs = last_ofs; face_section = true; // skinning: set current vertex offset and mark beginning of a face-section
+				file_drawcalls.push_back(std::move(*udc++));
+				current_drawcall = &file_drawcalls.back();
+				break;
+			case obj_event_t::VERTEX:
+				// update vertex offset and mark end to a face section
+				if (face_section) {
+					last_ofs = vertex_base + e.vertex;
+					face_section = false;
+				}
+				break;
+			}
+		}
+
+		append(file_vertices, chunk.vertices);
+		append(file_normals, chunk.normals);
+		append(file_texcoords, chunk.texcoords);
+	}
+
+	double parse_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+	printf("Parsed %.2f MB in %.1f ms (%.1f MB/s, %u threads)\n", file_size / 1048576.0, parse_ms, file_size / 1048576.0 / (parse_ms / 1000.0), nbr_threads);
 
 	// use defualt drawcall if no instance of usemtl
 	if (!file_drawcalls.size())
@@ -272,47 +482,23 @@ void mesh_t::load_obj(const std::string& filename,
 #if 1
 	printf("Welding vertex array...");
 
-	std::unordered_map<std::string, unsigned> mtl_to_index_hash;
+	auto t_weld = std::chrono::high_resolution_clock::now();
 
-	// hash function for int3
-	struct int3_hashfunction {
-		std::size_t operator () (const int3& i3) const {
-			return i3.x;
-		}
-	};
+	std::unordered_map<std::string, unsigned> mtl_to_index_hash;
 
 	for (auto &dc : file_drawcalls)
 	{
 		drawcall_t wdc;
 		wdc.group_name = dc.group_name;
+		wdc.tris.reserve(dc.tris.size());
+		wdc.quads.reserve(dc.quads.size());
 
-		std::unordered_map<int3, unsigned, int3_hashfunction> index3_to_index_hash;
+		// most corners are shared, so expect at most half of them to be unique
+		index3_map_t index3_to_index((dc.tris.size() * 3 + dc.quads.size() * 4) / 2);
 
 		// material
 		//
-		if (dc.mtl_name.size())
-		{
-			//
-			// is material added to main vector?
-			auto mtl_index = mtl_to_index_hash.find(dc.mtl_name);
-			if (mtl_index == mtl_to_index_hash.end())
-			{
-				auto mtl = file_materials.find(dc.mtl_name);
-
-				if (mtl == file_materials.end())
-					throw std::runtime_error(std::string("Error: used material ") + dc.mtl_name + " not found\n");
-
-				wdc.mtl_index = (unsigned)materials.size();
-				mtl_to_index_hash[dc.mtl_name] = (unsigned)materials.size();
-
-				materials.push_back(mtl->second);
-			}
-			else
-				wdc.mtl_index = mtl_index->second;;
-		}
-		else
-			// mtl string is empty, use empty index
-			wdc.mtl_index = -1;
+		wdc.mtl_index = resolve_material(dc.mtl_name, file_materials, mtl_to_index_hash, materials);
 
 		// weld vertices from triangles
 		//
@@ -323,26 +509,7 @@ void mesh_t::load_obj(const std::string& filename,
 			for (int i = 0; i < 3; i++)
 			{
 				int3 i3 = { tri.vi[0 + i], tri.vi[3 + i], tri.vi[6 + i] };
-
-				auto s = index3_to_index_hash.find(i3);
-				if (s == index3_to_index_hash.end())
-				{
-					// index-combo does not exist, create it
-					vertex_t v;
-					v.Pos = file_vertices[i3.x];
-					if (i3.y > -1) v.Normal = file_normals[i3.y];
-					if (i3.z > -1) v.TexCoord = file_texcoords[i3.z];
-
-					wtri.vi[i] = (unsigned)vertices.size();
-					index3_to_index_hash[i3] = (unsigned)(vertices.size());
-
-					vertices.push_back(v);
-				}
-				else
-				{
-					// use existing index-combo
-					wtri.vi[i] = s->second;
-				}
+				wtri.vi[i] = weld_corner(index3_to_index, i3, file_vertices, file_normals, file_texcoords, vertices);
 			}
 			wdc.tris.push_back(wtri);
 		}
@@ -356,36 +523,42 @@ void mesh_t::load_obj(const std::string& filename,
 
 			for (int i = 0; i < 4; i++)
 			{
-				int3 i3 = { quad.vi[0 + i], quad.vi[3 + i], quad.vi[6 + i] };
-
-				auto s = index3_to_index_hash.find(i3);
-				if (s == index3_to_index_hash.end())
-				{
-					// index-combo does not exist, create it
-					vertex_t v;
-					v.Pos = file_vertices[i3.x];
-					if (i3.y > -1) v.Normal = file_normals[i3.y];
-					if (i3.z > -1) v.TexCoord = file_texcoords[i3.z];
-
-					wquad.vi[i] = (unsigned)vertices.size();
-					index3_to_index_hash[i3] = (unsigned)(vertices.size());
-
-					vertices.push_back(v);
-				}
-				else
-				{
-					// use existing index-combo
-					wquad.vi[i] = s->second;
-				}
+				int3 i3 = { quad.vi[0 + i], quad.vi[4 + i], quad.vi[8 + i] };
+				wquad.vi[i] = weld_corner(index3_to_index, i3, file_vertices, file_normals, file_texcoords, vertices);
 			}
 			wdc.quads.push_back(wquad);
 		}
 #endif
 
-		drawcalls.push_back(wdc);
+		peak_load_memory = std::max(peak_load_memory, index3_to_index.bytes());
+		drawcalls.push_back(std::move(wdc));
 	}
-	printf("Done\n");
+	double weld_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_weld).count();
+	printf("Done (%.1f ms)\n", weld_ms);
 
+	// everything is still alive at this point, plus the largest weld table from above
+	size_t load_memory = heap_size(file_vertices) + heap_size(file_normals) + heap_size(file_texcoords) + heap_size(vertices);
+	for (auto& chunk : chunks)
+	{
+		load_memory += heap_size(chunk.vertices) + heap_size(chunk.normals) + heap_size(chunk.texcoords) + heap_size_faces(chunk.leading);
+		for (auto& dc : chunk.drawcalls)
+			load_memory += heap_size_faces(dc);
+	}
+	for (auto& dc : file_drawcalls)
+		load_memory += heap_size_faces(dc);
+	for (auto& dc : drawcalls)
+		load_memory += heap_size_faces(dc);
+	peak_load_memory += load_memory;
+
+	finish_load();
+#endif
+}
+
+//
+// Stats, winding and drawcall order of a welded mesh
+//
+void mesh_t::finish_load()
+{
 	// Produce and print some stats
 	//
 	int tris = 0, quads = 0;
@@ -420,6 +593,902 @@ void mesh_t::load_obj(const std::string& filename,
     std::sort(drawcalls.begin(), drawcalls.end());
 	printf("Sorted drawcalls\n");
 #endif
-    
+
+	vertex_cache_before = vertex_cache_after = vertex_cache_stats_t();
+	for (auto& dc : drawcalls)
+		vertex_cache_before += analyze_vertex_cache(dc.tris);
+	vertex_cache_after = vertex_cache_before;
+
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+	// Triangle order per drawcall, then vertex order following it
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (auto& dc : drawcalls)
+		optimize_vertex_cache(dc.tris);
+	optimize_vertex_fetch(vertices, drawcalls);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	vertex_cache_after = vertex_cache_stats_t();
+	for (auto& dc : drawcalls)
+		vertex_cache_after += analyze_vertex_cache(dc.tris);
+	printf("Optimized vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%.1f ms)\n",
+		vertex_cache_before.acmr(), vertex_cache_after.acmr(), vertex_cache_before.atvr(), vertex_cache_after.atvr(), ms);
+#endif
+
+#ifdef MESH_GENERATE_LODS
+	generate_lods();
+#endif
+
+#ifdef MESH_BUILD_MESHLETS
+	build_meshlets();
+#endif
+
+	printf("Peak load memory %.1f MB (process peak %.1f MB)\n", peak_load_memory / 1048576.0, peak_memory_usage() / 1048576.0);
+}
+
+void mesh_t::generate_lods(unsigned max_lods, float ratio)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (auto& dc : drawcalls)
+	{
+		dc.lods.clear();
+		simplify_lods(vertices, dc.tris, dc.lods, max_lods, ratio);
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+		for (auto& lod : dc.lods)
+			optimize_vertex_cache(lod.tris);
 #endif
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	// errors relative to the size of the mesh
+	bounds_t bounds = compute_bounds(vertices);
+	float size = (bounds.box.max - bounds.box.min).norm2();
+
+	size_t full = 0;
+	for (auto& dc : drawcalls)
+		full += dc.tris.size();
+	printf("Generated %u LODs (%.1f ms)\n", lod_count(), ms);
+	for (unsigned level = 1; level <= lod_count(); level++)
+	{
+		size_t tris = 0;
+		for (auto& dc : lod_drawcalls(level))
+			tris += dc.tris.size();
+		float error = lod_error(level);
+		printf("\tLOD %u: %d triangles (%.1f%%), error %g (%.3f%% of size)\n", level, (int)tris,
+			full ? 100.0 * tris / full : 0.0, error, size > 0 ? 100 * error / size : 0.0f);
+	}
+}
+
+void mesh_t::build_meshlets()
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	size_t nbr_meshlets = 0, nbr_vertices = 0, nbr_tris = 0;
+	for (auto& dc : drawcalls)
+	{
+		::build_meshlets(vertices, dc);
+		nbr_meshlets += dc.meshlets.size();
+		nbr_vertices += dc.meshlet_vertices.size();
+		nbr_tris += dc.meshlet_indices.size() / 3;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	printf("Built %d meshlets, %.1f vertices and %.1f triangles on average (%.1f ms)\n", (int)nbr_meshlets,
+		nbr_meshlets ? (double)nbr_vertices / nbr_meshlets : 0.0, nbr_meshlets ? (double)nbr_tris / nbr_meshlets : 0.0, ms);
+}
+
+unsigned mesh_t::lod_count() const
+{
+	size_t n = 0;
+	for (auto& dc : drawcalls)
+		n = std::max(n, dc.lods.size());
+	return (unsigned)n;
+}
+
+std::vector<drawcall_t> mesh_t::lod_drawcalls(unsigned level) const
+{
+	std::vector<drawcall_t> lod_dcs;
+	lod_dcs.reserve(drawcalls.size());
+	for (auto& dc : drawcalls)
+	{
+		drawcall_t lod_dc;
+		lod_dc.group_name = dc.group_name;
+		lod_dc.mtl_index = dc.mtl_index;
+		if (level && dc.lods.size())
+			lod_dc.tris = dc.lods[std::min((size_t)level, dc.lods.size()) - 1].tris;
+		else
+			lod_dc.tris = dc.tris;
+		lod_dcs.push_back(lod_dc);
+	}
+	return lod_dcs;
+}
+
+float mesh_t::lod_error(unsigned level) const
+{
+	float error = 0;
+	for (auto& dc : drawcalls)
+		if (level && dc.lods.size())
+			error = std::max(error, dc.lods[std::min((size_t)level, dc.lods.size()) - 1].error);
+	return error;
+}
+
+void mesh_t::load_obj_streaming(const std::string& filename,
+	bool auto_generate_normals,
+	bool triangulate)
+{
+	generated_normals = auto_generate_normals;
+	triangulated = triangulate;
+	mapped_file_t file(filename);
+	std::cout << "Opened " << filename << (file.mapped ? " (mapped)" : "") << "\n";
+
+	stream_obj(file, get_parentdir(filename), auto_generate_normals, triangulate);
+}
+
+//
+// Follows the usemtl/g/mtllib handling of parse_obj_chunk and the stitching in load_obj, but
+// welds the triangles of each drawcall as soon as they are parsed. Quads are kept until the
+// drawcall ends so that they are welded after its triangles, as load_obj does, and the faces
+// before the first usemtl are kept since load_obj only uses them if there is no usemtl at all.
+// Materials are resolved at the end, when all MTL files have been loaded.
+//
+void mesh_t::stream_obj(mapped_file_t& file, const std::string& parentdir, bool auto_generate_normals, bool triangulate)
+{
+	// raw data from obj
+	std::vector<vec3f> file_vertices, file_normals;
+	std::vector<vec2f> file_texcoords;
+	mtl_hash_t file_materials;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	peak_load_memory = 0;
+
+	std::string current_group_name;
+	unwelded_drawcall_t default_drawcall;
+	unwelded_drawcall_t faces;					// faces of the current line, and quads of the current drawcall
+	std::vector<std::string> mtl_names;			// material of each welded drawcall
+	std::vector<unsigned> vertex_positions;	// file position of each welded vertex, for auto-generated normals
+	index3_map_t index3_to_index(0);
+	bool has_usemtl = false;
+
+	// vi holds the position, normal and texcoord indices of the corners, in that order
+	auto weld = [&](const int* vi, int corners, unsigned* wvi)
+	{
+		for (int i = 0; i < corners; i++)
+		{
+			int3 i3 = { vi[0 + i], vi[corners + i], vi[2 * corners + i] };
+			size_t nbr_vertices = vertices.size();
+			wvi[i] = weld_corner(index3_to_index, i3, file_vertices, file_normals, file_texcoords, vertices);
+			if (vertices.size() > nbr_vertices)
+				vertex_positions.push_back(i3.x);
+		}
+	};
+
+	auto load_memory = [&]()
+	{
+		size_t bytes = heap_size(file_vertices) + heap_size(file_normals) + heap_size(file_texcoords) +
+			heap_size(vertices) + heap_size(vertex_positions) + index3_to_index.bytes() +
+			heap_size_faces(default_drawcall) + heap_size_faces(faces);
+		for (auto& dc : drawcalls)
+			bytes += heap_size_faces(dc);
+		return bytes;
+	};
+
+	// weld the pending quads of the current drawcall
+	auto end_drawcall = [&]()
+	{
+		drawcall_t& wdc = drawcalls.back();
+		for (auto& quad : faces.quads)
+		{
+			quad_t_ wquad;
+			weld(quad.vi, 4, wquad.vi);
+			wdc.quads.push_back(wquad);
+		}
+		peak_load_memory = std::max(peak_load_memory, load_memory());
+		std::vector<unwelded_quad_t>().swap(faces.quads);
+		index3_to_index = index3_map_t(0);
+	};
+
+	const char* next = file.data;
+	const char* file_end = file.data + file.size;
+	size_t release_at = 2 * (size_t)MESH_STREAM_WINDOW;
+	const char *p, *end;
+	while (next_line(next, file_end, p, end))
+	{
+		// drop what is more than a window behind, once per window
+		if ((size_t)(next - file.data) >= release_at)
+		{
+			file.release(next - MESH_STREAM_WINDOW);
+			release_at = (next - file.data) + MESH_STREAM_WINDOW;
+		}
+
+		const char* kw = p;
+		while (p < end && !is_space(*p)) p++;
+		size_t kwlen = p - kw;
+
+		float x, y, z;
+		const char* tok;
+		size_t toklen;
+
+		if (kwlen == 1 && kw[0] == 'f')
+		{
+			if (!has_usemtl)
+			{
+				parse_face(p, end, triangulate, default_drawcall);
+				continue;
+			}
+
+			parse_face(p, end, triangulate, faces);
+			for (auto& tri : faces.tris)
+			{
+				triangle_t wtri;
+				weld(tri.vi, 3, wtri.vi);
+				drawcalls.back().tris.push_back(wtri);
+			}
+			faces.tris.clear();
+		}
+		// 3D/2D vertex
+		//
+		else if (kwlen == 1 && kw[0] == 'v')
+		{
+			if (!parse_float(p, end, x) || !parse_float(p, end, y))
+				continue;
+
+			if (parse_float(p, end, z))
+				file_vertices.push_back(vec3f(x, y, z));
+			else
+				file_vertices.push_back(vec3f(x, y, 0.0f));
+		}
+		// 2D/3D texel (3D not supported: ignore last component)
+		//
+		else if (kwlen == 2 && kw[0] == 'v' && kw[1] == 't')
+		{
+			if (parse_float(p, end, x) && parse_float(p, end, y))
+				file_texcoords.push_back(vec2f(x, 1 - y));
+		}
+		// normal
+		//
+		else if (kwlen == 2 && kw[0] == 'v' && kw[1] == 'n')
+		{
+			if (parse_float(p, end, x) && parse_float(p, end, y) && parse_float(p, end, z))
+				file_normals.push_back(vec3f(x, y, z));
+		}
+		else if (kwlen == 1 && kw[0] == 'g')
+		{
+			if (parse_token(p, end, tok, toklen))
+				current_group_name.assign(tok, toklen);
+		}
+		// active material
+		//
+		else if (token_equals(kw, kwlen, "usemtl"))
+		{
+			if (!parse_token(p, end, tok, toklen))
+				continue;
+
+			if (has_usemtl)
+				end_drawcall();
+			else
+				// faces before the first usemtl are not used
+				default_drawcall = unwelded_drawcall_t();
+			has_usemtl = true;
+
+			drawcall_t wdc;
+			wdc.group_name = current_group_name;
+			drawcalls.push_back(std::move(wdc));
+			mtl_names.push_back(std::string(tok, toklen));
+			index3_to_index = index3_map_t(1024);
+		}
+		// material file
+		//
+		else if (token_equals(kw, kwlen, "mtllib"))
+		{
+			if (parse_token(p, end, tok, toklen))
+			{
+				std::string name(tok, toklen);
+				load_mtl(parentdir, name, file_materials);
+				mtl_files.push_back(parentdir + name);
+			}
+		}
+	}
+
+	if (has_usemtl)
+		end_drawcall();
+	else
+	{
+		// use default drawcall if no instance of usemtl
+		drawcall_t wdc;
+		drawcalls.push_back(std::move(wdc));
+		mtl_names.push_back("");
+		index3_to_index = index3_map_t((default_drawcall.tris.size() * 3 + default_drawcall.quads.size() * 4) / 2);
+		for (auto& tri : default_drawcall.tris)
+		{
+			triangle_t wtri;
+			weld(tri.vi, 3, wtri.vi);
+			drawcalls.back().tris.push_back(wtri);
+		}
+		faces.quads.swap(default_drawcall.quads);
+		end_drawcall();
+		default_drawcall = unwelded_drawcall_t();
+	}
+
+	double parse_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+	printf("Parsed and welded %.2f MB in %.1f ms (%.1f MB/s, streaming)\n", file.size / 1048576.0, parse_ms, file.size / 1048576.0 / (parse_ms / 1000.0));
+
+	has_normals = (bool)file_normals.size();
+	has_texcoords = (bool)file_texcoords.size();
+
+	printf("Loaded:\n\t%d vertices\n\t%d texels\n\t%d normals\n\t%d drawcalls\n",
+		(int)file_vertices.size(), (int)file_texcoords.size(), (int)file_normals.size(), (int)drawcalls.size());
+
+	std::unordered_map<std::string, unsigned> mtl_to_index_hash;
+	for (size_t i = 0; i < drawcalls.size(); i++)
+		drawcalls[i].mtl_index = resolve_material(mtl_names[i], file_materials, mtl_to_index_hash, materials);
+
+#if 1
+	// auto-generate normals, one per position as in compute_normals
+	if (!has_normals && auto_generate_normals)
+	{
+		std::vector<int> position_tris;
+		for (auto& dc : drawcalls)
+			position_tris.reserve(position_tris.capacity() + dc.tris.size() * 3);
+		for (auto& dc : drawcalls)
+			for (auto& tri : dc.tris)
+				for (int i = 0; i < 3; i++)
+					position_tris.push_back(vertex_positions[tri.vi[i]]);
+
+		std::vector<vec3f> position_normals;
+		normal_accumulator_t accumulator(file_vertices, MESH_NORMAL_WEIGHTING, 0);
+		accumulator.add(position_tris.data(), position_tris.size() / 3, 3);
+		accumulator.compute(position_normals);
+
+		for (auto& dc : drawcalls)
+			for (auto& tri : dc.tris)
+				for (int i = 0; i < 3; i++)
+					vertices[tri.vi[i]].Normal = position_normals[vertex_positions[tri.vi[i]]];
+
+		has_normals = true;
+		printf("Auto-generated %d normals\n", (int)position_normals.size());
+	}
+#endif
+
+	finish_load();
+}
+
+//
+// Weld the index triples of every drawcall with the old std::unordered_map (which hashed on the
+// position index only) and with index3_map_t, check that both give the same indices and report
+// the best time of each. Only the face indices are parsed, nothing else is built.
+//
+bool mesh_t::benchmark_welding(const std::string& filename)
+{
+	mapped_file_t file(filename);
+	obj_chunk_t chunk;
+	parse_obj_chunk(file.data, file.data + file.size, true, chunk);
+
+	std::vector<unwelded_drawcall_t*> dcs;
+	dcs.push_back(&chunk.leading);
+	for (auto& dc : chunk.drawcalls)
+		dcs.push_back(&dc);
+
+	// corner keys of each drawcall, in welding order
+	std::vector<std::vector<int3>> keys;
+	size_t nbr_keys = 0;
+	for (auto dc : dcs)
+	{
+		std::vector<int3> k;
+		k.reserve(dc->tris.size() * 3 + dc->quads.size() * 4);
+		for (auto& tri : dc->tris)
+			for (int i = 0; i < 3; i++)
+				k.push_back({ tri.vi[0 + i], tri.vi[3 + i], tri.vi[6 + i] });
+		for (auto& quad : dc->quads)
+			for (int i = 0; i < 4; i++)
+				k.push_back({ quad.vi[0 + i], quad.vi[4 + i], quad.vi[8 + i] });
+		nbr_keys += k.size();
+		keys.push_back(std::move(k));
+	}
+
+	struct int3_hashfunction {
+		std::size_t operator () (const int3& i3) const {
+			return i3.x;
+		}
+	};
+
+	std::vector<unsigned> legacy_indices, flat_indices;
+	double legacy_ms = 1e30, flat_ms = 1e30;
+	unsigned nbr_vertices = 0;
+
+	for (int run = 0; run < 5; run++)
+	{
+		legacy_indices.clear();
+		flat_indices.clear();
+		legacy_indices.reserve(nbr_keys);
+		flat_indices.reserve(nbr_keys);
+
+		auto t0 = std::chrono::high_resolution_clock::now();
+		nbr_vertices = 0;
+		for (auto& k : keys)
+		{
+			std::unordered_map<int3, unsigned, int3_hashfunction> index3_to_index_hash;
+			for (auto& i3 : k)
+			{
+				auto s = index3_to_index_hash.find(i3);
+				if (s == index3_to_index_hash.end())
+				{
+					index3_to_index_hash[i3] = nbr_vertices;
+					legacy_indices.push_back(nbr_vertices++);
+				}
+				else
+					legacy_indices.push_back(s->second);
+			}
+		}
+		auto t1 = std::chrono::high_resolution_clock::now();
+		nbr_vertices = 0;
+		for (auto& k : keys)
+		{
+			index3_map_t index3_to_index(k.size() / 2);
+			for (auto& i3 : k)
+			{
+				bool inserted;
+				flat_indices.push_back(index3_to_index.find_or_insert(i3, nbr_vertices, inserted));
+				if (inserted)
+					nbr_vertices++;
+			}
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		legacy_ms = std::min(legacy_ms, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		flat_ms = std::min(flat_ms, std::chrono::duration<double, std::milli>(t2 - t1).count());
+	}
+
+	printf("Welding %s: %d corners -> %d vertices, unordered_map %.1f ms, index3_map_t %.1f ms (%.1fx)%s\n",
+		filename.c_str(), (int)nbr_keys, (int)nbr_vertices, legacy_ms, flat_ms,
+		flat_ms > 0 ? legacy_ms / flat_ms : 0.0,
+		legacy_indices == flat_indices ? "" : ", RESULTS DIFFER");
+	return legacy_indices == flat_indices;
+}
+
+//
+// Generate normals for the positions and triangles of a file with the old per-vertex binning
+// and with normal_accumulator_t, and report the best time of each. Uniform weighting on one
+// thread should reproduce the binning exactly; for area weighting, the largest deviation of
+// the multithreaded result from the single-threaded one is reported.
+//
+bool mesh_t::benchmark_normals(const std::string& filename)
+{
+	mapped_file_t file(filename);
+	obj_chunk_t chunk;
+	parse_obj_chunk(file.data, file.data + file.size, true, chunk);
+
+	std::vector<unwelded_drawcall_t*> dcs;
+	dcs.push_back(&chunk.leading);
+	for (auto& dc : chunk.drawcalls)
+		dcs.push_back(&dc);
+	const std::vector<vec3f>& v = chunk.vertices;
+
+	size_t nbr_tris = 0;
+	for (auto dc : dcs)
+		nbr_tris += dc->tris.size();
+
+	auto best_of = [](const std::function<void()>& f)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			auto t0 = std::chrono::high_resolution_clock::now();
+			f();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+		}
+		return best;
+	};
+
+	std::vector<vec3f> binned;
+	double binned_ms = best_of([&]()
+	{
+		binned.clear();
+		std::vector<vec3f> *v_bin = new std::vector<vec3f>[v.size()];
+		for (auto dc : dcs)
+			for (auto& tri : dc->tris)
+			{
+				int a = tri.vi[0], b = tri.vi[1], c = tri.vi[2];
+				vec3f n = linalg::normalize((v[b]-v[a])%(v[c]-v[a]));
+				v_bin[a].push_back(n);
+				v_bin[b].push_back(n);
+				v_bin[c].push_back(n);
+			}
+		for (size_t i = 0; i < v.size(); i++)
+		{
+			vec3f n = vec3f(0,0,0);
+			for (size_t j = 0; j < v_bin[i].size(); j++)
+				n += v_bin[i][j];
+			binned.push_back(linalg::normalize(n));
+		}
+		delete[] v_bin;
+	});
+
+	auto accumulate = [&](normal_weighting_t weighting, unsigned nbr_threads, std::vector<vec3f>& normals, unsigned& used_threads)
+	{
+		return best_of([&]()
+		{
+			normal_accumulator_t accumulator(v, weighting, nbr_threads);
+			for (auto dc : dcs)
+				if (dc->tris.size())
+					accumulator.add(dc->tris[0].vi, dc->tris.size(), sizeof(unwelded_triangle_t) / sizeof(int));
+			accumulator.compute(normals);
+			used_threads = accumulator.threads_used();
+		});
+	};
+
+	std::vector<vec3f> uniform, area, area_mt, angle;
+	unsigned threads, mt_threads;
+	double uniform_ms = accumulate(NORMAL_WEIGHT_UNIFORM, 1, uniform, threads);
+	double area_ms = accumulate(NORMAL_WEIGHT_AREA, 1, area, threads);
+	double angle_ms = accumulate(NORMAL_WEIGHT_ANGLE, 1, angle, threads);
+	double area_mt_ms = accumulate(NORMAL_WEIGHT_AREA, std::max(4u, std::thread::hardware_concurrency()), area_mt, mt_threads);
+
+	bool uniform_same = true;
+	for (size_t i = 0; i < v.size(); i++)
+		if (!(binned[i] == uniform[i]))
+			uniform_same = false;
+
+	float max_deviation = 0;
+	for (size_t i = 0; i < v.size(); i++)
+		max_deviation = std::max(max_deviation, (area[i] - area_mt[i]).norm2());
+
+	printf("Normals %s: %d positions, %d triangles\n", filename.c_str(), (int)v.size(), (int)nbr_tris);
+	printf("\tbinned %.2f ms, uniform %.2f ms (%s), area %.2f ms, angle %.2f ms\n",
+		binned_ms, uniform_ms, uniform_same ? "identical" : "DIFFERS", area_ms, angle_ms);
+	printf("\tarea on %u threads %.2f ms, max deviation %g\n", mt_threads, area_mt_ms, max_deviation);
+	return uniform_same;
+}
+
+//
+// Binary mesh cache
+//
+// All values are stored in native byte order:
+//
+//	char[8] magic, uint32 version, uint32 sizeof(vertex_t), uint64 key
+//	uint32 has_normals, uint32 has_texcoords
+//	uint32 count, count x string: MTL files
+//	uint32 count, count x vertex_t
+//	uint32 count, count x { string group_name, int32 mtl_index, uint32 n, n x triangle_t, uint32 n, n x quad_t_,
+//		uint32 count, count x { float error, uint32 n, n x triangle_t },
+//		uint32 n, n x meshlet_t, uint32 n, n x uint32 meshlet vertex, uint32 n, n x uint8 meshlet index }
+//	uint32 count, count x { string name, map_Kd, map_bump, map_cube, vec3f Ka, Kd, Ks }
+//
+// where a string is a uint32 length followed by its characters.
+//
+static const char mesh_cache_magic[8] = { 'E','D','U','M','E','S','H','\0' };
+
+//
+// 64-bit hash of a byte range, eight bytes at a time
+//
+static uint64_t hash_bytes(const char* data, size_t size, uint64_t h)
+{
+	const uint64_t m = 0x9E3779B97F4A7C15ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * m;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++)
+		h = (h ^ (unsigned char)data[i]) * m;
+	return h ^ (h >> 32);
+}
+
+//
+// What a cached mesh depends on besides its source files: the options it was loaded with and
+// the compile-time options of finish_load
+//
+static uint64_t hash_load_config(bool auto_generate_normals, bool triangulate)
+{
+	uint32_t flags = (auto_generate_normals ? 1 : 0) | (triangulate ? 2 : 0);
+#ifdef MESH_FORCE_CCW
+	flags |= 4;
+#endif
+#ifdef MESH_SORT_DRAWCALLS
+	flags |= 8;
+#endif
+#ifdef MESH_OPTIMIZE_VERTEX_CACHE
+	flags |= 16;
+#endif
+#ifdef MESH_GENERATE_LODS
+	flags |= 32;
+#endif
+#ifdef MESH_BUILD_MESHLETS
+	flags |= 64;
+#endif
+	float lod_ratios[] = { MESH_LOD_RATIO, SIMPLIFY_MAX_LEVEL_RATIO };
+	uint32_t config[] = { MESH_CACHE_VERSION, flags, (uint32_t)MESH_NORMAL_WEIGHTING, VERTEX_CACHE_LRU_SIZE, MESH_LOD_COUNT,
+		MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES };
+	uint64_t h = hash_bytes((const char*)config, sizeof(config), 0);
+	return hash_bytes((const char*)lod_ratios, sizeof(lod_ratios), h);
+}
+
+//
+// Key of a set of source files from their sizes, modification times and contents, and of the
+// load config (see hash_load_config)
+//
+static uint64_t hash_source_files(const std::string& objfile, const std::vector<std::string>& mtl_files, uint64_t config)
+{
+	uint64_t h = config;
+
+	std::vector<std::string> files(1, objfile);
+	files.insert(files.end(), mtl_files.begin(), mtl_files.end());
+	for (auto& f : files)
+	{
+		struct stat st;
+		if (stat(f.c_str(), &st))
+			return 0;
+		h = hash_bytes((const char*)&st.st_size, sizeof(st.st_size), h);
+		h = hash_bytes((const char*)&st.st_mtime, sizeof(st.st_mtime), h);
+
+		mapped_file_t file(f);
+		h = hash_bytes(file.data, file.size, h);
+	}
+	return h;
+}
+
+//
+// Bounds-checked reads from a mapped cache
+//
+struct cache_reader_t
+{
+	const char *p, *end;
+
+	bool read(void* dst, size_t size)
+	{
+		if ((size_t)(end - p) < size)
+			return false;
+		memcpy(dst, p, size);
+		p += size;
+		return true;
+	}
+
+	bool read(uint32_t& u) { return read(&u, sizeof(u)); }
+
+	// a count of records of at least min_size bytes each, which must all fit in what is left
+	bool read_count(uint32_t& n, size_t min_size)
+	{
+		return read(n) && (size_t)(end - p) / min_size >= n;
+	}
+
+	bool read(std::string& str)
+	{
+		uint32_t len;
+		if (!read(len) || (size_t)(end - p) < len)
+			return false;
+		str.assign(p, len);
+		p += len;
+		return true;
+	}
+
+	template<class T>
+	bool read(std::vector<T>& vec)
+	{
+		uint32_t n;
+		if (!read(n) || (size_t)(end - p) / sizeof(T) < n)
+			return false;
+		vec.resize(n);
+		return !n || read(&vec[0], n * sizeof(T));
+	}
+};
+
+//
+// Whether every index of a cached mesh is in range: the vertices of triangles, quads and LODs,
+// the materials of drawcalls, and the vertices and triangles of meshlets, whose local indices
+// must be below their vertex counts
+//
+static bool cache_indices_valid(const std::vector<vertex_t>& vertices, const std::vector<drawcall_t>& drawcalls,
+	const std::vector<material_t>& materials)
+{
+	size_t nbr_vertices = vertices.size();
+	auto tris_valid = [nbr_vertices](const std::vector<triangle_t>& tris)
+	{
+		for (auto& tri : tris)
+			if (tri.vi[0] >= nbr_vertices || tri.vi[1] >= nbr_vertices || tri.vi[2] >= nbr_vertices)
+				return false;
+		return true;
+	};
+
+	for (auto& dc : drawcalls)
+	{
+		if (dc.mtl_index < -1 || dc.mtl_index >= (int)materials.size() || !tris_valid(dc.tris))
+			return false;
+		for (auto& quad : dc.quads)
+			for (unsigned v : quad.vi)
+				if (v >= nbr_vertices)
+					return false;
+		for (auto& lod : dc.lods)
+			if (!tris_valid(lod.tris))
+				return false;
+		for (unsigned v : dc.meshlet_vertices)
+			if (v >= nbr_vertices)
+				return false;
+		for (auto& m : dc.meshlets)
+		{
+			if ((uint64_t)m.vertex_offset + m.vertex_count > dc.meshlet_vertices.size() ||
+				((uint64_t)m.triangle_offset + m.triangle_count) * 3 > dc.meshlet_indices.size())
+				return false;
+			for (size_t i = m.triangle_offset * 3; i < (m.triangle_offset + m.triangle_count) * 3; i++)
+				if (dc.meshlet_indices[i] >= m.vertex_count)
+					return false;
+		}
+	}
+	return true;
+}
+
+bool mesh_t::load_cache(const std::string& objfile, std::string cachefile, bool auto_generate_normals, bool triangulate)
+{
+	if (cachefile.empty())
+		cachefile = objfile + MESH_CACHE_SUFFIX;
+
+	struct stat st;
+	if (stat(cachefile.c_str(), &st))
+		return false;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	mapped_file_t file(cachefile);
+	cache_reader_t in = { file.data, file.data + file.size };
+
+	char magic[8];
+	uint32_t version, vertex_size, has_n, has_t;
+	uint64_t key;
+	std::vector<std::string> c_mtl_files;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, mesh_cache_magic, sizeof(magic)) ||
+		!in.read(version) || version != MESH_CACHE_VERSION ||
+		!in.read(vertex_size) || vertex_size != sizeof(vertex_t) ||
+		!in.read(&key, sizeof(key)) || !in.read(has_n) || !in.read(has_t))
+		return false;
+
+	uint32_t n;
+	if (!in.read_count(n, sizeof(uint32_t)))
+		return false;
+	c_mtl_files.resize(n);
+	for (auto& f : c_mtl_files)
+		if (!in.read(f))
+			return false;
+
+	if (key != hash_source_files(objfile, c_mtl_files, hash_load_config(auto_generate_normals, triangulate)))
+	{
+		printf("Cache %s is stale\n", cachefile.c_str());
+		return false;
+	}
+
+	std::vector<vertex_t> c_vertices;
+	std::vector<drawcall_t> c_drawcalls;
+	std::vector<material_t> c_materials;
+
+	// a drawcall holds at least its mtl_index and the counts of its name, five vectors and LODs,
+	// a LOD its error and a count, a material the counts of its four strings and three colors
+	const size_t min_drawcall = sizeof(int32_t) + 7 * sizeof(uint32_t), min_lod = sizeof(float) + sizeof(uint32_t);
+	const size_t min_material = 4 * sizeof(uint32_t) + 3 * sizeof(vec3f);
+	if (!in.read(c_vertices) || !in.read_count(n, min_drawcall))
+		return false;
+	c_drawcalls.resize(n);
+	for (auto& dc : c_drawcalls)
+	{
+		if (!in.read(dc.group_name) || !in.read(&dc.mtl_index, sizeof(dc.mtl_index)) ||
+			!in.read(dc.tris) || !in.read(dc.quads) || !in.read_count(n, min_lod))
+			return false;
+		dc.lods.resize(n);
+		for (auto& lod : dc.lods)
+			if (!in.read(&lod.error, sizeof(lod.error)) || !in.read(lod.tris))
+				return false;
+		if (!in.read(dc.meshlets) || !in.read(dc.meshlet_vertices) || !in.read(dc.meshlet_indices))
+			return false;
+	}
+
+	if (!in.read_count(n, min_material))
+		return false;
+	c_materials.resize(n);
+	for (auto& mtl : c_materials)
+	{
+		if (!in.read(mtl.name) || !in.read(mtl.map_Kd) || !in.read(mtl.map_bump) || !in.read(mtl.map_cube) ||
+			!in.read(&mtl.Ka, sizeof(vec3f)) || !in.read(&mtl.Kd, sizeof(vec3f)) || !in.read(&mtl.Ks, sizeof(vec3f)))
+			return false;
+	}
+
+	if (in.p != in.end || !cache_indices_valid(c_vertices, c_drawcalls, c_materials))
+	{
+		printf("Cache %s is corrupt\n", cachefile.c_str());
+		return false;
+	}
+
+	has_normals = has_n != 0;
+	has_texcoords = has_t != 0;
+	generated_normals = auto_generate_normals;
+	triangulated = triangulate;
+	mtl_files.swap(c_mtl_files);
+	vertices.swap(c_vertices);
+	drawcalls.swap(c_drawcalls);
+	materials.swap(c_materials);
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+	printf("Loaded cache %s (%.2f MB in %.1f ms)\n", cachefile.c_str(), file.size / 1048576.0, ms);
+	return true;
+}
+
+//
+// Write helpers for the cache
+//
+static void write_u32(std::ofstream& out, uint32_t u)
+{
+	out.write((const char*)&u, sizeof(u));
+}
+
+static void write_string(std::ofstream& out, const std::string& str)
+{
+	write_u32(out, (uint32_t)str.size());
+	out.write(str.data(), str.size());
+}
+
+template<class T>
+static void write_vector(std::ofstream& out, const std::vector<T>& vec)
+{
+	write_u32(out, (uint32_t)vec.size());
+	if (vec.size())
+		out.write((const char*)&vec[0], vec.size() * sizeof(T));
+}
+
+void mesh_t::save_cache(const std::string& objfile, std::string cachefile) const
+{
+	if (cachefile.empty())
+		cachefile = objfile + MESH_CACHE_SUFFIX;
+	uint64_t key = hash_source_files(objfile, mtl_files, hash_load_config(generated_normals, triangulated));
+	if (!key)
+		return;
+
+	std::ofstream out(cachefile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		printf("Warning: could not write cache %s\n", cachefile.c_str());
+		return;
+	}
+
+	out.write(mesh_cache_magic, sizeof(mesh_cache_magic));
+	write_u32(out, MESH_CACHE_VERSION);
+	write_u32(out, sizeof(vertex_t));
+	out.write((const char*)&key, sizeof(key));
+	write_u32(out, has_normals);
+	write_u32(out, has_texcoords);
+
+	write_u32(out, (uint32_t)mtl_files.size());
+	for (auto& f : mtl_files)
+		write_string(out, f);
+
+	write_vector(out, vertices);
+
+	write_u32(out, (uint32_t)drawcalls.size());
+	for (auto& dc : drawcalls)
+	{
+		write_string(out, dc.group_name);
+		out.write((const char*)&dc.mtl_index, sizeof(dc.mtl_index));
+		write_vector(out, dc.tris);
+		write_vector(out, dc.quads);
+		write_u32(out, (uint32_t)dc.lods.size());
+		for (auto& lod : dc.lods)
+		{
+			out.write((const char*)&lod.error, sizeof(lod.error));
+			write_vector(out, lod.tris);
+		}
+		write_vector(out, dc.meshlets);
+		write_vector(out, dc.meshlet_vertices);
+		write_vector(out, dc.meshlet_indices);
+	}
+
+	write_u32(out, (uint32_t)materials.size());
+	for (auto& mtl : materials)
+	{
+		write_string(out, mtl.name);
+		write_string(out, mtl.map_Kd);
+		write_string(out, mtl.map_bump);
+		write_string(out, mtl.map_cube);
+		out.write((const char*)&mtl.Ka, sizeof(vec3f));
+		out.write((const char*)&mtl.Kd, sizeof(vec3f));
+		out.write((const char*)&mtl.Ks, sizeof(vec3f));
+	}
+
+	if (!out)
+		printf("Warning: could not write cache %s\n", cachefile.c_str());
+	else
+		printf("Wrote cache %s\n", cachefile.c_str());
 }
@@ -16,12 +16,38 @@
 #include "vec/vec.h"
 #include "drawcall.h"
 #include "parseutil.h"
+#include "normals.h"
+#include "meshopt.h"
+#include "simplify.h"
+#include "meshlet.h"
+
+class mapped_file_t;
 
 using linalg::vec3f;
 using linalg::vec3ui;
 
 #define MESH_FORCE_CCW
 #define MESH_SORT_DRAWCALLS
+// reorder triangles and vertices of loaded meshes for the vertex cache (see meshopt.h)
+#define MESH_OPTIMIZE_VERTEX_CACHE
+// simplified levels of detail for each drawcall of loaded meshes (see mesh_t::generate_lods)
+#define MESH_GENERATE_LODS
+#define MESH_LOD_COUNT 4
+#define MESH_LOD_RATIO 0.5f
+// partition the drawcalls of loaded meshes into meshlets (see mesh_t::build_meshlets)
+//#define MESH_BUILD_MESHLETS
+// weighting of face normals in auto-generated vertex normals (see normals.h)
+#define MESH_NORMAL_WEIGHTING NORMAL_WEIGHT_AREA
+// smallest part of an OBJ file worth giving its own parsing thread
+#define MESH_PARSE_MIN_CHUNK (256*1024)
+// OBJ files at least this large are welded while they are read (see mesh_t::load_obj_streaming)
+#define MESH_STREAM_MIN_SIZE (128*1024*1024)
+// how much of a streamed OBJ file is kept resident behind the parser
+#define MESH_STREAM_WINDOW (16*1024*1024)
+// keep welded meshes in a binary cache next to the OBJ (see mesh_t::save_cache)
+#define MESH_USE_CACHE
+#define MESH_CACHE_SUFFIX ".meshcache"
+#define MESH_CACHE_VERSION 6
 // note: all these formats *should* supposedly be supported by DirectXTex ...
 #define ALLOWED_TEXTURE_SUFFIXES { "bmp", "jpg", "png", "tiff", "gif" }
 
@@ -43,40 +69,23 @@ struct unwelded_drawcall_t
 // Creates normals to a set of vertices by averaging the geometric normals of the faces they belong to
 //
 // If a model lacks normals, this function can be used to create them. Works best for relatively smooth models.
+// vn gets one normal per vertex, and the normal indices of the triangles are set to their vertex indices.
 //
-static void compute_normals(const std::vector<vec3f> &v, std::vector<vec3f> &vn, std::vector<unwelded_drawcall_t> &drawcalls)
+static void compute_normals(const std::vector<vec3f> &v, std::vector<vec3f> &vn, std::vector<unwelded_drawcall_t> &drawcalls,
+                            normal_weighting_t weighting = MESH_NORMAL_WEIGHTING, unsigned nbr_threads = 0)
 {
-    std::vector<vec3f> *v_bin = new std::vector<vec3f>[v.size()];
+    normal_accumulator_t accumulator(v, weighting, nbr_threads);
     
-    // bin normals from all faces to vertex bins
     for (unwelded_drawcall_t& dc : drawcalls)
-        for(unwelded_triangle_t& tri : dc.tris)
-        {
-            int a = tri.vi[0], b = tri.vi[1], c = tri.vi[2];
-            vec3f v0 = v[a], v1 = v[b], v2 = v[c];
-            vec3f n = linalg::normalize((v1-v0)%(v2-v0));
-            
-            v_bin[a].push_back(n);
-            v_bin[b].push_back(n);
-            v_bin[c].push_back(n);
-            
-            memcpy(tri.vi+3, tri.vi, 3*sizeof(int));
-        }
-
-    // average binned normals and add to array
-    for (int i=0; i<v.size(); i++)
     {
-        vec3f n = vec3f(0,0,0);
-        for (int j=0; j<v_bin[i].size(); j++)
-        {
-            n += v_bin[i][j];
-        }
-        n = linalg::normalize(n);
+        if (dc.tris.size())
+            accumulator.add(dc.tris[0].vi, dc.tris.size(), sizeof(unwelded_triangle_t) / sizeof(int));
         
-        vn.push_back(n);
+        for(unwelded_triangle_t& tri : dc.tris)
+            memcpy(tri.vi+3, tri.vi, 3*sizeof(int));
     }
-
-    delete[] v_bin;
+    
+    accumulator.compute(vn);
 }
 
 
@@ -93,14 +102,90 @@ public:
     std::vector<vertex_t> vertices;
     std::vector<drawcall_t> drawcalls;
     std::vector<material_t> materials;
+    std::vector<std::string> mtl_files;     // MTL files used by the OBJ
+    size_t peak_load_memory = 0;            // heap used by the last OBJ load at its peak, in bytes
+    bool generated_normals = true, triangulated = true;    // options of the last OBJ load, part of the cache key
+    vertex_cache_stats_t vertex_cache_before, vertex_cache_after;  // of the triangles of the last OBJ load
     
     static void load_mtl(	std::string dir,
 							std::string filename,
 							mtl_hash_t &mtl_hash);
     
+    //
+    // nbr_threads: number of threads to parse with, 0 = one per core.
+    // The result is the same regardless of the number of threads.
+    // Files of MESH_STREAM_MIN_SIZE bytes or more are loaded with load_obj_streaming.
+    //
     void load_obj(	const std::string& filename,
 					bool auto_generate_normals = true,
-					bool triangulate = true);
+					bool triangulate = true,
+					unsigned nbr_threads = 0);
+    
+    //
+    // Single-threaded load that welds faces as they are read, instead of first collecting
+    // every face of the file. Only the raw vertex attributes, which any later face may refer
+    // to, are kept until the end, and only MESH_STREAM_WINDOW bytes of the file stay resident.
+    // Gives the same mesh as load_obj, except for untriangulated files without normals, where
+    // triangles and quads may share welded vertices.
+    //
+    void load_obj_streaming(const std::string& filename,
+							bool auto_generate_normals = true,
+							bool triangulate = true);
+    
+    //
+    // Simplified levels of detail of the triangles of each drawcall, up to max_lods levels with
+    // about ratio times the triangles of the level before (see simplify_lods). Replaces any
+    // earlier levels and prints the triangle count and error of each level.
+    //
+    void generate_lods(unsigned max_lods = MESH_LOD_COUNT, float ratio = MESH_LOD_RATIO);
+    
+    //
+    // Number of levels of detail, the most of any drawcall, not counting the full mesh
+    //
+    unsigned lod_count() const;
+    
+    //
+    // The drawcalls with their triangles at level (1 = the first lod), or at their coarsest
+    // level for drawcalls with fewer levels, and the largest error of any of them
+    //
+    std::vector<drawcall_t> lod_drawcalls(unsigned level) const;
+    float lod_error(unsigned level) const;
+    
+    //
+    // Meshlets of the triangles of each drawcall (see meshlet.h), replacing any earlier ones.
+    // Prints their number and average size.
+    //
+    void build_meshlets();
+    
+    //
+    // Time welding of the face indices of filename with the previous and current hash maps.
+    // Returns whether both give the same indices.
+    //
+    static bool benchmark_welding(const std::string& filename);
+    
+    //
+    // Time normal generation for the positions and triangles of filename, ignoring its normals.
+    // Returns whether uniform weighting reproduces the old binning.
+    //
+    static bool benchmark_normals(const std::string& filename);
+    
+    //
+    // Binary cache of the welded mesh (vertices, drawcalls and materials)
+    //
+    // The cache is stored as objfile + MESH_CACHE_SUFFIX, unless another cachefile is given,
+    // and is keyed by the size, mtime and contents of the OBJ and its MTL files, the options
+    // of the load and the defines above that shape the mesh. load_cache returns false, leaving
+    // the mesh untouched, if there is no cache or it is stale, truncated, of another version or
+    // has a count that does not fit the file or an index out of range.
+    // save_cache keys with the options of the last load_obj.
+    //
+    bool load_cache(const std::string& objfile, std::string cachefile = "",
+                    bool auto_generate_normals = true, bool triangulate = true);
+    void save_cache(const std::string& objfile, std::string cachefile = "") const;
+
+private:
+    void stream_obj(mapped_file_t& file, const std::string& parentdir, bool auto_generate_normals, bool triangulate);
+    void finish_load();
 };
 
 #endif
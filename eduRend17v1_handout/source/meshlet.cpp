@@ -0,0 +1,186 @@
+//
+//  meshlet.cpp
+//
+
+#include <cmath>
+#include <algorithm>
+#include "meshlet.h"
+
+using namespace linalg;
+
+static const unsigned char no_slot = 0xff;
+
+//
+// Bounding sphere and normal cone of a finished meshlet
+//
+static void compute_bounds(const std::vector<vertex_t>& vertices, const drawcall_t& dc, meshlet_t& m)
+{
+	const unsigned* mv = &dc.meshlet_vertices[m.vertex_offset];
+	const uint8_t* mi = &dc.meshlet_indices[m.triangle_offset * 3];
+
+	vec3f lo = vertices[mv[0]].Pos, hi = lo;
+	for (unsigned i = 1; i < m.vertex_count; i++)
+	{
+		const vec3f& p = vertices[mv[i]].Pos;
+		for (int k = 0; k < 3; k++)
+		{
+			lo.vec[k] = std::min(lo.vec[k], p.vec[k]);
+			hi.vec[k] = std::max(hi.vec[k], p.vec[k]);
+		}
+	}
+	m.center = (lo + hi) * 0.5f;
+	m.radius = 0;
+	for (unsigned i = 0; i < m.vertex_count; i++)
+		m.radius = std::max(m.radius, (vertices[mv[i]].Pos - m.center).norm2());
+
+	// axis along the average of the unit triangle normals, cutoff from the widest of them
+	vec3f normals[MESHLET_MAX_TRIANGLES];
+	vec3f axis(0, 0, 0);
+	unsigned n = 0;
+	for (unsigned t = 0; t < m.triangle_count; t++)
+	{
+		const vec3f &p0 = vertices[mv[mi[t * 3]]].Pos, &p1 = vertices[mv[mi[t * 3 + 1]]].Pos, &p2 = vertices[mv[mi[t * 3 + 2]]].Pos;
+		vec3f nt = (p1 - p0) % (p2 - p0);
+		float len = nt.norm2();
+		if (len == 0)
+			continue;
+		normals[n] = nt * (1.0f / len);
+		axis = axis + normals[n++];
+	}
+
+	float axis_len = axis.norm2();
+	m.cone_axis = axis_len > 0 ? axis * (1.0f / axis_len) : vec3f(0, 0, 0);
+	m.cone_cutoff = 1;
+	if (!n || axis_len == 0)
+		return;
+
+	float min_dot = 1;
+	for (unsigned t = 0; t < n; t++)
+		min_dot = std::min(min_dot, dot(normals[t], m.cone_axis));
+	if (min_dot > 0.1f)
+		m.cone_cutoff = sqrtf(1 - min_dot * min_dot);
+}
+
+void build_meshlets(const std::vector<vertex_t>& vertices, drawcall_t& dc)
+{
+	dc.meshlets.clear();
+	dc.meshlet_vertices.clear();
+	dc.meshlet_indices.clear();
+
+	const std::vector<triangle_t>& tris = dc.tris;
+	size_t nbr_tris = tris.size();
+	if (!nbr_tris)
+		return;
+
+	unsigned lo = ~0u, hi = 0;
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+		{
+			lo = std::min(lo, tri.vi[k]);
+			hi = std::max(hi, tri.vi[k]);
+		}
+	size_t nbr_vertices = hi - lo + 1;
+
+	// triangles of each vertex, in drawcall order
+	std::vector<unsigned> first(nbr_vertices + 1, 0), adjacency(nbr_tris * 3);
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+			first[tri.vi[k] - lo + 1]++;
+	for (size_t v = 0; v < nbr_vertices; v++)
+		first[v + 1] += first[v];
+	{
+		std::vector<unsigned> fill(first.begin(), first.end() - 1);
+		for (size_t t = 0; t < nbr_tris; t++)
+			for (int k = 0; k < 3; k++)
+				adjacency[fill[tris[t].vi[k] - lo]++] = (unsigned)t;
+	}
+
+	std::vector<bool> used(nbr_tris, false);
+	std::vector<unsigned char> slot(nbr_vertices, no_slot);	// position in the current meshlet
+	size_t next_unused = 0;
+
+	meshlet_t m = {};
+	unsigned last = ~0u;
+
+	auto new_vertices = [&](unsigned t)
+	{
+		unsigned n = 0;
+		for (int k = 0; k < 3; k++)
+			n += slot[tris[t].vi[k] - lo] == no_slot;
+		return n;
+	};
+
+	// best unused triangle around the given vertices, or ~0u
+	auto best_around = [&](const unsigned* vs, unsigned count)
+	{
+		unsigned best = ~0u, best_new = 4;
+		for (unsigned i = 0; i < count; i++)
+		{
+			unsigned v = vs[i] - lo;
+			for (unsigned j = first[v]; j < first[v + 1]; j++)
+			{
+				unsigned t = adjacency[j];
+				if (used[t])
+					continue;
+				unsigned n = new_vertices(t);
+				if (m.vertex_count + n > MESHLET_MAX_VERTICES)
+					continue;
+				if (n < best_new || (n == best_new && t < best))
+				{
+					best = t;
+					best_new = n;
+				}
+			}
+		}
+		return best;
+	};
+
+	auto close = [&]()
+	{
+		if (!m.triangle_count)
+			return;
+		compute_bounds(vertices, dc, m);
+		dc.meshlets.push_back(m);
+		for (unsigned i = 0; i < m.vertex_count; i++)
+			slot[dc.meshlet_vertices[m.vertex_offset + i] - lo] = no_slot;
+		m = meshlet_t();
+		m.vertex_offset = (unsigned)dc.meshlet_vertices.size();
+		m.triangle_offset = (unsigned)(dc.meshlet_indices.size() / 3);
+		last = ~0u;
+	};
+
+	for (size_t emitted = 0; emitted < nbr_tris; emitted++)
+	{
+		unsigned t = ~0u;
+		if (m.triangle_count == MESHLET_MAX_TRIANGLES)
+			close();
+		if (last != ~0u)
+			t = best_around(tris[last].vi, 3);
+		if (t == ~0u && m.vertex_count)
+			t = best_around(&dc.meshlet_vertices[m.vertex_offset], m.vertex_count);
+		if (t == ~0u)
+		{
+			while (used[next_unused])
+				next_unused++;
+			t = (unsigned)next_unused;
+			if (m.vertex_count + new_vertices(t) > MESHLET_MAX_VERTICES)
+				close();
+		}
+
+		used[t] = true;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned v = tris[t].vi[k];
+			unsigned char& s = slot[v - lo];
+			if (s == no_slot)
+			{
+				s = (unsigned char)m.vertex_count++;
+				dc.meshlet_vertices.push_back(v);
+			}
+			dc.meshlet_indices.push_back(s);
+		}
+		m.triangle_count++;
+		last = t;
+	}
+	close();
+}
@@ -0,0 +1,39 @@
+//
+//  meshlet.h
+//
+//  Partitioning of drawcalls into small clusters of triangles with bounds for culling
+//
+
+#pragma once
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+#include "drawcall.h"
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+//
+// Partition the triangles of dc into dc.meshlets, replacing any earlier ones.
+//
+// Meshlets are grown greedily from the triangles in their drawcall order: the next triangle is
+// the one adding the fewest new vertices among those sharing a vertex with the last triangle
+// added, then with any triangle of the meshlet, and otherwise the first triangle not yet
+// used. A meshlet is closed when the next triangle would not fit. Ties go to the earlier
+// triangle, so the result only depends on the triangles.
+//
+void build_meshlets(const std::vector<vertex_t>& vertices, drawcall_t& dc);
+
+//
+// Is every triangle of the meshlet facing away from a camera at camera_pos?
+// The normal cone holds the geometric normals of its triangles (counter-clockwise winding):
+// axis and cutoff = sine of its half angle, or a cutoff of 1 if it is too wide to ever cull.
+//
+inline bool meshlet_backfacing(const meshlet_t& m, const vec3f& camera_pos)
+{
+	vec3f d = m.center - camera_pos;
+	return linalg::dot(d, m.cone_axis) >= m.cone_cutoff * d.norm2() + m.radius;
+}
+
+#endif
@@ -0,0 +1,224 @@
+//
+//  meshopt.cpp
+//
+
+#include <cmath>
+#include <algorithm>
+#include "meshopt.h"
+
+//
+// Index range [lo, hi] used by a drawcall; drawcalls are welded into ranges of their own,
+// so per-vertex state is kept for that range only
+//
+static void index_range(const std::vector<triangle_t>& tris, unsigned& lo, unsigned& hi)
+{
+	lo = ~0u;
+	hi = 0;
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+		{
+			lo = std::min(lo, tri.vi[k]);
+			hi = std::max(hi, tri.vi[k]);
+		}
+}
+
+vertex_cache_stats_t analyze_vertex_cache(const std::vector<triangle_t>& tris, unsigned cache_size)
+{
+	vertex_cache_stats_t stats;
+	if (tris.empty())
+		return stats;
+
+	unsigned lo, hi;
+	index_range(tris, lo, hi);
+
+	// miss number at which each vertex last entered the cache, 0 = never; with FIFO
+	// replacement it stays there for cache_size more misses
+	std::vector<size_t> entered(hi - lo + 1, 0);
+
+	stats.triangles = tris.size();
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+		{
+			size_t& e = entered[tri.vi[k] - lo];
+			if (e && stats.transforms - e < cache_size)
+				continue;
+			if (!e)
+				stats.vertices++;
+			e = ++stats.transforms;
+		}
+
+	return stats;
+}
+
+//
+// Scoring of "Linear-Speed Vertex Cache Optimisation", Tom Forsyth 2006
+//
+static const float cache_decay_power = 1.5f;
+static const float last_tri_score = 0.75f;
+static const float valence_boost_scale = 2.0f;
+static const float valence_boost_power = 0.5f;
+static const unsigned max_valence_score = 32;
+
+struct vertex_score_table_t
+{
+	float cache[VERTEX_CACHE_LRU_SIZE];
+	float valence[max_valence_score];
+
+	vertex_score_table_t()
+	{
+		for (unsigned i = 0; i < VERTEX_CACHE_LRU_SIZE; i++)
+			cache[i] = i < 3 ? last_tri_score :
+				powf(1.0f - (i - 3) * (1.0f / (VERTEX_CACHE_LRU_SIZE - 3)), cache_decay_power);
+		valence[0] = 0;
+		for (unsigned i = 1; i < max_valence_score; i++)
+			valence[i] = valence_boost_scale * powf((float)i, -valence_boost_power);
+	}
+
+	float operator () (int cache_pos, unsigned remaining) const
+	{
+		if (!remaining)
+			return -1.0f;
+		float score = cache_pos >= 0 ? cache[cache_pos] : 0;
+		return score + (remaining < max_valence_score ? valence[remaining] :
+			valence_boost_scale * powf((float)remaining, -valence_boost_power));
+	}
+};
+
+void optimize_vertex_cache(std::vector<triangle_t>& tris)
+{
+	static const vertex_score_table_t vertex_score;
+	size_t nbr_tris = tris.size();
+	if (nbr_tris < 2)
+		return;
+
+	unsigned lo, hi;
+	index_range(tris, lo, hi);
+	size_t nbr_vertices = hi - lo + 1;
+
+	// triangles of each vertex, with the ones not yet emitted first
+	std::vector<unsigned> remaining(nbr_vertices, 0), first(nbr_vertices + 1, 0), adjacency(nbr_tris * 3);
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+			remaining[tri.vi[k] - lo]++;
+	for (size_t v = 0; v < nbr_vertices; v++)
+		first[v + 1] = first[v] + remaining[v];
+	{
+		std::vector<unsigned> fill(first.begin(), first.end() - 1);
+		for (size_t t = 0; t < nbr_tris; t++)
+			for (int k = 0; k < 3; k++)
+				adjacency[fill[tris[t].vi[k] - lo]++] = (unsigned)t;
+	}
+
+	std::vector<int> cache_pos(nbr_vertices, -1);
+	std::vector<float> score(nbr_vertices);
+	for (size_t v = 0; v < nbr_vertices; v++)
+		score[v] = vertex_score(-1, remaining[v]);
+
+	std::vector<bool> emitted(nbr_tris, false);
+
+	// LRU cache, most recent first, with room for the three vertices pushed out by a triangle
+	std::vector<unsigned> cache, new_cache;
+	cache.reserve(VERTEX_CACHE_LRU_SIZE + 3);
+	new_cache.reserve(VERTEX_CACHE_LRU_SIZE + 3);
+
+	std::vector<triangle_t> ordered;
+	ordered.reserve(nbr_tris);
+	size_t best = 0, next_unemitted = 0;
+
+	while (ordered.size() < nbr_tris)
+	{
+		// nothing left around the cache: continue with the next triangle in the original order
+		if (best == ~(size_t)0)
+		{
+			while (emitted[next_unemitted])
+				next_unemitted++;
+			best = next_unemitted;
+		}
+
+		const triangle_t& tri = tris[best];
+		ordered.push_back(tri);
+		emitted[best] = true;
+
+		new_cache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned v = tri.vi[k] - lo;
+			new_cache.push_back(v);
+
+			// move the triangle past the end of the live part of the vertex's list
+			unsigned* list = &adjacency[first[v]];
+			unsigned n = remaining[v];
+			for (unsigned i = 0; i < n; i++)
+				if (list[i] == best)
+				{
+					std::swap(list[i], list[n - 1]);
+					break;
+				}
+			remaining[v]--;
+		}
+		for (unsigned v : cache)
+			if (v != new_cache[0] && v != new_cache[1] && v != new_cache[2])
+				new_cache.push_back(v);
+		cache.swap(new_cache);
+
+		// rescore the cached vertices and the ones just pushed out, and their triangles
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			unsigned v = cache[i];
+			cache_pos[v] = i < VERTEX_CACHE_LRU_SIZE ? (int)i : -1;
+			score[v] = vertex_score(cache_pos[v], remaining[v]);
+		}
+
+		best = ~(size_t)0;
+		float best_score = -1.0f;
+		for (unsigned v : cache)
+		{
+			const unsigned* list = &adjacency[first[v]];
+			for (unsigned i = 0; i < remaining[v]; i++)
+			{
+				unsigned t = list[i];
+				const triangle_t& adj = tris[t];
+				float s = score[adj.vi[0] - lo] + score[adj.vi[1] - lo] + score[adj.vi[2] - lo];
+				if (s > best_score)
+				{
+					best_score = s;
+					best = t;
+				}
+			}
+		}
+
+		if (cache.size() > VERTEX_CACHE_LRU_SIZE)
+			cache.resize(VERTEX_CACHE_LRU_SIZE);
+	}
+
+	tris.swap(ordered);
+}
+
+void optimize_vertex_fetch(std::vector<vertex_t>& vertices, std::vector<drawcall_t>& drawcalls)
+{
+	std::vector<unsigned> remap(vertices.size(), ~0u);
+	std::vector<vertex_t> ordered;
+	ordered.reserve(vertices.size());
+
+	auto renumber = [&](unsigned& vi)
+	{
+		if (remap[vi] == ~0u)
+		{
+			remap[vi] = (unsigned)ordered.size();
+			ordered.push_back(vertices[vi]);
+		}
+		vi = remap[vi];
+	};
+
+	for (auto& dc : drawcalls)
+	{
+		for (auto& tri : dc.tris)
+			for (int k = 0; k < 3; k++)
+				renumber(tri.vi[k]);
+		for (auto& quad : dc.quads)
+			for (int k = 0; k < 4; k++)
+				renumber(quad.vi[k]);
+	}
+
+	vertices.swap(ordered);
+}
@@ -0,0 +1,62 @@
+//
+//  meshopt.h
+//
+//  Reordering of welded triangles and vertices for the post-transform vertex cache
+//
+
+#pragma once
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <vector>
+#include "drawcall.h"
+
+// FIFO cache size used to measure ACMR/ATVR
+#define VERTEX_CACHE_FIFO_SIZE 16
+// LRU cache size the reordering optimizes for
+#define VERTEX_CACHE_LRU_SIZE 32
+
+//
+// Post-transform cache behaviour of a triangle list, simulated with a FIFO cache
+//
+// ACMR: average cache miss ratio, vertex shader invocations per triangle (0.5 at best for
+// large regular meshes, 3 at worst).
+// ATVR: average transform to vertex ratio, vertex shader invocations per referenced vertex
+// (1 at best).
+//
+struct vertex_cache_stats_t
+{
+	size_t triangles = 0;
+	size_t vertices = 0;		// distinct vertices referenced
+	size_t transforms = 0;		// cache misses
+
+	float acmr() const { return triangles ? (float)transforms / triangles : 0; }
+	float atvr() const { return vertices ? (float)transforms / vertices : 0; }
+
+	vertex_cache_stats_t& operator += (const vertex_cache_stats_t& s)
+	{
+		triangles += s.triangles;
+		vertices += s.vertices;
+		transforms += s.transforms;
+		return *this;
+	}
+};
+
+vertex_cache_stats_t analyze_vertex_cache(const std::vector<triangle_t>& tris, unsigned cache_size = VERTEX_CACHE_FIFO_SIZE);
+
+//
+// Reorder the triangles of one drawcall for the vertex cache, after Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation": greedily emit the triangle with the highest score,
+// where vertices score by their position in a simulated LRU cache and by how few triangles
+// are left to use them. Triangles keep their winding.
+//
+void optimize_vertex_cache(std::vector<triangle_t>& tris);
+
+//
+// Renumber vertices in the order they are first used by the triangles, then quads, of the
+// drawcalls, so that vertex fetches move forward through memory. Vertices that no triangle or
+// quad uses are removed.
+//
+void optimize_vertex_fetch(std::vector<vertex_t>& vertices, std::vector<drawcall_t>& drawcalls);
+
+#endif
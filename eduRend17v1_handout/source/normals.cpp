@@ -0,0 +1,127 @@
+//
+//  normals.cpp
+//
+
+#include <algorithm>
+#include <thread>
+#include "normals.h"
+#include "vec/math.h"
+
+using namespace linalg;
+
+normal_accumulator_t::normal_accumulator_t(const std::vector<vec3f>& positions, normal_weighting_t weighting, unsigned nbr_threads)
+	: positions(positions), weighting(weighting), nbr_threads(nbr_threads)
+{
+}
+
+void normal_accumulator_t::add(const int* indices, size_t count, size_t stride)
+{
+	if (!count)
+		return;
+	spans.push_back({ indices, count, stride });
+	nbr_tris += count;
+}
+
+//
+// Add the weighted face normals of triangles [first, last), counted over all spans
+//
+void normal_accumulator_t::scatter(size_t first, size_t last, vec3f* normals) const
+{
+	size_t span_start = 0;
+	for (auto& span : spans)
+	{
+		size_t begin = std::max(first, span_start), end = std::min(last, span_start + span.count);
+		const int* tri = span.indices + (begin - span_start) * span.stride;
+
+		for (size_t t = begin; t < end; t++, tri += span.stride)
+		{
+			int a = tri[0], b = tri[1], c = tri[2];
+			vec3f v0 = positions[a], v1 = positions[b], v2 = positions[c];
+			vec3f e1 = v1 - v0, e2 = v2 - v0;
+			vec3f n = e1 % e2;		// |n| = twice the area
+
+			switch (weighting)
+			{
+			case NORMAL_WEIGHT_UNIFORM:
+				n = normalize(n);
+				normals[a] += n;
+				normals[b] += n;
+				normals[c] += n;
+				break;
+			case NORMAL_WEIGHT_AREA:
+				normals[a] += n;
+				normals[b] += n;
+				normals[c] += n;
+				break;
+			case NORMAL_WEIGHT_ANGLE:
+			{
+				vec3f e3 = v2 - v1;
+				float l1 = e1.norm2(), l2 = e2.norm2(), l3 = e3.norm2();
+				if (l1 == 0 || l2 == 0 || l3 == 0)
+					break;
+				n = normalize(n);
+				float angle_a = acosf(std::max(-1.0f, std::min(1.0f, dot(e1, e2) / (l1 * l2))));
+				float angle_b = acosf(std::max(-1.0f, std::min(1.0f, -dot(e1, e3) / (l1 * l3))));
+				normals[a] += n * angle_a;
+				normals[b] += n * angle_b;
+				normals[c] += n * (fPI - angle_a - angle_b);
+				break;
+			}
+			}
+		}
+
+		span_start += span.count;
+		if (span_start >= last)
+			break;
+	}
+}
+
+void normal_accumulator_t::compute(std::vector<vec3f>& normals) const
+{
+	normals.assign(positions.size(), vec3f(0, 0, 0));
+
+	if (nbr_threads)
+		used_threads = (unsigned)std::max<size_t>(1, std::min<size_t>(nbr_threads, nbr_tris));
+	else
+		used_threads = (unsigned)std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), nbr_tris / NORMALS_MIN_TRIS_PER_THREAD));
+
+	// pass 1: scatter, the first range on this thread and straight into normals
+	std::vector<std::vector<vec3f>> partial(used_threads - 1);
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < used_threads; i++)
+	{
+		partial[i - 1].resize(positions.size());
+		workers.push_back(std::thread(&normal_accumulator_t::scatter, this,
+			nbr_tris * i / used_threads, nbr_tris * (i + 1) / used_threads, partial[i - 1].data()));
+	}
+	scatter(0, nbr_tris / used_threads, normals.data());
+	for (auto& w : workers)
+		w.join();
+
+	// pass 2: sum the partial arrays and normalize, over ranges of positions
+	auto normalize_range = [&](size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; i++)
+		{
+			vec3f n = normals[i];
+			for (auto& p : partial)
+				n += p[i];
+
+			// sums of unit normals that (nearly) cancel out are zeroed by normalize(), but its
+			// fixed cut-off would also zero the area-weighted sums of small models
+			float len2 = n.norm2squared();
+			if (weighting == NORMAL_WEIGHT_AREA)
+				normals[i] = len2 > 0 ? n * (1.0 / sqrt(len2)) : vec3f(0, 0, 0);
+			else
+				normals[i] = normalize(n);
+		}
+	};
+
+	workers.clear();
+	size_t nbr_positions = positions.size();
+	for (unsigned i = 1; i < used_threads; i++)
+		workers.push_back(std::thread(normalize_range, nbr_positions * i / used_threads, nbr_positions * (i + 1) / used_threads));
+	normalize_range(0, nbr_positions / used_threads);
+	for (auto& w : workers)
+		w.join();
+}
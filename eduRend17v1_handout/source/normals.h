@@ -0,0 +1,72 @@
+//
+//  normals.h
+//
+//  Smooth vertex normals from triangle geometry
+//
+
+#pragma once
+#ifndef NORMALS_H
+#define NORMALS_H
+
+#include <vector>
+#include "vec/vec.h"
+
+// smallest number of triangles worth giving their own accumulation thread
+#define NORMALS_MIN_TRIS_PER_THREAD (64*1024)
+
+//
+// How much each triangle contributes to the normals of its corners
+//
+enum normal_weighting_t
+{
+	NORMAL_WEIGHT_UNIFORM,	// unit face normal, as the old per-vertex binning did
+	NORMAL_WEIGHT_AREA,		// face normal scaled by the triangle area
+	NORMAL_WEIGHT_ANGLE		// unit face normal scaled by the corner angle
+};
+
+//
+// Accumulates weighted face normals directly into one flat array with an entry per position,
+// then normalizes them in a second pass.
+//
+// Triangles are given as spans of position indices: count triangles whose corners are
+// indices[0..2], with stride ints from one triangle to the next (3 for packed triples, 9 for
+// unwelded_triangle_t). Spans are only referenced until compute() returns.
+//
+// With more than one thread, the triangles are split evenly over the threads, each scattering
+// into its own array, and the arrays are then summed and normalized over ranges of positions.
+// The result does not depend on the order of the triangles beyond float rounding, but is only
+// bitwise reproducible for the same number of threads.
+//
+class normal_accumulator_t
+{
+public:
+	// nbr_threads: 0 = one per core, but no more than one per NORMALS_MIN_TRIS_PER_THREAD triangles
+	normal_accumulator_t(const std::vector<linalg::vec3f>& positions,
+		normal_weighting_t weighting = NORMAL_WEIGHT_AREA,
+		unsigned nbr_threads = 1);
+
+	void add(const int* indices, size_t count, size_t stride);
+
+	// normals is resized to one per position; positions in no triangle get a zero normal
+	void compute(std::vector<linalg::vec3f>& normals) const;
+
+	unsigned threads_used() const { return used_threads; }
+
+private:
+	struct span_t
+	{
+		const int* indices;
+		size_t count, stride;
+	};
+
+	const std::vector<linalg::vec3f>& positions;
+	normal_weighting_t weighting;
+	unsigned nbr_threads;
+	mutable unsigned used_threads = 1;
+	std::vector<span_t> spans;
+	size_t nbr_tris = 0;
+
+	void scatter(size_t first, size_t last, linalg::vec3f* normals) const;
+};
+
+#endif
@@ -0,0 +1,246 @@
+//
+//  occlusion.cpp
+//
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "occlusion.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define OCCLUSION_SSE
+#include <emmintrin.h>
+#endif
+
+static double ms_since(std::chrono::high_resolution_clock::time_point t0)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+void occlusion_buffer_t::clear()
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	stats = occlusion_stats_t();
+	depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+	stats.clear_ms = ms_since(t0);
+}
+
+void occlusion_buffer_t::rasterize(const mat4f& M, const vec3f* triangles, size_t triangle_count)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	const float W = OCCLUSION_WIDTH, H = OCCLUSION_HEIGHT;
+
+	for (size_t t = 0; t < triangle_count; t++)
+	{
+		// to pixels, depth in [0, 1]
+		float x[3], y[3], z[3];
+		bool near_clipped = false;
+		for (int k = 0; k < 3; k++)
+		{
+			vec4f c = M * vec4f(triangles[t * 3 + k], 1);
+			if (c.w <= 0 || c.z < -c.w)
+			{
+				near_clipped = true;
+				break;
+			}
+			float inv_w = 1.0f / c.w;
+			x[k] = (c.x * inv_w * 0.5f + 0.5f) * W;
+			y[k] = (0.5f - c.y * inv_w * 0.5f) * H;
+			z[k] = c.z * inv_w * 0.5f + 0.5f;
+		}
+		if (near_clipped)
+			continue;
+
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (fabsf(area) < 1e-6f)
+			continue;
+		if (area < 0)
+		{
+			std::swap(x[1], x[2]);
+			std::swap(y[1], y[2]);
+			std::swap(z[1], z[2]);
+			area = -area;
+		}
+
+		int x0 = std::max(0, (int)floorf(std::min(x[0], std::min(x[1], x[2]))));
+		int x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf(std::max(x[0], std::max(x[1], x[2]))));
+		int y0 = std::max(0, (int)floorf(std::min(y[0], std::min(y[1], y[2]))));
+		int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf(std::max(y[0], std::max(y[1], y[2]))));
+		if (x0 > x1 || y0 > y1)
+			continue;
+		stats.triangles++;
+
+		// edge i is opposite vertex i, e = a * px + b * py + c, positive inside
+		float a[3], b[3], c[3];
+		for (int i = 0; i < 3; i++)
+		{
+			int j = (i + 1) % 3, k = (i + 2) % 3;
+			a[i] = -(y[k] - y[j]);
+			b[i] = x[k] - x[j];
+			c[i] = -(a[i] * x[j] + b[i] * y[j]);
+		}
+		// depth from the edges, which are the barycentric weights times area, through vertex 0
+		// rather than from the c of the edges, which cancel to within rounding of the depth
+		float inv_area = 1.0f / area;
+		float za = (z[0] * a[0] + z[1] * a[1] + z[2] * a[2]) * inv_area;
+		float zb = (z[0] * b[0] + z[1] * b[1] + z[2] * b[2]) * inv_area;
+		float zc = z[0] - za * x[0] - zb * y[0];
+
+		// inner-conservative: at the center of a texel, an edge or the depth is within half
+		// a texel of its value at every corner, so the edges move in by that much and the
+		// depth out to the farthest corner
+		for (int i = 0; i < 3; i++)
+			c[i] -= 0.5f * (fabsf(a[i]) + fabsf(b[i]));
+		zc += 0.5f * (fabsf(za) + fabsf(zb));
+
+#ifdef OCCLUSION_SSE
+		x0 &= ~3;
+		const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f), zero = _mm_setzero_ps();
+		__m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]), az = _mm_set1_ps(za);
+		for (int py = y0; py <= y1; py++)
+		{
+			float cy = py + 0.5f;
+			__m128 r0 = _mm_set1_ps(b[0] * cy + c[0]), r1 = _mm_set1_ps(b[1] * cy + c[1]);
+			__m128 r2 = _mm_set1_ps(b[2] * cy + c[2]), rz = _mm_set1_ps(zb * cy + zc);
+			float* row = &depth[py * OCCLUSION_WIDTH];
+			for (int px = x0; px <= x1; px += 4)
+			{
+				__m128 cx = _mm_add_ps(_mm_set1_ps((float)px), offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, cx), r0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, cx), r1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, cx), r2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (!_mm_movemask_ps(inside))
+					continue;
+				__m128 d = _mm_loadu_ps(row + px);
+				__m128 nearer = _mm_min_ps(d, _mm_add_ps(_mm_mul_ps(az, cx), rz));
+				_mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, d)));
+			}
+		}
+#else
+		for (int py = y0; py <= y1; py++)
+		{
+			float cy = py + 0.5f;
+			float* row = &depth[py * OCCLUSION_WIDTH];
+			for (int px = x0; px <= x1; px++)
+			{
+				float cx = px + 0.5f;
+				if (a[0] * cx + b[0] * cy + c[0] < 0 || a[1] * cx + b[1] * cy + c[1] < 0 || a[2] * cx + b[2] * cy + c[2] < 0)
+					continue;
+				row[px] = std::min(row[px], za * cx + zb * cy + zc);
+			}
+		}
+#endif
+	}
+
+	stats.raster_ms += ms_since(t0);
+}
+
+void occlusion_buffer_t::build_hiz()
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	hiz.clear();
+	const float* src = depth.data();
+	int w = OCCLUSION_WIDTH, h = OCCLUSION_HEIGHT;
+	while (w > 1 && h > 1)
+	{
+		int hw = w / 2, hh = h / 2;
+		hiz.push_back(std::vector<float>(hw * hh));
+		float* dst = hiz.back().data();
+		for (int y = 0; y < hh; y++)
+			for (int x = 0; x < hw; x++)
+			{
+				const float* s = src + y * 2 * w + x * 2;
+				dst[y * hw + x] = std::max(std::max(s[0], s[1]), std::max(s[w], s[w + 1]));
+			}
+		src = dst;
+		w = hw;
+		h = hh;
+	}
+	stats.hiz_ms = ms_since(t0);
+}
+
+bool occlusion_buffer_t::box_occluded(const mat4f& M, const aabb_t& box) const
+{
+	float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f, min_z = 1e30f;
+	for (int k = 0; k < 8; k++)
+	{
+		vec3f p(k & 1 ? box.max.x : box.min.x, k & 2 ? box.max.y : box.min.y, k & 4 ? box.max.z : box.min.z);
+		vec4f c = M * vec4f(p, 1);
+		if (c.w <= 0 || c.z < -c.w)
+			return false;
+		float inv_w = 1.0f / c.w;
+		float x = (c.x * inv_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (0.5f - c.y * inv_w * 0.5f) * OCCLUSION_HEIGHT;
+		min_x = std::min(min_x, x);
+		max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y);
+		max_y = std::max(max_y, y);
+		min_z = std::min(min_z, c.z * inv_w * 0.5f + 0.5f);
+	}
+	if (max_x < 0 || max_y < 0 || min_x >= OCCLUSION_WIDTH || min_y >= OCCLUSION_HEIGHT)
+		return false;
+
+	int x0 = std::max(0, (int)floorf(min_x)), x1 = std::min(OCCLUSION_WIDTH - 1, (int)floorf(max_x));
+	int y0 = std::max(0, (int)floorf(min_y)), y1 = std::min(OCCLUSION_HEIGHT - 1, (int)floorf(max_y));
+
+	// level 0 is depth, level l > 0 is hiz[l - 1]
+	int level = 0;
+	while (level < (int)hiz.size() && ((x1 >> level) - (x0 >> level) > 2 || (y1 >> level) - (y0 >> level) > 2))
+		level++;
+	const float* texels = level ? hiz[level - 1].data() : depth.data();
+	int w = OCCLUSION_WIDTH >> level;
+
+	for (int y = y0 >> level; y <= y1 >> level; y++)
+		for (int x = x0 >> level; x <= x1 >> level; x++)
+			if (texels[y * w + x] >= min_z)
+				return false;
+	return true;
+}
+
+unsigned occlusion_buffer_t::cull_boxes(const mat4f& M, const std::vector<bounds_t>& bounds, std::vector<uint8_t>& visible)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	unsigned occluded = 0;
+	for (size_t i = 0; i < bounds.size(); i++)
+	{
+		if (!visible[i])
+			continue;
+		stats.tested++;
+		if (box_occluded(M, bounds[i].box))
+		{
+			visible[i] = 0;
+			occluded++;
+		}
+	}
+	stats.occluded += occluded;
+	stats.test_ms += ms_since(t0);
+	return occluded;
+}
+
+void select_occluders(const std::vector<vertex_t>& vertices, const index_buffer_t& ib,
+	const std::vector<index_range_t>& ranges, size_t max_triangles, std::vector<vec3f>& triangles)
+{
+	struct candidate_t { float area; unsigned v[3]; };
+	std::vector<candidate_t> candidates;
+	for (auto& range : ranges)
+		for (size_t i = 0; i + 2 < range.size; i += 3)
+		{
+			candidate_t c;
+			for (int k = 0; k < 3; k++)
+				c.v[k] = ib.vertex(range, i + k);
+			const vec3f &p0 = vertices[c.v[0]].Pos, &p1 = vertices[c.v[1]].Pos, &p2 = vertices[c.v[2]].Pos;
+			c.area = ((p1 - p0) % (p2 - p0)).norm2();
+			candidates.push_back(c);
+		}
+
+	size_t n = std::min(max_triangles, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(),
+		[](const candidate_t& a, const candidate_t& b) { return a.area > b.area; });
+
+	triangles.clear();
+	triangles.reserve(n * 3);
+	for (size_t i = 0; i < n; i++)
+		for (int k = 0; k < 3; k++)
+			triangles.push_back(vertices[candidates[i].v[k]].Pos);
+}
@@ -0,0 +1,85 @@
+//
+//  occlusion.h
+//
+//  CPU occlusion culling: large triangles rasterized into a small depth buffer, and boxes
+//  tested against its hierarchical-Z
+//
+
+#pragma once
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <vector>
+#include <cstdint>
+#include "vec\vec.h"
+#include "vec\mat.h"
+#include "indexbuffer.h"
+#include "bounds.h"
+
+// skip the drawcalls of OBJModel_t hidden behind the occluders of the frame
+#define OCCLUSION_CULL_DRAWCALLS
+
+#define OCCLUSION_WIDTH		256
+#define OCCLUSION_HEIGHT	128
+#define OCCLUSION_OCCLUDERS	1024	// largest triangles kept as occluders per model
+
+using namespace linalg;
+
+struct occlusion_stats_t
+{
+	unsigned triangles = 0;		// occluder triangles rasterized
+	unsigned tested = 0;		// boxes tested
+	unsigned occluded = 0;		// boxes found hidden
+	double clear_ms = 0, raster_ms = 0, hiz_ms = 0, test_ms = 0;
+};
+
+//
+// Depth in [0, 1] from the near to the far plane, of the GL style clip space of
+// mat4f::projection. Row 0 is the top of the screen.
+//
+struct occlusion_buffer_t
+{
+	std::vector<float> depth;				// OCCLUSION_WIDTH x OCCLUSION_HEIGHT
+	std::vector<std::vector<float>> hiz;	// farthest depth of 2x2 texels of the level above,
+											// hiz[0] half the size of depth
+	occlusion_stats_t stats;
+
+	//
+	// Set all depths to the far plane, and zero the stats
+	//
+	void clear();
+
+	//
+	// Draw triangles, three positions each, keeping the nearest depth per pixel. Pixels are
+	// covered when all of the texel is (inner-conservative), with the farthest depth of the
+	// triangle over it, so an occluder never covers more or comes nearer than it does on the
+	// screen. Four at a time with SSE where available. Triangles with a vertex in front of
+	// the near plane are skipped, both windings are drawn.
+	//
+	void rasterize(const mat4f& ModelToClip, const vec3f* triangles, size_t triangle_count);
+
+	//
+	// Build hiz from depth, after the last rasterize
+	//
+	void build_hiz();
+
+	//
+	// Is the box behind the occluders everywhere it covers? Its nearest corner is compared
+	// to the farthest depth of the texels under it, at the hiz level where it covers at most
+	// 3x3 of them. Boxes crossing the near plane are never occluded.
+	//
+	bool box_occluded(const mat4f& ModelToClip, const aabb_t& box) const;
+
+	//
+	// Clear visible[i] for visible boxes that are occluded, returns how many were
+	//
+	unsigned cull_boxes(const mat4f& ModelToClip, const std::vector<bounds_t>& bounds, std::vector<uint8_t>& visible);
+};
+
+//
+// The largest triangles of the ranges, largest first, three positions each
+//
+void select_occluders(const std::vector<vertex_t>& vertices, const index_buffer_t& ib,
+	const std::vector<index_range_t>& ranges, size_t max_triangles, std::vector<vec3f>& triangles);
+
+#endif
@@ -0,0 +1,209 @@
+//
+//  packedvertex.cpp
+//
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "packedvertex.h"
+
+using namespace linalg;
+
+static inline float sign_not_zero(float v)
+{
+	return v < 0 ? -1.0f : 1.0f;
+}
+
+static inline float snorm16_to_float(int16_t q)
+{
+	return std::max(q / 32767.0f, -1.0f);
+}
+
+static vec3f decode_octahedral_f(float x, float y)
+{
+	vec3f n(x, y, 1.0f - fabsf(x) - fabsf(y));
+	if (n.z < 0)
+	{
+		float ox = n.x;
+		n.x = (1.0f - fabsf(n.y)) * sign_not_zero(ox);
+		n.y = (1.0f - fabsf(ox)) * sign_not_zero(n.y);
+	}
+	return normalize(n);
+}
+
+//
+// Project on the octahedron |x|+|y|+|z| = 1 and fold the lower half over the upper, then
+// pick the one of the four surrounding 16-bit codes that decodes closest to n
+//
+void encode_octahedral(const vec3f& n, int16_t oct[2])
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (l1 == 0)
+	{
+		oct[0] = oct[1] = 0;
+		return;
+	}
+
+	float x = n.x / l1, y = n.y / l1;
+	if (n.z < 0)
+	{
+		float ox = x;
+		x = (1.0f - fabsf(y)) * sign_not_zero(ox);
+		y = (1.0f - fabsf(ox)) * sign_not_zero(y);
+	}
+
+	float fx = floorf(x * 32767.0f), fy = floorf(y * 32767.0f);
+	float best = -2;
+	for (int i = 0; i < 4; i++)
+	{
+		float qx = std::max(-32767.0f, std::min(32767.0f, fx + (i & 1)));
+		float qy = std::max(-32767.0f, std::min(32767.0f, fy + (i >> 1)));
+		float d = dot(decode_octahedral_f(qx / 32767.0f, qy / 32767.0f), n);
+		if (d > best)
+		{
+			best = d;
+			oct[0] = (int16_t)qx;
+			oct[1] = (int16_t)qy;
+		}
+	}
+}
+
+vec3f decode_octahedral(const int16_t oct[2])
+{
+	return decode_octahedral_f(snorm16_to_float(oct[0]), snorm16_to_float(oct[1]));
+}
+
+//
+// IEEE 754 binary16, rounding to nearest even; out of range values become infinity
+//
+uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, 4);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mag = x & 0x7fffffff;
+
+	if (mag >= 0x7f800000)				// inf or NaN
+		return (uint16_t)(sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0));
+	if (mag >= 0x477ff000)				// rounds to above the largest half
+		return (uint16_t)(sign | 0x7c00);
+	if (mag < 0x38800000)				// subnormal half or zero
+	{
+		if (mag < 0x33000000)
+			return (uint16_t)sign;
+		uint32_t m = (mag & 0x7fffff) | 0x800000;
+		int shift = 126 - (int)(mag >> 23);	// 14..24
+		uint32_t h = m >> shift;
+		uint32_t rest = m & ((1u << shift) - 1), half_way = 1u << (shift - 1);
+		if (rest > half_way || (rest == half_way && (h & 1)))
+			h++;
+		return (uint16_t)(sign | h);
+	}
+
+	// normal: rebias the exponent and round the mantissa from 23 to 10 bits
+	uint32_t h = ((mag - 0x38000000) >> 13);
+	uint32_t rest = mag & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;
+	return (uint16_t)(sign | h);
+}
+
+float half_to_float(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+	uint32_t x;
+
+	if (exp == 0x1f)
+		x = sign | 0x7f800000 | (mant << 13);
+	else if (exp)
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	else if (mant)
+	{
+		// subnormal: normalize the mantissa
+		int e = -1;
+		do { mant <<= 1; e++; } while (!(mant & 0x400));
+		x = sign | ((uint32_t)(112 - e) << 23) | ((mant & 0x3ff) << 13);
+	}
+	else
+		x = sign;
+
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+void encode_vertices(const std::vector<vertex_t>& vertices, const std::vector<float>* handedness,
+	std::vector<packed_vertex_t>& packed, packed_box_t& box)
+{
+	box = packed_box_t();
+	packed.resize(vertices.size());
+
+#ifndef MESH_PACKED_POSITION_FP32
+	if (vertices.size())
+	{
+		vec3f lo = vertices[0].Pos, hi = vertices[0].Pos;
+		for (auto& v : vertices)
+			for (int i = 0; i < 3; i++)
+			{
+				lo.vec[i] = std::min(lo.vec[i], v.Pos.vec[i]);
+				hi.vec[i] = std::max(hi.vec[i], v.Pos.vec[i]);
+			}
+		box.offset = lo;
+		box.scale = hi - lo;
+	}
+#endif
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const vertex_t& v = vertices[i];
+		packed_vertex_t& p = packed[i];
+
+		float w = handedness ? (*handedness)[i] : (dot(v.Normal % v.Tangent, v.Binormal) < 0 ? -1.0f : 1.0f);
+
+#ifdef MESH_PACKED_POSITION_FP32
+		p.pos[0] = v.Pos.x;
+		p.pos[1] = v.Pos.y;
+		p.pos[2] = v.Pos.z;
+		p.pos[3] = w < 0 ? 0.0f : 1.0f;
+#else
+		for (int j = 0; j < 3; j++)
+		{
+			float u = box.scale.vec[j] > 0 ? (v.Pos.vec[j] - box.offset.vec[j]) / box.scale.vec[j] : 0.0f;
+			p.pos[j] = (uint16_t)(std::max(0.0f, std::min(1.0f, u)) * 65535.0f + 0.5f);
+		}
+		p.pos[3] = w < 0 ? 0 : 65535;
+#endif
+
+		encode_octahedral(v.Normal, p.normal);
+		encode_octahedral(v.Tangent, p.tangent);
+		p.texcoord[0] = float_to_half(v.TexCoord.x);
+		p.texcoord[1] = float_to_half(v.TexCoord.y);
+	}
+}
+
+void decode_vertices(const std::vector<packed_vertex_t>& packed, const packed_box_t& box,
+	std::vector<vertex_t>& vertices)
+{
+	vertices.resize(packed.size());
+
+	for (size_t i = 0; i < packed.size(); i++)
+	{
+		const packed_vertex_t& p = packed[i];
+		vertex_t& v = vertices[i];
+
+#ifdef MESH_PACKED_POSITION_FP32
+		v.Pos = vec3f(p.pos[0], p.pos[1], p.pos[2]);
+		float w = p.pos[3] * 2.0f - 1.0f;
+#else
+		for (int j = 0; j < 3; j++)
+			v.Pos.vec[j] = box.offset.vec[j] + p.pos[j] / 65535.0f * box.scale.vec[j];
+		float w = p.pos[3] / 65535.0f * 2.0f - 1.0f;
+#endif
+
+		v.Normal = decode_octahedral(p.normal);
+		v.Tangent = decode_octahedral(p.tangent);
+		v.Binormal = (v.Normal % v.Tangent) * w;
+		v.TexCoord = vec2f(half_to_float(p.texcoord[0]), half_to_float(p.texcoord[1]));
+	}
+}
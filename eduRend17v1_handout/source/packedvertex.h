@@ -0,0 +1,86 @@
+//
+//  packedvertex.h
+//
+//  Compact vertex format for upload, encoded from and decoded to vertex_t
+//
+
+#pragma once
+#ifndef PACKEDVERTEX_H
+#define PACKEDVERTEX_H
+
+#include <vector>
+#include <cstdint>
+#include "drawcall.h"
+
+// upload OBJ models as packed_vertex_t and draw them with DrawTriPacked.vs
+//#define MESH_PACKED_VERTICES
+// keep positions as 32-bit floats instead of quantizing them to 16 bits in the bounding box
+//#define MESH_PACKED_POSITION_FP32
+
+//
+// 20 bytes (28 with fp32 positions) instead of the 56 of vertex_t:
+//
+// position:	16-bit UNORM in the bounding box of the mesh (see packed_box_t), or fp32
+// normal:		octahedral, 2 x 16-bit SNORM
+// tangent:		octahedral, 2 x 16-bit SNORM
+// handedness:	stored in the w of the position, 0 for -1 and 1 (all bits set) for +1;
+//				the binormal is rebuilt as cross(normal, tangent) * handedness
+// texcoord:	2 x half float
+//
+struct packed_vertex_t
+{
+#ifdef MESH_PACKED_POSITION_FP32
+	float pos[4];
+#else
+	uint16_t pos[4];
+#endif
+	int16_t normal[2];
+	int16_t tangent[2];
+	uint16_t texcoord[2];
+};
+
+//
+// Dequantization of positions: pos = offset + unorm * scale, with unorm in [0,1].
+// Identity (zero offset, unit scale) for fp32 positions.
+//
+struct packed_box_t
+{
+	vec3f offset = { 0, 0, 0 };
+	vec3f scale = { 1, 1, 1 };
+};
+
+//
+// Vertex input elements matching packed_vertex_t, for the VSIn of DrawTriPacked.vs
+//
+#ifdef MESH_PACKED_POSITION_FP32
+#define PACKED_POSITION_FORMAT DXGI_FORMAT_R32G32B32A32_FLOAT
+#define PACKED_NORMAL_OFFSET 16
+#else
+#define PACKED_POSITION_FORMAT DXGI_FORMAT_R16G16B16A16_UNORM
+#define PACKED_NORMAL_OFFSET 8
+#endif
+
+#define PACKED_VERTEX_INPUT_DESC { \
+	{ "POSITION", 0, PACKED_POSITION_FORMAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }, \
+	{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, PACKED_NORMAL_OFFSET, D3D11_INPUT_PER_VERTEX_DATA, 0 }, \
+	{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, PACKED_NORMAL_OFFSET + 4, D3D11_INPUT_PER_VERTEX_DATA, 0 }, \
+	{ "TEX", 0, DXGI_FORMAT_R16G16_FLOAT, 0, PACKED_NORMAL_OFFSET + 8, D3D11_INPUT_PER_VERTEX_DATA, 0 }, \
+}
+
+//
+// Encoding of single values
+//
+void encode_octahedral(const vec3f& n, int16_t oct[2]);
+vec3f decode_octahedral(const int16_t oct[2]);
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+//
+// handedness: per vertex, +1 or -1 (see compute_tangent_frames); nullptr to derive it from the binormal
+//
+void encode_vertices(const std::vector<vertex_t>& vertices, const std::vector<float>* handedness,
+	std::vector<packed_vertex_t>& packed, packed_box_t& box);
+void decode_vertices(const std::vector<packed_vertex_t>& packed, const packed_box_t& box,
+	std::vector<vertex_t>& vertices);
+
+#endif
@@ -11,6 +11,10 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
 
 inline std::string& rtrim(std::string& str)
 {
@@ -73,4 +77,182 @@ static bool find_filename_from_suffixes(const std::string &str, const std::vecto
 	return false;
 }
 
+//
+// single-pass tokenizing over a [p, end) character range
+//
+// These mimic the conversions of sscanf's %d, %f and %s (leading whitespace is skipped,
+// the pointer is advanced past what was consumed) without needing a null-terminated line
+//
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+inline const char* skip_space(const char* p, const char* end)
+{
+    while (p < end && is_space(*p)) p++;
+    return p;
+}
+
+//
+// get the next line of [p, end) as [line, line_end), without the line break, and move p past it
+//
+inline bool next_line(const char*& p, const char* end, const char*& line, const char*& line_end)
+{
+    if (p >= end)
+        return false;
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    line = p;
+    line_end = nl ? nl : end;
+    p = nl ? nl + 1 : end;
+    return true;
+}
+
+inline bool token_equals(const char* tok, size_t len, const char* str)
+{
+    return strlen(str) == len && !strncmp(tok, str, len);
+}
+
+//
+// read a whitespace-delimited token, as %s
+//
+inline bool parse_token(const char*& p, const char* end, const char*& tok, size_t& len)
+{
+    const char* s = skip_space(p, end);
+    const char* q = s;
+    while (q < end && !is_space(*q)) q++;
+    if (q == s)
+        return false;
+    tok = s;
+    len = q - s;
+    p = q;
+    return true;
+}
+
+inline bool parse_int(const char*& p, const char* end, int& i)
+{
+    const char* q = skip_space(p, end);
+    bool neg = false;
+    if (q < end && (*q == '+' || *q == '-'))
+        neg = (*q++ == '-');
+    if (q == end || *q < '0' || *q > '9')
+        return false;
+
+    int n = 0;
+    while (q < end && *q >= '0' && *q <= '9')
+        n = n*10 + (*q++ - '0');
+
+    i = neg ? -n : n;
+    p = q;
+    return true;
+}
+
+//
+// fallback float conversion via strtof, for anything the fast path in parse_float does not handle
+//
+inline bool parse_float_slow(const char*& p, const char* end, float& f)
+{
+    const char* s = skip_space(p, end);
+    char buf[128];
+    size_t n = 0;
+    while (s + n < end && n < sizeof(buf) - 1 && !is_space(s[n]))
+    {
+        buf[n] = s[n];
+        n++;
+    }
+    buf[n] = 0;
+
+    char* e;
+    float v = strtof(buf, &e);
+    if (e == buf)
+        return false;
+    f = v;
+    p = s + (e - buf);
+    return true;
+}
+
+//
+// read a float, as %f
+//
+// Plain decimals with at most 19 significant digits and a small exponent are converted
+// as mantissa * 10^e in a single double operation, which is exact or correctly rounded.
+// Rounding that double to float gives the correctly rounded float unless the double
+// landed exactly halfway between two floats, so that case (and inf, nan, hex, denormals
+// etc) is left to strtof. The result is therefore identical to sscanf/strtof.
+//
+inline bool parse_float(const char*& p, const char* end, float& f)
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char* s = skip_space(p, end);
+    const char* q = s;
+    bool neg = false;
+    if (q < end && (*q == '+' || *q == '-'))
+        neg = (*q++ == '-');
+
+    uint64_t mant = 0;
+    int ndigits = 0, exp10 = 0;
+    bool any = false;
+
+    // integer part
+    for (; q < end && *q >= '0' && *q <= '9'; q++)
+    {
+        any = true;
+        if (ndigits < 19) { mant = mant*10 + (*q - '0'); if (mant) ndigits++; }
+        else exp10++, ndigits++;
+    }
+    // fraction
+    if (q < end && *q == '.')
+    {
+        for (q++; q < end && *q >= '0' && *q <= '9'; q++)
+        {
+            any = true;
+            if (ndigits < 19) { mant = mant*10 + (*q - '0'); if (mant) ndigits++; exp10--; }
+            else ndigits++;
+        }
+    }
+    // inf, nan, hex and the like
+    if (!any || ndigits > 19 || (q < end && (*q == 'x' || *q == 'X')))
+        return parse_float_slow(p, end, f);
+
+    // exponent, only consumed if there are digits after the (signed) 'e'
+    if (q < end && (*q == 'e' || *q == 'E'))
+    {
+        const char* r = q + 1;
+        bool eneg = false;
+        if (r < end && (*r == '+' || *r == '-'))
+            eneg = (*r++ == '-');
+        if (r < end && *r >= '0' && *r <= '9')
+        {
+            int e = 0;
+            for (; r < end && *r >= '0' && *r <= '9'; r++)
+                if (e < 10000) e = e*10 + (*r - '0');
+            exp10 += eneg ? -e : e;
+            q = r;
+        }
+    }
+
+    if (mant == 0)
+    {
+        f = neg ? -0.0f : 0.0f;
+        p = q;
+        return true;
+    }
+    if (mant > (1ull << 53) || exp10 < -22 || exp10 > 22)
+        return parse_float_slow(p, end, f);
+
+    double d = exp10 < 0 ? (double)mant / pow10[-exp10] : (double)mant * pow10[exp10];
+
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(d));
+    if ((bits & 0x1fffffffull) == 0x10000000ull || d < FLT_MIN || d > FLT_MAX)
+        return parse_float_slow(p, end, f);
+
+    f = neg ? -(float)d : (float)d;
+    p = q;
+    return true;
+}
+
 #endif /* parseutil_h */
@@ -0,0 +1,105 @@
+//
+//  renderdevice.cpp
+//
+
+#include "renderdevice.h"
+#include "Geometry.h"
+
+d3d11_ring_buffer_t::d3d11_ring_buffer_t(ID3D11Device* device, ID3D11DeviceContext* context, size_t capacity)
+	: context(context)
+{
+	D3D11_BUFFER_DESC desc = { 0 };
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = (UINT)capacity;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	device->CreateBuffer(&desc, nullptr, &buffer);
+
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = { 0 };
+	if (SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))))
+	{
+		no_overwrite = options.MapNoOverwriteOnDynamicConstantBuffer != 0;
+		offsetting = options.ConstantBufferOffsetting != 0;
+	}
+}
+
+void* d3d11_ring_buffer_t::map(bool discard)
+{
+	D3D11_MAPPED_SUBRESOURCE resource;
+	D3D11_MAP type = discard || !no_overwrite ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+	if (FAILED(context->Map(buffer, 0, type, 0, &resource)))
+		return nullptr;
+	return resource.pData;
+}
+
+void d3d11_ring_buffer_t::unmap()
+{
+	context->Unmap(buffer, 0);
+}
+
+void d3d11_render_device_t::bind(render_state_t slot, const void* state)
+{
+	switch (slot)
+	{
+	case render_state_shader:
+	{
+		const shader_program_t* p = (const shader_program_t*)state;
+		state_cache->set_input_layout(p->input_layout);
+		state_cache->set_vertex_shader(p->vertex_shader);
+		state_cache->set_pixel_shader(p->pixel_shader);
+		break;
+	}
+	case render_state_geometry:
+	{
+		const geometry_binding_t* g = (const geometry_binding_t*)state;
+		state_cache->set_vertex_buffer(g->vertex_buffer, g->stride, 0);
+		state_cache->set_index_buffer(g->index_buffer, g->index_format, 0);
+		if (g->vs_constants)
+			state_cache->set_vs_constant_buffer(1, g->vs_constants);
+		state_cache->set_ps_sampler(0, g->sampler);
+		break;
+	}
+	case render_state_material:
+	{
+		const material_t* mtl = (const material_t*)state;
+		state_cache->set_ps_shader_resource(0, mtl->map_Kd_TexSRV);
+		state_cache->set_ps_shader_resource(1, mtl->map_bump_TexSRV);
+		state_cache->set_ps_shader_resource(2, mtl->map_cube_TexSRV);
+		break;
+	}
+	case render_state_constants:
+	{
+		const object_constants_t* c = (const object_constants_t*)state;
+		if (constant_ring)
+		{
+			// ranges in constants of 16 bytes, as allocated; the cache skips the material's
+			// until it changes
+			UINT object_count = (UINT)padded_size(sizeof(ObjectBuffer_t)) / 16;
+			state_cache->set_vs_constant_buffer(2, constant_ring, c->offset / 16, object_count);
+			state_cache->set_ps_constant_buffer(2, constant_ring, c->offset / 16, object_count);
+			state_cache->set_ps_constant_buffer(1, constant_ring, c->material->offset / 16, (UINT)padded_size(sizeof(PhongBuffer_t)) / 16);
+			break;
+		}
+		c->geometry->MapObjectBuffer(object_buffer, c->object.ModelToWorldMatrix, c->object.ModelToProjectionMatrix,
+			c->object.NormalMatrix, c->object.LightDir);
+		constant_maps++;
+		constant_bytes += sizeof(ObjectBuffer_t);
+		if (c->material != mapped_material)
+		{
+			const PhongBuffer_t& p = c->material->phong;
+			c->geometry->MapPhongBuffer(phong_buffer, p.SpecularPower, p.SpecularColor, p.AmbientColor, p.DiffuseColor, p.isSkybox);
+			mapped_material = c->material;
+			constant_maps++;
+			constant_bytes += sizeof(PhongBuffer_t);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void d3d11_render_device_t::draw_indexed(unsigned index_count, unsigned start_index, int base_vertex)
+{
+	state_cache->get_context()->DrawIndexed(index_count, start_index, base_vertex);
+}
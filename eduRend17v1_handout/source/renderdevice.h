@@ -0,0 +1,144 @@
+//
+//  renderdevice.h
+//
+//  Render queue states and their binding on a D3D11 device context
+//
+
+#pragma once
+#ifndef RENDERDEVICE_H
+#define RENDERDEVICE_H
+
+#include "stdafx.h"
+#include "vec\vec.h"
+#include "vec\mat.h"
+#include "renderqueue.h"
+#include "statecache.h"
+#include "constantring.h"
+#include "ShaderBuffers.h"
+
+using namespace linalg;
+
+class Geometry_t;
+
+//
+// render_state_shader
+//
+struct shader_program_t
+{
+	ID3D11VertexShader* vertex_shader = nullptr;
+	ID3D11PixelShader* pixel_shader = nullptr;
+	ID3D11InputLayout* input_layout = nullptr;
+};
+
+//
+// render_state_geometry: the buffers and sampler of a model
+//
+struct geometry_binding_t
+{
+	ID3D11Buffer* vertex_buffer = nullptr;
+	UINT stride = 0;
+	ID3D11Buffer* index_buffer = nullptr;
+	DXGI_FORMAT index_format = DXGI_FORMAT_R32_UINT;
+	ID3D11Buffer* vs_constants = nullptr;	// VS slot 1, if any (see DrawTriPacked.vs)
+	ID3D11SamplerState* sampler = nullptr;
+};
+
+//
+// Constants of a material, shared by the objects drawn with it. offset is where they are in a
+// constant ring, written once per frame.
+//
+struct material_constants_t
+{
+	PhongBuffer_t phong;
+	unsigned offset;
+};
+
+//
+// render_state_constants: the constants of an object and its material, mapped with the Map
+// functions of geometry, or written into a constant ring with the object at offset. The
+// FrameBuffer_t is bound by whoever submits the queue.
+//
+struct object_constants_t
+{
+	Geometry_t* geometry;
+	ObjectBuffer_t object;
+	const material_constants_t* material;
+	unsigned offset;
+};
+
+//
+// Space the constants of a frame take in a constant ring (see constant_ring_t::begin_frame)
+//
+inline size_t frame_constant_bytes(size_t materials, size_t objects)
+{
+	return padded_size(sizeof(FrameBuffer_t)) + materials * padded_size(sizeof(PhongBuffer_t)) +
+		objects * padded_size(sizeof(ObjectBuffer_t));
+}
+
+//
+// A dynamic constant buffer as the ring_buffer_t of a constant_ring_t. Continuing in a mapped
+// buffer takes D3D11_MAP_WRITE_NO_OVERWRITE on constant buffers, where the driver supports
+// it; otherwise each map discards.
+//
+class d3d11_ring_buffer_t : public ring_buffer_t
+{
+	ID3D11DeviceContext* const context;
+	ID3D11Buffer* buffer = nullptr;
+	bool no_overwrite = false;
+	bool offsetting = false;
+
+public:
+
+	d3d11_ring_buffer_t(ID3D11Device* device, ID3D11DeviceContext* context, size_t capacity);
+
+	virtual void* map(bool discard);
+	virtual void unmap();
+
+	ID3D11Buffer* get_buffer() const { return buffer; }
+
+	// whether constant buffer ranges can be bound, which drawing with the ring takes
+	bool supports_offsetting() const { return offsetting; }
+
+	virtual ~d3d11_ring_buffer_t()
+	{
+		SAFE_RELEASE(buffer);
+	}
+};
+
+//
+// render_state_material is a material_t (see drawcall.h). Binds go through a state cache,
+// which also skips what the queue could not know was bound already. Constants are mapped
+// per object into the object buffer, and into the Phong buffer when the material changes, or
+// with a constant ring bound as ranges of it at their offsets.
+//
+class d3d11_render_device_t : public render_device_t
+{
+	d3d_state_cache_t* const state_cache;
+	ID3D11Buffer* const object_buffer;
+	ID3D11Buffer* const phong_buffer;
+	ID3D11Buffer* const constant_ring;
+	const material_constants_t* mapped_material = nullptr;
+
+public:
+
+	// constant buffer maps and bytes written by bind, without a constant ring
+	unsigned constant_maps = 0;
+	size_t constant_bytes = 0;
+
+	d3d11_render_device_t(
+		d3d_state_cache_t* state_cache,
+		ID3D11Buffer* object_buffer,
+		ID3D11Buffer* phong_buffer,
+		ID3D11Buffer* constant_ring = nullptr)
+		:	state_cache(state_cache),
+			object_buffer(object_buffer),
+			phong_buffer(phong_buffer),
+			constant_ring(constant_ring)
+	{
+	}
+
+	virtual void bind(render_state_t slot, const void* state);
+	virtual void draw_indexed(unsigned index_count, unsigned start_index, int base_vertex);
+};
+
+#endif
@@ -0,0 +1,76 @@
+//
+//  renderqueue.cpp
+//
+
+#include <chrono>
+#include "renderqueue.h"
+
+void radix_sort(sort_entry_t* entries, sort_entry_t* scratch, size_t count)
+{
+	// all histograms in one pass over the keys
+	size_t histograms[8][256] = {};
+	for (size_t i = 0; i < count; i++)
+		for (int b = 0; b < 8; b++)
+			histograms[b][(entries[i].key >> (b * 8)) & 0xff]++;
+
+	sort_entry_t *src = entries, *dst = scratch;
+	for (int b = 0; b < 8; b++)
+	{
+		size_t* h = histograms[b];
+		if (count && h[(entries[0].key >> (b * 8)) & 0xff] == count)
+			continue;
+
+		size_t sum = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			size_t n = h[i];
+			h[i] = sum;
+			sum += n;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[h[(src[i].key >> (b * 8)) & 0xff]++] = src[i];
+		std::swap(src, dst);
+	}
+
+	if (src != entries)
+		std::copy(src, src + count, entries);
+}
+
+void render_queue_t::submit(render_device_t& device)
+{
+	auto t0 = std::chrono::high_resolution_clock::now();
+	stats = render_queue_stats_t();
+	stats.packets = (unsigned)packets.size();
+
+	order.resize(packets.size());
+	scratch.resize(packets.size());
+	for (size_t i = 0; i < packets.size(); i++)
+		order[i] = { packets[i].key, (unsigned)i };
+	radix_sort(order.data(), scratch.data(), order.size());
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	// nothing is known to be bound before the first packet
+	const void* bound[render_state_count] = {};
+	bool first = true;
+	for (auto& e : order)
+	{
+		const render_packet_t& p = packets[e.index];
+		for (int s = 0; s < render_state_count; s++)
+		{
+			if (!first && p.state[s] == bound[s])
+			{
+				stats.redundant++;
+				continue;
+			}
+			device.bind((render_state_t)s, p.state[s]);
+			bound[s] = p.state[s];
+			stats.binds[s]++;
+		}
+		first = false;
+		device.draw_indexed(p.index_count, p.start_index, p.base_vertex);
+	}
+
+	auto t2 = std::chrono::high_resolution_clock::now();
+	stats.sort_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	stats.submit_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
@@ -0,0 +1,113 @@
+//
+//  renderqueue.h
+//
+//  Drawcalls collected as packets with sort keys, radix sorted and submitted to a device
+//  without rebinding state that is already bound
+//
+
+#pragma once
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+//
+// Sort key, most significant first: pass (4 bits), shader (8), material (16), depth (24),
+// and 12 bits to keep e.g. the ranges of a model together. Depth is in [0, 1]; pass
+// 1 - depth for back to front.
+//
+inline uint64_t make_sort_key(unsigned pass, unsigned shader, unsigned material, float depth, unsigned low = 0)
+{
+	uint64_t d = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * 0xffffff);
+	return ((uint64_t)(pass & 0xf) << 60) | ((uint64_t)(shader & 0xff) << 52) | ((uint64_t)(material & 0xffff) << 36) |
+		(d << 12) | (low & 0xfff);
+}
+
+//
+// State a packet needs bound, as handles the device knows how to bind. Equal handles
+// are the same state.
+//
+enum render_state_t
+{
+	render_state_shader,
+	render_state_geometry,	// vertex and index buffers
+	render_state_material,	// textures
+	render_state_constants,	// per object constant buffers
+	render_state_count
+};
+
+struct render_packet_t
+{
+	uint64_t key = 0;
+	const void* state[render_state_count] = {};
+	unsigned index_count = 0;
+	unsigned start_index = 0;
+	int base_vertex = 0;
+};
+
+//
+// What a queue submits to, e.g. a D3D11 device context (see renderdevice.h) or a recording
+// stub for tests
+//
+class render_device_t
+{
+public:
+	virtual void bind(render_state_t slot, const void* state) = 0;
+	virtual void draw_indexed(unsigned index_count, unsigned start_index, int base_vertex) = 0;
+	virtual ~render_device_t() { }
+};
+
+struct render_queue_stats_t
+{
+	unsigned packets = 0;
+	unsigned binds[render_state_count] = {};
+	unsigned redundant = 0;		// binds skipped since the state was bound already
+	double sort_ms = 0, submit_ms = 0;
+};
+
+//
+// Key and packet index, sorted by key
+//
+struct sort_entry_t
+{
+	uint64_t key;
+	unsigned index;
+};
+
+//
+// Stable LSD radix sort of entries by key, a byte per pass, skipping the bytes that all
+// keys share. scratch must hold count entries.
+//
+void radix_sort(sort_entry_t* entries, sort_entry_t* scratch, size_t count);
+
+struct render_queue_t
+{
+	std::vector<render_packet_t> packets;
+	render_queue_stats_t stats;
+
+	void clear()
+	{
+		packets.clear();
+	}
+
+	void push(const render_packet_t& packet)
+	{
+		packets.push_back(packet);
+	}
+
+	//
+	// Sort the packets by key, keeping the order of equal keys, and issue them: each state
+	// is bound when it differs from the one of the packet before, then the draw
+	//
+	void submit(render_device_t& device);
+
+	// packet indices in submission order, after submit
+	std::vector<sort_entry_t> order;
+
+private:
+	std::vector<sort_entry_t> scratch;
+};
+
+#endif
@@ -0,0 +1,287 @@
+//
+//  simplify.cpp
+//
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include "simplify.h"
+
+using namespace linalg;
+
+//
+// Symmetric 4x4 quadric, sum of w * (n.p + d)^2 over planes (n, d) with weights w
+//
+struct quadric_t
+{
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0, c = 0;
+	double w = 0;
+
+	void add_plane(const vec3f& n, float d, float weight)
+	{
+		double x = n.x, y = n.y, z = n.z;
+		a00 += weight * x * x; a01 += weight * x * y; a02 += weight * x * z;
+		a11 += weight * y * y; a12 += weight * y * z; a22 += weight * z * z;
+		b0 += weight * x * d; b1 += weight * y * d; b2 += weight * z * d;
+		c += weight * d * d;
+		w += weight;
+	}
+
+	quadric_t& operator += (const quadric_t& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; w += q.w;
+		return *this;
+	}
+
+	double eval(const vec3f& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+			2 * (b0 * x + b1 * y + b2 * z) + c;
+		return std::max(e, 0.0);
+	}
+};
+
+struct collapse_t
+{
+	unsigned from, to;
+	double cost;
+
+	bool operator < (const collapse_t& c) const { return cost < c.cost; }
+};
+
+//
+// The living triangles of a drawcall in local vertex numbering, and the triangles of each vertex
+//
+struct simplify_mesh_t
+{
+	const std::vector<vertex_t>& vertices;
+	unsigned lo;
+	std::vector<unsigned> tris;		// 3 per triangle
+	std::vector<unsigned> first, adjacency;
+
+	simplify_mesh_t(const std::vector<vertex_t>& vertices, unsigned lo) : vertices(vertices), lo(lo) { }
+
+	const vec3f& pos(unsigned v) const { return vertices[lo + v].Pos; }
+
+	void build_adjacency(size_t nbr_vertices)
+	{
+		first.assign(nbr_vertices + 1, 0);
+		for (unsigned v : tris)
+			first[v + 1]++;
+		for (size_t v = 0; v < nbr_vertices; v++)
+			first[v + 1] += first[v];
+		adjacency.resize(tris.size());
+		std::vector<unsigned> fill(first.begin(), first.end() - 1);
+		for (size_t i = 0; i < tris.size(); i++)
+			adjacency[fill[tris[i]]++] = (unsigned)(i / 3);
+	}
+};
+
+//
+// Would moving from onto to turn any of its triangles not containing to over, or flatten it?
+//
+static bool flips(const simplify_mesh_t& m, unsigned from, unsigned to)
+{
+	const vec3f& p = m.pos(to);
+	for (unsigned i = m.first[from]; i < m.first[from + 1]; i++)
+	{
+		const unsigned* t = &m.tris[m.adjacency[i] * 3];
+		if (t[0] == to || t[1] == to || t[2] == to)
+			continue;
+
+		vec3f p0 = m.pos(t[0]), p1 = m.pos(t[1]), p2 = m.pos(t[2]);
+		vec3f n0 = (p1 - p0) % (p2 - p0);
+		if (t[0] == from) p0 = p;
+		if (t[1] == from) p1 = p;
+		if (t[2] == from) p2 = p;
+		vec3f n1 = (p1 - p0) % (p2 - p0);
+
+		if (dot(n0, n1) <= 1e-3f * n0.norm2() * n1.norm2())
+			return true;
+	}
+	return false;
+}
+
+void simplify_lods(const std::vector<vertex_t>& vertices, const std::vector<triangle_t>& tris,
+	std::vector<lod_t>& lods, unsigned max_lods, float ratio)
+{
+	if (tris.empty() || !max_lods)
+		return;
+
+	unsigned lo = ~0u, hi = 0;
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+		{
+			lo = std::min(lo, tri.vi[k]);
+			hi = std::max(hi, tri.vi[k]);
+		}
+	size_t nbr_vertices = hi - lo + 1;
+
+	simplify_mesh_t m(vertices, lo);
+	m.tris.reserve(tris.size() * 3);
+	for (auto& tri : tris)
+		for (int k = 0; k < 3; k++)
+			m.tris.push_back(tri.vi[k] - lo);
+
+	// area weighted plane quadrics
+	std::vector<quadric_t> quadrics(nbr_vertices);
+	for (size_t i = 0; i < m.tris.size(); i += 3)
+	{
+		const vec3f &p0 = m.pos(m.tris[i]), &p1 = m.pos(m.tris[i + 1]), &p2 = m.pos(m.tris[i + 2]);
+		vec3f n = (p1 - p0) % (p2 - p0);
+		float len = n.norm2();
+		if (len == 0)
+			continue;
+		n = n * (1.0f / len);
+		float d = -dot(n, p0);
+		for (int k = 0; k < 3; k++)
+			quadrics[m.tris[i + k]].add_plane(n, d, len * 0.5f);
+	}
+
+	// lock the vertices of edges without exactly two triangles: borders and seams
+	std::vector<bool> locked(nbr_vertices, false);
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(m.tris.size());
+		for (size_t i = 0; i < m.tris.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t a = m.tris[i + k], b = m.tris[i + (k + 1) % 3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size(); )
+		{
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i != 2)
+				locked[edges[i] >> 32] = locked[edges[i] & 0xffffffff] = true;
+			i = j;
+		}
+	}
+
+	float error = 0;
+	size_t level_tris = tris.size();
+	size_t target = (size_t)(level_tris * ratio);
+
+	std::vector<collapse_t> collapses;
+	std::vector<bool> touched(nbr_vertices);
+	std::vector<unsigned> remap(nbr_vertices);
+
+	while (lods.size() < max_lods)
+	{
+		size_t nbr_tris = m.tris.size() / 3;
+		bool done = nbr_tris <= target;
+
+		if (!done)
+		{
+			m.build_adjacency(nbr_vertices);
+
+			// cheapest collapse of each movable vertex onto one of its neighbours
+			collapses.clear();
+			for (unsigned v = 0; v < nbr_vertices; v++)
+			{
+				if (locked[v] || m.first[v] == m.first[v + 1])
+					continue;
+				collapse_t best = { v, v, 0 };
+				for (unsigned i = m.first[v]; i < m.first[v + 1]; i++)
+				{
+					const unsigned* t = &m.tris[m.adjacency[i] * 3];
+					for (int k = 0; k < 3; k++)
+					{
+						unsigned u = t[k];
+						if (u == v)
+							continue;
+						quadric_t q = quadrics[v];
+						q += quadrics[u];
+						double cost = q.eval(m.pos(u));
+						if (best.to == v || cost < best.cost)
+							best = { v, u, cost };
+					}
+				}
+				if (best.to != v)
+					collapses.push_back(best);
+			}
+			std::sort(collapses.begin(), collapses.end());
+
+			// do the cheapest ones that do not share triangles, until the target is reached
+			std::fill(touched.begin(), touched.end(), false);
+			for (unsigned v = 0; v < nbr_vertices; v++)
+				remap[v] = v;
+
+			size_t removed = 0, collapsed = 0;
+			for (auto& c : collapses)
+			{
+				if (nbr_tris - removed <= target)
+					break;
+				if (touched[c.from] || touched[c.to] || flips(m, c.from, c.to))
+					continue;
+
+				for (unsigned i = m.first[c.from]; i < m.first[c.from + 1]; i++)
+				{
+					const unsigned* t = &m.tris[m.adjacency[i] * 3];
+					if (t[0] == c.to || t[1] == c.to || t[2] == c.to)
+						removed++;
+					touched[t[0]] = touched[t[1]] = touched[t[2]] = true;
+				}
+
+				remap[c.from] = c.to;
+				quadrics[c.to] += quadrics[c.from];
+				const quadric_t& q = quadrics[c.to];
+				error = std::max(error, q.w > 0 ? (float)sqrt(c.cost / q.w) : 0.0f);
+				collapsed++;
+			}
+
+			// rewrite the triangles, dropping the collapsed ones
+			size_t n = 0;
+			for (size_t i = 0; i < m.tris.size(); i += 3)
+			{
+				unsigned a = remap[m.tris[i]], b = remap[m.tris[i + 1]], c = remap[m.tris[i + 2]];
+				if (a == b || b == c || c == a)
+					continue;
+				m.tris[n++] = a;
+				m.tris[n++] = b;
+				m.tris[n++] = c;
+			}
+			m.tris.resize(n);
+
+			// nothing left that can be collapsed
+			done = !collapsed;
+		}
+
+		if (!done)
+			continue;
+
+		nbr_tris = m.tris.size() / 3;
+		if (nbr_tris > level_tris * SIMPLIFY_MAX_LEVEL_RATIO || !nbr_tris)
+			break;
+
+		lod_t lod;
+		lod.error = error;
+		lod.tris.resize(nbr_tris);
+		for (size_t i = 0; i < nbr_tris; i++)
+			for (int k = 0; k < 3; k++)
+				lod.tris[i].vi[k] = m.tris[i * 3 + k] + lo;
+		lods.push_back(lod);
+
+		level_tris = nbr_tris;
+		target = (size_t)(level_tris * ratio);
+	}
+}
+
+int select_lod(const std::vector<float>& errors, float error_scale, float distance, float vfov,
+	float viewport_height, float max_pixels)
+{
+	// pixels per model unit at distance
+	float pixels = viewport_height * 0.5f / (std::max(distance, 1e-6f) * tanf(vfov * 0.5f)) * error_scale;
+
+	int lod = 0;
+	for (int i = 1; i < (int)errors.size(); i++)
+		if (errors[i] * pixels <= max_pixels)
+			lod = i;
+	return lod;
+}
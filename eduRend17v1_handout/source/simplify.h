@@ -0,0 +1,46 @@
+//
+//  simplify.h
+//
+//  Level-of-detail chains by quadric error metric edge collapse
+//
+
+#pragma once
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include "drawcall.h"
+
+// a level is only kept if it has at most this fraction of the triangles of the previous one
+#define SIMPLIFY_MAX_LEVEL_RATIO 0.9f
+
+//
+// Simplify the triangles of one drawcall into up to max_lods coarser levels, each aiming for
+// ratio times the triangles of the one before, and append them to lods.
+//
+// Edges are collapsed onto one of their existing vertices, after Garland & Heckbert, "Surface
+// Simplification Using Quadric Error Metrics": each vertex accumulates the area weighted planes
+// of its triangles, and the cheapest collapses under the summed quadrics are done first. The
+// levels therefore index the same vertices as tris and share their vertex buffer.
+//
+// Vertices on an edge that is not shared by exactly two triangles are never moved. As vertices
+// are welded per drawcall and on position, normal and texcoord, this keeps the material borders
+// and the UV and normal seams of the drawcall, as well as its open borders, in place. Collapses
+// that would turn a triangle over are skipped.
+//
+// The error of a level is the largest RMS distance, in model units, from a moved vertex to the
+// planes it has accumulated, so the errors of a chain are increasing.
+//
+void simplify_lods(const std::vector<vertex_t>& vertices, const std::vector<triangle_t>& tris,
+	std::vector<lod_t>& lods, unsigned max_lods, float ratio);
+
+//
+// Level to draw for an object whose levels have the given errors (0 for the full mesh, then
+// the errors of the lods), seen at distance with a vertical field of view vfov (radians) on a
+// viewport viewport_height pixels high: the coarsest level whose error, scaled by error_scale
+// (the scale of the model transform), projects to at most max_pixels.
+//
+int select_lod(const std::vector<float>& errors, float error_scale, float distance, float vfov,
+	float viewport_height, float max_pixels = 1.0f);
+
+#endif
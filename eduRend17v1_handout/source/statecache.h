@@ -0,0 +1,259 @@
+//
+//  statecache.h
+//
+//  Device context state cache: remembers what is bound and skips calls that would bind
+//  the same again
+//
+
+#pragma once
+#ifndef STATECACHE_H
+#define STATECACHE_H
+
+#include "stdafx.h"
+
+#define STATE_CACHE_SLOTS 8		// SRV, sampler and constant buffer slots tracked per stage
+#define STATE_CACHE_STREAMS 2	// vertex buffer slots tracked: vertices and instances
+
+enum state_call_t
+{
+	state_call_topology,
+	state_call_input_layout,
+	state_call_shader,
+	state_call_vertex_buffer,
+	state_call_index_buffer,
+	state_call_constant_buffer,
+	state_call_shader_resource,
+	state_call_sampler,
+	state_call_count
+};
+
+struct state_cache_stats_t
+{
+	unsigned issued[state_call_count] = {};
+	unsigned skipped[state_call_count] = {};
+
+	unsigned total_issued() const
+	{
+		unsigned n = 0;
+		for (unsigned i : issued)
+			n += i;
+		return n;
+	}
+	unsigned total_skipped() const
+	{
+		unsigned n = 0;
+		for (unsigned s : skipped)
+			n += s;
+		return n;
+	}
+};
+
+//
+// A bound value, unknown until set
+//
+template<class T>
+struct cached_state_t
+{
+	T value;
+	bool known = false;
+
+	// does v need binding?
+	bool update(const T& v)
+	{
+		if (known && value == v)
+			return false;
+		value = v;
+		known = true;
+		return true;
+	}
+};
+
+//
+// Binds through context_t, ID3D11DeviceContext or anything with the same methods (e.g. a
+// mock that records the calls), and constant buffer ranges through context1_t, e.g.
+// ID3D11DeviceContext1, where there is one. Slots from STATE_CACHE_SLOTS up, and vertex buffer
+// slots from STATE_CACHE_STREAMS up, are passed through.
+// Call invalidate when the context has been used around the cache.
+//
+template<class context_t, class context1_t = context_t>
+class state_cache_t
+{
+	struct vertex_buffer_t
+	{
+		ID3D11Buffer* buffer;
+		UINT stride, offset;
+		bool operator == (const vertex_buffer_t& b) const { return buffer == b.buffer && stride == b.stride && offset == b.offset; }
+	};
+	struct constant_buffer_t
+	{
+		ID3D11Buffer* buffer;
+		UINT first, count;		// in constants of 16 bytes, 0 for the whole buffer
+		bool operator == (const constant_buffer_t& b) const { return buffer == b.buffer && first == b.first && count == b.count; }
+	};
+	struct index_buffer_t
+	{
+		ID3D11Buffer* buffer;
+		DXGI_FORMAT format;
+		UINT offset;
+		bool operator == (const index_buffer_t& b) const { return buffer == b.buffer && format == b.format && offset == b.offset; }
+	};
+
+	context_t* const context;
+	context1_t* const context1;
+	state_cache_stats_t counters;
+
+	cached_state_t<D3D11_PRIMITIVE_TOPOLOGY> topology;
+	cached_state_t<ID3D11InputLayout*> input_layout;
+	cached_state_t<ID3D11VertexShader*> vertex_shader;
+	cached_state_t<ID3D11PixelShader*> pixel_shader;
+	cached_state_t<vertex_buffer_t> vertex_buffers[STATE_CACHE_STREAMS];
+	cached_state_t<index_buffer_t> index_buffer;
+	cached_state_t<constant_buffer_t> vs_constant_buffers[STATE_CACHE_SLOTS];
+	cached_state_t<constant_buffer_t> ps_constant_buffers[STATE_CACHE_SLOTS];
+	cached_state_t<ID3D11ShaderResourceView*> ps_shader_resources[STATE_CACHE_SLOTS];
+	cached_state_t<ID3D11SamplerState*> ps_samplers[STATE_CACHE_SLOTS];
+
+	template<class T>
+	bool update(state_call_t call, cached_state_t<T>& state, const T& v)
+	{
+		bool changed = state.update(v);
+		(changed ? counters.issued : counters.skipped)[call]++;
+		return changed;
+	}
+
+	template<class T>
+	bool update_slot(state_call_t call, cached_state_t<T>* states, UINT slot, const T& v, UINT slots = STATE_CACHE_SLOTS)
+	{
+		if (slot < slots)
+			return update(call, states[slot], v);
+		counters.issued[call]++;
+		return true;
+	}
+
+public:
+
+	state_cache_t(context_t* context, context1_t* context1 = nullptr) : context(context), context1(context1) { }
+
+	context_t* get_context() const { return context; }
+
+	// whether the range overloads of set_vs/ps_constant_buffer can be called
+	bool binds_ranges() const { return context1 != nullptr; }
+
+	void invalidate()
+	{
+		topology.known = input_layout.known = vertex_shader.known = pixel_shader.known = false;
+		index_buffer.known = false;
+		for (int i = 0; i < STATE_CACHE_STREAMS; i++)
+			vertex_buffers[i].known = false;
+		for (int i = 0; i < STATE_CACHE_SLOTS; i++)
+			vs_constant_buffers[i].known = ps_constant_buffers[i].known = ps_shader_resources[i].known = ps_samplers[i].known = false;
+	}
+
+	//
+	// Calls issued to and skipped from the context since the last reset_stats
+	//
+	const state_cache_stats_t& stats() const { return counters; }
+	void reset_stats() { counters = state_cache_stats_t(); }
+
+	void set_topology(D3D11_PRIMITIVE_TOPOLOGY t)
+	{
+		if (update(state_call_topology, topology, t))
+			context->IASetPrimitiveTopology(t);
+	}
+
+	void set_input_layout(ID3D11InputLayout* layout)
+	{
+		if (update(state_call_input_layout, input_layout, layout))
+			context->IASetInputLayout(layout);
+	}
+
+	void set_vertex_shader(ID3D11VertexShader* shader)
+	{
+		if (update(state_call_shader, vertex_shader, shader))
+			context->VSSetShader(shader, nullptr, 0);
+	}
+
+	void set_pixel_shader(ID3D11PixelShader* shader)
+	{
+		if (update(state_call_shader, pixel_shader, shader))
+			context->PSSetShader(shader, nullptr, 0);
+	}
+
+	void set_vertex_buffer(ID3D11Buffer* buffer, UINT stride, UINT offset, UINT slot = 0)
+	{
+		vertex_buffer_t vb = { buffer, stride, offset };
+		if (update_slot(state_call_vertex_buffer, vertex_buffers, slot, vb, STATE_CACHE_STREAMS))
+			context->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+	}
+
+	void set_index_buffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+	{
+		index_buffer_t ib = { buffer, format, offset };
+		if (update(state_call_index_buffer, index_buffer, ib))
+			context->IASetIndexBuffer(buffer, format, offset);
+	}
+
+	void set_vs_constant_buffer(UINT slot, ID3D11Buffer* buffer)
+	{
+		constant_buffer_t cb = { buffer, 0, 0 };
+		if (update_slot(state_call_constant_buffer, vs_constant_buffers, slot, cb))
+			context->VSSetConstantBuffers(slot, 1, &buffer);
+	}
+
+	void set_ps_constant_buffer(UINT slot, ID3D11Buffer* buffer)
+	{
+		constant_buffer_t cb = { buffer, 0, 0 };
+		if (update_slot(state_call_constant_buffer, ps_constant_buffers, slot, cb))
+			context->PSSetConstantBuffers(slot, 1, &buffer);
+	}
+
+	//
+	// count constants of buffer from first, both multiples of 16 (see constantring.h); only
+	// where binds_ranges()
+	//
+	void set_vs_constant_buffer(UINT slot, ID3D11Buffer* buffer, UINT first, UINT count)
+	{
+		constant_buffer_t cb = { buffer, first, count };
+		if (update_slot(state_call_constant_buffer, vs_constant_buffers, slot, cb))
+			context1->VSSetConstantBuffers1(slot, 1, &buffer, &first, &count);
+	}
+
+	void set_ps_constant_buffer(UINT slot, ID3D11Buffer* buffer, UINT first, UINT count)
+	{
+		constant_buffer_t cb = { buffer, first, count };
+		if (update_slot(state_call_constant_buffer, ps_constant_buffers, slot, cb))
+			context1->PSSetConstantBuffers1(slot, 1, &buffer, &first, &count);
+	}
+
+	void set_ps_shader_resource(UINT slot, ID3D11ShaderResourceView* srv)
+	{
+		if (update_slot(state_call_shader_resource, ps_shader_resources, slot, srv))
+			context->PSSetShaderResources(slot, 1, &srv);
+	}
+
+	void set_ps_sampler(UINT slot, ID3D11SamplerState* sampler)
+	{
+		if (update_slot(state_call_sampler, ps_samplers, slot, sampler))
+			context->PSSetSamplers(slot, 1, &sampler);
+	}
+};
+
+//
+// Constant buffer ranges go through the Direct3D 11.1 interface of the context, if the
+// runtime has it (see query_context1)
+//
+typedef state_cache_t<ID3D11DeviceContext, ID3D11DeviceContext1> d3d_state_cache_t;
+
+//
+// The 11.1 interface of context, without a reference of its own, or nullptr before the 11.1
+// runtime
+//
+inline ID3D11DeviceContext1* query_context1(ID3D11DeviceContext* context)
+{
+	ID3D11DeviceContext1* context1 = nullptr;
+	if (SUCCEEDED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&context1)))
+		context1->Release();
+	return context1;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <windows.h>
 #include <D3D11.h>
+#include <d3d11_1.h>
 #include <d3dCompiler.h>
 #include <dinput.h>
 
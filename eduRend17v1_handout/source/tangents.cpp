@@ -0,0 +1,253 @@
+//
+//  tangents.cpp
+//
+
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include "tangents.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TANGENTS_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace linalg;
+
+namespace
+{
+	// accumulated texture-space directions of a vertex
+	struct frame_sum_t
+	{
+		float t[3], b[3];
+	};
+
+	struct triangle_soa_t
+	{
+		const std::vector<float> &px, &py, &pz, &u, &v;
+	};
+
+	inline void add_frame(frame_sum_t* sums, unsigned i, const float t[3], const float b[3])
+	{
+		frame_sum_t& s = sums[i];
+		s.t[0] += t[0]; s.t[1] += t[1]; s.t[2] += t[2];
+		s.b[0] += b[0]; s.b[1] += b[1]; s.b[2] += b[2];
+	}
+
+	//
+	// u and v directions of one triangle: solve [D E] = [T B] [F G] for the edges D, E and
+	// their texcoord deltas F, G. Triangles with a degenerate mapping contribute nothing.
+	//
+	inline void triangle_frame(const triangle_soa_t& soa, unsigned a, unsigned b, unsigned c, float t[3], float bn[3])
+	{
+		float dx = soa.px[b] - soa.px[a], dy = soa.py[b] - soa.py[a], dz = soa.pz[b] - soa.pz[a];
+		float ex = soa.px[c] - soa.px[a], ey = soa.py[c] - soa.py[a], ez = soa.pz[c] - soa.pz[a];
+		float fu = soa.u[b] - soa.u[a], fv = soa.v[b] - soa.v[a];
+		float gu = soa.u[c] - soa.u[a], gv = soa.v[c] - soa.v[a];
+
+		float det = fu * gv - fv * gu;
+		float r = det != 0 ? 1.0f / det : 0.0f;
+
+		t[0] = (dx * gv - ex * fv) * r;
+		t[1] = (dy * gv - ey * fv) * r;
+		t[2] = (dz * gv - ez * fv) * r;
+		bn[0] = (ex * fu - dx * gu) * r;
+		bn[1] = (ey * fu - dy * gu) * r;
+		bn[2] = (ez * fu - dz * gu) * r;
+	}
+
+	//
+	// Accumulate triangles [first, last) into sums
+	//
+	void scatter_frames(const triangle_soa_t& soa, const unsigned* indices, size_t first, size_t last, frame_sum_t* sums)
+	{
+		size_t t = first;
+
+#ifdef TANGENTS_SSE
+		for (; t + 4 <= last; t += 4)
+		{
+			const unsigned* tri = indices + t * 3;
+			unsigned a0 = tri[0], a1 = tri[3], a2 = tri[6], a3 = tri[9];
+			unsigned b0 = tri[1], b1 = tri[4], b2 = tri[7], b3 = tri[10];
+			unsigned c0 = tri[2], c1 = tri[5], c2 = tri[8], c3 = tri[11];
+
+#define GATHER(arr, i) _mm_setr_ps(arr[i##0], arr[i##1], arr[i##2], arr[i##3])
+			__m128 pax = GATHER(soa.px, a), pay = GATHER(soa.py, a), paz = GATHER(soa.pz, a);
+			__m128 dx = _mm_sub_ps(GATHER(soa.px, b), pax), dy = _mm_sub_ps(GATHER(soa.py, b), pay), dz = _mm_sub_ps(GATHER(soa.pz, b), paz);
+			__m128 ex = _mm_sub_ps(GATHER(soa.px, c), pax), ey = _mm_sub_ps(GATHER(soa.py, c), pay), ez = _mm_sub_ps(GATHER(soa.pz, c), paz);
+			__m128 ua = GATHER(soa.u, a), va = GATHER(soa.v, a);
+			__m128 fu = _mm_sub_ps(GATHER(soa.u, b), ua), fv = _mm_sub_ps(GATHER(soa.v, b), va);
+			__m128 gu = _mm_sub_ps(GATHER(soa.u, c), ua), gv = _mm_sub_ps(GATHER(soa.v, c), va);
+#undef GATHER
+
+			__m128 det = _mm_sub_ps(_mm_mul_ps(fu, gv), _mm_mul_ps(fv, gu));
+			__m128 nonzero = _mm_cmpneq_ps(det, _mm_setzero_ps());
+			__m128 r = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), det), nonzero);
+
+			float out[6][4];
+			_mm_storeu_ps(out[0], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx, gv), _mm_mul_ps(ex, fv)), r));
+			_mm_storeu_ps(out[1], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dy, gv), _mm_mul_ps(ey, fv)), r));
+			_mm_storeu_ps(out[2], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dz, gv), _mm_mul_ps(ez, fv)), r));
+			_mm_storeu_ps(out[3], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ex, fu), _mm_mul_ps(dx, gu)), r));
+			_mm_storeu_ps(out[4], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ey, fu), _mm_mul_ps(dy, gu)), r));
+			_mm_storeu_ps(out[5], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ez, fu), _mm_mul_ps(dz, gu)), r));
+
+			for (int k = 0; k < 4; k++)
+			{
+				float tk[3] = { out[0][k], out[1][k], out[2][k] }, bk[3] = { out[3][k], out[4][k], out[5][k] };
+				add_frame(sums, tri[k * 3 + 0], tk, bk);
+				add_frame(sums, tri[k * 3 + 1], tk, bk);
+				add_frame(sums, tri[k * 3 + 2], tk, bk);
+			}
+		}
+#endif
+
+		for (; t < last; t++)
+		{
+			const unsigned* tri = indices + t * 3;
+			float tk[3], bk[3];
+			triangle_frame(soa, tri[0], tri[1], tri[2], tk, bk);
+			add_frame(sums, tri[0], tk, bk);
+			add_frame(sums, tri[1], tk, bk);
+			add_frame(sums, tri[2], tk, bk);
+		}
+	}
+
+	//
+	// Orthonormal frame from a normal and the summed u and v directions
+	//
+	template<class T>
+	float orthogonalize(const vec3<T>& n, vec3<T> t, const vec3<T>& b, vec3<T>& tangent, vec3<T>& binormal)
+	{
+		// Gram-Schmidt: remove the normal component of the tangent
+		t = t - n * dot(n, t);
+		T len2 = t.norm2squared();
+
+		float w = 1.0f;
+		if (len2 > 0)
+		{
+			t = t * (T(1) / sqrt(len2));
+			if (dot(n % t, b) < 0)
+				w = -1.0f;
+		}
+		else
+		{
+			// no usable mapping: any direction orthogonal to the normal
+			vec3<T> axis = fabs(n.x) < 0.5 ? vec3<T>(1, 0, 0) : vec3<T>(0, 1, 0);
+			t = normalize(axis - n * dot(n, axis));
+		}
+
+		tangent = t;
+		binormal = (n % t) * T(w);
+		return w;
+	}
+}
+
+void compute_tangent_frames(std::vector<vertex_t>& vertices, const unsigned* indices, size_t nbr_tris,
+	unsigned nbr_threads, std::vector<float>* handedness)
+{
+	size_t nbr_vertices = vertices.size();
+
+	// structure-of-arrays copies of what the triangle kernel reads
+	std::vector<float> px(nbr_vertices), py(nbr_vertices), pz(nbr_vertices), u(nbr_vertices), v(nbr_vertices);
+	for (size_t i = 0; i < nbr_vertices; i++)
+	{
+		const vertex_t& vx = vertices[i];
+		px[i] = vx.Pos.x; py[i] = vx.Pos.y; pz[i] = vx.Pos.z;
+		u[i] = vx.TexCoord.x; v[i] = vx.TexCoord.y;
+	}
+	triangle_soa_t soa = { px, py, pz, u, v };
+
+	if (nbr_threads)
+		nbr_threads = (unsigned)std::max<size_t>(1, std::min<size_t>(nbr_threads, nbr_tris));
+	else
+		nbr_threads = (unsigned)std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), nbr_tris / TANGENTS_MIN_TRIS_PER_THREAD));
+
+	// pass 1: scatter, each thread into its own sums
+	std::vector<std::vector<frame_sum_t>> sums(nbr_threads, std::vector<frame_sum_t>(nbr_vertices, frame_sum_t()));
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < nbr_threads; i++)
+		workers.push_back(std::thread(scatter_frames, std::cref(soa), indices,
+			nbr_tris * i / nbr_threads, nbr_tris * (i + 1) / nbr_threads, sums[i].data()));
+	scatter_frames(soa, indices, 0, nbr_tris / nbr_threads, sums[0].data());
+	for (auto& w : workers)
+		w.join();
+
+	// pass 2: sum and orthogonalize, over ranges of vertices
+	if (handedness)
+		handedness->assign(nbr_vertices, 1.0f);
+
+	auto finish_range = [&](size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; i++)
+		{
+			frame_sum_t s = sums[0][i];
+			for (unsigned k = 1; k < nbr_threads; k++)
+			{
+				const frame_sum_t& p = sums[k][i];
+				for (int j = 0; j < 3; j++)
+				{
+					s.t[j] += p.t[j];
+					s.b[j] += p.b[j];
+				}
+			}
+
+			vertex_t& vx = vertices[i];
+			float w = orthogonalize(vx.Normal, vec3f(s.t[0], s.t[1], s.t[2]), vec3f(s.b[0], s.b[1], s.b[2]), vx.Tangent, vx.Binormal);
+			if (handedness)
+				(*handedness)[i] = w;
+		}
+	};
+
+	workers.clear();
+	for (unsigned i = 1; i < nbr_threads; i++)
+		workers.push_back(std::thread(finish_range, nbr_vertices * i / nbr_threads, nbr_vertices * (i + 1) / nbr_threads));
+	finish_range(0, nbr_vertices / nbr_threads);
+	for (auto& w : workers)
+		w.join();
+}
+
+void compute_tangent_frames_reference(std::vector<vertex_t>& vertices, const unsigned* indices, size_t nbr_tris,
+	std::vector<float>* handedness)
+{
+	typedef vec3<double> vec3d;
+	std::vector<vec3d> tan(vertices.size()), bin(vertices.size());
+
+	for (size_t t = 0; t < nbr_tris; t++)
+	{
+		const unsigned* tri = indices + t * 3;
+		const vertex_t &v0 = vertices[tri[0]], &v1 = vertices[tri[1]], &v2 = vertices[tri[2]];
+
+		vec3d D = vec3d(v1.Pos.x, v1.Pos.y, v1.Pos.z) - vec3d(v0.Pos.x, v0.Pos.y, v0.Pos.z);
+		vec3d E = vec3d(v2.Pos.x, v2.Pos.y, v2.Pos.z) - vec3d(v0.Pos.x, v0.Pos.y, v0.Pos.z);
+		double Fu = (double)v1.TexCoord.x - v0.TexCoord.x, Fv = (double)v1.TexCoord.y - v0.TexCoord.y;
+		double Gu = (double)v2.TexCoord.x - v0.TexCoord.x, Gv = (double)v2.TexCoord.y - v0.TexCoord.y;
+
+		double det = Fu * Gv - Fv * Gu;
+		if (det == 0)
+			continue;
+
+		vec3d T = (D * Gv - E * Fv) * (1 / det);
+		vec3d B = (E * Fu - D * Gu) * (1 / det);
+		for (int i = 0; i < 3; i++)
+		{
+			tan[tri[i]] += T;
+			bin[tri[i]] += B;
+		}
+	}
+
+	if (handedness)
+		handedness->assign(vertices.size(), 1.0f);
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		vertex_t& vx = vertices[i];
+		vec3d n(vx.Normal.x, vx.Normal.y, vx.Normal.z), t, b;
+		float w = orthogonalize(n, tan[i], bin[i], t, b);
+
+		vx.Tangent = vec3f((float)t.x, (float)t.y, (float)t.z);
+		vx.Binormal = vec3f((float)b.x, (float)b.y, (float)b.z);
+		if (handedness)
+			(*handedness)[i] = w;
+	}
+}
@@ -0,0 +1,40 @@
+//
+//  tangents.h
+//
+//  Per-vertex tangent frames for normal mapping
+//
+
+#pragma once
+#ifndef TANGENTS_H
+#define TANGENTS_H
+
+#include <vector>
+#include "drawcall.h"
+
+// smallest number of triangles worth giving their own accumulation thread
+#define TANGENTS_MIN_TRIS_PER_THREAD (64*1024)
+
+//
+// Sets Tangent and Binormal of the vertices used by nbr_tris triangles of three indices each
+//
+// The texture-space u and v directions of every triangle are accumulated per vertex over all
+// triangles using it. The summed tangent is then made orthogonal to the vertex normal
+// (Gram-Schmidt) and normalized, and the binormal is rebuilt as cross(Normal, Tangent) times
+// the handedness, which is -1 where the texture is mirrored and +1 otherwise. handedness, if
+// given, receives it per vertex. Vertices without a usable texture mapping get an arbitrary
+// tangent orthogonal to their normal.
+//
+// The per-triangle math runs four triangles at a time with SSE on structure-of-arrays copies
+// of the positions and texcoords, and is split over threads as in normal_accumulator_t.
+// nbr_threads: 0 = one per core, but no more than one per TANGENTS_MIN_TRIS_PER_THREAD triangles.
+//
+void compute_tangent_frames(std::vector<vertex_t>& vertices, const unsigned* indices, size_t nbr_tris,
+	unsigned nbr_threads = 0, std::vector<float>* handedness = nullptr);
+
+//
+// Same result computed one triangle and vertex at a time in double precision, for testing
+//
+void compute_tangent_frames_reference(std::vector<vertex_t>& vertices, const unsigned* indices, size_t nbr_tris,
+	std::vector<float>* handedness = nullptr);
+
+#endif
@@ -0,0 +1,1701 @@
+//
+//  tests.cpp
+//
+//  Checks of the mesh pipeline, culling, render queue, state cache, constants and math that
+//  need no device or window, as a console program of its own (the tests project). Each check
+//  prints a line and returns whether it passed; the program exits with 1 if any failed.
+//  Run from the output directory, as eduRend, for the paths of the assets.
+//
+
+#include "stdafx.h"
+#include <cstdio>
+#include <chrono>
+#include <array>
+#include <thread>
+#include <algorithm>
+#include <fstream>
+#include "ShaderBuffers.h"
+#include "Camera.h"
+#include "mesh.h"
+#include "tangents.h"
+#include "packedvertex.h"
+#include "indexbuffer.h"
+#include "bounds.h"
+#include "frustum.h"
+#include "occlusion.h"
+#include "bvh.h"
+#include "renderqueue.h"
+#include "renderdevice.h"
+#include "statecache.h"
+#include "constantring.h"
+#include "instancing.h"
+#include "transforms.h"
+
+//
+// Same vertices, drawcalls with their levels of detail and meshlets, and materials
+//
+bool meshesEqual(const mesh_t& a, const mesh_t& b)
+{
+	if (a.vertices.size() != b.vertices.size() || a.drawcalls.size() != b.drawcalls.size() || a.materials.size() != b.materials.size() ||
+		memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(vertex_t)))
+		return false;
+
+	for (size_t i = 0; i < a.drawcalls.size(); i++)
+	{
+		const drawcall_t &x = a.drawcalls[i], &y = b.drawcalls[i];
+		if (x.group_name != y.group_name || x.mtl_index != y.mtl_index || x.tris.size() != y.tris.size() ||
+			memcmp(x.tris.data(), y.tris.data(), x.tris.size() * sizeof(triangle_t)) || x.lods.size() != y.lods.size())
+			return false;
+		for (size_t j = 0; j < x.lods.size(); j++)
+			if (x.lods[j].error != y.lods[j].error || x.lods[j].tris.size() != y.lods[j].tris.size() ||
+				memcmp(x.lods[j].tris.data(), y.lods[j].tris.data(), x.lods[j].tris.size() * sizeof(triangle_t)))
+				return false;
+		if (x.meshlets.size() != y.meshlets.size() || x.meshlet_vertices != y.meshlet_vertices || x.meshlet_indices != y.meshlet_indices ||
+			memcmp(x.meshlets.data(), y.meshlets.data(), x.meshlets.size() * sizeof(meshlet_t)))
+			return false;
+	}
+
+	for (size_t i = 0; i < a.materials.size(); i++)
+	{
+		const material_t &x = a.materials[i], &y = b.materials[i];
+		if (x.name != y.name || x.map_Kd != y.map_Kd || x.map_bump != y.map_bump || x.map_cube != y.map_cube ||
+			!(x.Ka == y.Ka) || !(x.Kd == y.Kd) || !(x.Ks == y.Ks))
+			return false;
+	}
+	return true;
+}
+
+//
+// Compare compute_tangent_frames on one and several threads to the scalar double-precision
+// reference on the welded mesh of an OBJ, and time them. Reported are the best time of 5 runs,
+// the number of vertices whose frame differs by more than a degree or in handedness, and the
+// largest angle between tangents for the rest. At most one vertex in 1000 may differ.
+//
+bool testTangentFrames(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	std::vector<unsigned> indices;
+	for (auto& dc : mesh.drawcalls)
+		for (auto& tri : dc.tris)
+			indices.insert(indices.end(), tri.vi, tri.vi + 3);
+	size_t nbr_tris = indices.size() / 3;
+
+	std::vector<vertex_t> reference = mesh.vertices;
+	std::vector<float> reference_w;
+	compute_tangent_frames_reference(reference, indices.data(), nbr_tris, &reference_w);
+
+	bool passed = true;
+	unsigned threads[] = { 1, std::max(4u, std::thread::hardware_concurrency()) };
+	for (unsigned nbr_threads : threads)
+	{
+		std::vector<vertex_t> vertices;
+		std::vector<float> w;
+		double best_ms = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			vertices = mesh.vertices;
+			auto t0 = std::chrono::high_resolution_clock::now();
+			compute_tangent_frames(vertices, indices.data(), nbr_tris, nbr_threads, &w);
+			best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+		}
+
+		// where the summed directions (nearly) cancel, float rounding can turn the frame around
+		const float cos_1deg = 0.99985f;
+		float min_dot = 1;
+		int differing = 0;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			float d = dot(vertices[i].Tangent, reference[i].Tangent);
+			if (d < cos_1deg || w[i] != reference_w[i])
+				differing++;
+			else
+				min_dot = std::min(min_dot, d);
+		}
+		printf("Tangents %s: %d vertices, %u threads %.2f ms, max deviation %.3f deg, %d off by more than 1 deg or in handedness\n",
+			file, (int)vertices.size(), nbr_threads, best_ms, acosf(std::min(1.0f, min_dot)) / fTO_RAD, differing);
+		passed &= differing * 1000 <= (int)vertices.size();
+	}
+	return passed;
+}
+
+//
+// Encode the vertices of an OBJ, with generated tangent frames, as packed_vertex_t and decode
+// them again. Reports the largest position error relative to the bounding box, the largest
+// angle between original and decoded normals and tangents, the largest texcoord error and the
+// number of vertices where the rebuilt binormal points the other way.
+//
+bool testPackedVertices(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	std::vector<unsigned> indices;
+	for (auto& dc : mesh.drawcalls)
+		for (auto& tri : dc.tris)
+			indices.insert(indices.end(), tri.vi, tri.vi + 3);
+
+	std::vector<vertex_t>& vertices = mesh.vertices;
+	std::vector<float> w;
+	compute_tangent_frames(vertices, indices.data(), indices.size() / 3, 0, &w);
+
+	std::vector<packed_vertex_t> packed;
+	std::vector<vertex_t> decoded;
+	packed_box_t box;
+	encode_vertices(vertices, &w, packed, box);
+	decode_vertices(packed, box, decoded);
+
+	float extent = std::max(box.scale.x, std::max(box.scale.y, box.scale.z));
+	float pos_err = 0, uv_err = 0, n_dot = 1, t_dot = 1;
+	int flipped = 0;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const vertex_t& a = vertices[i];
+		const vertex_t& b = decoded[i];
+		for (int j = 0; j < 3; j++)
+			pos_err = std::max(pos_err, fabsf(a.Pos.vec[j] - b.Pos.vec[j]));
+		uv_err = std::max(uv_err, std::max(fabsf(a.TexCoord.x - b.TexCoord.x), fabsf(a.TexCoord.y - b.TexCoord.y)));
+		n_dot = std::min(n_dot, dot(normalize(a.Normal), b.Normal));
+		t_dot = std::min(t_dot, dot(a.Tangent, b.Tangent));
+		if (dot(a.Binormal, b.Binormal) < 0)
+			flipped++;
+	}
+	printf("Packed %s: %d vertices %.1f -> %.1f MB, max error position %.2e of extent, normal %.4f deg, tangent %.4f deg, texcoord %.2e, %d binormals flipped\n",
+		file, (int)vertices.size(), vertices.size() * sizeof(vertex_t) / 1048576.0, packed.size() * sizeof(packed_vertex_t) / 1048576.0,
+		extent > 0 ? pos_err / extent : pos_err, acosf(std::min(1.0f, n_dot)) / fTO_RAD, acosf(std::min(1.0f, t_dot)) / fTO_RAD,
+		uv_err, flipped);
+	return flipped == 0;
+}
+
+//
+// ACMR and ATVR (see meshopt.h) of the bundled OBJs as loaded, before and after the vertex
+// cache optimization of load_obj
+//
+void reportVertexCache()
+{
+	const char* files[] = {
+		"../../assets/city/city.obj",
+		"../../assets/hand/hand.obj",
+		"../../assets/crytek-sponza/banner.obj",
+		"../../assets/sphere/sphere.obj",
+		"../../assets/sphere/invertedSphere.obj",
+		"../../assets/tyre/Tyre.obj",
+		"../../assets/tyre/Rim.obj",
+		"../../assets/wooddoll/wooddoll.obj",
+		"../../assets/carbody/carbody.obj",
+		"../../assets/WoodenCrate/WoodenCrate.obj" };
+
+	std::vector<std::string> lines;
+	for (auto file : files)
+	{
+		mesh_t mesh;
+		mesh.load_obj(file);
+		char line[256];
+		snprintf(line, sizeof(line), "%-40s %8d %6.3f -> %6.3f %6.3f -> %6.3f", file, (int)mesh.vertex_cache_after.triangles,
+			mesh.vertex_cache_before.acmr(), mesh.vertex_cache_after.acmr(), mesh.vertex_cache_before.atvr(), mesh.vertex_cache_after.atvr());
+		lines.push_back(line);
+	}
+
+	printf("%-40s %8s %16s %16s\n", "Vertex cache", "tris", "ACMR", "ATVR");
+	for (auto& line : lines)
+		printf("%s\n", line.c_str());
+}
+
+//
+// Build the index buffer of an OBJ as OBJModel_t does, and with lower vertex limits to force
+// drawcalls to be split, and check that the ranges, with their ofs added, give back the
+// triangles of the drawcalls in order and with the same materials.
+//
+bool testIndexBuffers(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	std::vector<unsigned> expected;
+	std::vector<int> expected_mtl;
+	for (auto& dc : mesh.drawcalls)
+		for (auto& tri : dc.tris)
+		{
+			expected.insert(expected.end(), tri.vi, tri.vi + 3);
+			expected_mtl.push_back(dc.mtl_index);
+		}
+
+	bool passed = true;
+	unsigned limits[] = { INDEX16_MAX_VERTICES, 4096, 256 };
+	for (unsigned max_vertices : limits)
+	{
+		index_buffer_t ib;
+		build_index_buffer(mesh.drawcalls, ib, max_vertices);
+
+		std::vector<unsigned> rebuilt;
+		std::vector<int> rebuilt_mtl;
+		for (auto& range : ib.ranges)
+		{
+			for (size_t i = 0; i < range.size; i++)
+				rebuilt.push_back(ib.vertex(range, i));
+			rebuilt_mtl.insert(rebuilt_mtl.end(), range.size / 3, range.mtl_index);
+		}
+
+		bool same = rebuilt == expected && rebuilt_mtl == expected_mtl;
+		printf("Index buffer %s, at most %u vertices: %d ranges for %d drawcalls, %d-bit, %.1f KB -> %.1f KB, %s\n",
+			file, max_vertices, (int)ib.ranges.size(), (int)mesh.drawcalls.size(), (int)ib.index_size() * 8,
+			expected.size() * sizeof(unsigned) / 1024.0, ib.bytes() / 1024.0, same ? "identical" : "DIFFERS");
+		passed &= same;
+	}
+	return passed;
+}
+
+//
+// Merging the ranges of a material, at the default and a low vertex limit: the draws before
+// and after, and a check that the merged ranges draw the same triangles with the same
+// materials, and that find_group gives the group of each triangle
+//
+bool testBatching(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	bool passed = true;
+	unsigned limits[] = { INDEX16_MAX_VERTICES, 4096 };
+	for (unsigned max_vertices : limits)
+	{
+		index_buffer_t ib;
+		build_index_buffer(mesh.drawcalls, ib, max_vertices);
+		size_t draws = ib.ranges.size();
+
+		std::vector<unsigned> expected;
+		std::vector<int> expected_mtl;
+		for (auto& range : ib.ranges)
+			for (size_t i = 0; i < range.size; i++)
+			{
+				expected.push_back(ib.vertex(range, i));
+				expected_mtl.push_back(range.mtl_index);
+			}
+
+		std::vector<index_group_t> groups;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		batch_index_ranges(mesh.drawcalls, ib, 0, groups, max_vertices);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+		std::vector<unsigned> batched;
+		std::vector<int> batched_mtl;
+		for (auto& range : ib.ranges)
+			for (size_t i = 0; i < range.size; i++)
+			{
+				batched.push_back(ib.vertex(range, i));
+				batched_mtl.push_back(range.mtl_index);
+			}
+
+		int misplaced = 0;
+		for (size_t d = 0, i = 0; d < mesh.drawcalls.size(); d++)
+			for (size_t t = 0; t < mesh.drawcalls[d].tris.size(); t++, i += 3)
+			{
+				const index_group_t* group = find_group(groups, i);
+				if (group != &groups[d] || group->mtl_index != mesh.drawcalls[d].mtl_index ||
+					ib.ranges[group->range].start > group->start ||
+					ib.ranges[group->range].start + ib.ranges[group->range].size <= group->start)
+					misplaced++;
+			}
+
+		bool same = batched == expected && batched_mtl == expected_mtl;
+		printf("Batching %s, at most %u vertices: %d draws -> %d for %d groups in %.2f ms, %s, %d triangles with a wrong group\n",
+			file, max_vertices, (int)draws, (int)ib.ranges.size(), (int)groups.size(), ms, same ? "identical" : "DIFFERS", misplaced);
+		passed &= same && misplaced == 0;
+	}
+	return passed;
+}
+
+//
+// Levels of detail of an OBJ (load_obj prints their triangle counts and errors) and the level
+// select_lod picks at a range of distances, for the default camera on a 720 pixel viewport
+//
+void reportLods(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	std::vector<float> errors(1, 0.0f);
+	for (unsigned level = 1; level <= mesh.lod_count(); level++)
+		errors.push_back(mesh.lod_error(level));
+
+	printf("LOD of %s by distance:", file);
+	float distances[] = { 1, 5, 10, 25, 50, 100, 200, 400 };
+	for (float distance : distances)
+		printf(" %g: %d", distance, select_lod(errors, 1.0f, distance, fPI / 4, 720.0f));
+	printf("\n");
+}
+
+//
+// Time meshlet building on the drawcalls of an OBJ (best of 5), and check that the meshlets
+// are within their limits, hold exactly the triangles of their drawcall, come out the same
+// every time and survive a round trip through the binary cache. Also reports how many have a
+// normal cone narrow enough for backface culling.
+//
+bool testMeshlets(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	double best_ms = 1e30;
+	std::vector<drawcall_t> first_build;
+	bool deterministic = true;
+	for (int run = 0; run < 5; run++)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto& dc : mesh.drawcalls)
+			build_meshlets(mesh.vertices, dc);
+		best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count());
+
+		if (!run)
+			first_build = mesh.drawcalls;
+		else
+			for (size_t i = 0; i < mesh.drawcalls.size(); i++)
+			{
+				const drawcall_t &x = first_build[i], &y = mesh.drawcalls[i];
+				deterministic = deterministic && x.meshlets.size() == y.meshlets.size() &&
+					x.meshlet_vertices == y.meshlet_vertices && x.meshlet_indices == y.meshlet_indices &&
+					!memcmp(x.meshlets.data(), y.meshlets.data(), x.meshlets.size() * sizeof(meshlet_t));
+			}
+	}
+
+	size_t nbr_meshlets = 0, nbr_tris = 0, cullable = 0;
+	bool valid = true;
+	for (auto& dc : mesh.drawcalls)
+	{
+		std::vector<std::array<unsigned, 3>> expected, rebuilt;
+		for (auto& tri : dc.tris)
+			expected.push_back({ tri.vi[0], tri.vi[1], tri.vi[2] });
+		for (auto& m : dc.meshlets)
+		{
+			valid = valid && m.vertex_count <= MESHLET_MAX_VERTICES && m.triangle_count <= MESHLET_MAX_TRIANGLES;
+			for (unsigned t = 0; t < m.triangle_count; t++)
+			{
+				const uint8_t* mi = &dc.meshlet_indices[(m.triangle_offset + t) * 3];
+				const unsigned* mv = &dc.meshlet_vertices[m.vertex_offset];
+				valid = valid && mi[0] < m.vertex_count && mi[1] < m.vertex_count && mi[2] < m.vertex_count;
+				rebuilt.push_back({ mv[mi[0]], mv[mi[1]], mv[mi[2]] });
+			}
+			if (m.cone_cutoff < 1)
+				cullable++;
+		}
+		std::sort(expected.begin(), expected.end());
+		std::sort(rebuilt.begin(), rebuilt.end());
+		valid = valid && expected == rebuilt;
+		nbr_meshlets += dc.meshlets.size();
+		nbr_tris += dc.tris.size();
+	}
+
+	mesh_t cached;
+	std::string cachefile = std::string(file) + ".tests" + MESH_CACHE_SUFFIX;
+	mesh.save_cache(file, cachefile);
+	bool same = cached.load_cache(file, cachefile) && meshesEqual(mesh, cached);
+
+	printf("Meshlets %s: %d in %.2f ms, %.1f triangles each, %d%% with a cullable cone, %s, %s, cache %s\n",
+		file, (int)nbr_meshlets, best_ms, nbr_meshlets ? (double)nbr_tris / nbr_meshlets : 0.0,
+		nbr_meshlets ? (int)(100 * cullable / nbr_meshlets) : 0, valid ? "valid" : "INVALID",
+		deterministic ? "deterministic" : "NOT DETERMINISTIC", same ? "identical" : "DIFFERS");
+	return valid && deterministic && same;
+}
+
+//
+// Bounds of the mesh and of the ranges of its index buffer, split at 4096 vertices to get more
+// ranges, against boxes and spheres computed one vertex at a time from the triangles
+//
+bool testBounds(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	index_buffer_t ib;
+	build_index_buffer(mesh.drawcalls, ib, 4096);
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	bounds_t mesh_bounds = compute_bounds(mesh.vertices);
+	std::vector<bounds_t> bounds;
+	compute_bounds(mesh.vertices, ib, ib.ranges, bounds);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	auto same = [](const bounds_t& a, const bounds_t& b)
+	{
+		return a.box.min == b.box.min && a.box.max == b.box.max && a.sphere.center == b.sphere.center &&
+			fabsf(a.sphere.radius - b.sphere.radius) <= 1e-6f * std::max(1.0f, b.sphere.radius);
+	};
+	auto brute_force = [&](const std::vector<unsigned>& vis)
+	{
+		bounds_t b;
+		if (vis.empty())
+			return b;
+		b.box.min = b.box.max = mesh.vertices[vis[0]].Pos;
+		for (unsigned vi : vis)
+			for (int k = 0; k < 3; k++)
+			{
+				b.box.min.vec[k] = std::min(b.box.min.vec[k], mesh.vertices[vi].Pos.vec[k]);
+				b.box.max.vec[k] = std::max(b.box.max.vec[k], mesh.vertices[vi].Pos.vec[k]);
+			}
+		b.sphere.center = (b.box.min + b.box.max) * 0.5f;
+		for (unsigned vi : vis)
+			b.sphere.radius = std::max(b.sphere.radius, (mesh.vertices[vi].Pos - b.sphere.center).norm2());
+		return b;
+	};
+
+	std::vector<unsigned> all(mesh.vertices.size());
+	for (unsigned i = 0; i < all.size(); i++)
+		all[i] = i;
+	int differing = same(mesh_bounds, brute_force(all)) ? 0 : 1;
+
+	// the ranges hold the triangles of the drawcalls in order
+	size_t tri = 0, dc = 0;
+	for (size_t r = 0; r < ib.ranges.size(); r++)
+	{
+		std::vector<unsigned> vis;
+		for (size_t t = 0; t < ib.ranges[r].size / 3; t++, tri++)
+		{
+			while (tri >= mesh.drawcalls[dc].tris.size())
+			{
+				tri = 0;
+				dc++;
+			}
+			vis.insert(vis.end(), mesh.drawcalls[dc].tris[tri].vi, mesh.drawcalls[dc].tris[tri].vi + 3);
+		}
+		if (!same(bounds[r], brute_force(vis)))
+			differing++;
+	}
+
+	printf("Bounds %s: mesh and %d ranges in %.2f ms, %d differ from brute force\n", file, (int)ib.ranges.size(), ms, differing);
+	return differing == 0;
+}
+
+//
+// Records what a render queue submits, for checking it without a D3D device
+//
+class counting_device_t : public render_device_t
+{
+public:
+	unsigned binds[render_state_count] = {};
+	const void* bound[render_state_count] = {};
+	std::vector<unsigned> draws;		// start_index of each draw
+	int stale = 0;						// draws with other states bound than their packets had
+
+	const std::vector<render_packet_t>* packets = nullptr;
+
+	virtual void bind(render_state_t slot, const void* state)
+	{
+		binds[slot]++;
+		bound[slot] = state;
+	}
+	virtual void draw_indexed(unsigned index_count, unsigned start_index, int base_vertex)
+	{
+		const render_packet_t& p = (*packets)[start_index];
+		for (int s = 0; s < render_state_count; s++)
+			stale += bound[s] != p.state[s];
+		draws.push_back(start_index);
+	}
+};
+
+//
+// A render queue of random packets from 20 models with 200 materials, 2 passes and 3
+// shaders, submitted to a counting device: draws must come in stable key order, with their
+// own states bound. Binds are compared to one bind per state and packet, and radix_sort is
+// timed against std::stable_sort.
+//
+bool testRenderQueue()
+{
+	const int nbr_packets = 20000, nbr_models = 20, nbr_materials = 200;
+	int handles[nbr_models + nbr_materials + 3];	// addresses only
+	const void* shaders[3] = { &handles[0], &handles[1], &handles[2] };
+
+	render_queue_t queue;
+	srand(1);
+	for (int i = 0; i < nbr_packets; i++)
+	{
+		int model = rand() % nbr_models, material = model * 10 + rand() % 10, shader = rand() % 3;
+		unsigned pass = rand() % 2;
+		float depth = (model + 1) / (float)(nbr_models + 1);
+		render_packet_t p;
+		p.key = make_sort_key(pass, shader, material, pass ? 1 - depth : depth, model);
+		p.state[render_state_shader] = shaders[shader];
+		p.state[render_state_geometry] = &handles[3 + model];
+		p.state[render_state_material] = &handles[3 + nbr_models + material];
+		p.state[render_state_constants] = &handles[3 + model];
+		p.start_index = i;
+		queue.push(p);
+	}
+
+	counting_device_t device;
+	device.packets = &queue.packets;
+	queue.submit(device);
+
+	std::vector<unsigned> expected(nbr_packets);
+	for (int i = 0; i < nbr_packets; i++)
+		expected[i] = i;
+	std::stable_sort(expected.begin(), expected.end(), [&](unsigned a, unsigned b) { return queue.packets[a].key < queue.packets[b].key; });
+	bool ordered = device.draws == expected;
+
+	unsigned binds = 0;
+	for (int s = 0; s < render_state_count; s++)
+		binds += device.binds[s];
+
+	// sort timing on 16x the keys
+	std::vector<sort_entry_t> entries, scratch;
+	for (int k = 0; k < 16; k++)
+		for (auto& p : queue.packets)
+			entries.push_back({ p.key ^ ((uint64_t)k << 12), (unsigned)entries.size() });
+	std::vector<sort_entry_t> copy = entries;
+	scratch.resize(entries.size());
+	auto t0 = std::chrono::high_resolution_clock::now();
+	radix_sort(entries.data(), scratch.data(), entries.size());
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::stable_sort(copy.begin(), copy.end(), [](const sort_entry_t& a, const sort_entry_t& b) { return a.key < b.key; });
+	auto t2 = std::chrono::high_resolution_clock::now();
+	bool same_sort = true;
+	for (size_t i = 0; i < entries.size(); i++)
+		same_sort &= entries[i].key == copy[i].key && entries[i].index == copy[i].index;
+
+	printf("Render queue: %d packets, %s, %d draws with stale state, %u binds (shader %u, geometry %u, material %u, constants %u) "
+		"vs %d without elimination, sort %.3f ms, submit %.3f ms; %d keys radix sorted in %.2f ms vs std::stable_sort %.2f ms, %s\n",
+		nbr_packets, ordered ? "in key order" : "OUT OF ORDER", device.stale, binds, device.binds[render_state_shader],
+		device.binds[render_state_geometry], device.binds[render_state_material], device.binds[render_state_constants],
+		nbr_packets * render_state_count, queue.stats.sort_ms, queue.stats.submit_ms, (int)entries.size(),
+		std::chrono::duration<double, std::milli>(t1 - t0).count(), std::chrono::duration<double, std::milli>(t2 - t1).count(),
+		same_sort ? "same order" : "DIFFERENT ORDER");
+	return ordered && device.stale == 0 && same_sort;
+}
+
+//
+// A device context that records what is bound, with the methods of ID3D11DeviceContext1 that
+// state_cache_t calls, counting the calls
+//
+struct mock_context_t
+{
+	D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	ID3D11InputLayout* input_layout = nullptr;
+	ID3D11VertexShader* vertex_shader = nullptr;
+	ID3D11PixelShader* pixel_shader = nullptr;
+	ID3D11Buffer* vertex_buffers[4] = {};
+	UINT strides[4] = {}, offsets[4] = {};
+	ID3D11Buffer* index_buffer = nullptr;
+	DXGI_FORMAT index_format = DXGI_FORMAT_UNKNOWN;
+	UINT index_offset = 0;
+	ID3D11Buffer* vs_constant_buffers[16] = {};
+	ID3D11Buffer* ps_constant_buffers[16] = {};
+	UINT vs_constant_ranges[16][2] = {}, ps_constant_ranges[16][2] = {};	// first and count, 0 for whole buffers
+	ID3D11ShaderResourceView* ps_shader_resources[16] = {};
+	ID3D11SamplerState* ps_samplers[16] = {};
+	unsigned calls = 0;
+
+	void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY t) { topology = t; calls++; }
+	void IASetInputLayout(ID3D11InputLayout* l) { input_layout = l; calls++; }
+	void VSSetShader(ID3D11VertexShader* s, ID3D11ClassInstance* const*, UINT) { vertex_shader = s; calls++; }
+	void PSSetShader(ID3D11PixelShader* s, ID3D11ClassInstance* const*, UINT) { pixel_shader = s; calls++; }
+	void IASetVertexBuffers(UINT slot, UINT n, ID3D11Buffer* const* b, const UINT* strides, const UINT* offsets)
+	{
+		vertex_buffers[slot] = b[0]; this->strides[slot] = strides[0]; this->offsets[slot] = offsets[0]; calls++;
+	}
+	void IASetIndexBuffer(ID3D11Buffer* b, DXGI_FORMAT f, UINT o) { index_buffer = b; index_format = f; index_offset = o; calls++; }
+	void VSSetConstantBuffers(UINT slot, UINT n, ID3D11Buffer* const* b) { VSSetConstantBuffers1(slot, n, b, nullptr, nullptr); }
+	void PSSetConstantBuffers(UINT slot, UINT n, ID3D11Buffer* const* b) { PSSetConstantBuffers1(slot, n, b, nullptr, nullptr); }
+	void VSSetConstantBuffers1(UINT slot, UINT n, ID3D11Buffer* const* b, const UINT* first, const UINT* count)
+	{
+		vs_constant_buffers[slot] = b[0]; vs_constant_ranges[slot][0] = first ? first[0] : 0; vs_constant_ranges[slot][1] = count ? count[0] : 0; calls++;
+	}
+	void PSSetConstantBuffers1(UINT slot, UINT n, ID3D11Buffer* const* b, const UINT* first, const UINT* count)
+	{
+		ps_constant_buffers[slot] = b[0]; ps_constant_ranges[slot][0] = first ? first[0] : 0; ps_constant_ranges[slot][1] = count ? count[0] : 0; calls++;
+	}
+	void PSSetShaderResources(UINT slot, UINT n, ID3D11ShaderResourceView* const* v) { ps_shader_resources[slot] = v[0]; calls++; }
+	void PSSetSamplers(UINT slot, UINT n, ID3D11SamplerState* const* s) { ps_samplers[slot] = s[0]; calls++; }
+};
+
+// a distinct handle per i, never dereferenced
+template<class T>
+T* fake_handle(int i)
+{
+	return (T*)(uintptr_t)(16 * (i + 1));
+}
+
+//
+// State cache on a mock context: a random sequence of binds, with invalidations, must leave
+// the context with the last state of every bind and issue exactly the calls the context saw.
+// Constant buffers are bound whole and as ranges of 16 constants, the ranges through the
+// same mock as the 11.1 interface.
+//
+bool testStateCache()
+{
+	mock_context_t context;
+	state_cache_t<mock_context_t> cache(&context, &context);
+	mock_context_t expected;	// set directly, as without the cache
+
+	srand(1);
+	const int nbr_binds = 100000;
+	int mismatches = 0;
+	for (int i = 0; i < nbr_binds; i++)
+	{
+		int h = rand() % 3;
+		UINT slot = rand() % 10;	// also past STATE_CACHE_SLOTS
+		UINT stream = slot % 4;		// and STATE_CACHE_STREAMS
+		int op = rand() % 11;
+		switch (op)
+		{
+		case 0: cache.set_topology(h ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+			expected.topology = h ? D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST : D3D11_PRIMITIVE_TOPOLOGY_LINELIST; break;
+		case 1: cache.set_input_layout(fake_handle<ID3D11InputLayout>(h)); expected.input_layout = fake_handle<ID3D11InputLayout>(h); break;
+		case 2: cache.set_vertex_shader(fake_handle<ID3D11VertexShader>(h)); expected.vertex_shader = fake_handle<ID3D11VertexShader>(h); break;
+		case 3: cache.set_pixel_shader(fake_handle<ID3D11PixelShader>(h)); expected.pixel_shader = fake_handle<ID3D11PixelShader>(h); break;
+		case 4: cache.set_vertex_buffer(fake_handle<ID3D11Buffer>(h), 16 + 16 * (slot & 1), 0, stream);
+			expected.vertex_buffers[stream] = fake_handle<ID3D11Buffer>(h); expected.strides[stream] = 16 + 16 * (slot & 1); break;
+		case 5: cache.set_index_buffer(fake_handle<ID3D11Buffer>(h), (slot & 1) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT, 0);
+			expected.index_buffer = fake_handle<ID3D11Buffer>(h); expected.index_format = (slot & 1) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT; break;
+		case 6: case 7:
+		{
+			UINT first = 16 * (rand() % 3), count = first ? 16 : 0;	// whole buffer at 0
+			ID3D11Buffer*& buffer = op == 6 ? expected.vs_constant_buffers[slot] : expected.ps_constant_buffers[slot];
+			UINT* range = op == 6 ? expected.vs_constant_ranges[slot] : expected.ps_constant_ranges[slot];
+			if (op == 6 && first)
+				cache.set_vs_constant_buffer(slot, fake_handle<ID3D11Buffer>(h), first, count);
+			else if (op == 6)
+				cache.set_vs_constant_buffer(slot, fake_handle<ID3D11Buffer>(h));
+			else if (first)
+				cache.set_ps_constant_buffer(slot, fake_handle<ID3D11Buffer>(h), first, count);
+			else
+				cache.set_ps_constant_buffer(slot, fake_handle<ID3D11Buffer>(h));
+			buffer = fake_handle<ID3D11Buffer>(h); range[0] = first; range[1] = count;
+			break;
+		}
+		case 8: cache.set_ps_shader_resource(slot, fake_handle<ID3D11ShaderResourceView>(h)); expected.ps_shader_resources[slot] = fake_handle<ID3D11ShaderResourceView>(h); break;
+		case 9: cache.set_ps_sampler(slot, fake_handle<ID3D11SamplerState>(h)); expected.ps_samplers[slot] = fake_handle<ID3D11SamplerState>(h); break;
+		default: if (rand() % 100 == 0) cache.invalidate(); break;
+		}
+
+		bool same = context.topology == expected.topology && context.input_layout == expected.input_layout &&
+			context.vertex_shader == expected.vertex_shader && context.pixel_shader == expected.pixel_shader &&
+			context.index_buffer == expected.index_buffer && context.index_format == expected.index_format;
+		for (int s = 0; s < 4; s++)
+			same &= context.vertex_buffers[s] == expected.vertex_buffers[s] && context.strides[s] == expected.strides[s];
+		for (int s = 0; s < 16; s++)
+			same &= context.vs_constant_buffers[s] == expected.vs_constant_buffers[s] && context.ps_constant_buffers[s] == expected.ps_constant_buffers[s] &&
+				!memcmp(context.vs_constant_ranges[s], expected.vs_constant_ranges[s], sizeof(UINT) * 2) &&
+				!memcmp(context.ps_constant_ranges[s], expected.ps_constant_ranges[s], sizeof(UINT) * 2) &&
+				context.ps_shader_resources[s] == expected.ps_shader_resources[s] && context.ps_samplers[s] == expected.ps_samplers[s];
+		mismatches += !same;
+	}
+	const state_cache_stats_t& stats = cache.stats();
+	printf("State cache: %u of %u binds issued, %u skipped, %d with the context in another state, %s\n",
+		stats.total_issued(), stats.total_issued() + stats.total_skipped(), stats.total_skipped(), mismatches,
+		context.calls == stats.total_issued() ? "issued count matches the context" : "ISSUED COUNT DIFFERS FROM THE CONTEXT");
+	return mismatches == 0 && context.calls == stats.total_issued();
+}
+
+//
+// Texture and sampler binds of the ranges of a mesh, split at 4096 vertices, through the
+// state cache on a mock context, as OBJModel_t::render makes them
+//
+void reportStateCache(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+	index_buffer_t ib;
+	build_index_buffer(mesh.drawcalls, ib, 4096);
+
+	mock_context_t context;
+	state_cache_t<mock_context_t> cache(&context);
+	for (auto& r : ib.ranges)
+	{
+		for (int t = 0; t < 3; t++)
+			cache.set_ps_shader_resource(t, fake_handle<ID3D11ShaderResourceView>(r.mtl_index * 3 + t));
+		cache.set_ps_sampler(0, fake_handle<ID3D11SamplerState>(0));
+	}
+	printf("State cache, %s: %d ranges, %u texture and sampler binds issued, %u skipped\n", file, (int)ib.ranges.size(),
+		cache.stats().total_issued(), cache.stats().total_skipped());
+}
+
+//
+// 10k random affine transforms with non-uniform scale and colors packed for the instance
+// buffer: unpacked, the transforms must come back exactly and the colors within 8-bit rounding.
+// The packed normal matrices must match those of transform_objects_scalar, and keep a normal
+// perpendicular to a tangent of the surface transformed by the model matrix. Packing is timed
+// against writing an ObjectBuffer_t per instance, as the one object per draw path does.
+//
+bool testInstancePacking()
+{
+	const int nbr_instances = 10000;
+	std::vector<instance_t> instances(nbr_instances);
+	srand(1);
+	auto frand = []() { return rand() / (float)RAND_MAX; };
+	for (auto& instance : instances)
+	{
+		instance.ModelToWorldMatrix = mat4f::translation(frand() * 100 - 50, frand() * 100 - 50, frand() * 100 - 50) *
+			mat4f::rotation(frand() * 2 * fPI, frand(), frand() + 0.1f, frand()) * mat4f::scaling(0.5f + frand(), 0.5f + frand(), 0.5f + frand());
+		instance.DiffuseColor = vec4f(frand(), frand(), frand(), 1);
+	}
+
+	std::vector<instance_data_t> packed(nbr_instances);
+	std::vector<ObjectBuffer_t> per_object(nbr_instances);
+	double pack_ms = 1e9, per_object_ms = 1e9;
+	for (int run = 0; run < 5; run++)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		pack_instances(instances.data(), instances.size(), packed.data());
+		auto t1 = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < nbr_instances; i++)
+		{
+			per_object[i].ModelToWorldMatrix = instances[i].ModelToWorldMatrix;
+			normal_matrix(instances[i].ModelToWorldMatrix, per_object[i].NormalMatrix);
+			per_object[i].LightDir = instances[i].DiffuseColor;
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+		pack_ms = std::min(pack_ms, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		per_object_ms = std::min(per_object_ms, std::chrono::duration<double, std::milli>(t2 - t1).count());
+	}
+
+	int differing = 0, normals_differing = 0, not_perpendicular = 0;
+	float max_color_error = 0;
+	for (int i = 0; i < nbr_instances; i++)
+	{
+		const mat4f& M = instances[i].ModelToWorldMatrix;
+		mat4f mvp, N;
+		transform_objects_scalar(mat4f_identity, &M, 1, &mvp, &N);
+		bool same_normal = true;
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				same_normal &= fabsf(packed[i].normal[r][c] - N.col[c].vec[r]) <= 1e-5f * (1 + fabsf(N.col[c].vec[r]));
+		normals_differing += !same_normal;
+
+		// a tangent and a normal of a surface, through the model and the packed normal matrix
+		vec3f t = normalize(vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f));
+		vec3f n = normalize(t % vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f));
+		vec3f wt = normalize((M * vec4f(t, 0)).xyz());
+		vec3f wn = normalize(vec3f(
+			packed[i].normal[0][0] * n.x + packed[i].normal[0][1] * n.y + packed[i].normal[0][2] * n.z,
+			packed[i].normal[1][0] * n.x + packed[i].normal[1][1] * n.y + packed[i].normal[1][2] * n.z,
+			packed[i].normal[2][0] * n.x + packed[i].normal[2][1] * n.y + packed[i].normal[2][2] * n.z));
+		not_perpendicular += fabsf(wt.dot(wn)) > 1e-4f;
+
+		instance_t unpacked = unpack_instance(packed[i]);
+		bool same = true;
+		for (int c = 0; c < 4; c++)
+			for (int k = 0; k < 4; k++)
+				same &= unpacked.ModelToWorldMatrix.col[c].vec[k] == instances[i].ModelToWorldMatrix.col[c].vec[k];
+		differing += !same;
+		for (int k = 0; k < 4; k++)
+			max_color_error = std::max(max_color_error, fabsf(unpacked.DiffuseColor.vec[k] - instances[i].DiffuseColor.vec[k]));
+	}
+
+	printf("Instance packing: %d instances, %d B each vs %d B of an object buffer, packed in %.3f ms vs %.3f ms, "
+		"%d transforms differ, %d normal matrices differ, %d normals not perpendicular, color error %.4f (at most %.4f)\n",
+		nbr_instances, (int)sizeof(instance_data_t), (int)sizeof(ObjectBuffer_t), pack_ms, per_object_ms,
+		differing, normals_differing, not_perpendicular, max_color_error, 0.5f / 255);
+	return differing == 0 && normals_differing == 0 && not_perpendicular == 0 && max_color_error <= 0.5f / 255 + 1e-6f;
+}
+
+//
+// Plain memory as the ring of a constant_ring_t, which keeps the frame that wrote each block of
+// CONSTANT_RING_ALIGNMENT bytes since the last discard, as the GPU may still read them
+//
+class mock_ring_buffer_t : public ring_buffer_t
+{
+public:
+	std::vector<uint8_t> memory;
+	std::vector<int> written;		// per block, by frame, -1 if free
+	unsigned maps = 0, discards = 0;
+
+	mock_ring_buffer_t(size_t capacity) : memory(capacity), written(capacity / CONSTANT_RING_ALIGNMENT, -1) { }
+
+	virtual void* map(bool discard)
+	{
+		maps++;
+		if (discard)
+		{
+			discards++;
+			std::fill(written.begin(), written.end(), -1);
+		}
+		return memory.data();
+	}
+	virtual void unmap() { }
+};
+
+//
+// 1000 frames of 1-200 objects of 4 materials through a 64 kB constant ring: every allocation
+// must be aligned and on blocks no frame wrote since the last discard, so nothing overlaps in a
+// frame or overwrites what an earlier frame may still draw with, the ring must discard only
+// when the rest is too small, allocations past what begin_frame was given must fail, and the
+// constants must read back as written. Reports bytes and maps per frame against mapping the
+// frame, material and object buffers.
+//
+bool testConstantRing()
+{
+	const size_t capacity = 1 << 16;
+	mock_ring_buffer_t buffer(capacity);
+	constant_ring_t ring(&buffer, capacity);
+
+	srand(1);
+	const int nbr_frames = 1000;
+	int misaligned = 0, overwrites = 0, wrong_discards = 0, wrong_values = 0, missed_failures = 0, objects = 0;
+	size_t bytes = 0, padded_bytes = 0, head = 0;
+	unsigned maps = 0;
+	FrameBuffer_t frame;
+	unsigned frame_offset = 0;
+	material_constants_t materials[4];
+	std::vector<object_constants_t> constants;
+
+	// what was allocated, to check and read back
+	struct allocation_t { unsigned offset; size_t size; const void* values; };
+	std::vector<allocation_t> allocations;
+
+	for (int f = 0; f < nbr_frames; f++)
+	{
+		constants.resize(1 + rand() % 200);
+		size_t frame_bytes = frame_constant_bytes(4, constants.size());
+		bool wraps = f == 0 || head + frame_bytes > capacity;
+		unsigned discards = buffer.discards;
+		allocations.clear();
+
+		ring.begin_frame(frame_bytes);
+		frame.WorldToViewMatrix = mat4f::translation((float)f, 0, 0);
+		frame.ProjectionMatrix = mat4f::scaling((float)f);
+		frame.LightColor = frame.CameraDir = float4((float)f, 1, 2, 3);
+		ring.write(frame, frame_offset);
+		allocations.push_back({ frame_offset, sizeof(FrameBuffer_t), &frame });
+		for (int m = 0; m < 4; m++)
+		{
+			PhongBuffer_t& p = materials[m].phong;
+			p.SpecularPower = p.SpecularColor = p.AmbientColor = p.DiffuseColor = float4((float)m, (float)f, 2, 0);
+			p.isSkybox = (float)(m & 1);
+			ring.write(p, materials[m].offset);
+			allocations.push_back({ materials[m].offset, sizeof(PhongBuffer_t), &p });
+		}
+		for (size_t i = 0; i < constants.size(); i++)
+		{
+			object_constants_t& c = constants[i];
+			c.object.ModelToWorldMatrix = mat4f::translation((float)f, (float)i, 0);
+			c.object.LightDir = float4((float)f, (float)i, 1, 0);
+			c.material = &materials[i % 4];
+			ring.write(c.object, c.offset);
+			allocations.push_back({ c.offset, sizeof(ObjectBuffer_t), &c.object });
+		}
+		unsigned offset;
+		missed_failures += ring.allocate(1, offset) != nullptr;
+		ring.end_frame();
+		wrong_discards += (buffer.discards != discards) != wraps;
+
+		for (auto& a : allocations)
+		{
+			misaligned += a.offset % CONSTANT_RING_ALIGNMENT != 0;
+			for (size_t b = a.offset / CONSTANT_RING_ALIGNMENT; b < (a.offset + padded_size(a.size)) / CONSTANT_RING_ALIGNMENT; b++)
+			{
+				overwrites += buffer.written[b] != -1;
+				buffer.written[b] = f;
+			}
+			wrong_values += memcmp(&buffer.memory[a.offset], a.values, a.size) != 0;
+		}
+		head = allocations.back().offset + padded_size(allocations.back().size);
+
+		objects += (int)constants.size();
+		bytes += ring.stats.bytes;
+		padded_bytes += ring.stats.padded_bytes;
+		maps += ring.stats.maps;
+	}
+
+	printf("Constant ring: %d frames of %.1f objects, %.0f bytes (%.0f padded) and %.2f maps per frame vs %.1f maps of each buffer, "
+		"%u discards, %d misaligned, %d overwrites, %d wrong discards, %d allocations past the frame, %d wrong values\n",
+		nbr_frames, objects / (double)nbr_frames, bytes / (double)nbr_frames, padded_bytes / (double)nbr_frames, maps / (double)nbr_frames,
+		1 + 4 + objects / (double)nbr_frames, buffer.discards, misaligned, overwrites, wrong_discards, missed_failures, wrong_values);
+	return misaligned == 0 && overwrites == 0 && wrong_discards == 0 && missed_failures == 0 && wrong_values == 0;
+}
+
+//
+// Constants uploaded per frame for objects drawn in material order, with the buffers of before
+// they were split by update frequency (model, view and projection matrices, a light buffer of
+// color, direction and camera, and a PhongBuffer_t, for each object) and with the split ones:
+// mapped per buffer, as d3d11_render_device_t maps them, and written through a constant ring,
+// for the scene of renderObjects and for 1000 objects of 16 materials. The rings must take
+// exactly the bytes of the buffers.
+//
+bool testConstantLayout()
+{
+	const size_t matrix_bytes = 3 * sizeof(mat4f), light_bytes = 3 * sizeof(float4);
+	const int scenes[][2] = { { 3, 2 }, { 1000, 16 } };	// objects, materials
+	bool passed = true;
+
+	for (auto& scene : scenes)
+	{
+		size_t objects = scene[0], materials = scene[1];
+		const size_t capacity = 1 << 20;
+		mock_ring_buffer_t old_buffer(capacity), split_buffer(capacity);
+		constant_ring_t old_ring(&old_buffer, capacity), split_ring(&split_buffer, capacity);
+
+		// before: everything per object
+		unsigned offset;
+		old_ring.begin_frame(objects * (padded_size(matrix_bytes) + padded_size(light_bytes) + padded_size(sizeof(PhongBuffer_t))));
+		for (size_t i = 0; i < objects; i++)
+		{
+			old_ring.allocate(matrix_bytes, offset);
+			old_ring.allocate(light_bytes, offset);
+			old_ring.allocate<PhongBuffer_t>(offset);
+		}
+		old_ring.end_frame();
+		size_t old_bytes = objects * (matrix_bytes + light_bytes + sizeof(PhongBuffer_t));
+		size_t old_maps = 3 * objects;
+
+		// split: the frame once, each material once and the model matrix per object
+		FrameBuffer_t frame = {};
+		std::vector<material_constants_t> material_constants(materials);
+		std::vector<object_constants_t> object_constants(objects);
+		split_ring.begin_frame(frame_constant_bytes(materials, objects));
+		split_ring.write(frame, offset);
+		for (auto& m : material_constants)
+			split_ring.write(m.phong, m.offset);
+		for (auto& c : object_constants)
+			split_ring.write(c.object, c.offset);
+		split_ring.end_frame();
+		size_t split_bytes = sizeof(FrameBuffer_t) + materials * sizeof(PhongBuffer_t) + objects * sizeof(ObjectBuffer_t);
+		size_t split_maps = 1 + materials + objects;
+
+		bool same = old_ring.stats.bytes == old_bytes && split_ring.stats.bytes == split_bytes && !old_ring.stats.failed && !split_ring.stats.failed;
+		printf("Constant layout, %d objects of %d materials: %d bytes in %d maps -> %d bytes in %d maps, "
+			"in a ring %d bytes (%d padded) -> %d bytes (%d padded)%s\n", (int)objects, (int)materials,
+			(int)old_bytes, (int)old_maps, (int)split_bytes, (int)split_maps, (int)old_ring.stats.bytes, (int)old_ring.stats.padded_bytes,
+			(int)split_ring.stats.bytes, (int)split_ring.stats.padded_bytes, same ? "" : ", RING BYTES DIFFER");
+		passed &= same;
+	}
+	return passed;
+}
+
+//
+// 100k and 3 random model matrices, scaled non-uniformly, through transform_objects, so the
+// last three go one at a time after the batches of four: the products must match P * V * M
+// and the normal matrices the upper 3x3 of the transposed inverse of M, as linalg::mat4f
+// computes them, relative to the largest element, and normals transformed with them must
+// stay perpendicular to tangents transformed with M, which M itself does not keep. Every
+// 1000th model scales x to zero and must keep its 3x3. Times the batch against the mat4f
+// products and inverse, and the scalar batch, over the first 1000 objects, which stay in the
+// cache as the objects of a frame would, 100 times, best of 5.
+//
+bool testObjectTransforms()
+{
+	const int nbr_objects = 100003;
+	srand(1);
+	auto frand = []() { return rand() / (float)RAND_MAX; };
+	std::vector<mat4f> models(nbr_objects);
+	for (int i = 0; i < nbr_objects; i++)
+	{
+		vec3f axis = vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f) + vec3f(0, 0.01f, 0);
+		axis.normalize();
+		models[i] = mat4f::translation(frand() * 100 - 50, frand() * 100 - 50, frand() * 100 - 50) *
+			mat4f::rotation(frand() * 2 * fPI, axis) * mat4f::scaling(i % 1000 == 999 ? 0 : 0.05f + frand() * 2, 0.05f + frand() * 2, 0.05f + frand() * 2);
+	}
+	auto singular = [](int i) { return i % 1000 == 999; };
+	camera_t cam(fPI / 4, 16 / 9.0f, 1.0f, 500.0f);
+	cam.moveTo({ 3, 4, 5 });
+	mat4f P = cam.get_ProjectionMatrix(), V = cam.get_WorldToViewMatrix();
+	mat4f VP = P * V;
+
+	std::vector<mat4f> mvps(nbr_objects), normals(nbr_objects), scalar_mvps(nbr_objects), scalar_normals(nbr_objects);
+	std::vector<mat4f> ref_mvps(nbr_objects), ref_normals(nbr_objects);
+	transform_objects(VP, models.data(), nbr_objects, mvps.data(), normals.data());
+	transform_objects_scalar(VP, models.data(), nbr_objects, scalar_mvps.data(), scalar_normals.data());
+	for (int i = 0; i < nbr_objects; i++)
+	{
+		ref_mvps[i] = VP * models[i];
+		ref_normals[i] = singular(i) ? models[i] : transpose(models[i].inverse());
+	}
+
+	const int timed_objects = 1000, repeats = 100;
+	double batch_ns = 1e9, scalar_ns = 1e9, ref_ns = 1e9;
+	std::vector<mat4f> timed_mvps(timed_objects), timed_normals(timed_objects);
+	for (int run = 0; run < 5; run++)
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < repeats; k++)
+			transform_objects(VP, models.data(), timed_objects, timed_mvps.data(), timed_normals.data());
+		auto t1 = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < repeats; k++)
+			transform_objects_scalar(VP, models.data(), timed_objects, timed_mvps.data(), timed_normals.data());
+		auto t2 = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < repeats; k++)
+			for (int i = 0; i < timed_objects; i++)
+			{
+				timed_mvps[i] = VP * models[i];
+				timed_normals[i] = transpose(models[i].inverse());
+			}
+		auto t3 = std::chrono::high_resolution_clock::now();
+		batch_ns = std::min(batch_ns, std::chrono::duration<double, std::nano>(t1 - t0).count() / (repeats * timed_objects));
+		scalar_ns = std::min(scalar_ns, std::chrono::duration<double, std::nano>(t2 - t1).count() / (repeats * timed_objects));
+		ref_ns = std::min(ref_ns, std::chrono::duration<double, std::nano>(t3 - t2).count() / (repeats * timed_objects));
+	}
+
+	// largest difference of a and b over the largest element of b, over the upper n x n
+	auto error = [](const mat4f& a, const mat4f& b, int n)
+	{
+		float diff = 0, size = 0;
+		for (int c = 0; c < n; c++)
+			for (int r = 0; r < n; r++)
+			{
+				diff = std::max(diff, fabsf(a.col[c].vec[r] - b.col[c].vec[r]));
+				size = std::max(size, fabsf(b.col[c].vec[r]));
+			}
+		return diff / size;
+	};
+
+	const float tolerance = 1e-5f;
+	float max_mvp_error = 0, max_normal_error = 0, max_normal_dot = 0;
+	int differing = 0, scalar_differing = 0, skewed = 0;
+	for (int i = 0; i < nbr_objects; i++)
+	{
+		float mvp_error = error(mvps[i], ref_mvps[i], 4), normal_error = error(normals[i], ref_normals[i], 3);
+		const mat4f& N = normals[i];
+		bool last = N.m14 == 0 && N.m24 == 0 && N.m34 == 0 && N.m41 == 0 && N.m42 == 0 && N.m43 == 0 && N.m44 == 1;
+		differing += mvp_error > tolerance || normal_error > tolerance || !last;
+		scalar_differing += error(scalar_mvps[i], ref_mvps[i], 4) > tolerance || error(scalar_normals[i], ref_normals[i], 3) > tolerance;
+		max_mvp_error = std::max(max_mvp_error, mvp_error);
+		max_normal_error = std::max(max_normal_error, normal_error);
+
+		// a normal and a tangent of it, transformed, where the model keeps them apart
+		if (singular(i))
+			continue;
+		vec3f n = vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f).normalize();
+		vec3f t = n % vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f);
+		t.normalize();
+		vec3f mt = (models[i] * vec4f(t, 0)).xyz().normalize();
+		max_normal_dot = std::max(max_normal_dot, fabsf((normals[i] * vec4f(n, 0)).xyz().normalize().dot(mt)));
+		skewed += fabsf((models[i] * vec4f(n, 0)).xyz().normalize().dot(mt)) > 0.01f;
+	}
+
+	printf("Object transforms: %d objects, %.2f ns each vs %.2f ns scalar and %.2f ns with mat4f products and inverse, "
+		"%d differ (%d scalar), error %.2g mvp %.2g normal, normals off tangents by %.2g vs %d of %d skewed by the model matrix\n",
+		nbr_objects, batch_ns, scalar_ns, ref_ns, differing, scalar_differing, max_mvp_error, max_normal_error, max_normal_dot, skewed, nbr_objects);
+	return differing == 0 && scalar_differing == 0 && max_normal_dot < 1e-3f;
+}
+
+//
+// mat4f with the SIMD of vec/mat_simd.h against linalg::scalar: products, matrix-vector
+// products, transposes and inverses of 100k random matrices, inverse_affine of as many
+// random rotations, translations and non-uniform scales (some mirrored), plus the identity,
+// a projection and a product in place. Transposes must be exact and the rest within 1e-5 of
+// the scalar result relative to its largest element, or 1e-3 for the general inverse, whose
+// rounding grows with the condition of the matrix; it is left out for determinants under
+// 1e-3, where neither is that close to the exact inverse.
+// Times each op against the scalar one, best of 5.
+//
+bool testMat4Simd()
+{
+	const int nbr_matrices = 100000;
+	srand(1);
+	auto frand = []() { return rand() / (float)RAND_MAX; };
+	std::vector<mat4f> general(nbr_matrices), affine(nbr_matrices);
+	std::vector<vec4f> vectors(nbr_matrices);
+	for (int i = 0; i < nbr_matrices; i++)
+	{
+		for (auto& e : general[i].array)
+			e = frand() * 2 - 1;
+		vec3f axis = vec3f(frand() - 0.5f, frand() - 0.5f, frand() - 0.5f) + vec3f(0, 0.01f, 0);
+		axis.normalize();
+		float mirror = i % 4 ? 1.0f : -1.0f;
+		affine[i] = mat4f::translation(frand() * 100 - 50, frand() * 100 - 50, frand() * 100 - 50) *
+			mat4f::rotation(frand() * 2 * fPI, axis) * mat4f::scaling(mirror * (0.05f + frand() * 2), 0.05f + frand() * 2, 0.05f + frand() * 2);
+		vectors[i] = vec4f(frand() * 2 - 1, frand() * 2 - 1, frand() * 2 - 1, frand() * 2 - 1);
+	}
+	camera_t cam(fPI / 4, 16 / 9.0f, 1.0f, 500.0f);
+	general[0] = mat4f_identity;
+	general[1] = cam.get_ProjectionMatrix();
+	affine[0] = mat4f_identity;
+
+	// largest difference of a and b over the largest element of b
+	auto error = [](const float* a, const float* b, int n)
+	{
+		float diff = 0, size = 0;
+		for (int i = 0; i < n; i++)
+		{
+			diff = std::max(diff, fabsf(a[i] - b[i]));
+			size = std::max(size, fabsf(b[i]));
+		}
+		return diff / size;
+	};
+
+	const float tolerance = 1e-5f, inverse_tolerance = 1e-3f;
+	float max_mul = 0, max_vec = 0, max_inverse = 0, max_affine = 0;
+	int differing = 0, near_singular = 0;
+	for (int i = 0; i < nbr_matrices; i++)
+	{
+		const mat4f& A = general[i];
+		const mat4f& B = general[(i + 1) % nbr_matrices];
+		float mul = error((A * B).array, scalar::mul(A, B).array, 16);
+		vec4f v = A * vectors[i], ref_v = scalar::mul(A, vectors[i]);
+		float vec = error(&v.x, &ref_v.x, 4);
+		bool singular = fabsf(A.determinant()) < 1e-3f;
+		float inverse = singular ? 0 : error(A.inverse().array, scalar::inverse(A).array, 16);
+		near_singular += singular;
+		float inverse_affine = error(affine[i].inverse_affine().array, scalar::inverse_affine(affine[i]).array, 16);
+		mat4f T = A, ref_T = A;
+		T.transpose();
+		scalar::transpose(ref_T);
+		mat4f C = A;
+		C = C * C;
+
+		differing += mul > tolerance || vec > tolerance || inverse > inverse_tolerance || inverse_affine > tolerance ||
+			memcmp(T.array, ref_T.array, sizeof(T.array)) || error(C.array, scalar::mul(A, A).array, 16) > tolerance;
+		max_mul = std::max(max_mul, mul);
+		max_vec = std::max(max_vec, vec);
+		max_inverse = std::max(max_inverse, inverse);
+		max_affine = std::max(max_affine, inverse_affine);
+	}
+	printf("mat4f SIMD: %d of %d differ from scalar, error %.2g product, %.2g vector, %.2g inverse (%d near singular left out), %.2g affine inverse\n",
+		differing, nbr_matrices, max_mul, max_vec, max_inverse, near_singular, max_affine);
+
+	// best of 5 runs of op over all matrices, in ms
+	std::vector<mat4f> results(nbr_matrices);
+	std::vector<vec4f> vector_results(nbr_matrices);
+	auto time = [&](const auto& op)
+	{
+		double best = 1e9;
+		for (int run = 0; run < 5; run++)
+		{
+			auto t0 = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < nbr_matrices; i++)
+				op(i);
+			auto t1 = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		}
+		return best;
+	};
+	const char* names[] = { "product", "vector", "transpose", "inverse", "affine inverse" };
+	double simd_ms[] = {
+		time([&](int i) { results[i] = general[i] * affine[i]; }),
+		time([&](int i) { vector_results[i] = general[i] * vectors[i]; }),
+		time([&](int i) { results[i] = transpose(general[i]); }),
+		time([&](int i) { results[i] = general[i].inverse(); }),
+		time([&](int i) { results[i] = affine[i].inverse_affine(); }) };
+	double scalar_ms[] = {
+		time([&](int i) { results[i] = scalar::mul(general[i], affine[i]); }),
+		time([&](int i) { vector_results[i] = scalar::mul(general[i], vectors[i]); }),
+		time([&](int i) { results[i] = general[i]; scalar::transpose(results[i]); }),
+		time([&](int i) { results[i] = scalar::inverse(general[i]); }),
+		time([&](int i) { results[i] = scalar::inverse_affine(affine[i]); }) };
+	for (int op = 0; op < 5; op++)
+		printf("mat4f SIMD: %d %s in %.2f ms vs %.2f ms scalar, %.1fx\n",
+			nbr_matrices, names[op], simd_ms[op], scalar_ms[op], scalar_ms[op] / simd_ms[op]);
+	return differing == 0;
+}
+
+//
+// 1000 random triangles rasterized one at a time into an occlusion buffer: every texel written
+// must lie wholly inside its triangle, with a depth no nearer than the triangle at any of its
+// corners, so occluders never cover more than they do on the screen
+//
+bool testOcclusionRaster()
+{
+	const int nbr_triangles = 1000;
+	srand(1);
+	auto frand = []() { return rand() / (float)RAND_MAX; };
+	occlusion_buffer_t buffer;
+	int outside = 0, nearer = 0;
+	size_t covered = 0;
+	for (int t = 0; t < nbr_triangles; t++)
+	{
+		vec3f tri[3];
+		double x[3], y[3], z[3];
+		for (int k = 0; k < 3; k++)
+		{
+			tri[k] = vec3f(frand() * 2.4f - 1.2f, frand() * 2.4f - 1.2f, frand() * 2 - 1);
+			x[k] = (tri[k].x * 0.5 + 0.5) * OCCLUSION_WIDTH;
+			y[k] = (0.5 - tri[k].y * 0.5) * OCCLUSION_HEIGHT;
+			z[k] = tri[k].z * 0.5 + 0.5;
+		}
+		double area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (fabs(area) < 1e-3)
+			continue;
+
+		buffer.clear();
+		buffer.rasterize(mat4f_identity, tri, 1);
+		for (int py = 0; py < OCCLUSION_HEIGHT; py++)
+			for (int px = 0; px < OCCLUSION_WIDTH; px++)
+			{
+				float d = buffer.depth[py * OCCLUSION_WIDTH + px];
+				if (d >= 1)
+					continue;
+				covered++;
+				bool in = true;
+				double farthest = 0;
+				for (int corner = 0; corner < 4; corner++)
+				{
+					double cx = px + (corner & 1), cy = py + (corner >> 1), w[3];
+					for (int i = 0; i < 3; i++)
+					{
+						int j = (i + 1) % 3, k = (i + 2) % 3;
+						w[i] = ((x[j] - cx) * (y[k] - cy) - (y[j] - cy) * (x[k] - cx)) / area;
+						in &= w[i] >= -1e-4;
+					}
+					farthest = std::max(farthest, w[0] * z[0] + w[1] * z[1] + w[2] * z[2]);
+				}
+				outside += !in;
+				nearer += in && d < farthest - 1e-5;
+			}
+	}
+
+	printf("Occlusion raster: %d triangles, %d texels covered, %d partly outside their triangle, %d nearer than it\n",
+		nbr_triangles, (int)covered, outside, nearer);
+	return outside == 0 && nearer == 0;
+}
+
+//
+// Occlusion culling of the ranges of a mesh, split at 4096 vertices, from a point above its
+// floor looking in eight directions, after frustum culling. The largest triangles are the
+// occluders. Every triangle of the mesh is rasterized as a reference: no occluded range may
+// have a pixel in front of it.
+//
+bool testOcclusionCulling(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	index_buffer_t ib;
+	build_index_buffer(mesh.drawcalls, ib, 4096);
+	std::vector<bounds_t> bounds;
+	compute_bounds(mesh.vertices, ib, ib.ranges, bounds);
+	bounds_t mesh_bounds = compute_bounds(mesh.vertices);
+
+	std::vector<vec3f> occluders;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	select_occluders(mesh.vertices, ib, ib.ranges, OCCLUSION_OCCLUDERS, occluders);
+	double select_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+
+	std::vector<std::vector<vec3f>> range_tris(ib.ranges.size());
+	std::vector<vec3f> all_tris;
+	for (size_t r = 0; r < ib.ranges.size(); r++)
+		for (size_t i = 0; i < ib.ranges[r].size; i++)
+			range_tris[r].push_back(mesh.vertices[ib.vertex(ib.ranges[r], i)].Pos);
+	for (auto& tris : range_tris)
+		all_tris.insert(all_tris.end(), tris.begin(), tris.end());
+
+	vec3f eye = mesh_bounds.sphere.center;
+	eye.y = mesh_bounds.box.min.y + (mesh_bounds.box.max.y - mesh_bounds.box.min.y) * 0.05f;
+	camera_t cam(fPI / 4, 2.0f, mesh_bounds.sphere.radius * 0.001f, mesh_bounds.sphere.radius * 4);
+	cam.moveTo(eye);
+
+	occlusion_buffer_t buffer, reference, own;
+	occlusion_stats_t total;
+	cull_stats_t culled;
+	int wrongly_occluded = 0;
+	std::vector<uint8_t> visible;
+	for (int view = 0; view < 8; view++)
+	{
+		cam.Rotate(fPI / 4, 0);
+		cam.UpdateMatrix();
+		mat4f clip = cam.get_ProjectionMatrix() * cam.get_WorldToViewMatrix();
+
+		culled += cull_boxes(extract_frustum(clip), bounds, visible);
+		buffer.clear();
+		buffer.rasterize(clip, occluders.data(), occluders.size() / 3);
+		buffer.build_hiz();
+		unsigned occluded = buffer.cull_boxes(clip, bounds, visible);
+		culled.visible -= occluded;
+		culled.occluded += occluded;
+
+		total.triangles += buffer.stats.triangles;
+		total.tested += buffer.stats.tested;
+		total.clear_ms += buffer.stats.clear_ms;
+		total.raster_ms += buffer.stats.raster_ms;
+		total.hiz_ms += buffer.stats.hiz_ms;
+		total.test_ms += buffer.stats.test_ms;
+
+		reference.clear();
+		reference.rasterize(clip, all_tris.data(), all_tris.size() / 3);
+		std::vector<uint8_t> in_frustum;
+		cull_boxes(extract_frustum(clip), bounds, in_frustum);
+		for (size_t r = 0; r < ib.ranges.size(); r++)
+		{
+			if (visible[r] || !in_frustum[r])
+				continue;
+			own.clear();
+			own.rasterize(clip, range_tris[r].data(), range_tris[r].size() / 3);
+			for (size_t i = 0; i < own.depth.size(); i++)
+				if (own.depth[i] < 1 && own.depth[i] <= reference.depth[i] + 1e-6f)
+				{
+					wrongly_occluded++;
+					break;
+				}
+		}
+	}
+
+	printf("Occlusion %s: %d occluders selected in %.2f ms, 8 views of %d ranges: %u visible, %u outside, %u occluded; "
+		"per view %.0f triangles, clear %.3f ms, raster %.3f ms, hiz %.3f ms, test %.3f ms for %.0f boxes; %d occluded with visible pixels\n",
+		file, (int)occluders.size() / 3, select_ms, (int)ib.ranges.size(), culled.visible, culled.culled, culled.occluded,
+		total.triangles / 8.0, total.clear_ms / 8, total.raster_ms / 8, total.hiz_ms / 8, total.test_ms / 8, total.tested / 8.0,
+		wrongly_occluded);
+	return wrongly_occluded == 0;
+}
+
+//
+// Scene hierarchy over a grid of city and hand instances, thousands of ranges split at 4096
+// vertices: time to build, to move the hand instances (one update per range and a full
+// refit) and to query eight views, against testing every box. Queries must find the same
+// ranges as the scalar test of every box.
+//
+bool testSceneBvh(const char* city_file, const char* hand_file)
+{
+	std::vector<aabb_t> model_boxes[2];
+	const char* files[] = { city_file, hand_file };
+	for (int f = 0; f < 2; f++)
+	{
+		mesh_t mesh;
+		mesh.load_obj(files[f]);
+		index_buffer_t ib;
+		build_index_buffer(mesh.drawcalls, ib, 4096);
+		std::vector<bounds_t> bounds;
+		compute_bounds(mesh.vertices, ib, ib.ranges, bounds);
+		for (auto& b : bounds)
+			model_boxes[f].push_back(b.box);
+	}
+
+	// city blocks 200 units apart, a hand above each, turned a little more for each instance
+	const int grid = 10;
+	std::vector<aabb_t> boxes;
+	std::vector<unsigned> hand_items;
+	auto place = [&](int f, int i, float angle)
+	{
+		mat4f M = mat4f::translation((i % grid) * 200.0f, f * 20.0f, (i / grid) * 200.0f) * mat4f::rotation(angle, 0.0f, 1.0f, 0.0f);
+		if (f)
+			M = M * mat4f::scaling(20.0f);
+		return M;
+	};
+	for (int i = 0; i < grid * grid; i++)
+		for (int f = 0; f < 2; f++)
+			for (auto& box : model_boxes[f])
+			{
+				if (f)
+					hand_items.push_back((unsigned)boxes.size());
+				boxes.push_back(transform_box(place(f, i, i * 0.1f), box));
+			}
+
+	bvh_t bvh;
+	auto t0 = std::chrono::high_resolution_clock::now();
+	bvh.build(boxes);
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	// rotate the hands
+	std::vector<aabb_t> moved = boxes;
+	for (size_t k = 0; k < hand_items.size(); k++)
+	{
+		int i = (int)(k / model_boxes[1].size());
+		moved[hand_items[k]] = transform_box(place(1, i, i * 0.1f + 1.0f), model_boxes[1][k % model_boxes[1].size()]);
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+	for (unsigned item : hand_items)
+		bvh.update(item, moved[item]);
+	auto t3 = std::chrono::high_resolution_clock::now();
+	bvh.boxes = moved;
+	bvh.refit();
+	auto t4 = std::chrono::high_resolution_clock::now();
+
+	camera_t cam(fPI / 4, 1.0f, 1.0f, 1000.0f);
+	cam.moveTo({ grid * 100.0f, 50.0f, grid * 100.0f });
+	double query_ms = 0, linear_ms = 0;
+	int differing = 0;
+	size_t found = 0;
+	for (int view = 0; view < 8; view++)
+	{
+		cam.Rotate(fPI / 4, 0);
+		cam.UpdateMatrix();
+		frustum_t frustum = extract_frustum(cam.get_ProjectionMatrix() * cam.get_WorldToViewMatrix());
+
+		std::vector<uint8_t> in_query(moved.size(), 0);
+		auto q0 = std::chrono::high_resolution_clock::now();
+		bvh.query(frustum, [&](unsigned item) { in_query[item] = 1; });
+		auto q1 = std::chrono::high_resolution_clock::now();
+		std::vector<uint8_t> in_linear(moved.size());
+		for (size_t i = 0; i < moved.size(); i++)
+			in_linear[i] = box_in_frustum(frustum, moved[i]);
+		auto q2 = std::chrono::high_resolution_clock::now();
+
+		query_ms += std::chrono::duration<double, std::milli>(q1 - q0).count();
+		linear_ms += std::chrono::duration<double, std::milli>(q2 - q1).count();
+		for (size_t i = 0; i < moved.size(); i++)
+		{
+			differing += in_query[i] != in_linear[i];
+			found += in_query[i];
+		}
+	}
+
+	auto ms = [](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b)
+	{
+		return std::chrono::duration<double, std::milli>(b - a).count();
+	};
+	printf("Scene BVH: %d ranges, %d nodes, depth %d, build %.2f ms, %d updates %.2f ms, refit %.2f ms, "
+		"query %.3f ms vs %.3f ms for all boxes, %.1f visible per view, %d differ\n", (int)boxes.size(), (int)bvh.nodes.size(),
+		bvh.depth(), ms(t0, t1), (int)hand_items.size(), ms(t2, t3), ms(t3, t4), query_ms / 8, linear_ms / 8, found / 8.0, differing);
+	return differing == 0;
+}
+
+//
+// Query stacks: a hierarchy over 100k identical boxes, split only at the median, and a chain
+// of 100 inner nodes made by hand, with a leaf beside each, deeper than query keeps on its
+// own stack, must both give every item
+//
+bool testBvhStack()
+{
+	aabb_t unit;
+	unit.min = vec3f(0, 0, 0);
+	unit.max = vec3f(1, 1, 1);
+	auto all = [](const aabb_t&) { return frustum_intersects; };
+
+	const unsigned nbr_boxes = 100000;
+	bvh_t median;
+	median.build(std::vector<aabb_t>(nbr_boxes, unit));
+	unsigned found_median = 0;
+	median.query(all, [&](unsigned) { found_median++; });
+
+	// inner node k (node 0, then 2k - 1) has the next one at 2k + 1 and the leaf of item k at
+	// 2k + 2; the last "inner" node is the leaf of item chain
+	const unsigned chain = 100;
+	bvh_t deep;
+	deep.boxes.assign(chain + 1, unit);
+	for (unsigned k = 0; k <= chain; k++)
+		deep.items.push_back(k);
+	deep.nodes.resize(2 * chain + 1);
+	for (unsigned k = 0; k < chain; k++)
+	{
+		deep.nodes[k ? 2 * k - 1 : 0].first = 2 * k + 1;
+		deep.nodes[2 * k + 2].first = k;
+		deep.nodes[2 * k + 2].count = 1;
+	}
+	deep.nodes[2 * chain - 1].first = chain;
+	deep.nodes[2 * chain - 1].count = 1;
+	deep.stack_size = chain + 2;
+	std::vector<unsigned> found_deep;
+	deep.query(all, [&](unsigned item) { found_deep.push_back(item); });
+	std::sort(found_deep.begin(), found_deep.end());
+	bool all_deep = found_deep.size() == chain + 1;
+	for (unsigned k = 0; all_deep && k <= chain; k++)
+		all_deep = found_deep[k] == k;
+
+	printf("BVH stack: %u identical boxes, depth %d, stack of %u, %u found; chain of %u nodes, stack of %u, %s\n",
+		nbr_boxes, median.depth(), median.stack_size, found_median, chain, deep.stack_size, all_deep ? "all found" : "ITEMS MISSED");
+	return found_median == nbr_boxes && median.stack_size > (unsigned)median.depth() && all_deep;
+}
+
+//
+// Frustum culling of the ranges of a mesh, split at 4096 vertices, from the center of the mesh
+// looking in eight directions. The SIMD batch test is compared to the scalar one, no culled
+// range may have a vertex inside the frustum, and a counting stub stands in for DrawIndexed.
+//
+bool testFrustumCulling(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+
+	index_buffer_t ib;
+	build_index_buffer(mesh.drawcalls, ib, 4096);
+	std::vector<bounds_t> bounds;
+	compute_bounds(mesh.vertices, ib, ib.ranges, bounds);
+	bounds_t mesh_bounds = compute_bounds(mesh.vertices);
+
+	camera_t cam(fPI / 4, 1.0f, mesh_bounds.sphere.radius * 0.01f, mesh_bounds.sphere.radius * 4);
+	cam.moveTo(mesh_bounds.sphere.center);
+
+	int differing = 0, wrongly_culled = 0;
+	cull_stats_t total;
+	size_t draws = 0, drawn_indices = 0;
+	double ms = 0;
+	std::vector<uint8_t> visible;
+	for (int view = 0; view < 8; view++)
+	{
+		cam.Rotate(fPI / 4, 0);
+		cam.UpdateMatrix();
+		mat4f clip = cam.get_ProjectionMatrix() * cam.get_WorldToViewMatrix();
+		frustum_t frustum = extract_frustum(clip);
+
+		const int repeats = 1000;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		cull_stats_t stats;
+		for (int i = 0; i < repeats; i++)
+			stats = cull_boxes(frustum, bounds, visible);
+		ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count() / repeats;
+		total += stats;
+
+		draw_visible(ib.ranges, visible, [&](const index_range_t& range)
+		{
+			draws++;
+			drawn_indices += range.size;
+		});
+
+		for (size_t r = 0; r < ib.ranges.size(); r++)
+		{
+			if (visible[r] != box_in_frustum(frustum, bounds[r].box))
+				differing++;
+			if (visible[r])
+				continue;
+			for (size_t i = 0; i < ib.ranges[r].size; i++)
+			{
+				vec4f p = clip * vec4f(mesh.vertices[ib.vertex(ib.ranges[r], i)].Pos, 1);
+				if (fabsf(p.x) <= p.w && fabsf(p.y) <= p.w && fabsf(p.z) <= p.w)
+				{
+					wrongly_culled++;
+					break;
+				}
+			}
+		}
+	}
+
+	printf("Frustum %s: %d ranges in 8 views, %u visible %u culled, %.4f ms per view, %d draws of %.1f%% of the indices, "
+		"%d differ from the scalar test, %d culled with visible vertices\n", file, (int)ib.ranges.size(), total.visible,
+		total.culled, ms / 8, (int)draws, 100.0 * drawn_indices / (8.0 * ib.count()), differing, wrongly_culled);
+	return differing == 0 && wrongly_culled == 0;
+}
+
+//
+// The same mesh from one and from several parsing threads, from the streaming loader and from
+// a round trip through the binary cache, which must not be taken for a load with other options
+//
+bool testParser(const char* file)
+{
+	mesh_t single, threaded, streamed, cached, untriangulated;
+	single.load_obj(file, true, true, 1);
+	threaded.load_obj(file, true, true, 8);
+	streamed.load_obj_streaming(file);
+	std::string cachefile = std::string(file) + ".tests" + MESH_CACHE_SUFFIX;
+	single.save_cache(file, cachefile);
+	bool same_threaded = meshesEqual(single, threaded), same_streamed = meshesEqual(single, streamed);
+	bool same_cached = cached.load_cache(file, cachefile) && meshesEqual(single, cached);
+	bool keyed = !untriangulated.load_cache(file, cachefile, true, false);
+	printf("Parser %s: threaded %s, streaming %s (peak load memory %.1f MB -> %.1f MB), cache %s, %s\n", file,
+		same_threaded ? "identical" : "DIFFERS", same_streamed ? "identical" : "DIFFERS",
+		single.peak_load_memory / 1048576.0, streamed.peak_load_memory / 1048576.0,
+		same_cached ? "identical" : "DIFFERS", keyed ? "keyed by the load options" : "LOADED FOR OTHER OPTIONS");
+	return same_threaded && same_streamed && same_cached && keyed;
+}
+
+//
+// Damaged caches with a valid header and key must not load: truncated at 64 lengths, with
+// trailing bytes, with a drawcall count larger than the file, and saved from meshes with a
+// triangle past the vertices, a material past the materials, a meshlet past its vertices and
+// a meshlet index past the vertices of its meshlet, with meshlets built whatever
+// MESH_BUILD_MESHLETS is
+//
+bool testCacheValidation(const char* file)
+{
+	mesh_t mesh;
+	mesh.load_obj(file);
+	for (auto& dc : mesh.drawcalls)
+		if (dc.meshlets.empty())
+			build_meshlets(mesh.vertices, dc);
+	std::string cachefile = std::string(file) + ".tests" + MESH_CACHE_SUFFIX;
+	mesh.save_cache(file, cachefile);
+	std::ifstream in(cachefile.c_str(), std::ios::binary);
+	std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+
+	// bytes up to the vertices and the drawcall count, see the layout above hash_bytes in mesh.cpp
+	size_t header = 8 + 4 + 4 + 8 + 4 + 4 + 4;
+	for (auto& f : mesh.mtl_files)
+		header += 4 + f.size();
+	size_t drawcall_count = header + 4 + mesh.vertices.size() * sizeof(vertex_t);
+
+	auto loads_bytes = [&](const std::vector<char>& damaged)
+	{
+		std::ofstream out(cachefile.c_str(), std::ios::binary | std::ios::trunc);
+		out.write(damaged.data(), damaged.size());
+		out.close();
+		mesh_t cached;
+		return cached.load_cache(file, cachefile);
+	};
+	auto loads_mesh = [&](const mesh_t& damaged)
+	{
+		damaged.save_cache(file, cachefile);
+		mesh_t cached;
+		return cached.load_cache(file, cachefile);
+	};
+
+	bool intact = loads_bytes(bytes);
+	int loaded = 0, damages = 0;
+	for (int i = 0; i < 64; i++, damages++)
+		loaded += loads_bytes(std::vector<char>(bytes.begin(), bytes.begin() + header + (bytes.size() - header) * i / 64));
+	std::vector<char> damaged_bytes = bytes;
+	damaged_bytes.push_back(0);
+	loaded += loads_bytes(damaged_bytes);
+	damaged_bytes = bytes;
+	memset(&damaged_bytes[drawcall_count], 0xFF, 4);
+	loaded += loads_bytes(damaged_bytes);
+	damages += 2;
+
+	auto dc = std::find_if(mesh.drawcalls.begin(), mesh.drawcalls.end(), [](const drawcall_t& dc) { return dc.tris.size() && dc.meshlets.size(); });
+	if (dc != mesh.drawcalls.end())
+	{
+		size_t d = dc - mesh.drawcalls.begin();
+		mesh_t damaged = mesh;
+		damaged.drawcalls[d].tris[0].vi[0] = (unsigned)mesh.vertices.size();
+		loaded += loads_mesh(damaged);
+		damaged = mesh;
+		damaged.drawcalls[d].mtl_index = (int)mesh.materials.size();
+		loaded += loads_mesh(damaged);
+		damaged = mesh;
+		damaged.drawcalls[d].meshlets.back().vertex_offset = (unsigned)dc->meshlet_vertices.size();
+		loaded += loads_mesh(damaged);
+		damaged = mesh;
+		damaged.drawcalls[d].meshlet_indices[0] = (uint8_t)dc->meshlets[0].vertex_count;
+		loaded += loads_mesh(damaged);
+		damages += 4;
+	}
+
+	printf("Cache validation %s: intact %s, %d of %d damaged caches loaded\n", file, intact ? "loaded" : "NOT LOADED", loaded, damages);
+	return intact && damages == 70 && loaded == 0;
+}
+
+int main()
+{
+	const char* files[] = {
+		"../../assets/city/city.obj",
+		"../../assets/hand/hand.obj",
+		"../../assets/crytek-sponza/banner.obj" };
+
+	int checks = 0, failed = 0;
+	auto check = [&](bool passed)
+	{
+		checks++;
+		failed += !passed;
+	};
+
+	for (auto file : files)
+		check(testParser(file));
+	check(testCacheValidation(files[1]));
+
+	// vertex welding and normal generation, against the old hash map and binning
+	for (auto file : files)
+		check(mesh_t::benchmark_welding(file));
+	check(mesh_t::benchmark_normals(files[0]));
+
+	// tangent frames on sponza (banner) and city against the reference
+	check(testTangentFrames(files[2]));
+	check(testTangentFrames(files[0]));
+
+	for (auto file : files)
+	{
+		check(testPackedVertices(file));
+		check(testIndexBuffers(file));
+		check(testBatching(file));
+		check(testMeshlets(file));
+		check(testBounds(file));
+		check(testFrustumCulling(file));
+	}
+	check(testSceneBvh(files[0], files[1]));
+	check(testBvhStack());
+	check(testOcclusionRaster());
+	check(testOcclusionCulling(files[0]));
+	check(testRenderQueue());
+	check(testStateCache());
+	check(testInstancePacking());
+	check(testConstantRing());
+	check(testConstantLayout());
+	check(testObjectTransforms());
+	check(testMat4Simd());
+
+	// reports only
+	reportVertexCache();
+	for (auto file : files)
+	{
+		reportLods(file);
+		reportStateCache(file);
+	}
+
+	printf("%d of %d checks failed\n", failed, checks);
+	return failed ? 1 : 0;
+}
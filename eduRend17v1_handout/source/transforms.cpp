@@ -0,0 +1,209 @@
+//
+//  transforms.cpp
+//
+
+#include "transforms.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TRANSFORMS_SSE
+#include <emmintrin.h>
+#endif
+
+//
+// The columns of the inverse transpose of a 3x3 with columns a0, a1, a2 are the cross
+// products a1 x a2, a2 x a0 and a0 x a1 over the determinant a0 . (a1 x a2)
+//
+static void normal_matrix_scalar(const mat4f& M, mat4f& N)
+{
+	vec3f a0 = M.col[0].xyz(), a1 = M.col[1].xyz(), a2 = M.col[2].xyz();
+	vec3f c0 = a1 % a2, c1 = a2 % a0, c2 = a0 % a1;
+	float det = a0.dot(c0);
+	if (det == 0)
+	{
+		N = M;
+		N.col[3] = vec4f(0, 0, 0, 1);
+		return;
+	}
+	float idet = 1 / det;
+	N.col[0] = vec4f(c0 * idet, 0);
+	N.col[1] = vec4f(c1 * idet, 0);
+	N.col[2] = vec4f(c2 * idet, 0);
+	N.col[3] = vec4f(0, 0, 0, 1);
+}
+
+void transform_objects_scalar(const mat4f& view_projection, const mat4f* models, size_t count, mat4f* mvps, mat4f* normals)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		mvps[i] = view_projection * models[i];
+		normal_matrix_scalar(models[i], normals[i]);
+	}
+}
+
+#ifdef TRANSFORMS_SSE
+
+#define SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+
+// xyz of a x b, w 0
+static inline __m128 cross(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(
+		_mm_mul_ps(SHUFFLE(a, 1, 2, 0, 3), SHUFFLE(b, 2, 0, 1, 3)),
+		_mm_mul_ps(SHUFFLE(a, 2, 0, 1, 3), SHUFFLE(b, 1, 2, 0, 3)));
+}
+
+// as normal_matrix_scalar, from the first three columns m0, m1, m2 of M, with w 0 in the
+// columns and cross products
+static inline void normal_matrix_sse(__m128 m0, __m128 m1, __m128 m2, const mat4f& M, mat4f& N)
+{
+	const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 a0 = _mm_and_ps(m0, xyz), a1 = _mm_and_ps(m1, xyz), a2 = _mm_and_ps(m2, xyz);
+	__m128 c0 = cross(a1, a2), c1 = cross(a2, a0), c2 = cross(a0, a1);
+	__m128 d = _mm_mul_ps(a0, c0);
+	d = _mm_add_ps(d, SHUFFLE(d, 1, 0, 3, 2));
+	d = _mm_add_ps(d, SHUFFLE(d, 2, 3, 0, 1));
+	if (_mm_cvtss_f32(d) == 0)
+	{
+		normal_matrix_scalar(M, N);
+		return;
+	}
+	__m128 idet = _mm_div_ps(_mm_set1_ps(1), d);
+	_mm_storeu_ps(&N.col[0].x, _mm_mul_ps(c0, idet));
+	_mm_storeu_ps(&N.col[1].x, _mm_mul_ps(c1, idet));
+	_mm_storeu_ps(&N.col[2].x, _mm_mul_ps(c2, idet));
+	_mm_storeu_ps(&N.col[3].x, _mm_set_ps(1, 0, 0, 0));
+}
+
+void normal_matrix(const mat4f& M, mat4f& N)
+{
+	normal_matrix_sse(_mm_loadu_ps(&M.col[0].x), _mm_loadu_ps(&M.col[1].x), _mm_loadu_ps(&M.col[2].x), M, N);
+}
+
+// mvps[i] and normals[i] of one object, with SSE over the columns of its matrices
+static inline void transform_object_sse(__m128 v0, __m128 v1, __m128 v2, __m128 v3, const mat4f& M, mat4f& mvp, mat4f& N)
+{
+	__m128 m[4];
+	for (int c = 0; c < 4; c++)
+	{
+		// column c of view_projection * M: the columns of view_projection weighted by column c of M
+		m[c] = _mm_loadu_ps(&M.col[c].x);
+		__m128 r = _mm_mul_ps(v0, SHUFFLE(m[c], 0, 0, 0, 0));
+		r = _mm_add_ps(r, _mm_mul_ps(v1, SHUFFLE(m[c], 1, 1, 1, 1)));
+		r = _mm_add_ps(r, _mm_mul_ps(v2, SHUFFLE(m[c], 2, 2, 2, 2)));
+		r = _mm_add_ps(r, _mm_mul_ps(v3, SHUFFLE(m[c], 3, 3, 3, 3)));
+		_mm_storeu_ps(&mvp.col[c].x, r);
+	}
+	normal_matrix_sse(m[0], m[1], m[2], M, N);
+}
+
+// column c of view_projection * model for four affine models, into each mvps[j], from
+// elements 0, 1 and 2 of column c of the models in m0, m1 and m2 (the last is 0, or 1 for
+// the translation), with vp[r][k] element r, k of view_projection in every lane
+static inline void transform_column4(const __m128 (&vp)[4][4], __m128 m0, __m128 m1, __m128 m2, bool translation, int c, mat4f* mvps)
+{
+	__m128 out[4];
+	for (int r = 0; r < 4; r++)
+	{
+		__m128 e = _mm_add_ps(_mm_mul_ps(vp[r][0], m0), _mm_mul_ps(vp[r][1], m1));
+		e = _mm_add_ps(e, _mm_mul_ps(vp[r][2], m2));
+		out[r] = translation ? _mm_add_ps(e, vp[r][3]) : e;
+	}
+	_MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+	for (int j = 0; j < 4; j++)
+		_mm_storeu_ps(&mvps[j].col[c].x, out[j]);
+}
+
+// x, y, z of column c of the normal matrices of four models in each normals[j]
+static inline void store_column4(__m128 x, __m128 y, __m128 z, int c, mat4f* normals)
+{
+	__m128 w = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(&normals[0].col[c].x, x);
+	_mm_storeu_ps(&normals[1].col[c].x, y);
+	_mm_storeu_ps(&normals[2].col[c].x, z);
+	_mm_storeu_ps(&normals[3].col[c].x, w);
+}
+
+//
+// Four objects per iteration: their model matrices are transposed so that each register
+// holds one element of all four. The products and cross products then run on the four
+// objects at once with no shuffles, and are transposed back on the way out. The objects
+// left over go one at a time.
+//
+void transform_objects(const mat4f& view_projection, const mat4f* models, size_t count, mat4f* mvps, mat4f* normals)
+{
+	__m128 vp[4][4];
+	for (int k = 0; k < 4; k++)
+		for (int r = 0; r < 4; r++)
+			vp[r][k] = _mm_set1_ps((&view_projection.col[k].x)[r]);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const mat4f* M = models + i;
+
+		// column c of the four models, transposed: ac.x, ac.y and ac.z of each
+		__m128 a0x = _mm_loadu_ps(&M[0].col[0].x), a0y = _mm_loadu_ps(&M[1].col[0].x);
+		__m128 a0z = _mm_loadu_ps(&M[2].col[0].x), a0w = _mm_loadu_ps(&M[3].col[0].x);
+		_MM_TRANSPOSE4_PS(a0x, a0y, a0z, a0w);
+		transform_column4(vp, a0x, a0y, a0z, false, 0, mvps + i);
+
+		__m128 a1x = _mm_loadu_ps(&M[0].col[1].x), a1y = _mm_loadu_ps(&M[1].col[1].x);
+		__m128 a1z = _mm_loadu_ps(&M[2].col[1].x), a1w = _mm_loadu_ps(&M[3].col[1].x);
+		_MM_TRANSPOSE4_PS(a1x, a1y, a1z, a1w);
+		transform_column4(vp, a1x, a1y, a1z, false, 1, mvps + i);
+
+		__m128 a2x = _mm_loadu_ps(&M[0].col[2].x), a2y = _mm_loadu_ps(&M[1].col[2].x);
+		__m128 a2z = _mm_loadu_ps(&M[2].col[2].x), a2w = _mm_loadu_ps(&M[3].col[2].x);
+		_MM_TRANSPOSE4_PS(a2x, a2y, a2z, a2w);
+		transform_column4(vp, a2x, a2y, a2z, false, 2, mvps + i);
+
+		__m128 tx = _mm_loadu_ps(&M[0].col[3].x), ty = _mm_loadu_ps(&M[1].col[3].x);
+		__m128 tz = _mm_loadu_ps(&M[2].col[3].x), tw = _mm_loadu_ps(&M[3].col[3].x);
+		_MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+		transform_column4(vp, tx, ty, tz, true, 3, mvps + i);
+
+		// a1 x a2, a2 x a0 and a0 x a1 over a0 . (a1 x a2), as in normal_matrix_scalar
+		__m128 c0x = _mm_sub_ps(_mm_mul_ps(a1y, a2z), _mm_mul_ps(a1z, a2y));
+		__m128 c0y = _mm_sub_ps(_mm_mul_ps(a1z, a2x), _mm_mul_ps(a1x, a2z));
+		__m128 c0z = _mm_sub_ps(_mm_mul_ps(a1x, a2y), _mm_mul_ps(a1y, a2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0x, c0x), _mm_mul_ps(a0y, c0y)), _mm_mul_ps(a0z, c0z));
+		__m128 idet = _mm_div_ps(_mm_set1_ps(1), det);
+		store_column4(_mm_mul_ps(c0x, idet), _mm_mul_ps(c0y, idet), _mm_mul_ps(c0z, idet), 0, normals + i);
+		store_column4(
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a2y, a0z), _mm_mul_ps(a2z, a0y)), idet),
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a2z, a0x), _mm_mul_ps(a2x, a0z)), idet),
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a2x, a0y), _mm_mul_ps(a2y, a0x)), idet), 1, normals + i);
+		store_column4(
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a0y, a1z), _mm_mul_ps(a0z, a1y)), idet),
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a0z, a1x), _mm_mul_ps(a0x, a1z)), idet),
+			_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(a0x, a1y), _mm_mul_ps(a0y, a1x)), idet), 2, normals + i);
+		for (int j = 0; j < 4; j++)
+			_mm_storeu_ps(&normals[i + j].col[3].x, _mm_set_ps(1, 0, 0, 0));
+
+		// models that scale to zero keep their 3x3
+		int singular = _mm_movemask_ps(_mm_cmpeq_ps(det, _mm_setzero_ps()));
+		for (int j = 0; singular; j++, singular >>= 1)
+			if (singular & 1)
+				normal_matrix_scalar(M[j], normals[i + j]);
+	}
+
+	__m128 v0 = _mm_loadu_ps(&view_projection.col[0].x), v1 = _mm_loadu_ps(&view_projection.col[1].x);
+	__m128 v2 = _mm_loadu_ps(&view_projection.col[2].x), v3 = _mm_loadu_ps(&view_projection.col[3].x);
+	for (; i < count; i++)
+		transform_object_sse(v0, v1, v2, v3, models[i], mvps[i], normals[i]);
+}
+
+#else
+
+void normal_matrix(const mat4f& M, mat4f& N)
+{
+	normal_matrix_scalar(M, N);
+}
+
+void transform_objects(const mat4f& view_projection, const mat4f* models, size_t count, mat4f* mvps, mat4f* normals)
+{
+	transform_objects_scalar(view_projection, models, count, mvps, normals);
+}
+
+#endif
@@ -0,0 +1,40 @@
+//
+//  transforms.h
+//
+//  Model-view-projection and normal matrices of objects, computed on the CPU once per object
+//  instead of for every vertex in the vertex shader
+//
+
+#pragma once
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <cstddef>
+#include "vec\vec.h"
+#include "vec\mat.h"
+
+using namespace linalg;
+
+//
+// For count objects:
+//
+// mvps[i]:		view_projection * models[i], with view_projection = projection * world to view
+// normals[i]:	the inverse transpose of the upper 3x3 of models[i], which keeps normals
+//				perpendicular to the surface under non-uniform scale, with 0, 0, 0, 1 in the
+//				last row and column. The 3x3 of a model that scales to zero is kept.
+//
+// Four objects at a time with SSE where available. models[i] must be affine (last row 0, 0, 0, 1).
+//
+void transform_objects(const mat4f& view_projection, const mat4f* models, size_t count, mat4f* mvps, mat4f* normals);
+
+//
+// normals[i] of transform_objects for one model matrix, e.g. of an instance
+//
+void normal_matrix(const mat4f& M, mat4f& N);
+
+//
+// The same without SSE, for reference
+//
+void transform_objects_scalar(const mat4f& view_projection, const mat4f* models, size_t count, mat4f* mvps, mat4f* normals);
+
+#endif
@@ -40,12 +40,4 @@ namespace linalg
     }
     // explicit template specialisation for <float>
     template vec3<float> mat3<float>::operator*(const vec3<float> &v) const;
-    
-    template <class T>
-    vec4<T> mat4<T>::operator *(const vec4<T> &v) const
-    {
-        return col[0]*v.x + col[1]*v.y + col[2]*v.z + col[3]*v.w;
-    }
-    // explicit template specialisation for <float>
-    template vec4<float> mat4<float>::operator *(const vec4<float> &v) const;
 }
\ No newline at end of file
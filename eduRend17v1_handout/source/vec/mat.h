@@ -291,6 +291,21 @@ namespace linalg
         return out;
     }
     
+    template<class T> class mat4;
+    
+    //
+    // mat4 operations without SIMD: what mat4<T> does, and mat4<float> where mat_simd.h has
+    // nothing faster; for reference in tests
+    //
+    namespace scalar
+    {
+        template<class T> mat4<T> mul(const mat4<T>& a, const mat4<T>& b);
+        template<class T> vec4<T> mul(const mat4<T>& m, const vec4<T>& v);
+        template<class T> void transpose(mat4<T>& m);
+        template<class T> mat4<T> inverse(const mat4<T>& m);
+        template<class T> mat4<T> inverse_affine(const mat4<T>& m);
+    }
+    
 	//
 	// 4D column-major matrix
 	//
@@ -349,38 +364,21 @@ namespace linalg
         
         void transpose()
         {
-            std::swap(m21, m12);
-            std::swap(m31, m13);
-            std::swap(m32, m23);
-            std::swap(m41, m14);
-            std::swap(m42, m24);
-            std::swap(m43, m34);
+            scalar::transpose(*this);
         }
         
         mat4<T> inverse() const
         {
-            T det = determinant();
-            assert(abs(det) > 1e-8);
-            T idet = 1.0/det;
-            
-            mat4<T> M = mat4<T>(m23 * m34 * m42 - m24 * m33 * m42 + m24 * m32 * m43 - m22 * m34 * m43 - m23 * m32 * m44 + m22 * m33 * m44,
-                                m14 * m33 * m42 - m13 * m34 * m42 - m14 * m32 * m43 + m12 * m34 * m43 + m13 * m32 * m44 - m12 * m33 * m44,
-                                m13 * m24 * m42 - m14 * m23 * m42 + m14 * m22 * m43 - m12 * m24 * m43 - m13 * m22 * m44 + m12 * m23 * m44,
-                                m14 * m23 * m32 - m13 * m24 * m32 - m14 * m22 * m33 + m12 * m24 * m33 + m13 * m22 * m34 - m12 * m23 * m34,
-                                m24 * m33 * m41 - m23 * m34 * m41 - m24 * m31 * m43 + m21 * m34 * m43 + m23 * m31 * m44 - m21 * m33 * m44,
-                                m13 * m34 * m41 - m14 * m33 * m41 + m14 * m31 * m43 - m11 * m34 * m43 - m13 * m31 * m44 + m11 * m33 * m44,
-                                m14 * m23 * m41 - m13 * m24 * m41 - m14 * m21 * m43 + m11 * m24 * m43 + m13 * m21 * m44 - m11 * m23 * m44,
-                                m13 * m24 * m31 - m14 * m23 * m31 + m14 * m21 * m33 - m11 * m24 * m33 - m13 * m21 * m34 + m11 * m23 * m34,
-                                m22 * m34 * m41 - m24 * m32 * m41 + m24 * m31 * m42 - m21 * m34 * m42 - m22 * m31 * m44 + m21 * m32 * m44,
-                                m14 * m32 * m41 - m12 * m34 * m41 - m14 * m31 * m42 + m11 * m34 * m42 + m12 * m31 * m44 - m11 * m32 * m44,
-                                m12 * m24 * m41 - m14 * m22 * m41 + m14 * m21 * m42 - m11 * m24 * m42 - m12 * m21 * m44 + m11 * m22 * m44,
-                                m14 * m22 * m31 - m12 * m24 * m31 - m14 * m21 * m32 + m11 * m24 * m32 + m12 * m21 * m34 - m11 * m22 * m34,
-                                m23 * m32 * m41 - m22 * m33 * m41 - m23 * m31 * m42 + m21 * m33 * m42 + m22 * m31 * m43 - m21 * m32 * m43,
-                                m12 * m33 * m41 - m13 * m32 * m41 + m13 * m31 * m42 - m11 * m33 * m42 - m12 * m31 * m43 + m11 * m32 * m43,
-                                m13 * m22 * m41 - m12 * m23 * m41 - m13 * m21 * m42 + m11 * m23 * m42 + m12 * m21 * m43 - m11 * m22 * m43,
-                                m12 * m23 * m31 - m13 * m22 * m31 + m13 * m21 * m32 - m11 * m23 * m32 - m12 * m21 * m33 + m11 * m22 * m33);
-            
-            return M*idet;
+            return scalar::inverse(*this);
+        }
+        
+        //
+        // inverse of an affine matrix (last row 0, 0, 0, 1), e.g. a model or view matrix:
+        // the inverse of the upper 3x3 and the translation taken back through it
+        //
+        mat4<T> inverse_affine() const
+        {
+            return scalar::inverse_affine(*this);
         }
         
         T determinant() const
@@ -449,28 +447,13 @@ namespace linalg
         
         mat4<T> operator *(const mat4<T>& m) const
         {
-            return mat4<T>(m11 * m.m11 + m12 * m.m21 + m13 * m.m31 + m14 * m.m41,
-                           m11 * m.m12 + m12 * m.m22 + m13 * m.m32 + m14 * m.m42,
-                           m11 * m.m13 + m12 * m.m23 + m13 * m.m33 + m14 * m.m43,
-                           m11 * m.m14 + m12 * m.m24 + m13 * m.m34 + m14 * m.m44,
-                           
-                           m21 * m.m11 + m22 * m.m21 + m23 * m.m31 + m24 * m.m41,
-                           m21 * m.m12 + m22 * m.m22 + m23 * m.m32 + m24 * m.m42,
-                           m21 * m.m13 + m22 * m.m23 + m23 * m.m33 + m24 * m.m43,
-                           m21 * m.m14 + m22 * m.m24 + m23 * m.m34 + m24 * m.m44,
-                           
-                           m31 * m.m11 + m32 * m.m21 + m33 * m.m31 + m34 * m.m41,
-                           m31 * m.m12 + m32 * m.m22 + m33 * m.m32 + m34 * m.m42,
-                           m31 * m.m13 + m32 * m.m23 + m33 * m.m33 + m34 * m.m43,
-                           m31 * m.m14 + m32 * m.m24 + m33 * m.m34 + m34 * m.m44,
-                           
-                           m41 * m.m11 + m42 * m.m21 + m43 * m.m31 + m44 * m.m41,
-                           m41 * m.m12 + m42 * m.m22 + m43 * m.m32 + m44 * m.m42,
-                           m41 * m.m13 + m42 * m.m23 + m43 * m.m33 + m44 * m.m43,
-                           m41 * m.m14 + m42 * m.m24 + m43 * m.m34 + m44 * m.m44);
+            return scalar::mul(*this, m);
         }
         
-        vec4<T> operator *(const vec4<T> &v) const;
+        vec4<T> operator *(const vec4<T> &v) const
+        {
+            return scalar::mul(*this, v);
+        }
         
         static mat4<T> translation(const vec3<T>& p)
         {
@@ -634,6 +617,97 @@ namespace linalg
         
     };
     
+    namespace scalar
+    {
+        template<class T>
+        inline mat4<T> mul(const mat4<T>& a, const mat4<T>& b)
+        {
+            return mat4<T>(a.m11 * b.m11 + a.m12 * b.m21 + a.m13 * b.m31 + a.m14 * b.m41,
+                           a.m11 * b.m12 + a.m12 * b.m22 + a.m13 * b.m32 + a.m14 * b.m42,
+                           a.m11 * b.m13 + a.m12 * b.m23 + a.m13 * b.m33 + a.m14 * b.m43,
+                           a.m11 * b.m14 + a.m12 * b.m24 + a.m13 * b.m34 + a.m14 * b.m44,
+                           
+                           a.m21 * b.m11 + a.m22 * b.m21 + a.m23 * b.m31 + a.m24 * b.m41,
+                           a.m21 * b.m12 + a.m22 * b.m22 + a.m23 * b.m32 + a.m24 * b.m42,
+                           a.m21 * b.m13 + a.m22 * b.m23 + a.m23 * b.m33 + a.m24 * b.m43,
+                           a.m21 * b.m14 + a.m22 * b.m24 + a.m23 * b.m34 + a.m24 * b.m44,
+                           
+                           a.m31 * b.m11 + a.m32 * b.m21 + a.m33 * b.m31 + a.m34 * b.m41,
+                           a.m31 * b.m12 + a.m32 * b.m22 + a.m33 * b.m32 + a.m34 * b.m42,
+                           a.m31 * b.m13 + a.m32 * b.m23 + a.m33 * b.m33 + a.m34 * b.m43,
+                           a.m31 * b.m14 + a.m32 * b.m24 + a.m33 * b.m34 + a.m34 * b.m44,
+                           
+                           a.m41 * b.m11 + a.m42 * b.m21 + a.m43 * b.m31 + a.m44 * b.m41,
+                           a.m41 * b.m12 + a.m42 * b.m22 + a.m43 * b.m32 + a.m44 * b.m42,
+                           a.m41 * b.m13 + a.m42 * b.m23 + a.m43 * b.m33 + a.m44 * b.m43,
+                           a.m41 * b.m14 + a.m42 * b.m24 + a.m43 * b.m34 + a.m44 * b.m44);
+        }
+        
+        template<class T>
+        inline vec4<T> mul(const mat4<T>& m, const vec4<T>& v)
+        {
+            return m.col[0]*v.x + m.col[1]*v.y + m.col[2]*v.z + m.col[3]*v.w;
+        }
+        
+        template<class T>
+        inline void transpose(mat4<T>& m)
+        {
+            std::swap(m.m21, m.m12);
+            std::swap(m.m31, m.m13);
+            std::swap(m.m32, m.m23);
+            std::swap(m.m41, m.m14);
+            std::swap(m.m42, m.m24);
+            std::swap(m.m43, m.m34);
+        }
+        
+        template<class T>
+        inline mat4<T> inverse(const mat4<T>& m)
+        {
+            T det = m.determinant();
+            assert(abs(det) > 1e-8);
+            T idet = 1.0/det;
+            
+            mat4<T> M = mat4<T>(m.m23 * m.m34 * m.m42 - m.m24 * m.m33 * m.m42 + m.m24 * m.m32 * m.m43 - m.m22 * m.m34 * m.m43 - m.m23 * m.m32 * m.m44 + m.m22 * m.m33 * m.m44,
+                                m.m14 * m.m33 * m.m42 - m.m13 * m.m34 * m.m42 - m.m14 * m.m32 * m.m43 + m.m12 * m.m34 * m.m43 + m.m13 * m.m32 * m.m44 - m.m12 * m.m33 * m.m44,
+                                m.m13 * m.m24 * m.m42 - m.m14 * m.m23 * m.m42 + m.m14 * m.m22 * m.m43 - m.m12 * m.m24 * m.m43 - m.m13 * m.m22 * m.m44 + m.m12 * m.m23 * m.m44,
+                                m.m14 * m.m23 * m.m32 - m.m13 * m.m24 * m.m32 - m.m14 * m.m22 * m.m33 + m.m12 * m.m24 * m.m33 + m.m13 * m.m22 * m.m34 - m.m12 * m.m23 * m.m34,
+                                m.m24 * m.m33 * m.m41 - m.m23 * m.m34 * m.m41 - m.m24 * m.m31 * m.m43 + m.m21 * m.m34 * m.m43 + m.m23 * m.m31 * m.m44 - m.m21 * m.m33 * m.m44,
+                                m.m13 * m.m34 * m.m41 - m.m14 * m.m33 * m.m41 + m.m14 * m.m31 * m.m43 - m.m11 * m.m34 * m.m43 - m.m13 * m.m31 * m.m44 + m.m11 * m.m33 * m.m44,
+                                m.m14 * m.m23 * m.m41 - m.m13 * m.m24 * m.m41 - m.m14 * m.m21 * m.m43 + m.m11 * m.m24 * m.m43 + m.m13 * m.m21 * m.m44 - m.m11 * m.m23 * m.m44,
+                                m.m13 * m.m24 * m.m31 - m.m14 * m.m23 * m.m31 + m.m14 * m.m21 * m.m33 - m.m11 * m.m24 * m.m33 - m.m13 * m.m21 * m.m34 + m.m11 * m.m23 * m.m34,
+                                m.m22 * m.m34 * m.m41 - m.m24 * m.m32 * m.m41 + m.m24 * m.m31 * m.m42 - m.m21 * m.m34 * m.m42 - m.m22 * m.m31 * m.m44 + m.m21 * m.m32 * m.m44,
+                                m.m14 * m.m32 * m.m41 - m.m12 * m.m34 * m.m41 - m.m14 * m.m31 * m.m42 + m.m11 * m.m34 * m.m42 + m.m12 * m.m31 * m.m44 - m.m11 * m.m32 * m.m44,
+                                m.m12 * m.m24 * m.m41 - m.m14 * m.m22 * m.m41 + m.m14 * m.m21 * m.m42 - m.m11 * m.m24 * m.m42 - m.m12 * m.m21 * m.m44 + m.m11 * m.m22 * m.m44,
+                                m.m14 * m.m22 * m.m31 - m.m12 * m.m24 * m.m31 - m.m14 * m.m21 * m.m32 + m.m11 * m.m24 * m.m32 + m.m12 * m.m21 * m.m34 - m.m11 * m.m22 * m.m34,
+                                m.m23 * m.m32 * m.m41 - m.m22 * m.m33 * m.m41 - m.m23 * m.m31 * m.m42 + m.m21 * m.m33 * m.m42 + m.m22 * m.m31 * m.m43 - m.m21 * m.m32 * m.m43,
+                                m.m12 * m.m33 * m.m41 - m.m13 * m.m32 * m.m41 + m.m13 * m.m31 * m.m42 - m.m11 * m.m33 * m.m42 - m.m12 * m.m31 * m.m43 + m.m11 * m.m32 * m.m43,
+                                m.m13 * m.m22 * m.m41 - m.m12 * m.m23 * m.m41 - m.m13 * m.m21 * m.m42 + m.m11 * m.m23 * m.m42 + m.m12 * m.m21 * m.m43 - m.m11 * m.m22 * m.m43,
+                                m.m12 * m.m23 * m.m31 - m.m13 * m.m22 * m.m31 + m.m13 * m.m21 * m.m32 - m.m11 * m.m23 * m.m32 - m.m12 * m.m21 * m.m33 + m.m11 * m.m22 * m.m33);
+            
+            return M*idet;
+        }
+        
+        //
+        // the rows of the inverse of a 3x3 with columns a0, a1, a2 are the cross products
+        // a1 x a2, a2 x a0 and a0 x a1 over the determinant a0 . (a1 x a2)
+        //
+        template<class T>
+        inline mat4<T> inverse_affine(const mat4<T>& m)
+        {
+            vec3<T> a0 = m.col[0].xyz(), a1 = m.col[1].xyz(), a2 = m.col[2].xyz(), t = m.col[3].xyz();
+            vec3<T> r0 = a1 % a2, r1 = a2 % a0, r2 = a0 % a1;
+            T det = a0.dot(r0);
+            assert(abs(det) > 1e-8);
+            T idet = 1.0/det;
+            r0 = r0*idet; r1 = r1*idet; r2 = r2*idet;
+            
+            return mat4<T>(r0.x, r0.y, r0.z, -r0.dot(t),
+                           r1.x, r1.y, r1.z, -r1.dot(t),
+                           r2.x, r2.y, r2.z, -r2.dot(t),
+                           0.0,  0.0,  0.0,  1.0);
+        }
+    }
+    
 	//
 	// thread unsafe debug print
 	//
@@ -669,4 +743,6 @@ namespace linalg
     const mat4f mat4f_identity = mat4f(1.0f);
 }
 
+#include "mat_simd.h"
+
 #endif /* MAT_H */
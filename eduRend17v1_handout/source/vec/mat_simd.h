@@ -0,0 +1,267 @@
+
+//
+// SIMD specializations of mat4<float>
+//
+// Multiply, matrix-vector, transpose, inverse and inverse_affine with SSE (AVX for the
+// multiply where the compiler targets it), or multiply, matrix-vector and transpose with
+// NEON. Included by mat.h, so every mat4f gets them at compile time; the rest stays the
+// scalar code of mat4<T>, which linalg::scalar keeps callable for reference.
+//
+// Define LINALG_NO_SIMD for the scalar code only.
+//
+
+#pragma once
+#ifndef MAT_SIMD_H
+#define MAT_SIMD_H
+
+#ifndef LINALG_NO_SIMD
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define LINALG_SSE
+#include <emmintrin.h>
+#if defined(__AVX__)
+#define LINALG_AVX
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM) || defined(_M_ARM64)
+#define LINALG_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace linalg
+{
+#if defined(LINALG_SSE)
+
+    namespace simd
+    {
+        #define LINALG_SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+
+        // sum of the lanes of v in every lane
+        inline __m128 hsum(__m128 v)
+        {
+            v = _mm_add_ps(v, LINALG_SHUFFLE(v, 1, 0, 3, 2));
+            return _mm_add_ps(v, LINALG_SHUFFLE(v, 2, 3, 0, 1));
+        }
+
+        // xyz of a x b, w 0
+        inline __m128 cross(__m128 a, __m128 b)
+        {
+            return _mm_sub_ps(_mm_mul_ps(LINALG_SHUFFLE(a, 1, 2, 0, 3), LINALG_SHUFFLE(b, 2, 0, 1, 3)),
+                              _mm_mul_ps(LINALG_SHUFFLE(a, 2, 0, 1, 3), LINALG_SHUFFLE(b, 1, 2, 0, 3)));
+        }
+
+        //
+        // 2x2 matrices as m11, m12, m21, m22 in the lanes of a __m128, for the inverse
+        //
+
+        // a * b
+        inline __m128 mul2(__m128 a, __m128 b)
+        {
+            return _mm_add_ps(_mm_mul_ps(a, LINALG_SHUFFLE(b, 0, 3, 0, 3)),
+                              _mm_mul_ps(LINALG_SHUFFLE(a, 1, 0, 3, 2), LINALG_SHUFFLE(b, 2, 1, 2, 1)));
+        }
+
+        // adjugate(a) * b
+        inline __m128 adj_mul2(__m128 a, __m128 b)
+        {
+            return _mm_sub_ps(_mm_mul_ps(LINALG_SHUFFLE(a, 3, 3, 0, 0), b),
+                              _mm_mul_ps(LINALG_SHUFFLE(a, 1, 1, 2, 2), LINALG_SHUFFLE(b, 2, 3, 0, 1)));
+        }
+
+        // a * adjugate(b)
+        inline __m128 mul_adj2(__m128 a, __m128 b)
+        {
+            return _mm_sub_ps(_mm_mul_ps(a, LINALG_SHUFFLE(b, 3, 0, 3, 0)),
+                              _mm_mul_ps(LINALG_SHUFFLE(a, 1, 0, 3, 2), LINALG_SHUFFLE(b, 2, 1, 2, 1)));
+        }
+    }
+
+    template<>
+    inline mat4<float> mat4<float>::operator *(const mat4<float>& m) const
+    {
+        mat4<float> r;
+#if defined(LINALG_AVX)
+        // two columns at a time: each half of b holds a column of m
+        __m256 a0 = _mm256_broadcast_ps((const __m128*)&array[0]), a1 = _mm256_broadcast_ps((const __m128*)&array[4]);
+        __m256 a2 = _mm256_broadcast_ps((const __m128*)&array[8]), a3 = _mm256_broadcast_ps((const __m128*)&array[12]);
+        for (int c = 0; c < 4; c += 2)
+        {
+            __m256 b = _mm256_loadu_ps(&m.array[4 * c]);
+            __m256 s = _mm256_mul_ps(a0, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+            s = _mm256_add_ps(s, _mm256_mul_ps(a1, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1))));
+            s = _mm256_add_ps(s, _mm256_mul_ps(a2, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2))));
+            s = _mm256_add_ps(s, _mm256_mul_ps(a3, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))));
+            _mm256_storeu_ps(&r.array[4 * c], s);
+        }
+#else
+        // column c of the product: the columns of this weighted by column c of m
+        __m128 a0 = _mm_loadu_ps(&array[0]), a1 = _mm_loadu_ps(&array[4]);
+        __m128 a2 = _mm_loadu_ps(&array[8]), a3 = _mm_loadu_ps(&array[12]);
+        for (int c = 0; c < 4; c++)
+        {
+            __m128 b = _mm_loadu_ps(&m.array[4 * c]);
+            __m128 s = _mm_mul_ps(a0, LINALG_SHUFFLE(b, 0, 0, 0, 0));
+            s = _mm_add_ps(s, _mm_mul_ps(a1, LINALG_SHUFFLE(b, 1, 1, 1, 1)));
+            s = _mm_add_ps(s, _mm_mul_ps(a2, LINALG_SHUFFLE(b, 2, 2, 2, 2)));
+            s = _mm_add_ps(s, _mm_mul_ps(a3, LINALG_SHUFFLE(b, 3, 3, 3, 3)));
+            _mm_storeu_ps(&r.array[4 * c], s);
+        }
+#endif
+        return r;
+    }
+
+    template<>
+    inline vec4<float> mat4<float>::operator *(const vec4<float>& v) const
+    {
+        __m128 x = _mm_loadu_ps(&v.x);
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(&array[0]), LINALG_SHUFFLE(x, 0, 0, 0, 0));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(&array[4]), LINALG_SHUFFLE(x, 1, 1, 1, 1)));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(&array[8]), LINALG_SHUFFLE(x, 2, 2, 2, 2)));
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(&array[12]), LINALG_SHUFFLE(x, 3, 3, 3, 3)));
+        vec4<float> r;
+        _mm_storeu_ps(&r.x, s);
+        return r;
+    }
+
+    template<>
+    inline void mat4<float>::transpose()
+    {
+        __m128 c0 = _mm_loadu_ps(&array[0]), c1 = _mm_loadu_ps(&array[4]);
+        __m128 c2 = _mm_loadu_ps(&array[8]), c3 = _mm_loadu_ps(&array[12]);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        _mm_storeu_ps(&array[0], c0);
+        _mm_storeu_ps(&array[4], c1);
+        _mm_storeu_ps(&array[8], c2);
+        _mm_storeu_ps(&array[12], c3);
+    }
+
+    //
+    // By 2x2 blocks: with the columns read as rows this inverts the transpose, which stored
+    // row by row is the inverse stored column by column. Singular matrices give inf or nan
+    // instead of the assert of the scalar inverse.
+    //
+    template<>
+    inline mat4<float> mat4<float>::inverse() const
+    {
+        __m128 r0 = _mm_loadu_ps(&array[0]), r1 = _mm_loadu_ps(&array[4]);
+        __m128 r2 = _mm_loadu_ps(&array[8]), r3 = _mm_loadu_ps(&array[12]);
+
+        // | A B |
+        // | C D |
+        __m128 A = _mm_movelh_ps(r0, r1), B = _mm_movehl_ps(r1, r0);
+        __m128 C = _mm_movelh_ps(r2, r3), D = _mm_movehl_ps(r3, r2);
+
+        // |A|, |B|, |C|, |D|
+        __m128 det = _mm_sub_ps(
+            _mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(3, 1, 3, 1))),
+            _mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(2, 0, 2, 0))));
+        __m128 detA = LINALG_SHUFFLE(det, 0, 0, 0, 0), detB = LINALG_SHUFFLE(det, 1, 1, 1, 1);
+        __m128 detC = LINALG_SHUFFLE(det, 2, 2, 2, 2), detD = LINALG_SHUFFLE(det, 3, 3, 3, 3);
+
+        // the inverse is | X Y | / |M|, here with X, Y, Z and W as their adjugates
+        //                | Z W |
+        __m128 D_C = simd::adj_mul2(D, C);
+        __m128 A_B = simd::adj_mul2(A, B);
+        __m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), simd::mul2(B, D_C));
+        __m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), simd::mul2(C, A_B));
+        __m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), simd::mul_adj2(D, A_B));
+        __m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), simd::mul_adj2(A, D_C));
+
+        // |M| = |A| |D| + |B| |C| - trace(adjugate(A) B adjugate(D) C)
+        __m128 detM = _mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC));
+        detM = _mm_sub_ps(detM, simd::hsum(_mm_mul_ps(A_B, LINALG_SHUFFLE(D_C, 0, 2, 1, 3))));
+
+        // the signs of the adjugates
+        __m128 idet = _mm_div_ps(_mm_setr_ps(1, -1, -1, 1), detM);
+        X = _mm_mul_ps(X, idet);
+        Y = _mm_mul_ps(Y, idet);
+        Z = _mm_mul_ps(Z, idet);
+        W = _mm_mul_ps(W, idet);
+
+        // back from the adjugates, stored as rows
+        mat4<float> r;
+        _mm_storeu_ps(&r.array[0], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(1, 3, 1, 3)));
+        _mm_storeu_ps(&r.array[4], _mm_shuffle_ps(X, Y, _MM_SHUFFLE(0, 2, 0, 2)));
+        _mm_storeu_ps(&r.array[8], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(1, 3, 1, 3)));
+        _mm_storeu_ps(&r.array[12], _mm_shuffle_ps(Z, W, _MM_SHUFFLE(0, 2, 0, 2)));
+        return r;
+    }
+
+    //
+    // As scalar::inverse_affine, with the rows of the inverse 3x3 transposed to columns
+    //
+    template<>
+    inline mat4<float> mat4<float>::inverse_affine() const
+    {
+        const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        __m128 a0 = _mm_and_ps(_mm_loadu_ps(&array[0]), xyz), a1 = _mm_and_ps(_mm_loadu_ps(&array[4]), xyz);
+        __m128 a2 = _mm_and_ps(_mm_loadu_ps(&array[8]), xyz), t = _mm_loadu_ps(&array[12]);
+        __m128 r0 = simd::cross(a1, a2), r1 = simd::cross(a2, a0), r2 = simd::cross(a0, a1);
+        __m128 idet = _mm_div_ps(_mm_set1_ps(1), simd::hsum(_mm_mul_ps(a0, r0)));
+        r0 = _mm_mul_ps(r0, idet);
+        r1 = _mm_mul_ps(r1, idet);
+        r2 = _mm_mul_ps(r2, idet);
+        __m128 r3 = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        // the translation taken back, with w 1 as the w of r0, r1 and r2 is 0
+        __m128 s = _mm_mul_ps(r0, LINALG_SHUFFLE(t, 0, 0, 0, 0));
+        s = _mm_add_ps(s, _mm_mul_ps(r1, LINALG_SHUFFLE(t, 1, 1, 1, 1)));
+        s = _mm_add_ps(s, _mm_mul_ps(r2, LINALG_SHUFFLE(t, 2, 2, 2, 2)));
+
+        mat4<float> r;
+        _mm_storeu_ps(&r.array[0], r0);
+        _mm_storeu_ps(&r.array[4], r1);
+        _mm_storeu_ps(&r.array[8], r2);
+        _mm_storeu_ps(&r.array[12], _mm_sub_ps(_mm_setr_ps(0, 0, 0, 1), s));
+        return r;
+    }
+
+#elif defined(LINALG_NEON)
+
+    template<>
+    inline mat4<float> mat4<float>::operator *(const mat4<float>& m) const
+    {
+        // column c of the product: the columns of this weighted by column c of m
+        float32x4_t a0 = vld1q_f32(&array[0]), a1 = vld1q_f32(&array[4]);
+        float32x4_t a2 = vld1q_f32(&array[8]), a3 = vld1q_f32(&array[12]);
+        mat4<float> r;
+        for (int c = 0; c < 4; c++)
+        {
+            float32x4_t b = vld1q_f32(&m.array[4 * c]);
+            float32x4_t s = vmulq_n_f32(a0, vgetq_lane_f32(b, 0));
+            s = vmlaq_n_f32(s, a1, vgetq_lane_f32(b, 1));
+            s = vmlaq_n_f32(s, a2, vgetq_lane_f32(b, 2));
+            s = vmlaq_n_f32(s, a3, vgetq_lane_f32(b, 3));
+            vst1q_f32(&r.array[4 * c], s);
+        }
+        return r;
+    }
+
+    template<>
+    inline vec4<float> mat4<float>::operator *(const vec4<float>& v) const
+    {
+        float32x4_t s = vmulq_n_f32(vld1q_f32(&array[0]), v.x);
+        s = vmlaq_n_f32(s, vld1q_f32(&array[4]), v.y);
+        s = vmlaq_n_f32(s, vld1q_f32(&array[8]), v.z);
+        s = vmlaq_n_f32(s, vld1q_f32(&array[12]), v.w);
+        vec4<float> r;
+        vst1q_f32(&r.x, s);
+        return r;
+    }
+
+    template<>
+    inline void mat4<float>::transpose()
+    {
+        // the de-interleaving load gathers every fourth element: the rows
+        float32x4x4_t rows = vld4q_f32(array);
+        vst1q_f32(&array[0], rows.val[0]);
+        vst1q_f32(&array[4], rows.val[1]);
+        vst1q_f32(&array[8], rows.val[2]);
+        vst1q_f32(&array[12], rows.val[3]);
+    }
+
+#endif
+}
+
+#endif /* MAT_SIMD_H */